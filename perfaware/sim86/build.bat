@@ -7,11 +7,14 @@ call clang -g -fuse-ld=lld ..\sim86.cpp -o sim86_clang_debug.exe
 call cl -O2 -nologo -Zi -FC ..\sim86.cpp -Fesim86_msvc_release.exe
 call clang -O3 -g -fuse-ld=lld ..\sim86.cpp -o sim86_clang_release.exe
 
+call cl -O2 -nologo -Zi -FC ..\sim86_bench.cpp -Fesim86_bench_msvc_release.exe
+call clang -O3 -g -fuse-ld=lld ..\sim86_bench.cpp -o sim86_bench_clang_release.exe
+
 call clang -P -E ..\sim86_lib.h | call clang-format --style="Microsoft" > ..\shared\sim86_shared.h
 call clang -P -E ..\sim86_instruction_table_standalone.h | call clang-format --style="Microsoft" > sim86_instruction_table_standalone.h
 
-call cl -nologo -Zi -FC ..\sim86_lib.cpp -Fesim86_shared_debug.dll /link /DLL /PDBALTPATH:sim86_shared_debug.pdb /export:Sim86_Decode8086Instruction /export:Sim86_RegisterNameFromOperand /export:Sim86_MnemonicFromOperationType /export:Sim86_Get8086InstructionTable /export:Sim86_GetVersion
-call cl -nologo -O2 -Zi -FC ..\sim86_lib.cpp -Fesim86_shared_release.dll /link /DLL /PDBALTPATH:sim86_shared_release.pdb /export:Sim86_Decode8086Instruction /export:Sim86_RegisterNameFromOperand /export:Sim86_MnemonicFromOperationType /export:Sim86_Get8086InstructionTable /export:Sim86_GetVersion
+call cl -nologo -Zi -FC ..\sim86_lib.cpp -Fesim86_shared_debug.dll /link /DLL /PDBALTPATH:sim86_shared_debug.pdb /export:Sim86_Decode8086Instruction /export:Sim86_RegisterNameFromOperand /export:Sim86_MnemonicFromOperationType /export:Sim86_FormatInstruction /export:Sim86_Get8086InstructionTable /export:Sim86_GetVersion /export:Sim86_DecodeBlock /export:Sim86_CreateDecoder /export:Sim86_DestroyDecoder /export:Sim86_DecoderDecodeInstruction /export:Sim86_DecoderDecodeBlock /export:Sim86_DecoderDecodeCompactBlock /export:Sim86_PackInstruction /export:Sim86_UnpackInstruction /export:Sim86_ScanInstructionBoundaries /export:Sim86_MapS86iFile /export:Sim86_UnmapS86iFile /export:Sim86_FindS86iInstruction /export:Sim86_S86iMnemonic /export:Sim86_S86iRegisterName /export:Sim86_AllocateMachineMemory /export:Sim86_FreeMachineMemory /export:Sim86_LoadMachineMemory /export:Sim86_CreatePagedMemory /export:Sim86_DestroyPagedMemory /export:Sim86_GetWritablePage /export:Sim86_LoadPagedMemory /export:Sim86_ReadPagedMemory /export:Sim86_WritePagedMemory /export:Sim86_ClearDirtyPages /export:Sim86_FindFirstDifference /export:Sim86_WriteSparseDump /export:Sim86_LoadSparseDump /export:Sim86_SaveSnapshot /export:Sim86_RestoreSnapshot /export:Sim86_CreateDecodeCache /export:Sim86_DestroyDecodeCache /export:Sim86_CreateJIT /export:Sim86_DestroyJIT /export:Sim86_Step /export:Sim86_Run /export:Sim86_RunVariants
+call cl -nologo -O2 -Zi -FC ..\sim86_lib.cpp -Fesim86_shared_release.dll /link /DLL /PDBALTPATH:sim86_shared_release.pdb /export:Sim86_Decode8086Instruction /export:Sim86_RegisterNameFromOperand /export:Sim86_MnemonicFromOperationType /export:Sim86_FormatInstruction /export:Sim86_Get8086InstructionTable /export:Sim86_GetVersion /export:Sim86_DecodeBlock /export:Sim86_CreateDecoder /export:Sim86_DestroyDecoder /export:Sim86_DecoderDecodeInstruction /export:Sim86_DecoderDecodeBlock /export:Sim86_DecoderDecodeCompactBlock /export:Sim86_PackInstruction /export:Sim86_UnpackInstruction /export:Sim86_ScanInstructionBoundaries /export:Sim86_MapS86iFile /export:Sim86_UnmapS86iFile /export:Sim86_FindS86iInstruction /export:Sim86_S86iMnemonic /export:Sim86_S86iRegisterName /export:Sim86_AllocateMachineMemory /export:Sim86_FreeMachineMemory /export:Sim86_LoadMachineMemory /export:Sim86_CreatePagedMemory /export:Sim86_DestroyPagedMemory /export:Sim86_GetWritablePage /export:Sim86_LoadPagedMemory /export:Sim86_ReadPagedMemory /export:Sim86_WritePagedMemory /export:Sim86_ClearDirtyPages /export:Sim86_FindFirstDifference /export:Sim86_WriteSparseDump /export:Sim86_LoadSparseDump /export:Sim86_SaveSnapshot /export:Sim86_RestoreSnapshot /export:Sim86_CreateDecodeCache /export:Sim86_DestroyDecodeCache /export:Sim86_CreateJIT /export:Sim86_DestroyJIT /export:Sim86_Step /export:Sim86_Run /export:Sim86_RunVariants
 
 call copy sim86_shared*.dll ..\shared
 call copy sim86_shared*.lib ..\shared
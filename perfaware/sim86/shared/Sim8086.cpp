@@ -11,8 +11,9 @@
 
 static constexpr size_t MEGABYTE = 1024 * 1024;
 static constexpr int REGISTER_COUNT = 15;
+static constexpr int CS_REGISTER = 10;
 static constexpr int IP_REGISTER = 13;
-static constexpr int CX_REGISTER = 3;
+static constexpr int FLAGS_REGISTER = 14;
 static constexpr u16 INVALID_VALUE = 0xFFFF;
 static char const* RegisterNames[][3] =
 {
@@ -48,56 +49,22 @@ enum Flags
     Flag_count
 };
 
-static u8 Memory[MEGABYTE];
-static u64 ClockCycles = 0;
-
-static void SetFlags(const instruction& Instruction, const u16 LeftOperandValue, 
-    const u16 RightOperandValue, const u16 Result, bool* FlagArray)
-{   
-    u16 HighOrderBit = (Instruction.Operands[1].Register.Count == 1) ? 0x80 : 0x8000;
-    bool Parity = true;
-    
-    FlagArray[Flag_SF] = Result & HighOrderBit;
-    FlagArray[Flag_ZF] = (Result == 0);
-    for (u16 i = 0; i < 8; i++)
-    {
-        if (Result & (1 << i))
-        {
-            Parity = !Parity;
-        }
-    }
-    FlagArray[Flag_PF] = Parity;
+// NOTE: Where each of our flags lives in the real 8086 FLAGS word, which is what snapshots store.
+static u16 const FlagBits[Flag_count] =
+{
+    FlagBit_OF, FlagBit_DF, FlagBit_IF, FlagBit_TF, FlagBit_SF, FlagBit_ZF, FlagBit_AF, FlagBit_PF, FlagBit_CF
+};
 
-    switch (Instruction.Op)
-    {
-        case Op_add:
-        {
-            FlagArray[Flag_CF] = ((LeftOperandValue & HighOrderBit) || (RightOperandValue & HighOrderBit))
-                && !(Result & HighOrderBit);
-            FlagArray[Flag_AF] = ((LeftOperandValue & 0x8) || (RightOperandValue & 0x8))
-                && !(Result & 0x8);
-            FlagArray[Flag_OF] = (~(LeftOperandValue ^ RightOperandValue) & (Result ^ LeftOperandValue)) & HighOrderBit;
-        } break;
-        case Op_sub: [[fallthrough]];
-        case Op_cmp:
-        {
-            FlagArray[Flag_CF] = RightOperandValue > LeftOperandValue;
-            FlagArray[Flag_AF] = (RightOperandValue & 0xF) > (LeftOperandValue & 0xF);
-            FlagArray[Flag_OF] = ((LeftOperandValue ^ RightOperandValue) & ~Result) & HighOrderBit;
-        } break;
-        default:
-        {
-            assert(false);
-        } break;
-    }
-}    
+// NOTE: Paged, so a program only costs memory for the pages it writes and the pages it was
+// loaded into. The DLL runs the program on it one instruction at a time with Sim86_Step.
+static paged_memory* Memory = nullptr;
 
-static void PrintFlags(const bool* FlagArray)
+static void PrintFlags(u16 FlagsWord)
 {
     std::string OutputBuffer = "Flags: ";
     for (size_t i = 0; i < Flag_count; i++)
     {
-        if (FlagArray[i])
+        if (FlagsWord & FlagBits[i])
         {
             OutputBuffer += FlagNames[i];
         }
@@ -105,284 +72,6 @@ static void PrintFlags(const bool* FlagArray)
     std::cout << OutputBuffer << std::endl;
 }
 
-static inline size_t ComputeEffectiveAddress(const instruction_operand& Operand, const s16* Registers)
-{
-    size_t Result = 0;
-
-    Result += Registers[Operand.Address.Terms[0].Register.Index];
-    Result += Registers[Operand.Address.Terms[1].Register.Index];
-    Result += Operand.Address.Displacement;
-
-    return Result;
-}
-
-static u16 GetRightOperandValue(const instruction_operand& Source, const s16* Registers)
-{
-    u16 RightOperandValue = INVALID_VALUE;
-
-    switch (Source.Type)
-    {
-        case Operand_Register:
-        {
-            RightOperandValue = Registers[Source.Register.Index];
-            if (Source.Register.Count == 1) // Accessing half registers
-            {
-                RightOperandValue >>= 8 * Source.Register.Offset;
-            }
-        } break;
-        case Operand_Immediate:
-        {
-            RightOperandValue = static_cast<u16>(Source.Immediate.Value);
-        } break;
-        case Operand_Memory:
-        {
-            size_t EffectiveAddress = ComputeEffectiveAddress(Source, Registers);
-            if (Source.Register.Count == 2) // word value
-            {
-                u16* SourcePointer = reinterpret_cast<u16*>(&Memory[EffectiveAddress]);
-                RightOperandValue = *SourcePointer;
-            }
-            else
-            {
-                RightOperandValue = Memory[EffectiveAddress];
-            }
-        } break;
-        default:
-        {
-            assert(false);
-        } break;
-    }
-
-    return RightOperandValue;
-}
-
-static void SimulateInstruction(const instruction& Instruction, s16* Registers, bool* FlagArray)
-{
-    switch (Instruction.Op)
-    {
-        case Op_mov:
-        {
-            const instruction_operand& Dest = Instruction.Operands[0];
-            const instruction_operand& Source = Instruction.Operands[1];
-            u16 RightOperandValue = GetRightOperandValue(Source, Registers);
-           
-            switch (Dest.Type)
-            {
-                case Operand_Register:
-                {
-                    if (Dest.Register.Count == 1) // Accessing half registers
-                    {
-                        u8* DestPointer = reinterpret_cast<u8*>(&Registers[Dest.Register.Index]) + Dest.Register.Offset;
-                        *DestPointer = static_cast<u8>(RightOperandValue);
-                    }
-                    else
-                    {
-                        Registers[Dest.Register.Index] = RightOperandValue;
-                    }
-                } break;
-                case Operand_Memory:
-                {
-                    size_t EffectiveAddress = ComputeEffectiveAddress(Dest, Registers);
-                    if (Dest.Register.Count == 2) // word value
-                    {
-                        u16* DestPointer = reinterpret_cast<u16*>(&Memory[EffectiveAddress]);                            
-                        *DestPointer = RightOperandValue;
-                    }
-                    else
-                    {
-                        Memory[EffectiveAddress] = static_cast<u8>(RightOperandValue);
-                    }
-                } break;
-                default:
-                {
-                    assert(false);
-                } break;
-            }
-        } break;
-        case Op_add: [[fallthrough]];
-        case Op_sub: [[fallthrough]];
-        case Op_cmp: 
-        {
-            const instruction_operand& Dest = Instruction.Operands[0];
-            const instruction_operand& Source = Instruction.Operands[1];
-            u16 RightOperandValue = GetRightOperandValue(Source, Registers);
-            u16 LeftOperandValue = INVALID_VALUE;
-            u16 Result = INVALID_VALUE;
-
-            switch (Dest.Type)
-            {
-                case Operand_Register:
-                {
-                    if (Dest.Register.Count == 1) // Accessing half registers
-                    {
-                        u8* DestPointer = reinterpret_cast<u8*>(&Registers[Dest.Register.Index]) + Dest.Register.Offset;
-                        LeftOperandValue = *DestPointer;
-
-                        switch (Instruction.Op)
-                        {
-                            case Op_add:
-                            {
-                                Result = LeftOperandValue + RightOperandValue;
-                                *DestPointer = static_cast<u8>(Result);
-                            } break;
-                            case Op_sub:
-                            {
-                                Result = LeftOperandValue - RightOperandValue;
-                                *DestPointer = static_cast<u8>(Result);
-                            } break;
-                            case Op_cmp:
-                            {
-                                Result = LeftOperandValue - RightOperandValue;
-                            } break;
-                            default:
-                            {
-                                assert(false);
-                            } break;
-                        }
-                    }
-                    else
-                    {
-                        LeftOperandValue = Registers[Dest.Register.Index];
-                        switch (Instruction.Op)
-                        {
-                            case Op_add:
-                            {                           
-                                Result = LeftOperandValue + RightOperandValue;
-                                Registers[Dest.Register.Index] = Result;
-                            } break;
-                            case Op_sub:
-                            {
-                                Result = LeftOperandValue - RightOperandValue;
-                                Registers[Dest.Register.Index] = Result;
-                            } break;
-                            case Op_cmp:
-                            {
-                                Result = LeftOperandValue - RightOperandValue;
-                            } break;
-                            default:
-                            {
-                                assert(false);
-                            } break;
-                        }
-                        
-                    }
-                } break;
-                case Operand_Memory:
-                {
-                    size_t EffectiveAddress = ComputeEffectiveAddress(Dest, Registers);
-                    if (Dest.Register.Count == 2) // word value
-                    {
-                        u16* DestPointer = reinterpret_cast<u16*>(&Memory[EffectiveAddress]);
-                        LeftOperandValue = *DestPointer;
-                        switch (Instruction.Op)
-                        {
-                            case Op_add:
-                            {
-                                Result = LeftOperandValue + RightOperandValue;
-                                *DestPointer = Result;
-                            } break;
-                            case Op_sub:
-                            {
-                                Result = LeftOperandValue - RightOperandValue;
-                                *DestPointer = Result;
-                            } break;
-                            case Op_cmp:
-                            {
-                                Result = LeftOperandValue - RightOperandValue;
-                            } break;
-                            default:
-                            {
-                                assert(false);
-                            } break;
-                        }
-                    }
-                    else
-                    {
-                        LeftOperandValue = Memory[EffectiveAddress];
-                        switch (Instruction.Op)
-                        {
-                            case Op_add:
-                            {
-                                Result = LeftOperandValue + RightOperandValue;
-                                Memory[EffectiveAddress] = static_cast<u8>(Result);
-                            } break;
-                            case Op_sub:
-                            {
-                                Result = LeftOperandValue - RightOperandValue;
-                                Memory[EffectiveAddress] = static_cast<u8>(Result);
-                            } break;
-                            case Op_cmp:
-                            {
-                                Result = LeftOperandValue - RightOperandValue;
-                            } break;
-                            default:
-                            {
-                                assert(false);
-                            } break;
-                        }
-                    }
-                } break;
-                default:
-                {
-                    assert(false);
-                } break;
-            }
-            SetFlags(Instruction, LeftOperandValue, RightOperandValue, Result, FlagArray);
-#if _DEBUG
-            PrintFlags(FlagArray);
-#endif
-        } break;
-        case Op_jne: // JNE/JNZ
-        {
-            if (!FlagArray[Flag_ZF])
-            {
-                Registers[IP_REGISTER] += static_cast<s8>(Instruction.Operands[0].Immediate.Value);
-            }
-        } break;
-        case Op_je:
-        {
-            if (FlagArray[Flag_ZF])
-            {
-                Registers[IP_REGISTER] += static_cast<s8>(Instruction.Operands[0].Immediate.Value);
-            }
-        } break;
-        case Op_jb:
-        {
-            if (FlagArray[Flag_CF])
-            {
-                Registers[IP_REGISTER] += static_cast<s8>(Instruction.Operands[0].Immediate.Value);
-            }
-        } break;
-        case Op_jp:
-        {
-            if (FlagArray[Flag_PF])
-            {
-                Registers[IP_REGISTER] += static_cast<s8>(Instruction.Operands[0].Immediate.Value);
-            }
-        } break;
-        case Op_loopnz:
-        {
-            Registers[CX_REGISTER] -= 1;
-            if (!FlagArray[Flag_ZF] && Registers[CX_REGISTER])
-            {
-                Registers[IP_REGISTER] += static_cast<s8>(Instruction.Operands[0].Immediate.Value);
-            }
-        } break;
-        case Op_loop:
-        {
-            Registers[CX_REGISTER] -= 1;
-            if (Registers[CX_REGISTER])
-            {
-                Registers[IP_REGISTER] += static_cast<s8>(Instruction.Operands[0].Immediate.Value);
-            }
-        } break;
-        default:
-        {
-            assert(false);
-        } break;
-    }
-}
-
 int main(int ArgCount, char** Args)
 {
     u32 Version = Sim86_GetVersion();
@@ -398,6 +87,10 @@ int main(int ArgCount, char** Args)
     printf("8086 Instruction Instruction Encoding Count: %u\n", Table.EncodingCount);
     
     bool DumpFile = false;
+    bool DumpSparse = false;
+    bool SaveSnapshot = false;
+    bool Trace = false;
+    u64 MaxSteps = 0;
     
     int ArgIndex = 1;
     for (; ArgIndex < ArgCount; ArgIndex++)
@@ -406,81 +99,174 @@ int main(int ArgCount, char** Args)
         {
             DumpFile = true;
         }
+        else if (Args[ArgIndex] == std::string_view("-sparse"))
+        {
+            DumpSparse = true;
+        }
+        else if (Args[ArgIndex] == std::string_view("-snapshot"))
+        {
+            SaveSnapshot = true;
+        }
+        else if (Args[ArgIndex] == std::string_view("-trace"))
+        {
+            Trace = true;
+        }
+        else if ((Args[ArgIndex] == std::string_view("-steps")) && ((ArgIndex + 1) < ArgCount))
+        {
+            MaxSteps = std::stoull(Args[++ArgIndex]);
+        }
         else
         {
             break;
         }
     }
+    // NOTE: One decode cache for every file - each instruction is only decoded the first time
+    // it runs. If it can't be allocated, the program still runs, decoding every instruction.
+    decode_cache* DecodeCache = Sim86_CreateDecodeCache();
+
+    // NOTE: The JIT compiles the loops the programs spend their time in, unless they are being
+    // traced. Without one (on a host that isn't x86-64, say) they run on the interpreter instead.
+    jit_cache* JIT = Sim86_CreateJIT();
+
     for (; ArgIndex < ArgCount; ArgIndex++)
     {
         std::string FileName = Args[ArgIndex];
-        memset(Memory, 0, sizeof(Memory));
-        s16 Registers[REGISTER_COUNT] = {};
-        bool FlagArray[Flag_count] = {};
-        
-        std::string OutputBuffer;
-        std::ifstream File;
-        File.open(FileName, std::ifstream::binary | std::ifstream::in);
-        if (!File.good())
-        {
-            std::cout << "Error opening file " << FileName << std::endl;
-            continue;
-        }
+        machine_state State = {};
 
-        std::cout << "\n" << FileName << std::endl;
+        std::string OutputBuffer;
 
-        u16 BytesRead = 0;
-        for (u8 Byte = static_cast<u8>(File.get()); !File.fail(); Byte = static_cast<u8>(File.get()))
+        if (FileName.size() > 5 && FileName.compare(FileName.size() - 5, 5, ".s86s") == 0)
         {
-            Memory[BytesRead++] = Byte;
+            // NOTE: A snapshot picks up exactly where the run that saved it stopped.
+            if (!Sim86_RestoreSnapshot(FileName.c_str(), &State))
+            {
+                std::cout << "Error restoring snapshot " << FileName << std::endl;
+                continue;
+            }
+            Memory = State.Memory;
         }
-
-        u16& InstructionPointer = reinterpret_cast<u16&>(Registers[IP_REGISTER]);
-
-        while (InstructionPointer < BytesRead)
+        else
         {
-            instruction Decoded;
-            Sim86_Decode8086Instruction(BytesRead - InstructionPointer, Memory + InstructionPointer, &Decoded);
-
-            if (Decoded.Op)
+            // NOTE: Each file gets fresh memory that reads as zero everywhere. Only the pages the
+            // file fills, and the pages the program writes, ever get allocated.
+            Memory = Sim86_CreatePagedMemory(nullptr);
+            if (!Memory)
             {
-                InstructionPointer += static_cast<u16>(Decoded.Size);
-                SimulateInstruction(Decoded, Registers, FlagArray);
+                printf("ERROR: Unable to allocate main memory for 8086.\n");
+                return -1;
             }
-            else
+
+            u32 BytesRead = 0;
+            if (!Sim86_LoadPagedMemory(FileName.c_str(), Memory, &BytesRead))
             {
-                std::cout << "Unrecognized instruction" << std::endl;
-                break;
+                std::cout << "Error opening file " << FileName << std::endl;
+                Sim86_DestroyPagedMemory(Memory);
+                continue;
             }
+            State.ProgramSize = BytesRead;
+            State.Memory = Memory;
+        }
+
+        State.DecodeCache = DecodeCache;
+        State.JIT = JIT;
+
+        std::cout << "\n" << FileName << std::endl;
+
+        // NOTE: The program stops when it runs off the end of the file, halts, or reaches
+        // something that can't be decoded.
+        machine_stop_reason Stop = MachineStop_None;
+        if (Trace)
+        {
+            // NOTE: Tracing prints every instruction, so they run one at a time. Each one is
+            // decoded here as well, just to print it - the DLL decodes its own copy when it runs it.
+            for (u64 StepCount = 0; !MaxSteps || (StepCount < MaxSteps); StepCount++)
+            {
+                instruction Instruction = {};
+                u64 ClocksBefore = State.ClockCount;
+                u8 Bytes[16];
+                u32 Address = ((State.Registers[CS_REGISTER] << 4) + State.Registers[IP_REGISTER]) & (MEGABYTE - 1);
+                Sim86_ReadPagedMemory(Memory, Address, sizeof(Bytes), Bytes);
+                Sim86_Decode8086Instruction(sizeof(Bytes), Bytes, &Instruction);
+
+                Stop = Sim86_Step(&State);
+                if (Stop != MachineStop_None)
+                {
+                    break;
+                }
+
+                char Text[256];
+                Sim86_FormatInstruction(&Instruction, sizeof(Text), Text);
+                std::cout << Text << " ; Clocks: +" << (State.ClockCount - ClocksBefore) << " = " << State.ClockCount << std::endl;
 #if _DEBUG
-            //printf("0x%02x\n", Registers[IP_REGISTER]);
-            std::cout << ClockCycles << " " << Registers[IP_REGISTER] << std::endl;
+                std::cout << State.ClockCount << " " << State.Registers[IP_REGISTER] << std::endl;
 #endif
+            }
+        }
+        else
+        {
+            // NOTE: Untraced, the whole run is handed to the DLL at once, so it goes through the
+            // decode cache and the JIT gets to compile the loops the program spends its time in.
+            u64 InstructionCount = 0;
+            Stop = Sim86_Run(&State, MaxSteps, &InstructionCount);
         }
 
-        for (size_t i = 1; i < REGISTER_COUNT; i++)
+        if (Stop == MachineStop_Unrecognized)
         {
-            if (Registers[i] != 0)
+            std::cout << "Unrecognized instruction" << std::endl;
+        }
+        else if (MaxSteps && (Stop == MachineStop_None))
+        {
+            std::cout << "Stopped after " << MaxSteps << " instructions" << std::endl;
+        }
+
+        for (size_t i = 1; i < FLAGS_REGISTER; i++)
+        {
+            s16 Value = static_cast<s16>(State.Registers[i]);
+            if (Value != 0)
             {
                 std::stringstream Stream;
                 Stream << RegisterNames[i][2]
-                    << ": 0x" << std::hex << Registers[i]
-                    << " (" << std::to_string(Registers[i]) << ")\n";
+                    << ": 0x" << std::hex << Value
+                    << " (" << std::to_string(Value) << ")\n";
                 OutputBuffer += Stream.str();
             }
         }
         std::cout << OutputBuffer << std::endl;
-        PrintFlags(FlagArray);
+        PrintFlags(State.Registers[FLAGS_REGISTER]);
         if (DumpFile)
         {
             std::string OutFileName = FileName + ".data";
             std::ofstream OutFile;
             OutFile.open(OutFileName, std::ofstream::binary);
-            for (size_t Counter = 0; Counter < MEGABYTE; Counter++)
+            for (u32 PageIndex = 0; PageIndex < Memory->PageCount; PageIndex++)
             {
-                OutFile << Memory[Counter];
+                OutFile.write(reinterpret_cast<char const*>(Memory->ReadPages[PageIndex]), MEMORY_PAGE_SIZE);
             }
             OutFile.close();
         }
+        if (SaveSnapshot)
+        {
+            std::string OutFileName = FileName + ".s86s";
+            if (!Sim86_SaveSnapshot(OutFileName.c_str(), &State))
+            {
+                std::cout << "Error writing " << OutFileName << std::endl;
+            }
+        }
+        if (DumpSparse)
+        {
+            // NOTE: Just the pages the file was loaded into or the program wrote - everything
+            // else in memory is still zero.
+            std::string OutFileName = FileName + ".s86d";
+            if (!Sim86_WriteSparseDump(OutFileName.c_str(), Memory))
+            {
+                std::cout << "Error writing " << OutFileName << std::endl;
+            }
+        }
+
+        Sim86_DestroyPagedMemory(Memory);
+        Memory = nullptr;
     }
+
+    Sim86_DestroyJIT(JIT);
+    Sim86_DestroyDecodeCache(DecodeCache);
 }
\ No newline at end of file
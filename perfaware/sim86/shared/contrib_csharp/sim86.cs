@@ -284,7 +284,7 @@ static class Sim86
         public static extern void Sim86_Get8086InstructionTable(out InstructionTable Dest);
     }
 
-    public const int Version = 3;
+    public const int Version = 4;
 
     public static uint GetVersion()
     {
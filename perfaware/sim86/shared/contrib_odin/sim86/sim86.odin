@@ -4,7 +4,7 @@ package sim86
 when ODIN_OS == .Windows { foreign import sim86 "./sim86_shared_debug.lib" }
 when ODIN_OS == .Linux { foreign import sim86 "./sim86_shared_debug.a" }
 
-SIM86_VERSION : u32 : 3
+SIM86_VERSION : u32 : 4
 
 Operation_Type :: enum u32 {
 	None,
@@ -8,7 +8,7 @@ from dataclasses import dataclass, fields
 
 ### public interface
 
-VERSION = 3
+VERSION = 4
 
 OperationType = IntEnum("OperationType", """
   none mov push pop xchg in out xlat lea lds les lahf sahf
@@ -32,6 +32,10 @@ ImmediateFlag = IntFlag("ImmediateFlag", """
   relative_jump_displacement
 """.split())
 
+DecodeStopReason = IntEnum("DecodeStopReason", """
+  end_of_source dest_full unrecognized truncated
+""".split(), start=0)
+
 InstructionBitsUsage = IntEnum("InstructionBitsUsage", """
   end literal d s w v z mod reg rm sr disp data
   disp_always_w w_makes_data_w rm_reg_always_w
@@ -105,6 +109,22 @@ def decode_8086_instruction(data: bytes, offset: int) -> Instruction:
   _decode_8086_instruction(length, ptr, ctypes.byref(decoded))
   return _make(decoded)
 
+def decode_8086_block(data: bytes, offset: int = 0, max_count: int = 0) -> tuple[list[Instruction], DecodeStopReason, int]:
+  """Decodes instructions starting at offset with a single call into the library.
+  Returns the instructions, why decoding stopped, and how many bytes were decoded.
+  Instruction addresses are relative to offset."""
+  assert isinstance(data, bytes)
+  length = len(data) - offset
+  if max_count <= 0:
+    max_count = max(length, 1)
+  decoded = (_instruction * max_count)()
+  result = _decode_block_result()
+  ptr = ctypes.cast(data, ctypes.POINTER(ctypes.c_ubyte))
+  ptr = ctypes.addressof(ptr.contents) + offset
+  _decode_block(length, ptr, max_count, decoded, ctypes.byref(result))
+  instructions = [_make(decoded[i]) for i in range(result.instruction_count)]
+  return instructions, DecodeStopReason(result.stop_reason), result.bytes_decoded
+
 def register_name_from_operand(register_access: RegisterAccess) -> str:
   access = _register_access(register_access.index, register_access.offset, register_access.count)
   return _register_name_from_operand(ctypes.byref(access)).decode("ascii")
@@ -179,6 +199,11 @@ class _instruction(ctypes.Structure):
     operands = [op._convert() for op in self.operands if op.type != _operand_type.none]
     return Instruction(self.address, self.size, OperationType(self.op), InstructionFlag(self.flags), operands, self.segment_override)
 
+class _decode_block_result(ctypes.Structure):
+  _fields_ = [("instruction_count", u32),
+              ("bytes_decoded", u32),
+              ("stop_reason", u32)] # DecodeStopReason
+
 class _instruction_bits(ctypes.Structure):
   _fields_ = [("usage", u8), # InstructionBitsUsage
               ("bit_count", u8),
@@ -208,6 +233,9 @@ _get_version.restype = u32
 _decode_8086_instruction = dll.Sim86_Decode8086Instruction
 _decode_8086_instruction.argtypes = [u32, ctypes.c_void_p, ctypes.POINTER(_instruction)]
 
+_decode_block = dll.Sim86_DecodeBlock
+_decode_block.argtypes = [u32, ctypes.c_void_p, u32, ctypes.POINTER(_instruction), ctypes.POINTER(_decode_block_result)]
+
 _register_name_from_operand = dll.Sim86_RegisterNameFromOperand
 _register_name_from_operand.argtypes = [ctypes.POINTER(_register_access)]
 _register_name_from_operand.restype = ctypes.c_char_p
@@ -36,3 +36,6 @@ if __name__ == "__main__":
     else:
       print("unrecognized instruction")
       break
+
+  instructions, stop_reason, bytes_decoded = sim86.decode_8086_block(example_disassembly)
+  print(f"Block decode: {len(instructions)} instructions, {bytes_decoded} bytes, stop reason {stop_reason.name}")
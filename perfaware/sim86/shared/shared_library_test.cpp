@@ -11,6 +11,11 @@
    ======================================================================== */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
 
 #include "sim86_shared.h"
 #pragma comment (lib, "sim86_shared_debug.lib")
@@ -35,6 +40,115 @@ unsigned char ExampleDisassembly[247] =
     0xDE, 0xE1, 0xDC, 0xE0, 0xDA, 0xE3, 0xD8
 };
 
+// NOTE: The stress test decodes the example buffer repeated this many times, from this many
+// threads at once, each one with its own decoder.
+static u32 const StressCopyCount = 256;
+static u32 const StressThreadCount = 16;
+static u32 const StressPassCount = 16;
+
+struct stress_corpus
+{
+    u32 Size;
+    u8 *Bytes;
+    
+    u32 InstructionCount;
+    instruction *Reference;
+};
+
+static void StressThread(stress_corpus *Corpus, u32 ThreadIndex, std::atomic<u32> *MismatchCount)
+{
+    // NOTE: Half the threads decode a view of the shared corpus, the other half their own
+    // padded copy of it, and they alternate between block and single-instruction decoding.
+    u32 Flags = (ThreadIndex & 1) ? Decoder_CopySource : 0;
+    sim86_decoder *Decoder = Sim86_CreateDecoder(Corpus->Size, Corpus->Bytes, Flags);
+    instruction *Decoded = (instruction *)calloc(Corpus->InstructionCount + 1, sizeof(instruction));
+    
+    for(u32 Pass = 0; Decoder && Decoded && (Pass < StressPassCount); ++Pass)
+    {
+        u32 Count = 0;
+        if((Pass + ThreadIndex) & 1)
+        {
+            decode_block_result Result;
+            Sim86_DecoderDecodeBlock(Decoder, 0, Corpus->InstructionCount + 1, Decoded, &Result);
+            Count = Result.InstructionCount;
+        }
+        else
+        {
+            u32 Offset = 0;
+            while(Offset < Corpus->Size)
+            {
+                instruction *Dest = &Decoded[Count];
+                Sim86_DecoderDecodeInstruction(Decoder, Offset, Dest);
+                if(!Dest->Op)
+                {
+                    break;
+                }
+                
+                Offset += Dest->Size;
+                ++Count;
+            }
+        }
+        
+        if((Count != Corpus->InstructionCount) ||
+           memcmp(Decoded, Corpus->Reference, Count*sizeof(instruction)))
+        {
+            ++*MismatchCount;
+        }
+    }
+    
+    free(Decoded);
+    Sim86_DestroyDecoder(Decoder);
+}
+
+static b32 RunDecoderStressTest(void)
+{
+    stress_corpus Corpus = {};
+    Corpus.Size = StressCopyCount*sizeof(ExampleDisassembly);
+    Corpus.Bytes = (u8 *)malloc(Corpus.Size);
+    Corpus.Reference = (instruction *)calloc(Corpus.Size, sizeof(instruction));
+    for(u32 Copy = 0; Copy < StressCopyCount; ++Copy)
+    {
+        memcpy(Corpus.Bytes + Copy*sizeof(ExampleDisassembly), ExampleDisassembly, sizeof(ExampleDisassembly));
+    }
+    
+    // NOTE: The reference is the plain single-threaded, one-instruction-at-a-time decode.
+    u32 Offset = 0;
+    while(Offset < Corpus.Size)
+    {
+        instruction *Dest = &Corpus.Reference[Corpus.InstructionCount];
+        Sim86_Decode8086Instruction(Corpus.Size - Offset, Corpus.Bytes + Offset, Dest);
+        if(!Dest->Op)
+        {
+            break;
+        }
+        
+        Dest->Address = Offset;
+        Offset += Dest->Size;
+        ++Corpus.InstructionCount;
+    }
+    
+    std::atomic<u32> MismatchCount(0);
+    std::thread Threads[StressThreadCount];
+    for(u32 ThreadIndex = 0; ThreadIndex < StressThreadCount; ++ThreadIndex)
+    {
+        Threads[ThreadIndex] = std::thread(StressThread, &Corpus, ThreadIndex, &MismatchCount);
+    }
+    
+    for(u32 ThreadIndex = 0; ThreadIndex < StressThreadCount; ++ThreadIndex)
+    {
+        Threads[ThreadIndex].join();
+    }
+    
+    printf("Decoder stress test: %u threads x %u passes over %u instructions, %u mismatches\n",
+           StressThreadCount, StressPassCount, Corpus.InstructionCount, MismatchCount.load());
+    
+    free(Corpus.Reference);
+    free(Corpus.Bytes);
+    
+    b32 Result = ((Offset == Corpus.Size) && (MismatchCount.load() == 0));
+    return Result;
+}
+
 int main(void)
 {
     u32 Version = Sim86_GetVersion();
@@ -66,5 +180,19 @@ int main(void)
         }
     }
     
+    // NOTE: The same buffer decoded with a single call. Addresses in the block are byte
+    // offsets from the start of the buffer.
+    instruction Block[sizeof(ExampleDisassembly)];
+    decode_block_result BlockResult;
+    Sim86_DecodeBlock(sizeof(ExampleDisassembly), ExampleDisassembly, sizeof(Block) / sizeof(Block[0]), Block, &BlockResult);
+    printf("Block decode: %u instructions, %u bytes, stop reason %u\n",
+           BlockResult.InstructionCount, BlockResult.BytesDecoded, BlockResult.StopReason);
+    
+    if(!RunDecoderStressTest())
+    {
+        printf("ERROR: Multi-threaded decode does not match single-threaded decode.\n");
+        return -1;
+    }
+    
     return 0;
 }
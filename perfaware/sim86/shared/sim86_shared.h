@@ -10,7 +10,7 @@ typedef long long s64;
 
 typedef s32 b32;
 
-static u32 const SIM86_VERSION = 3;
+static u32 const SIM86_VERSION = 4;
 typedef enum operation_type : u32
 {
     Op_None,
@@ -214,6 +214,52 @@ typedef struct instruction
 
     u32 SegmentOverride;
 } instruction;
+
+typedef enum compact_operand_form : u8
+{
+    CompactOperand_None,
+    CompactOperand_Register,
+    CompactOperand_Memory,
+    CompactOperand_MemoryExplicitSegment,
+    CompactOperand_ImmediateUnsigned,
+    CompactOperand_ImmediateSigned,
+    CompactOperand_RelativeJumpDisplacement,
+} compact_operand_form;
+typedef struct compact_operand
+{
+    u16 Info;
+    u16 Value;
+} compact_operand;
+typedef struct compact_instruction
+{
+    u32 Address;
+
+    u8 Op;
+    u8 Flags;
+    u8 SizeAndSegmentOverride;
+    u8 Forms;
+
+    compact_operand Operands[2];
+} compact_instruction;
+
+typedef enum decode_stop_reason : u32
+{
+    DecodeStop_EndOfSource,
+    DecodeStop_DestFull,
+    DecodeStop_Unrecognized,
+    DecodeStop_Truncated,
+} decode_stop_reason;
+typedef struct decode_block_result
+{
+    u32 InstructionCount;
+    u32 BytesDecoded;
+    decode_stop_reason StopReason;
+} decode_block_result;
+
+typedef enum decoder_flag : u32
+{
+    Decoder_CopySource = 0x1,
+} decoder_flag;
 typedef enum instruction_bits_usage : u8
 {
     Bits_End,
@@ -262,6 +308,181 @@ typedef struct instruction_table
     u32 MaxInstructionByteCount;
 } instruction_table;
 
+static u32 const MEMORY_PAGE_SIZE_POW2 = 12;
+static u32 const MEMORY_PAGE_SIZE = 4096;
+static u32 const MEMORY_PAGE_MASK = 4095;
+static u32 const MAX_MEMORY_PAGE_COUNT = 256;
+static u32 const MEMORY_PAGE_BITMAP_COUNT = 4;
+
+typedef struct page_backing page_backing;
+
+typedef struct paged_memory
+{
+    u8 *ReadPages[MAX_MEMORY_PAGE_COUNT];
+    u8 *WritePages[MAX_MEMORY_PAGE_COUNT];
+
+    u64 DirtyPages[MEMORY_PAGE_BITMAP_COUNT];
+    u64 CodePages[MEMORY_PAGE_BITMAP_COUNT];
+
+    u32 Mask;
+    u32 PageCount;
+
+    b32 OutOfMemory;
+
+    page_backing *Backing;
+} paged_memory;
+
+static u32 const SPARSE_DUMP_MAGIC = 0x44363853;
+static u32 const SPARSE_DUMP_VERSION = 1;
+
+typedef struct sparse_dump_header
+{
+    u32 Magic;
+    u32 Version;
+    u32 HeaderSize;
+    u32 PageSize;
+
+    u32 MemorySize;
+    u32 PageCount;
+    u64 PageBits[MEMORY_PAGE_BITMAP_COUNT];
+} sparse_dump_header;
+
+typedef enum flags_bit : u16
+{
+    FlagBit_CF = 0x0001,
+    FlagBit_PF = 0x0004,
+    FlagBit_AF = 0x0010,
+    FlagBit_ZF = 0x0040,
+    FlagBit_SF = 0x0080,
+    FlagBit_TF = 0x0100,
+    FlagBit_IF = 0x0200,
+    FlagBit_DF = 0x0400,
+    FlagBit_OF = 0x0800,
+} flags_bit;
+
+static u32 const MACHINE_REGISTER_COUNT = 16;
+
+typedef struct decode_cache decode_cache;
+typedef struct jit_cache jit_cache;
+
+typedef struct machine_state
+{
+    u16 Registers[MACHINE_REGISTER_COUNT];
+    u64 ClockCount;
+
+    u32 ProgramSize;
+
+    paged_memory *Memory;
+
+    decode_cache *DecodeCache;
+
+    jit_cache *JIT;
+} machine_state;
+
+typedef enum machine_stop_reason : u32
+{
+    MachineStop_None,
+    MachineStop_EndOfProgram,
+    MachineStop_Halt,
+    MachineStop_Unrecognized,
+    MachineStop_Unimplemented,
+} machine_stop_reason;
+
+static u32 const SNAPSHOT_MAGIC = 0x53363853;
+static u32 const SNAPSHOT_VERSION = 1;
+
+typedef struct snapshot_header
+{
+    u32 Magic;
+    u32 Version;
+    u32 HeaderSize;
+    u32 PageSize;
+
+    u32 MemorySize;
+    u32 PageCount;
+    u64 PageBits[MEMORY_PAGE_BITMAP_COUNT];
+    u64 PagesOffset;
+
+    u64 ClockCount;
+    u32 ProgramSize;
+    u16 Registers[MACHINE_REGISTER_COUNT];
+} snapshot_header;
+
+typedef enum machine_input_type : u8
+{
+    Input_Register,
+    Input_Byte,
+    Input_Word,
+} machine_input_type;
+
+typedef struct machine_input
+{
+    u32 Variant;
+    u32 Address;
+    u16 Value;
+    u8 Type;
+    u8 Register;
+} machine_input;
+
+typedef struct variant_result
+{
+    u16 Registers[MACHINE_REGISTER_COUNT];
+    u64 ClockCount;
+    u64 InstructionCount;
+    u32 StopReason;
+    u32 DirtyPageCount;
+} variant_result;
+
+static u32 const S86I_MAGIC = 0x49363853;
+static u32 const S86I_VERSION = 1;
+static u32 const S86I_INDEX_GRANULARITY = 256;
+static u32 const S86I_NOT_FOUND = 0xffffffff;
+
+typedef struct s86i_section
+{
+    u64 Offset;
+    u64 Size;
+} s86i_section;
+
+typedef struct s86i_header
+{
+    u32 Magic;
+    u32 Version;
+    u32 HeaderSize;
+    u32 RecordSize;
+
+    u64 SourceSize;
+    u32 InstructionCount;
+    decode_stop_reason StopReason;
+
+    u32 IndexGranularity;
+    u32 IndexCount;
+    u32 MnemonicCount;
+    u32 RegisterNameCount;
+
+    s86i_section Records;
+    s86i_section AddressIndex;
+    s86i_section Mnemonics;
+    s86i_section RegisterNames;
+} s86i_header;
+
+typedef struct s86i_view
+{
+    s86i_header const *Header;
+
+    u32 InstructionCount;
+    compact_instruction const *Instructions;
+    u32 const *AddressIndex;
+
+    u32 const *MnemonicOffsets;
+    u32 const *RegisterNameOffsets;
+    char const *Mnemonics;
+    char const *RegisterNames;
+} s86i_view;
+
+typedef struct sim86_decoder sim86_decoder;
+typedef struct sim86_mapped_file sim86_mapped_file;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -269,7 +490,46 @@ u32 Sim86_GetVersion(void);
 void Sim86_Decode8086Instruction(u32 SourceSize, u8 *Source, instruction *Dest);
 char const *Sim86_RegisterNameFromOperand(register_access *RegAccess);
 char const *Sim86_MnemonicFromOperationType(operation_type Type);
+u32 Sim86_FormatInstruction(instruction *Instruction, u32 DestSize, char *Dest);
 void Sim86_Get8086InstructionTable(instruction_table *Dest);
+void Sim86_DecodeBlock(u32 SourceSize, u8 *Source, u32 DestCount, instruction *Dest, decode_block_result *Result);
+sim86_decoder *Sim86_CreateDecoder(u32 SourceSize, u8 *Source, u32 Flags);
+void Sim86_DestroyDecoder(sim86_decoder *Decoder);
+void Sim86_DecoderDecodeInstruction(sim86_decoder *Decoder, u32 Offset, instruction *Dest);
+void Sim86_DecoderDecodeBlock(sim86_decoder *Decoder, u32 Offset, u32 DestCount, instruction *Dest,
+                              decode_block_result *Result);
+void Sim86_DecoderDecodeCompactBlock(sim86_decoder *Decoder, u32 Offset, u32 DestCount, compact_instruction *Dest,
+                                     decode_block_result *Result);
+b32 Sim86_PackInstruction(instruction *Source, compact_instruction *Dest);
+void Sim86_UnpackInstruction(compact_instruction *Source, instruction *Dest);
+void Sim86_ScanInstructionBoundaries(u32 SourceSize, u8 *Source, u64 *Bitmap, decode_block_result *Result);
+sim86_mapped_file *Sim86_MapS86iFile(char const *FileName, s86i_view *View);
+void Sim86_UnmapS86iFile(sim86_mapped_file *File);
+u32 Sim86_FindS86iInstruction(s86i_view *View, u32 Address);
+char const *Sim86_S86iMnemonic(s86i_view *View, u32 Op);
+char const *Sim86_S86iRegisterName(s86i_view *View, register_access *RegAccess);
+u8 *Sim86_AllocateMachineMemory(u32 Size);
+void Sim86_FreeMachineMemory(u8 *Memory, u32 Size);
+b32 Sim86_LoadMachineMemory(char const *FileName, u32 MemorySize, u8 *Memory, u32 *BytesLoaded);
+paged_memory *Sim86_CreatePagedMemory(paged_memory *CloneFrom);
+void Sim86_DestroyPagedMemory(paged_memory *Memory);
+u8 *Sim86_GetWritablePage(paged_memory *Memory, u32 PageIndex);
+b32 Sim86_LoadPagedMemory(char const *FileName, paged_memory *Memory, u32 *BytesLoaded);
+void Sim86_ReadPagedMemory(paged_memory *Memory, u32 Address, u32 Size, u8 *Dest);
+void Sim86_WritePagedMemory(paged_memory *Memory, u32 Address, u32 Size, u8 *Source);
+void Sim86_ClearDirtyPages(paged_memory *Memory);
+b32 Sim86_FindFirstDifference(paged_memory *A, paged_memory *B, u32 *Address);
+b32 Sim86_WriteSparseDump(char const *FileName, paged_memory *Memory);
+b32 Sim86_LoadSparseDump(char const *FileName, paged_memory *Memory);
+b32 Sim86_SaveSnapshot(char const *FileName, machine_state *State);
+b32 Sim86_RestoreSnapshot(char const *FileName, machine_state *State);
+decode_cache *Sim86_CreateDecodeCache(void);
+void Sim86_DestroyDecodeCache(decode_cache *Cache);
+jit_cache *Sim86_CreateJIT(void);
+void Sim86_DestroyJIT(jit_cache *JIT);
+machine_stop_reason Sim86_Step(machine_state *State);
+machine_stop_reason Sim86_Run(machine_state *State, u64 MaxInstructions, u64 *InstructionCount);
+b32 Sim86_RunVariants(machine_state *Start, u32 InputCount, machine_input *Inputs, u32 VariantCount, variant_result *Results, u64 MaxInstructions, u32 ThreadCount);
 #ifdef __cplusplus
 }
 #endif
@@ -24,19 +24,34 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#include "sim86_platform.h"
 #include "sim86_instruction.h"
 #include "sim86_instruction_table.h"
+#include "sim86_paged_memory.h"
 #include "sim86_memory.h"
 #include "sim86_text.h"
 #include "sim86_decode.h"
+#include "sim86_scan.h"
+#include "sim86_sweep.h"
+#include "sim86_cfg.h"
+#include "sim86_pipeline.h"
+#include "sim86_s86i.h"
 
+#include "sim86_platform.cpp"
 #include "sim86_instruction.cpp"
 #include "sim86_instruction_table.cpp"
+#include "sim86_paged_memory.cpp"
 #include "sim86_memory.cpp"
 #include "sim86_text.cpp"
 #include "sim86_decode.cpp"
+#include "sim86_scan.cpp"
+#include "sim86_sweep.cpp"
+#include "sim86_cfg.cpp"
+#include "sim86_pipeline.cpp"
+#include "sim86_s86i.cpp"
 
 static u32 LoadMemoryFromFile(char *FileName, segmented_access SegMem, u32 AtOffset)
 {
@@ -49,15 +64,33 @@ static u32 LoadMemoryFromFile(char *FileName, segmented_access SegMem, u32 AtOff
     u32 HighAddress = GetHighestAddress(SegMem);
     u32 MaxBytes = (HighAddress - BaseAddress) + 1;
     
-    FILE *File = fopen(FileName, "rb");
-    if(File)
+    if((BaseAddress % GetPageSize()) == 0)
     {
-        Result = fread(SegMem.Memory + BaseAddress, 1, MaxBytes, File);
-        fclose(File);
+        // NOTE: Main memory comes from AllocatePages, so the file can be mapped straight into
+        // it instead of read. Only the pages that actually get touched are ever faulted in,
+        // and the rest of memory is zeroed by swapping in fresh pages, not by clearing them.
+        u64 BytesMapped = 0;
+        if(MapFileIntoPages(FileName, SegMem.Memory + BaseAddress, MaxBytes, &BytesMapped))
+        {
+            Result = (u32)BytesMapped;
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unable to open %s.\n", FileName);
+        }
     }
     else
     {
-        fprintf(stderr, "ERROR: Unable to open %s.\n", FileName);
+        FILE *File = fopen(FileName, "rb");
+        if(File)
+        {
+            Result = fread(SegMem.Memory + BaseAddress, 1, MaxBytes, File);
+            fclose(File);
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unable to open %s.\n", FileName);
+        }
     }
     
     return Result;
@@ -67,7 +100,7 @@ static segmented_access AllocateMemoryPow2(u32 SizePow2)
 {
     static u8 FailedAllocationByte;
     
-    u8 *Memory = (u8 *)malloc(1 << SizePow2);
+    u8 *Memory = AllocatePages(1 << SizePow2);
     if(!Memory)
     {
         SizePow2 = 0;
@@ -78,38 +111,447 @@ static segmented_access AllocateMemoryPow2(u32 SizePow2)
     return Result;
 }
 
-static void DisAsm8086(u32 DisAsmByteCount, segmented_access DisAsmStart)
+static void PrintDecodeError(decode_stop_reason StopReason)
+{
+    if(StopReason == DecodeStop_Truncated)
+    {
+        fprintf(stderr, "ERROR: Instruction extends outside disassembly region\n");
+    }
+    else if(StopReason == DecodeStop_Unrecognized)
+    {
+        fprintf(stderr, "ERROR: Unrecognized binary in instruction stream.\n");
+    }
+}
+
+#define OUTPUT_TEXT_BUFFER_SIZE (64*1024)
+
+static void EmitInstruction(text_buffer *Output, output_format Format, instruction Instruction, u64 AddressBase = 0)
+{
+    if(!HasRoomForRecord(Output))
+    {
+        FlushTextBuffer(Output, stdout);
+    }
+    
+    AppendInstructionRecord(Output, Format, Instruction, AddressBase);
+}
+
+static void DisAsm8086(decode_source Source, output_format Format)
+{
+    opcode_table *Opcodes = Get8086OpcodeTable();
+    
+    char OutputText[OUTPUT_TEXT_BUFFER_SIZE];
+    text_buffer Output = TextBuffer(sizeof(OutputText), OutputText);
+    
+    u32 Offset = 0;
+    instruction Instruction;
+    decode_stop_reason StopReason;
+    while(DecodeNext(Opcodes, Source, Offset, &Instruction, &StopReason))
+    {
+        Offset += Instruction.Size;
+        EmitInstruction(&Output, Format, Instruction);
+    }
+    
+    FlushTextBuffer(&Output, stdout);
+    PrintDecodeError(StopReason);
+}
+
+static void DisAsm8086Parallel(decode_source Source, output_format Format, u32 ThreadCount)
+{
+    // NOTE: Same output as DisAsm8086, but decoded by a speculative linear sweep across
+    // ThreadCount threads (see sim86_sweep.cpp). Printing still happens in order, here.
+    linear_sweep Sweep = BeginLinearSweep(Source, ThreadCount);
+    if(IsValid(&Sweep))
+    {
+        char OutputText[OUTPUT_TEXT_BUFFER_SIZE];
+        text_buffer Output = TextBuffer(sizeof(OutputText), OutputText);
+        
+        while(u32 ChunkCount = SweepNextBatch(&Sweep))
+        {
+            for(u32 ChunkIndex = 0; ChunkIndex < ChunkCount; ++ChunkIndex)
+            {
+                sweep_chunk *Chunk = &Sweep.Chunks[ChunkIndex];
+                for(u32 InstructionIndex = 0; InstructionIndex < Chunk->InstructionCount; ++InstructionIndex)
+                {
+                    EmitInstruction(&Output, Format, UnpackInstruction(Chunk->Instructions[InstructionIndex]));
+                }
+            }
+        }
+        
+        FlushTextBuffer(&Output, stdout);
+        if(Sweep.Stopped)
+        {
+            PrintDecodeError(Sweep.StopReason);
+        }
+        
+        EndLinearSweep(&Sweep);
+    }
+    else
+    {
+        DisAsm8086(Source, Format);
+    }
+}
+
+static void DisAsm8086Pipelined(decode_source Source, output_format Format, u32 ThreadCount)
 {
-    segmented_access At = DisAsmStart;
+    // NOTE: One thread decodes, this thread writes, and the rest format (but always at least one).
+    u32 FormatterCount = (ThreadCount > 3) ? (ThreadCount - 2) : 1;
     
-    instruction_table Table = Get8086InstructionTable();
+    decode_stop_reason StopReason;
+    if(DisAsm8086Pipelined(Source, FormatterCount, Format, stdout, &StopReason))
+    {
+        PrintDecodeError(StopReason);
+    }
+    else
+    {
+        DisAsm8086(Source, Format);
+    }
+}
+
+#define STREAM_CHUNK_SIZE (4*1024*1024)
+#define STREAM_BATCH_SIZE 4096
+
+static void DisAsm8086Streamed(char const *FileName, output_format Format)
+{
+    // NOTE: For files of any size. The file goes through a fixed window, one chunk at a time,
+    // so memory use doesn't depend on the file size. An instruction cut off at the end of a
+    // chunk is carried over to the front of the window and decoded with the next chunk, so the
+    // output is the same as decoding the whole file at once, with addresses as file offsets.
+    //
+    // The window starts with room for the carried-over bytes, and ends with zeroed padding so
+    // the decoder can read whole instructions in place.
+    u32 CarryCapacity = DECODE_SOURCE_PADDING;
+    u32 WindowSize = CarryCapacity + STREAM_CHUNK_SIZE + DECODE_SOURCE_PADDING;
+    u8 *Window = (u8 *)malloc(WindowSize);
+    instruction *Batch = (instruction *)malloc(STREAM_BATCH_SIZE*sizeof(instruction));
+    FILE *File = fopen(FileName, "rb");
     
-    u32 Count = DisAsmByteCount;
-    while(Count)
+    if(Window && Batch && File)
     {
-        instruction Instruction = DecodeInstruction(Table, At);
-        if(Instruction.Op)
+        opcode_table *Opcodes = Get8086OpcodeTable();
+        u32 MaxInstructionByteCount = Opcodes->Instructions.MaxInstructionByteCount;
+        
+        char OutputText[OUTPUT_TEXT_BUFFER_SIZE];
+        text_buffer Output = TextBuffer(sizeof(OutputText), OutputText);
+        
+        u64 WindowAddress = 0;
+        u32 CarryCount = 0;
+        decode_stop_reason StopReason = DecodeStop_EndOfSource;
+        for(b32 Streaming = true; Streaming;)
         {
-            if(Count >= Instruction.Size)
+            u32 BytesRead = (u32)fread(Window + CarryCount, 1, STREAM_CHUNK_SIZE, File);
+            b32 LastChunk = (BytesRead < STREAM_CHUNK_SIZE);
+            
+            u32 WindowBytes = CarryCount + BytesRead;
+            memset(Window + WindowBytes, 0, DECODE_SOURCE_PADDING);
+            decode_source Source = DecodeSource(WindowBytes, Window, true);
+            
+            u32 Offset = 0;
+            decode_block_result Result;
+            do
             {
-                At = MoveBaseBy(At, Instruction.Size);
-                Count -= Instruction.Size;
+                Result = DecodeBlock(Opcodes, Source, Offset, STREAM_BATCH_SIZE, Batch);
+                for(u32 InstructionIndex = 0; InstructionIndex < Result.InstructionCount; ++InstructionIndex)
+                {
+                    EmitInstruction(&Output, Format, Batch[InstructionIndex], WindowAddress);
+                }
+                Offset += Result.BytesDecoded;
+            } while(Result.StopReason == DecodeStop_DestFull);
+            
+            // NOTE: Anything that stops within one instruction of the end of a chunk might only
+            // have stopped because the rest of it is in the next chunk, so it gets another try.
+            CarryCount = WindowBytes - Offset;
+            if(!LastChunk && (CarryCount < MaxInstructionByteCount))
+            {
+                memmove(Window, Window + Offset, CarryCount);
+                WindowAddress += Offset;
             }
             else
             {
-                fprintf(stderr, "ERROR: Instruction extends outside disassembly region\n");
-                break;
+                StopReason = Result.StopReason;
+                Streaming = false;
+            }
+        }
+        
+        FlushTextBuffer(&Output, stdout);
+        if(ferror(File))
+        {
+            fprintf(stderr, "ERROR: Unable to read %s.\n", FileName);
+        }
+        else
+        {
+            PrintDecodeError(StopReason);
+        }
+    }
+    else if(!File)
+    {
+        fprintf(stderr, "ERROR: Unable to open %s.\n", FileName);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to allocate memory for streaming %s.\n", FileName);
+    }
+    
+    if(File)
+    {
+        fclose(File);
+    }
+    free(Batch);
+    free(Window);
+}
+
+static void WriteDecodedFile(char const *FileName, decode_source Source)
+{
+    char OutputName[1024];
+    snprintf(OutputName, sizeof(OutputName), "%s.s86i", FileName);
+    
+    FILE *Dest = fopen(OutputName, "wb");
+    if(Dest)
+    {
+        u32 InstructionCount = 0;
+        b32 Written = WriteS86iFile(Dest, Source, &InstructionCount);
+        Written = (fclose(Dest) == 0) && Written;
+        
+        if(Written)
+        {
+            printf("; %u instructions written to %s\n", InstructionCount, OutputName);
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unable to write %s.\n", OutputName);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to open %s.\n", OutputName);
+    }
+}
+
+static void PrintDataBytes(decode_source Source, u32 Offset, u32 End)
+{
+    printf("; data 0x%04x-0x%04x (%u bytes, not reached)\n", Offset, End, End - Offset);
+    while(Offset < End)
+    {
+        printf("db ");
+        for(u32 ByteIndex = 0; (ByteIndex < 16) && (Offset < End); ++ByteIndex)
+        {
+            printf("%s0x%02x", ByteIndex ? ", " : "", Source.Bytes[Offset++]);
+        }
+        printf("\n");
+    }
+}
+
+static void DisAsm8086ControlFlow(decode_source Source, u32 EntryPointCount, u32 *EntryPoints)
+{
+    // NOTE: Only code reachable from the entry points is disassembled, one basic block at a
+    // time, in address order. Everything in between is emitted as db, so the output still
+    // reassembles to the original file.
+    control_flow_graph Graph = BuildControlFlowGraph(Source, EntryPointCount, EntryPoints);
+    if(IsValid(&Graph))
+    {
+        u32 Offset = 0;
+        for(u32 BlockIndex = 0; BlockIndex < Graph.BlockCount; ++BlockIndex)
+        {
+            cfg_block *Block = &Graph.Blocks[BlockIndex];
+            if(Offset < Block->Start)
+            {
+                PrintDataBytes(Source, Offset, Block->Start);
             }
             
-            PrintInstruction(Instruction, stdout);
+            printf("; block 0x%04x-0x%04x%s%s", Block->Start, Block->End,
+                   (Block->Flags & Block_EntryPoint) ? " (entry point)" : "",
+                   (Block->Flags & Block_BranchTarget) ? " (branch target)" : "");
+            for(u32 SuccessorIndex = 0; SuccessorIndex < Block->SuccessorCount; ++SuccessorIndex)
+            {
+                printf("%s0x%04x", SuccessorIndex ? ", " : " -> ", Block->Successors[SuccessorIndex]);
+            }
             printf("\n");
+            
+            for(u32 InstructionIndex = 0; InstructionIndex < Block->InstructionCount; ++InstructionIndex)
+            {
+                PrintInstruction(UnpackInstruction(Graph.Instructions[Block->FirstInstruction + InstructionIndex]), stdout);
+                printf("\n");
+            }
+            
+            if(Block->Flags & Block_EndsOnBadCode)
+            {
+                printf("; %s at 0x%04x\n", (Block->StopReason == DecodeStop_Truncated) ?
+                       "instruction extends outside disassembly region" : "unrecognized binary", Block->End);
+            }
+            
+            Offset = Block->End;
+        }
+        
+        if(Offset < Source.Size)
+        {
+            PrintDataBytes(Source, Offset, Source.Size);
+        }
+        
+        printf("; %u blocks, %u instructions", Graph.BlockCount, Graph.InstructionCount);
+        if(Graph.ConflictCount)
+        {
+            printf(", %u targets inside other instructions (not followed)", Graph.ConflictCount);
+        }
+        if(Graph.ExternalTargetCount)
+        {
+            printf(", %u targets outside the file (not followed)", Graph.ExternalTargetCount);
+        }
+        printf("\n");
+        
+        FreeControlFlowGraph(&Graph);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to allocate memory for the control flow graph.\n");
+    }
+}
+
+static void PrintJSONFileRecord(char const *FileName, u64 ByteCount)
+{
+    // NOTE: In NDJSON output, each file's instructions are preceded by one of these, so several
+    // files can go down the same stream.
+    printf("{\"file\":\"");
+    for(char const *At = FileName; *At; ++At)
+    {
+        u8 Char = (u8)*At;
+        if((Char == '"') || (Char == '\\'))
+        {
+            printf("\\%c", Char);
+        }
+        else if(Char < 0x20)
+        {
+            printf("\\u%04x", Char);
+        }
+        else
+        {
+            putchar(Char);
+        }
+    }
+    printf("\",\"bytes\":%llu}\n", (unsigned long long)ByteCount);
+}
+
+static void PrintFileHeader(output_format Format, char const *FileName, u64 ByteCount)
+{
+    if(Format == Output_Text)
+    {
+        printf("; %s disassembly:\n", FileName);
+        printf("bits 16\n");
+    }
+    else if(Format == Output_NDJSON)
+    {
+        PrintJSONFileRecord(FileName, ByteCount);
+    }
+}
+
+struct disasm_options
+{
+    output_format Format;
+    u32 ThreadCount;
+    b32 Pipelined;
+    b32 Streamed;
+    b32 WriteDecoded;
+    
+    b32 FollowControlFlow;
+    u32 EntryPointCount;
+    u32 EntryPoints[CFG_MAX_ENTRY_POINTS];
+};
+
+static int ParseOptions(int ArgCount, char **Args, disasm_options *Options)
+{
+    // NOTE: Returns the index of the first file name, or 0 if the options don't make sense.
+    //   -threads N  decode with N threads (0 = one per logical processor). Same output as serial.
+    //   -pipeline   decode, format and write on separate threads (-threads sets how many)
+    //   -stream     disassemble the whole file, however big, not just the first megabyte
+    //   -s86i       write the decoded instructions to <file>.s86i instead of disassembling
+    //   -cfg        only disassemble code reachable from the entry points, by basic block
+    //   -entry N    add an entry point for -cfg (decimal, or hex with 0x). Defaults to 0.
+    //   -ndjson     print one JSON record per instruction instead of assembly (not with -cfg)
+    //   -csv        print one CSV row per instruction instead of assembly (not with -cfg)
+    *Options = {};
+    Options->ThreadCount = 1;
+    
+    int ArgIndex = 1;
+    while(ArgIndex && (ArgIndex < ArgCount) && (Args[ArgIndex][0] == '-'))
+    {
+        char *Option = Args[ArgIndex++];
+        char *Value = (ArgIndex < ArgCount) ? Args[ArgIndex] : 0;
+        
+        if((strcmp(Option, "-threads") == 0) && Value)
+        {
+            Options->ThreadCount = (u32)atoi(Value);
+            if(Options->ThreadCount == 0)
+            {
+                Options->ThreadCount = GetLogicalProcessorCount();
+            }
+            ++ArgIndex;
+        }
+        else if(strcmp(Option, "-pipeline") == 0)
+        {
+            Options->Pipelined = true;
+        }
+        else if(strcmp(Option, "-stream") == 0)
+        {
+            Options->Streamed = true;
+        }
+        else if(strcmp(Option, "-s86i") == 0)
+        {
+            Options->WriteDecoded = true;
+        }
+        else if(strcmp(Option, "-ndjson") == 0)
+        {
+            Options->Format = Output_NDJSON;
+        }
+        else if(strcmp(Option, "-csv") == 0)
+        {
+            Options->Format = Output_CSV;
+        }
+        else if(strcmp(Option, "-cfg") == 0)
+        {
+            Options->FollowControlFlow = true;
+        }
+        else if((strcmp(Option, "-entry") == 0) && Value && (Options->EntryPointCount < ArrayCount(Options->EntryPoints)))
+        {
+            Options->EntryPoints[Options->EntryPointCount++] = (u32)strtoul(Value, 0, 0);
+            ++ArgIndex;
         }
         else
         {
-            fprintf(stderr, "ERROR: Unrecognized binary in instruction stream.\n");
-            break;
+            ArgIndex = 0;
         }
     }
+    
+    if(Options->EntryPointCount == 0)
+    {
+        Options->EntryPoints[Options->EntryPointCount++] = 0;
+    }
+    
+    if((ArgIndex >= ArgCount) ||
+       ((Options->Format != Output_Text) && (Options->FollowControlFlow || Options->WriteDecoded)) ||
+       (Options->Streamed && (Options->FollowControlFlow || Options->WriteDecoded || Options->Pipelined)))
+    {
+        ArgIndex = 0;
+    }
+    
+    return ArgIndex;
+}
+
+static void DisAsm8086(decode_source Source, disasm_options *Options)
+{
+    if(Options->FollowControlFlow)
+    {
+        DisAsm8086ControlFlow(Source, Options->EntryPointCount, Options->EntryPoints);
+    }
+    else if(Options->Pipelined)
+    {
+        DisAsm8086Pipelined(Source, Options->Format, Options->ThreadCount);
+    }
+    else if(Options->ThreadCount > 1)
+    {
+        DisAsm8086Parallel(Source, Options->Format, Options->ThreadCount);
+    }
+    else
+    {
+        DisAsm8086(Source, Options->Format);
+    }
 }
 
 int main(int ArgCount, char **Args)
@@ -117,21 +559,48 @@ int main(int ArgCount, char **Args)
     segmented_access MainMemory = AllocateMemoryPow2(20);
     if(IsValid(MainMemory))
     {
-        if(ArgCount > 1)
+        disasm_options Options;
+        int FirstFileArg = ParseOptions(ArgCount, Args, &Options);
+        if(FirstFileArg)
         {
-            for(int ArgIndex = 1; ArgIndex < ArgCount; ++ArgIndex)
+            if(Options.Format == Output_CSV)
+            {
+                char HeaderText[MAX_INSTRUCTION_RECORD_LENGTH];
+                text_buffer Header = TextBuffer(sizeof(HeaderText), HeaderText);
+                AppendCSVHeader(&Header);
+                FlushTextBuffer(&Header, stdout);
+            }
+            
+            for(int ArgIndex = FirstFileArg; ArgIndex < ArgCount; ++ArgIndex)
             {
                 char *FileName = Args[ArgIndex];
-                u32 BytesRead = LoadMemoryFromFile(FileName, MainMemory, 0);
-                
-                printf("; %s disassembly:\n", FileName);
-                printf("bits 16\n");
-                DisAsm8086(BytesRead, MainMemory);
+                if(Options.Streamed)
+                {
+                    u64 ByteCount = 0;
+                    GetFileByteCount(FileName, &ByteCount);
+                    PrintFileHeader(Options.Format, FileName, ByteCount);
+                    DisAsm8086Streamed(FileName, Options.Format);
+                }
+                else
+                {
+                    u32 BytesRead = LoadMemoryFromFile(FileName, MainMemory, 0);
+                    decode_source Source = DecodeSource(BytesRead, MainMemory.Memory);
+                    
+                    if(Options.WriteDecoded)
+                    {
+                        WriteDecodedFile(FileName, Source);
+                    }
+                    else
+                    {
+                        PrintFileHeader(Options.Format, FileName, BytesRead);
+                        DisAsm8086(Source, &Options);
+                    }
+                }
             }
         }
         else
         {
-            fprintf(stderr, "USAGE: %s [8086 machine code file] ...\n", Args[0]);
+            fprintf(stderr, "USAGE: %s [-threads count] [-pipeline] [-stream] [-s86i] [-cfg] [-entry offset] [-ndjson | -csv] [8086 machine code file] ...\n", Args[0]);
         }
     }
     else
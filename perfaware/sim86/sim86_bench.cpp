@@ -0,0 +1,1638 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+/* NOTE: This is a standalone benchmark for the decoder. It is built exactly like sim86.cpp
+   (compile this one file, no build tools necessary), and takes the same 8086 machine code
+   files on the command line:
+
+       sim86_bench ../part1/listing_0037_single_register_mov ../part1/listing_0042_completionist_decode ...
+
+   Before timing anything, every path is checked against the reference decoder, so a
+   benchmark run is also a correctness run.
+*/
+
+#include "sim86.h"
+
+typedef double f64;
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stddef.h>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "sim86_platform.h"
+#include "sim86_instruction.h"
+#include "sim86_instruction_table.h"
+#include "sim86_paged_memory.h"
+#include "sim86_machine.h"
+#include "sim86_fanout.h"
+#include "sim86_memory.h"
+#include "sim86_text.h"
+#include "sim86_s86i.h"
+#include "sim86_decode.h"
+#include "sim86_scan.h"
+#include "sim86_sweep.h"
+#include "sim86_clocks.h"
+#include "sim86_threaded.h"
+#include "sim86_execute.h"
+#include "sim86_jit.h"
+
+#include "sim86_platform.cpp"
+#include "sim86_instruction.cpp"
+#include "sim86_instruction_table.cpp"
+#include "sim86_paged_memory.cpp"
+#include "sim86_machine.cpp"
+#include "sim86_memory.cpp"
+#include "sim86_text.cpp"
+#include "sim86_s86i.cpp"
+#include "sim86_decode.cpp"
+#include "sim86_scan.cpp"
+#include "sim86_sweep.cpp"
+#include "sim86_execute.cpp"
+#include "sim86_clocks.cpp"
+#include "sim86_threaded.cpp"
+#include "sim86_jit.cpp"
+#include "sim86_fanout.cpp"
+
+#if _WIN32
+static u64 ReadOSTimer(void)
+{
+    LARGE_INTEGER Value;
+    QueryPerformanceCounter(&Value);
+    return Value.QuadPart;
+}
+
+static u64 GetOSTimerFreq(void)
+{
+    LARGE_INTEGER Freq;
+    QueryPerformanceFrequency(&Freq);
+    return Freq.QuadPart;
+}
+#else
+static u64 ReadOSTimer(void)
+{
+    timespec Value;
+    clock_gettime(CLOCK_MONOTONIC, &Value);
+    u64 Result = (u64)Value.tv_sec*1000000000ull + (u64)Value.tv_nsec;
+    return Result;
+}
+
+static u64 GetOSTimerFreq(void)
+{
+    return 1000000000ull;
+}
+#endif
+
+// NOTE: Each path is repeated until it has run for at least this long, so tiny listings
+// still produce stable numbers.
+static f64 const MinSecondsPerTest = 0.25;
+
+struct bench_listing
+{
+    char *FileName;
+    segmented_access Memory;
+    paged_memory PagedMemory;
+    u32 ByteCount;
+
+    u32 InstructionCount;
+    instruction *Reference;
+};
+
+struct bench_result
+{
+    u64 ByteCount;
+    u64 InstructionCount;
+    u64 Ticks;
+};
+
+static void Accumulate(bench_result *Total, bench_result Add)
+{
+    Total->ByteCount += Add.ByteCount;
+    Total->InstructionCount += Add.InstructionCount;
+    Total->Ticks += Add.Ticks;
+}
+
+static void PrintResult(char const *Label, bench_result Result, bench_result Baseline)
+{
+    f64 Seconds = (f64)Result.Ticks / (f64)GetOSTimerFreq();
+    f64 MBPerSecond = ((f64)Result.ByteCount / (1024.0*1024.0)) / Seconds;
+    f64 InstructionsPerSecond = (f64)Result.InstructionCount / Seconds;
+
+    printf("  %-20s %10.2f MB/s %14.0f inst/s", Label, MBPerSecond, InstructionsPerSecond);
+    if(Baseline.Ticks && (Baseline.Ticks != Result.Ticks))
+    {
+        f64 BaselineSeconds = (f64)Baseline.Ticks / (f64)GetOSTimerFreq();
+        f64 BaselineRate = (f64)Baseline.ByteCount / BaselineSeconds;
+        printf("  (%.2fx)", ((f64)Result.ByteCount / Seconds) / BaselineRate);
+    }
+    printf("\n");
+}
+
+static u32 DecodeListing(instruction_table Table, opcode_table *Opcodes, bench_listing *Listing, instruction *Dest)
+{
+    u32 Count = 0;
+
+    segmented_access At = Listing->Memory;
+    u32 Remaining = Listing->ByteCount;
+    while(Remaining)
+    {
+        instruction Instruction = DecodePrefixedInstruction(Table, Opcodes, At, 0);
+        if(!Instruction.Op || (Instruction.Size > Remaining))
+        {
+            break;
+        }
+
+        Dest[Count++] = Instruction;
+        At = MoveBaseBy(At, Instruction.Size);
+        Remaining -= Instruction.Size;
+    }
+
+    return Count;
+}
+
+static b32 LoadListing(char *FileName, bench_listing *Listing)
+{
+    b32 Result = false;
+
+    *Listing = {};
+    Listing->FileName = FileName;
+
+    u32 MemorySize = 1 << 20;
+    u8 *Memory = (u8 *)calloc(MemorySize, 1);
+    FILE *File = fopen(FileName, "rb");
+    if(Memory && File)
+    {
+        Listing->Memory = FixedMemoryPow2(20, Memory);
+        Listing->ByteCount = (u32)fread(Memory, 1, MemorySize, File);
+        
+        InitPagedMemory(&Listing->PagedMemory, 20);
+        CopyToPagedMemory(&Listing->PagedMemory, 0, Listing->ByteCount, Memory);
+
+        // NOTE: The reference decode is the linear table scan, which is what every other
+        // path has to match exactly.
+        Listing->Reference = (instruction *)calloc(Listing->ByteCount + 1, sizeof(instruction));
+        Listing->InstructionCount = DecodeListing(Get8086InstructionTable(), 0, Listing, Listing->Reference);
+        Result = (Listing->Reference != 0);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to open %s.\n", FileName);
+        free(Memory);
+    }
+
+    if(File)
+    {
+        fclose(File);
+    }
+
+    return Result;
+}
+
+// NOTE: Every path decodes the whole listing into Dest and returns the instruction count. Dest
+// points at DestStride bytes per instruction, and paths that don't write full instructions
+// say how to expand them back for checking against the reference.
+typedef u32 bench_decode_func(bench_listing *Listing, void *Dest);
+typedef instruction bench_expand_func(void *Decoded, u32 Index);
+
+struct bench_path
+{
+    char const *Label;
+    bench_decode_func *Decode;
+    u32 DestStride;
+    bench_expand_func *Expand;
+};
+
+static u32 DecodeLinear(bench_listing *Listing, void *Dest)
+{
+    u32 Result = DecodeListing(Get8086InstructionTable(), 0, Listing, (instruction *)Dest);
+    return Result;
+}
+
+static u32 DecodeOpcode(bench_listing *Listing, void *Dest)
+{
+    u32 Result = DecodeListing(Get8086InstructionTable(), Get8086OpcodeTable(), Listing, (instruction *)Dest);
+    return Result;
+}
+
+static u32 DecodeOpcodePaged(bench_listing *Listing, void *Dest)
+{
+    bench_listing Paged = *Listing;
+    Paged.Memory = PagedMemoryAccess(&Listing->PagedMemory);
+    
+    u32 Result = DecodeListing(Get8086InstructionTable(), Get8086OpcodeTable(), &Paged, (instruction *)Dest);
+    return Result;
+}
+
+static decode_source ListingSource(bench_listing *Listing)
+{
+    // NOTE: Listings sit at the bottom of a zeroed megabyte, so they are always padded.
+    decode_source Result = DecodeSource(Listing->ByteCount, Listing->Memory.Memory, true);
+    return Result;
+}
+
+static u32 DecodeWideBlock(bench_listing *Listing, void *Dest)
+{
+    decode_block_result Result = DecodeBlock(Get8086OpcodeTable(), ListingSource(Listing), 0, Listing->ByteCount, (instruction *)Dest);
+    return Result.InstructionCount;
+}
+
+static u32 DecodeCompactBlock(bench_listing *Listing, void *Dest)
+{
+    decode_block_result Result = DecodeCompactBlock(Get8086OpcodeTable(), ListingSource(Listing), 0, Listing->ByteCount, (compact_instruction *)Dest);
+    return Result.InstructionCount;
+}
+
+static instruction ExpandCompact(void *Decoded, u32 Index)
+{
+    instruction Result = UnpackInstruction(((compact_instruction *)Decoded)[Index]);
+    return Result;
+}
+
+static u32 ScanBoundaries(bench_listing *Listing, void *Dest)
+{
+    // NOTE: The scan only produces a bitmap, so it is checked separately (see MatchesBoundaries).
+    u64 *Bitmap = (u64 *)Dest;
+    memset(Bitmap, 0, ((Listing->ByteCount + 63) / 64)*sizeof(u64));
+    decode_block_result Result = ScanInstructionBoundaries(Get8086LengthTable(), ListingSource(Listing), Bitmap);
+    return Result.InstructionCount;
+}
+
+static u32 WalkBoundaries(bench_listing *Listing, void *Dest)
+{
+    // NOTE: The plain table walk, which ScanInstructionBoundaries only uses when there is no AVX2.
+    u64 *Bitmap = (u64 *)Dest;
+    memset(Bitmap, 0, ((Listing->ByteCount + 63) / 64)*sizeof(u64));
+    decode_block_result Result = WalkInstructionBoundaries(Get8086LengthTable(), ListingSource(Listing), Bitmap);
+    return Result.InstructionCount;
+}
+
+static b32 MatchesBoundaries(bench_listing *Listing, bench_path *Path, u64 *Bitmap)
+{
+    u32 Count = Path->Decode(Listing, Bitmap);
+    
+    b32 Result = (Count == Listing->InstructionCount);
+    u32 ReferenceIndex = 0;
+    for(u32 Offset = 0; Result && (Offset < Listing->ByteCount); ++Offset)
+    {
+        if(Bitmap[Offset / 64] & (1ull << (Offset % 64)))
+        {
+            Result = ((ReferenceIndex < Listing->InstructionCount) &&
+                      (Listing->Reference[ReferenceIndex++].Address == Offset));
+        }
+    }
+    
+    if(!Result)
+    {
+        fprintf(stderr, "ERROR: \"%s\" of %s does not match the reference decoder.\n", Path->Label, Listing->FileName);
+    }
+    
+    return Result;
+}
+
+static u32 DecodeLinearSweep(bench_listing *Listing, void *Dest)
+{
+    // NOTE: The listings are tiny, so the chunks are too, to make sure plenty of them have to be
+    // stitched. That also means this times thread startup as much as decoding.
+    u32 Result = 0;
+    
+    linear_sweep Sweep = BeginLinearSweep(ListingSource(Listing), GetLogicalProcessorCount(), 256);
+    while(u32 ChunkCount = SweepNextBatch(&Sweep))
+    {
+        for(u32 ChunkIndex = 0; ChunkIndex < ChunkCount; ++ChunkIndex)
+        {
+            sweep_chunk *Chunk = &Sweep.Chunks[ChunkIndex];
+            memcpy((compact_instruction *)Dest + Result, Chunk->Instructions, Chunk->InstructionCount*sizeof(compact_instruction));
+            Result += Chunk->InstructionCount;
+        }
+    }
+    EndLinearSweep(&Sweep);
+    
+    return Result;
+}
+
+static bench_path BenchPaths[] =
+{
+    {"linear table scan", DecodeLinear, sizeof(instruction)},
+    {"opcode table", DecodeOpcode, sizeof(instruction)},
+    {"opcode, paged", DecodeOpcodePaged, sizeof(instruction)},
+    {"block, wide", DecodeWideBlock, sizeof(instruction)},
+    {"block, compact", DecodeCompactBlock, sizeof(compact_instruction), ExpandCompact},
+    {"boundary scan", ScanBoundaries, 0},
+    {"boundary walk", WalkBoundaries, 0},
+    {"linear sweep", DecodeLinearSweep, sizeof(compact_instruction), ExpandCompact},
+};
+
+static b32 MatchesReference(bench_listing *Listing, bench_path *Path, u32 Count, void *Decoded)
+{
+    b32 Result = (Count == Listing->InstructionCount);
+    for(u32 Index = 0; Result && (Index < Count); ++Index)
+    {
+        instruction Instruction = Path->Expand ? Path->Expand(Decoded, Index) : ((instruction *)Decoded)[Index];
+        Result = (memcmp(&Instruction, &Listing->Reference[Index], sizeof(instruction)) == 0);
+    }
+
+    if(!Result)
+    {
+        fprintf(stderr, "ERROR: \"%s\" decode of %s does not match the reference decoder.\n", Path->Label, Listing->FileName);
+    }
+
+    return Result;
+}
+
+static b32 RoundTripsThroughCompact(bench_listing *Listing)
+{
+    b32 Result = true;
+    for(u32 Index = 0; Result && (Index < Listing->InstructionCount); ++Index)
+    {
+        compact_instruction Packed;
+        Result = PackInstruction(Listing->Reference[Index], &Packed);
+        if(Result)
+        {
+            instruction Unpacked = UnpackInstruction(Packed);
+            Result = (memcmp(&Unpacked, &Listing->Reference[Index], sizeof(instruction)) == 0);
+        }
+    }
+
+    if(!Result)
+    {
+        fprintf(stderr, "ERROR: %s does not round-trip through compact_instruction.\n", Listing->FileName);
+    }
+
+    return Result;
+}
+
+static bench_result TimeDecode(bench_path *Path, bench_listing *Listing, void *Scratch)
+{
+    bench_result Result = {};
+
+    u64 MinTicks = (u64)(MinSecondsPerTest * (f64)GetOSTimerFreq());
+    while(Result.Ticks < MinTicks)
+    {
+        u64 Start = ReadOSTimer();
+        u32 Count = Path->Decode(Listing, Scratch);
+        Result.Ticks += ReadOSTimer() - Start;
+
+        Result.ByteCount += Listing->ByteCount;
+        Result.InstructionCount += Count;
+    }
+
+    return Result;
+}
+
+// NOTE: The operand stage is timed on its own, outside of decoding: building the REG and MOD/RM
+// operands for every (ModRM, W) combination, either field by field the way the reference
+// decoder does, or by copying the precomputed template and patching in the displacement.
+static u32 BuildOperandsByField(u32 Pass, instruction_operand *Dest)
+{
+    u32 Count = 0;
+    for(u32 Wide = 0; Wide < 2; ++Wide)
+    {
+        for(u32 ModRM = 0; ModRM < 256; ++ModRM)
+        {
+            s16 Displacement = (s16)(ModRM + Pass);
+            Dest[Count++] = GetRegOperand((ModRM >> 3) & 0x7, Wide);
+            Dest[Count++] = GetModOperand(ModRM >> 6, ModRM & 0x7, Wide, Displacement);
+        }
+    }
+
+    return Count;
+}
+
+static u32 BuildOperandsFromTemplates(u32 Pass, instruction_operand *Dest)
+{
+    operand_templates *Templates = &Get8086OpcodeTable()->Templates;
+
+    u32 Count = 0;
+    for(u32 Wide = 0; Wide < 2; ++Wide)
+    {
+        for(u32 ModRM = 0; ModRM < 256; ++ModRM)
+        {
+            s16 Displacement = (s16)(ModRM + Pass);
+            Dest[Count++] = Templates->RegOperands[Wide][(ModRM >> 3) & 0x7];
+
+            instruction_operand *ModOperand = &Dest[Count++];
+            *ModOperand = Templates->ModOperands[Wide][((ModRM >> 6) << 3) | (ModRM & 0x7)];
+            if(ModOperand->Type == Operand_Memory)
+            {
+                ModOperand->Address.Displacement = Displacement;
+            }
+        }
+    }
+
+    return Count;
+}
+
+typedef u32 bench_operand_func(u32 Pass, instruction_operand *Dest);
+static bench_result TimeOperandStage(bench_operand_func *Build, instruction_operand *Scratch)
+{
+    // NOTE: InstructionCount counts operands here.
+    bench_result Result = {};
+
+    u64 MinTicks = (u64)(MinSecondsPerTest * (f64)GetOSTimerFreq());
+    for(u32 Pass = 0; Result.Ticks < MinTicks; ++Pass)
+    {
+        u64 Start = ReadOSTimer();
+        u32 Count = Build(Pass, Scratch);
+        Result.Ticks += ReadOSTimer() - Start;
+
+        Result.InstructionCount += Count;
+    }
+
+    return Result;
+}
+
+static b32 BenchOperandStage(void)
+{
+    instruction_operand ByField[2*2*256];
+    instruction_operand FromTemplates[2*2*256];
+
+    u32 Count = BuildOperandsByField(7, ByField);
+    b32 Result = ((BuildOperandsFromTemplates(7, FromTemplates) == Count) &&
+                  (memcmp(ByField, FromTemplates, Count*sizeof(instruction_operand)) == 0));
+    if(Result)
+    {
+        bench_result Baseline = TimeOperandStage(BuildOperandsByField, ByField);
+        bench_result Templated = TimeOperandStage(BuildOperandsFromTemplates, FromTemplates);
+
+        f64 Freq = (f64)GetOSTimerFreq();
+        f64 BaselineRate = (f64)Baseline.InstructionCount / ((f64)Baseline.Ticks / Freq);
+        f64 TemplatedRate = (f64)Templated.InstructionCount / ((f64)Templated.Ticks / Freq);
+
+        printf("Operand stage (REG + MOD/RM operands for all 512 ModRM/W combinations):\n");
+        printf("  %-20s %14.0f operands/s\n", "built by field", BaselineRate);
+        printf("  %-20s %14.0f operands/s  (%.2fx)\n", "from templates", TemplatedRate, TemplatedRate / BaselineRate);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Operand templates do not match the field-by-field operands.\n");
+    }
+
+    return Result;
+}
+
+// NOTE: Simulator-style memory traffic, timed on its own: word read-modify-writes at
+// pseudo-random segment:offset addresses across the whole megabyte, including the ones that
+// wrap past the top. Done a byte at a time, the way the decoder used to read words, then a word
+// at a time, on plain and on paged memory.
+#define BENCH_TRAFFIC_COUNT (1024*1024)
+
+static u32 NextBenchRandom(u32 *State)
+{
+    // NOTE: xorshift32 - the same addresses every run, and cheap next to what is being timed.
+    u32 X = *State;
+    X ^= X << 13;
+    X ^= X >> 17;
+    X ^= X << 5;
+    *State = X;
+    return X;
+}
+
+static void TrafficByBytes(segmented_access Memory, u32 Pass)
+{
+    u32 State = 0x9e3779b9;
+    for(u32 Index = 0; Index < BENCH_TRAFFIC_COUNT; ++Index)
+    {
+        u32 Random = NextBenchRandom(&State);
+        Memory.SegmentBase = (u16)(Random >> 16);
+        Memory.SegmentOffset = (u16)Random;
+        
+        u8 *Low = AccessMemory(Memory, 0);
+        u8 *High = AccessMemory(Memory, 1);
+        u16 Value = (u16)(((*High << 8) | *Low) + Pass);
+        *Low = (u8)Value;
+        *High = (u8)(Value >> 8);
+    }
+}
+
+static void TrafficByWords(segmented_access Memory, u32 Pass)
+{
+    u32 State = 0x9e3779b9;
+    for(u32 Index = 0; Index < BENCH_TRAFFIC_COUNT; ++Index)
+    {
+        u32 Random = NextBenchRandom(&State);
+        Memory.SegmentBase = (u16)(Random >> 16);
+        Memory.SegmentOffset = (u16)Random;
+        
+        WriteMemoryU16(Memory, 0, (u16)(ReadMemoryU16(Memory) + Pass));
+    }
+}
+
+typedef void bench_traffic_func(segmented_access Memory, u32 Pass);
+static bench_result TimeMemoryTraffic(bench_traffic_func *Traffic, segmented_access Memory)
+{
+    // NOTE: InstructionCount counts word accesses here.
+    bench_result Result = {};
+
+    u64 MinTicks = (u64)(MinSecondsPerTest * (f64)GetOSTimerFreq());
+    for(u32 Pass = 1; Result.Ticks < MinTicks; ++Pass)
+    {
+        u64 Start = ReadOSTimer();
+        Traffic(Memory, Pass);
+        Result.Ticks += ReadOSTimer() - Start;
+
+        Result.InstructionCount += BENCH_TRAFFIC_COUNT;
+    }
+
+    return Result;
+}
+
+static b32 BenchMemoryTraffic(void)
+{
+    u32 MemorySize = 1 << 20;
+    u8 *ByteMemory = (u8 *)calloc(MemorySize, 1);
+    u8 *WordMemory = (u8 *)calloc(MemorySize, 1);
+    u8 *PagedCopy = (u8 *)calloc(MemorySize, 1);
+    paged_memory PagedMemory;
+    InitPagedMemory(&PagedMemory, 20);
+    
+    b32 Result = (ByteMemory && WordMemory && PagedCopy);
+    if(Result)
+    {
+        segmented_access Bytes = FixedMemoryPow2(20, ByteMemory);
+        segmented_access Words = FixedMemoryPow2(20, WordMemory);
+        segmented_access Paged = PagedMemoryAccess(&PagedMemory);
+        
+        // NOTE: One pass each has to leave all the memories the same, wrapped words included.
+        TrafficByBytes(Bytes, 1);
+        TrafficByWords(Words, 1);
+        TrafficByWords(Paged, 1);
+        CopyFromPagedMemory(&PagedMemory, 0, MemorySize, PagedCopy);
+        Result = ((memcmp(ByteMemory, WordMemory, MemorySize) == 0) &&
+                  (memcmp(ByteMemory, PagedCopy, MemorySize) == 0));
+        if(Result)
+        {
+            bench_result Baseline = TimeMemoryTraffic(TrafficByBytes, Bytes);
+            bench_result Plain = TimeMemoryTraffic(TrafficByWords, Words);
+            bench_result PagedWords = TimeMemoryTraffic(TrafficByWords, Paged);
+            
+            f64 Freq = (f64)GetOSTimerFreq();
+            f64 BaselineRate = (f64)Baseline.InstructionCount / ((f64)Baseline.Ticks / Freq);
+            f64 PlainRate = (f64)Plain.InstructionCount / ((f64)Plain.Ticks / Freq);
+            f64 PagedRate = (f64)PagedWords.InstructionCount / ((f64)PagedWords.Ticks / Freq);
+            
+            printf("Memory traffic (word read-modify-write at random segment:offset):\n");
+            printf("  %-20s %14.0f words/s\n", "byte at a time", BaselineRate);
+            printf("  %-20s %14.0f words/s  (%.2fx)\n", "word, plain", PlainRate, PlainRate / BaselineRate);
+            printf("  %-20s %14.0f words/s  (%.2fx)\n", "word, paged", PagedRate, PagedRate / BaselineRate);
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Word accesses do not match byte accesses.\n");
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to allocate memory for the memory traffic test.\n");
+    }
+    
+    free(ByteMemory);
+    free(WordMemory);
+    free(PagedCopy);
+    ReleasePagedMemory(&PagedMemory);
+    
+    return Result;
+}
+
+#define BENCH_MACHINE_COUNT 4096
+#define BENCH_IMAGE_SIZE (64*1024)
+
+static void WriteMachineState(paged_memory *Machine, u32 MachineIndex)
+{
+    // NOTE: What a small program typically dirties: a word on its stack, a word of data, and one
+    // word patched in its own image.
+    segmented_access Access = PagedMemoryAccess(Machine);
+    
+    Access.SegmentBase = 0x9000;
+    WriteMemoryU16(Access, 0xfffe, (u16)MachineIndex);
+    
+    Access.SegmentBase = 0x2000;
+    WriteMemoryU16(Access, 0x0100, (u16)~MachineIndex);
+    
+    Access.SegmentBase = 0;
+    WriteMemoryU16(Access, 0x1000, (u16)(MachineIndex*3));
+}
+
+static b32 BenchPagedMachines(void)
+{
+    // NOTE: BENCH_MACHINE_COUNT machines all start from the same 64k program image, the way
+    // a batch of simulations would. Each one only ever owns the pages it wrote to, so the whole
+    // batch should cost a tiny fraction of a flat megabyte per machine.
+    paged_memory Image;
+    InitPagedMemory(&Image, 20);
+    
+    u8 *ImageBytes = (u8 *)malloc(BENCH_IMAGE_SIZE);
+    paged_memory *Machines = (paged_memory *)calloc(BENCH_MACHINE_COUNT, sizeof(paged_memory));
+    b32 Result = (ImageBytes && Machines);
+    if(Result)
+    {
+        u32 State = 0x12345678;
+        for(u32 Index = 0; Index < BENCH_IMAGE_SIZE; ++Index)
+        {
+            ImageBytes[Index] = (u8)NextBenchRandom(&State);
+        }
+        CopyToPagedMemory(&Image, 0, BENCH_IMAGE_SIZE, ImageBytes);
+        
+        u64 Start = ReadOSTimer();
+        for(u32 MachineIndex = 0; MachineIndex < BENCH_MACHINE_COUNT; ++MachineIndex)
+        {
+            ClonePagedMemory(&Image, &Machines[MachineIndex]);
+            WriteMachineState(&Machines[MachineIndex], MachineIndex);
+        }
+        u64 Ticks = ReadOSTimer() - Start;
+        
+        u64 PagedBytes = ((u64)GlobalAllocatedPageCount*sizeof(memory_page) +
+                          (u64)(BENCH_MACHINE_COUNT + 1)*sizeof(paged_memory));
+        u64 FlatBytes = (u64)(BENCH_MACHINE_COUNT + 1) << 20;
+        
+        // NOTE: Every machine has to see its own writes on top of the image, and the image
+        // has to be untouched by all of them.
+        for(u32 MachineIndex = 0; Result && (MachineIndex < BENCH_MACHINE_COUNT); ++MachineIndex)
+        {
+            segmented_access Access = PagedMemoryAccess(&Machines[MachineIndex]);
+            u16 Patch = ReadMemoryU16(Access, 0x1000);
+            u16 Code = ReadMemoryU16(Access, 0x2000);
+            Access.SegmentBase = 0x9000;
+            u16 Stack = ReadMemoryU16(Access, 0xfffe);
+            Access.SegmentBase = 0x2000;
+            u16 Data = ReadMemoryU16(Access, 0x0100);
+            Result = ((Stack == (u16)MachineIndex) && (Data == (u16)~MachineIndex) &&
+                      (Patch == (u16)(MachineIndex*3)) && (Code == (ImageBytes[0x2000] | (ImageBytes[0x2001] << 8))) &&
+                      (Machines[MachineIndex].ReadPages[2] == Image.ReadPages[2]));
+        }
+        
+        segmented_access ImageAccess = PagedMemoryAccess(&Image);
+        Result = Result && (ReadMemoryU16(ImageAccess, 0x1000) == (ImageBytes[0x1000] | (ImageBytes[0x1001] << 8)));
+        
+        for(u32 MachineIndex = 0; MachineIndex < BENCH_MACHINE_COUNT; ++MachineIndex)
+        {
+            ReleasePagedMemory(&Machines[MachineIndex]);
+        }
+        
+        if(Result)
+        {
+            f64 Seconds = (f64)Ticks / (f64)GetOSTimerFreq();
+            printf("Paged machines (%u clones of a %uk image, 3 words written by each):\n",
+                   BENCH_MACHINE_COUNT, BENCH_IMAGE_SIZE / 1024);
+            printf("  %-20s %14.0f machines/s\n", "clone and write", (f64)BENCH_MACHINE_COUNT / Seconds);
+            printf("  %-20s %14.2f MB  (flat: %.2f MB, %.1fx smaller)\n", "memory used",
+                   (f64)PagedBytes / (1024.0*1024.0), (f64)FlatBytes / (1024.0*1024.0), (f64)FlatBytes / (f64)PagedBytes);
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Paged machines do not see their own writes.\n");
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to allocate memory for the paged machine test.\n");
+    }
+    
+    ReleasePagedMemory(&Image);
+    free(Machines);
+    free(ImageBytes);
+    
+    return Result;
+}
+
+#define BENCH_VARIANT_COUNT 1024
+#define BENCH_VARIANT_LOOP_COUNT 100
+
+static b32 BenchFanout(void)
+{
+    // NOTE: A small loop that keeps storing into memory as it goes:
+    //
+    //     mov cx, BENCH_VARIANT_LOOP_COUNT
+    // top:
+    //     add ax, bx
+    //     sub dx, 3
+    //     cmp ax, dx
+    //     mov [si + 0x1000], ax
+    //     add si, 2
+    //     loop top
+    //
+    // Every variant gets its own bx, and every third one its own si as well, so variants differ
+    // in the pages they dirty. Each thread count has to produce exactly the same results.
+    u8 Program[] =
+    {
+        0xb9, (u8)BENCH_VARIANT_LOOP_COUNT, (u8)(BENCH_VARIANT_LOOP_COUNT >> 8),
+        0x01, 0xd8, 0x83, 0xea, 0x03, 0x39, 0xd0, 0x89, 0x84, 0x00, 0x10, 0x83, 0xc6, 0x02, 0xe2, 0xf0,
+    };
+    
+    paged_memory Image;
+    InitPagedMemory(&Image, 20);
+    CopyToPagedMemory(&Image, 0, sizeof(Program), Program);
+    
+    machine_state Initial = {};
+    Initial.ProgramSize = sizeof(Program);
+    Initial.Memory = &Image;
+    
+    machine_input *Inputs = (machine_input *)calloc(2*BENCH_VARIANT_COUNT, sizeof(machine_input));
+    variant_result *Expected = (variant_result *)calloc(BENCH_VARIANT_COUNT, sizeof(variant_result));
+    variant_result *Results = (variant_result *)calloc(BENCH_VARIANT_COUNT, sizeof(variant_result));
+    b32 Result = (Inputs && Expected && Results);
+    if(Result)
+    {
+        u32 InputCount = 0;
+        for(u32 Variant = 0; Variant < BENCH_VARIANT_COUNT; ++Variant)
+        {
+            Inputs[InputCount++] = {Variant, 0, (u16)Variant, Input_Register, Register_b};
+            if((Variant % 3) == 0)
+            {
+                Inputs[InputCount++] = {Variant, 0, (u16)(Variant*16), Input_Register, Register_si};
+            }
+        }
+        
+        printf("Fan-out (%u variants of a %u-iteration loop):\n", BENCH_VARIANT_COUNT, BENCH_VARIANT_LOOP_COUNT);
+        
+        u32 MaxThreadCount = GetLogicalProcessorCount();
+        f64 SingleSeconds = 0;
+        for(u32 ThreadCount = 1; Result && (ThreadCount <= MaxThreadCount);
+            ThreadCount = ((ThreadCount < MaxThreadCount) && (2*ThreadCount > MaxThreadCount)) ? MaxThreadCount : 2*ThreadCount)
+        {
+            variant_result *Dest = (ThreadCount == 1) ? Expected : Results;
+            
+            u64 Start = ReadOSTimer();
+            Result = RunVariants(&Initial, InputCount, Inputs, BENCH_VARIANT_COUNT, Dest, 0, ThreadCount);
+            u64 Ticks = ReadOSTimer() - Start;
+            
+            u64 InstructionCount = 0;
+            for(u32 Variant = 0; Result && (Variant < BENCH_VARIANT_COUNT); ++Variant)
+            {
+                variant_result *Check = &Dest[Variant];
+                Result = ((Check->StopReason == MachineStop_EndOfProgram) &&
+                          (Check->Registers[Register_a] == (u16)(Variant*BENCH_VARIANT_LOOP_COUNT)) &&
+                          (memcmp(Check, &Expected[Variant], sizeof(*Check)) == 0));
+                InstructionCount += Check->InstructionCount;
+            }
+            
+            if(Result)
+            {
+                f64 Seconds = (f64)Ticks / (f64)GetOSTimerFreq();
+                if(ThreadCount == 1)
+                {
+                    SingleSeconds = Seconds;
+                }
+                
+                char Label[32];
+                snprintf(Label, sizeof(Label), "%u thread%s", ThreadCount, (ThreadCount == 1) ? "" : "s");
+                printf("  %-20s %10.0f variants/s %14.0f inst/s  (%.2fx)\n", Label, BENCH_VARIANT_COUNT / Seconds,
+                       (f64)InstructionCount / Seconds, SingleSeconds / Seconds);
+            }
+        }
+        
+        // NOTE: None of the variants' writes can show up in the starting memory.
+        Result = Result && (ReadPagedU16(&Image, 0x1000) == 0);
+        if(!Result)
+        {
+            fprintf(stderr, "ERROR: Fan-out variants did not all produce the expected results.\n");
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to allocate memory for the fan-out test.\n");
+    }
+    
+    ReleasePagedMemory(&Image);
+    free(Inputs);
+    free(Expected);
+    free(Results);
+    
+    return Result;
+}
+
+struct bench_program
+{
+    char const *Label;
+    u32 Size;
+    u8 const *Code;
+};
+
+// NOTE: add/sub/cmp and a conditional jump, in a loop of loops:
+//
+//         mov di, 8
+// outer:  mov cx, 0xffff
+// top:    add ax, bx
+//         sub dx, 3
+//         cmp ax, dx
+//         jne skip
+//         inc si
+// skip:   loop top
+//         dec di
+//         jnz outer
+static u8 const BenchArithmeticLoop[] =
+{
+    0xbf, 0x08, 0x00, 0xb9, 0xff, 0xff, 0x01, 0xd8, 0x83, 0xea, 0x03, 0x39,
+    0xd0, 0x75, 0x01, 0x46, 0xe2, 0xf4, 0x4f, 0x75, 0xee,
+};
+
+// NOTE: Walks an array, reading each word and writing the next:
+//
+//         mov di, 0x100
+// outer:  mov cx, 0x7ff
+//         mov si, 0x2000
+// top:    mov ax, [si]
+//         add ax, cx
+//         mov [si + 2], ax
+//         add si, 2
+//         loop top
+//         dec di
+//         jnz outer
+static u8 const BenchMemoryLoop[] =
+{
+    0xbf, 0x00, 0x01, 0xb9, 0xff, 0x07, 0xbe, 0x00, 0x20, 0x8b, 0x04, 0x01,
+    0xc8, 0x89, 0x44, 0x02, 0x83, 0xc6, 0x02, 0xe2, 0xf4, 0x4f, 0x75, 0xeb,
+};
+
+// NOTE: Listing 49's loop, run 0x40 times over with the full count each time:
+//
+//         mov di, 0x40
+// outer:  mov cx, 0xffff
+//         mov bx, 1000
+// top:    add bx, 10
+//         sub cx, 1
+//         jnz top
+//         dec di
+//         jnz outer
+static u8 const BenchCountdownLoop[] =
+{
+    0xbf, 0x40, 0x00, 0xb9, 0xff, 0xff, 0xbb, 0xe8, 0x03, 0x83, 0xc3, 0x0a,
+    0x83, 0xe9, 0x01, 0x75, 0xf8, 0x4f, 0x75, 0xef,
+};
+
+// NOTE: Changes its own code every time around, which is the worst case for a decode cache:
+//
+//         mov cx, 0x8000
+// top:    mov ax, 0
+//         add bx, ax
+//         inc word [top + 1]
+//         loop top
+static u8 const BenchSelfModifyingLoop[] =
+{
+    0xb9, 0x00, 0x80, 0xb8, 0x00, 0x00, 0x01, 0xc3, 0xff, 0x06, 0x04, 0x00,
+    0xe2, 0xf5,
+};
+
+static bench_program BenchPrograms[] =
+{
+    {"arithmetic loop", sizeof(BenchArithmeticLoop), BenchArithmeticLoop},
+    {"memory loop", sizeof(BenchMemoryLoop), BenchMemoryLoop},
+    {"countdown loop", sizeof(BenchCountdownLoop), BenchCountdownLoop},
+    {"self-modifying loop", sizeof(BenchSelfModifyingLoop), BenchSelfModifyingLoop},
+};
+
+enum bench_engine
+{
+    Engine_Decode,
+    Engine_DecodeCache,
+    Engine_Threaded,
+    Engine_JIT,
+    
+    Engine_Count,
+};
+
+static char const *BenchEngineLabels[Engine_Count] =
+{
+    "decode every step",
+    "decode cache",
+    "threaded",
+    "jit",
+};
+
+static f64 RunBenchProgram(bench_program *Program, bench_engine Engine, decode_cache *Cache, jit_cache *JIT,
+                           machine_state *State, u64 *InstructionCount)
+{
+    // NOTE: Returns how many seconds it took to run the program from the start to its end.
+    InitPagedMemory(State->Memory, 20);
+    CopyToPagedMemory(State->Memory, 0, Program->Size, Program->Code);
+    
+    paged_memory *Memory = State->Memory;
+    *State = {};
+    State->ProgramSize = Program->Size;
+    State->Memory = Memory;
+    State->DecodeCache = (Engine != Engine_Decode) ? Cache : 0;
+    State->JIT = (Engine == Engine_JIT) ? JIT : 0;
+    
+    opcode_table *Opcodes = Get8086OpcodeTable();
+    u64 Start = ReadOSTimer();
+    machine_stop_reason Stop = MachineStop_None;
+    switch(Engine)
+    {
+        case Engine_Threaded: {Stop = RunThreaded(Opcodes, State, 0, InstructionCount);} break;
+        case Engine_JIT: {Stop = RunJIT(Opcodes, State, 0, InstructionCount);} break;
+        default: {Stop = RunMachine(Opcodes, State, 0, InstructionCount);} break;
+    }
+    u64 Ticks = ReadOSTimer() - Start;
+    
+    f64 Result = (Stop == MachineStop_EndOfProgram) ? ((f64)Ticks / (f64)GetOSTimerFreq()) : 0;
+    return Result;
+}
+
+static b32 BenchExecution(void)
+{
+    // NOTE: Each program runs to its end once decoding every instruction, again with a decode
+    // cache, again on the threaded interpreter, and again with the JIT (if this host has one).
+    // All of them have to finish with the same registers and the same memory.
+    decode_cache *Cache = (decode_cache *)calloc(1, sizeof(decode_cache));
+    jit_cache *JIT = CreateJITCache();
+    u32 EngineCount = JIT ? Engine_Count : Engine_JIT;
+    
+    b32 Result = (Cache != 0);
+    if(Result)
+    {
+        printf("Execution (one machine, each program run to its end):\n");
+        for(u32 ProgramIndex = 0; Result && (ProgramIndex < ArrayCount(BenchPrograms)); ++ProgramIndex)
+        {
+            bench_program *Program = &BenchPrograms[ProgramIndex];
+            
+            paged_memory Memories[Engine_Count];
+            machine_state States[Engine_Count] = {};
+            u64 Counts[Engine_Count] = {};
+            f64 Rates[Engine_Count] = {};
+            for(u32 Engine = 0; Engine < EngineCount; ++Engine)
+            {
+                States[Engine].Memory = &Memories[Engine];
+                f64 Seconds = RunBenchProgram(Program, (bench_engine)Engine, Cache, JIT, &States[Engine], &Counts[Engine]);
+                
+                u32 Difference;
+                Result = (Result && (Seconds > 0) && (Counts[Engine] == Counts[0]) &&
+                          (States[Engine].ClockCount == States[0].ClockCount) &&
+                          (memcmp(States[Engine].Registers, States[0].Registers, sizeof(States[0].Registers)) == 0) &&
+                          !FindFirstDifference(&Memories[Engine], &Memories[0], &Difference));
+                Rates[Engine] = Result ? ((f64)Counts[Engine] / Seconds) : 0;
+            }
+            
+            if(Result)
+            {
+                printf("  %s (%llu instructions, %llu clocks):\n", Program->Label, (unsigned long long)Counts[0],
+                       (unsigned long long)States[0].ClockCount);
+                for(u32 Engine = 0; Engine < EngineCount; ++Engine)
+                {
+                    printf("    %-20s %14.0f inst/s", BenchEngineLabels[Engine], Rates[Engine]);
+                    if(Engine > Engine_DecodeCache)
+                    {
+                        printf("  (%.2fx, %.2fx over the switch)", Rates[Engine] / Rates[Engine_Decode], Rates[Engine] / Rates[Engine_DecodeCache]);
+                    }
+                    else if(Engine)
+                    {
+                        printf("  (%.2fx)", Rates[Engine] / Rates[Engine_Decode]);
+                    }
+                    printf("\n");
+                }
+            }
+            else
+            {
+                fprintf(stderr, "ERROR: %s did not run the same way on every interpreter.\n", Program->Label);
+            }
+            
+            for(u32 Engine = 0; Engine < EngineCount; ++Engine)
+            {
+                ReleasePagedMemory(&Memories[Engine]);
+            }
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Unable to allocate memory for the execution test.\n");
+    }
+    
+    DestroyJITCache(JIT);
+    free(Cache);
+    
+    return Result;
+}
+
+struct bench_step_check
+{
+    char const *Label;
+    u32 Size;
+    u8 Code[4];
+    
+    u16 AX;
+    u16 Flags;
+    
+    // NOTE: Only the flags in FlagMask are compared.
+    u16 ExpectedAX;
+    u16 ExpectedFlags;
+    u16 FlagMask;
+    u32 ExpectedClocks;
+};
+
+static bench_step_check BenchStepChecks[] =
+{
+    {"das with a borrow out of the low digit", 1, {0x2f}, 0x0005, FlagBit_AF, 0x00ff, FlagBit_AF | FlagBit_CF, FlagBit_AF | FlagBit_CF, 4},
+    {"das of 0x10 with AF", 1, {0x2f}, 0x0010, FlagBit_AF, 0x000a, FlagBit_AF, FlagBit_AF | FlagBit_CF, 4},
+    {"das of 0x9a", 1, {0x2f}, 0x009a, 0, 0x0034, FlagBit_AF | FlagBit_CF, FlagBit_AF | FlagBit_CF, 4},
+    {"daa of 0x9a", 1, {0x27}, 0x009a, 0, 0x0000, FlagBit_AF | FlagBit_CF | FlagBit_ZF, FlagBit_AF | FlagBit_CF | FlagBit_ZF, 4},
+    
+    // NOTE: The accumulator's short forms against the same instructions encoded the long way,
+    // and an explicit zero displacement, which costs as much as any other.
+    {"xchg ax, bx (short form)", 1, {0x93}, 0x0000, 0, 0x0000, 0, 0, 3},
+    {"xchg ax, bx (long form)", 2, {0x87, 0xc3}, 0x0000, 0, 0x0000, 0, 0, 4},
+    {"test al, 5 (short form)", 2, {0xa8, 0x05}, 0x0000, 0, 0x0000, FlagBit_ZF, FlagBit_ZF, 4},
+    {"test al, 5 (long form)", 3, {0xf6, 0xc0, 0x05}, 0x0000, 0, 0x0000, FlagBit_ZF, FlagBit_ZF, 5},
+    {"mov ax, [1234h] (short form)", 3, {0xa1, 0x34, 0x12}, 0x0000, 0, 0x0000, 0, 0, 10},
+    {"mov ax, [1234h] (long form)", 4, {0x8b, 0x06, 0x34, 0x12}, 0x0000, 0, 0x0000, 0, 0, 14},
+    {"mov ax, [bx]", 2, {0x8b, 0x07}, 0x0000, 0, 0x078b, 0, 0, 13},
+    {"mov ax, [bx + 0]", 3, {0x8b, 0x47, 0x00}, 0x0000, 0, 0x478b, 0, 0, 17},
+};
+
+static b32 BenchStepResults(void)
+{
+    // NOTE: The interpreters are only checked against each other elsewhere, which can't catch a
+    // mistake they all share, so these single instructions are checked against known results.
+    b32 Result = true;
+    for(u32 CheckIndex = 0; CheckIndex < ArrayCount(BenchStepChecks); ++CheckIndex)
+    {
+        bench_step_check *Check = &BenchStepChecks[CheckIndex];
+        
+        paged_memory Memory;
+        InitPagedMemory(&Memory, 20);
+        CopyToPagedMemory(&Memory, 0, Check->Size, Check->Code);
+        
+        machine_state State = {};
+        State.Memory = &Memory;
+        State.Registers[Register_a] = Check->AX;
+        State.Registers[Register_flags] = Check->Flags;
+        
+        machine_stop_reason Stop = StepMachine(Get8086OpcodeTable(), &State);
+        if((Stop != MachineStop_None) || (State.Registers[Register_a] != Check->ExpectedAX) ||
+           ((State.Registers[Register_flags] & Check->FlagMask) != Check->ExpectedFlags) ||
+           (State.ClockCount != Check->ExpectedClocks))
+        {
+            fprintf(stderr, "ERROR: %s gave ax %04x, flags %04x, %llu clocks.\n", Check->Label,
+                    State.Registers[Register_a], State.Registers[Register_flags], (unsigned long long)State.ClockCount);
+            Result = false;
+        }
+        
+        ReleasePagedMemory(&Memory);
+    }
+    
+    return Result;
+}
+
+// NOTE: The file formats are checked by writing them to the current directory, reading them
+// back, and deleting them again. These read and write whole files for making damaged copies.
+static u8 *ReadBenchFile(char const *FileName, u32 *Size)
+{
+    u8 *Result = 0;
+    
+    FILE *File = fopen(FileName, "rb");
+    if(File)
+    {
+        fseek(File, 0, SEEK_END);
+        *Size = (u32)ftell(File);
+        fseek(File, 0, SEEK_SET);
+        
+        Result = (u8 *)malloc(*Size + 1);
+        if(Result && (fread(Result, 1, *Size, File) != *Size))
+        {
+            free(Result);
+            Result = 0;
+        }
+        
+        fclose(File);
+    }
+    
+    return Result;
+}
+
+static b32 WriteBenchFile(char const *FileName, u8 *Data, u32 Size)
+{
+    b32 Result = false;
+    
+    FILE *File = fopen(FileName, "wb");
+    if(File)
+    {
+        Result = (fwrite(Data, 1, Size, File) == Size);
+        Result = (fclose(File) == 0) && Result;
+    }
+    
+    return Result;
+}
+
+static b32 MachinesMatch(machine_state *A, machine_state *B)
+{
+    u32 Difference;
+    b32 Result = ((A->ClockCount == B->ClockCount) &&
+                  (memcmp(A->Registers, B->Registers, sizeof(A->Registers)) == 0) &&
+                  !FindFirstDifference(A->Memory, B->Memory, &Difference));
+    return Result;
+}
+
+#define BENCH_SNAPSHOT_FILE "sim86_bench.s86s"
+
+static b32 BenchSnapshots(void)
+{
+    // NOTE: Each program is stopped part way, saved, and restored into fresh memory. The
+    // restored machine then has to finish exactly the way the original one does. A snapshot
+    // that has been cut short, or isn't one, has to be turned away with nothing changed.
+    opcode_table *Opcodes = Get8086OpcodeTable();
+    bench_program *Programs[] = {&BenchPrograms[1], &BenchPrograms[3]};
+    
+    b32 Result = true;
+    for(u32 ProgramIndex = 0; Result && (ProgramIndex < ArrayCount(Programs)); ++ProgramIndex)
+    {
+        bench_program *Program = Programs[ProgramIndex];
+        
+        paged_memory OriginalMemory;
+        InitPagedMemory(&OriginalMemory, 20);
+        CopyToPagedMemory(&OriginalMemory, 0, Program->Size, Program->Code);
+        
+        machine_state Original = {};
+        Original.ProgramSize = Program->Size;
+        Original.Memory = &OriginalMemory;
+        
+        paged_memory RestoredMemory;
+        InitPagedMemory(&RestoredMemory, 20);
+        
+        machine_state Restored = {};
+        Restored.Memory = &RestoredMemory;
+        
+        Result = ((RunMachine(Opcodes, &Original, 100000) == MachineStop_None) &&
+                  SaveSnapshot(BENCH_SNAPSHOT_FILE, &Original) &&
+                  RestoreSnapshot(BENCH_SNAPSHOT_FILE, &Restored, &RestoredMemory) &&
+                  (Restored.ProgramSize == Original.ProgramSize) &&
+                  MachinesMatch(&Restored, &Original));
+        if(Result)
+        {
+            Result = ((RunMachine(Opcodes, &Original, 0) == MachineStop_EndOfProgram) &&
+                      (RunMachine(Opcodes, &Restored, 0) == MachineStop_EndOfProgram) &&
+                      MachinesMatch(&Restored, &Original));
+        }
+        
+        u32 Size = 0;
+        u8 *Snapshot = Result ? ReadBenchFile(BENCH_SNAPSHOT_FILE, &Size) : 0;
+        Result = (Snapshot != 0);
+        if(Result)
+        {
+            // NOTE: The restored memory reads its pages straight from the snapshot file, so it
+            // has to let go of it before the file can be rewritten.
+            ReleasePagedMemory(&RestoredMemory);
+            InitPagedMemory(&RestoredMemory, 20);
+            machine_state Before = Restored;
+            
+            // NOTE: Missing the end of the last page, missing most of the header, and a bad magic.
+            u32 ShortSizes[] = {Size - MEMORY_PAGE_SIZE/2, (u32)sizeof(snapshot_header)/2};
+            for(u32 ShortIndex = 0; Result && (ShortIndex < ArrayCount(ShortSizes)); ++ShortIndex)
+            {
+                Result = (WriteBenchFile(BENCH_SNAPSHOT_FILE, Snapshot, ShortSizes[ShortIndex]) &&
+                          !RestoreSnapshot(BENCH_SNAPSHOT_FILE, &Restored, &RestoredMemory));
+            }
+            
+            Snapshot[0] ^= 0xff;
+            Result = (Result &&
+                      WriteBenchFile(BENCH_SNAPSHOT_FILE, Snapshot, Size) &&
+                      !RestoreSnapshot(BENCH_SNAPSHOT_FILE, &Restored, &RestoredMemory) &&
+                      (Restored.Memory == &RestoredMemory) && MachinesMatch(&Restored, &Before));
+            
+            free(Snapshot);
+        }
+        
+        if(!Result)
+        {
+            fprintf(stderr, "ERROR: %s does not survive a snapshot.\n", Program->Label);
+        }
+        
+        ReleasePagedMemory(&RestoredMemory);
+        ReleasePagedMemory(&OriginalMemory);
+        remove(BENCH_SNAPSHOT_FILE);
+    }
+    
+    return Result;
+}
+
+#define BENCH_DUMP_FILE "sim86_bench.s86d"
+
+static b32 BenchSparseDumps(void)
+{
+    // NOTE: The memory loop is run twice: once on fresh memory, whose dirty pages are then its
+    // whole image, and once on memory cleaned after loading the program, whose dirty pages are
+    // just what the run wrote. The first dump has to load into fresh memory as an exact copy,
+    // and the second has to replay onto a clone of the cleaned memory as one.
+    opcode_table *Opcodes = Get8086OpcodeTable();
+    bench_program *Program = &BenchPrograms[1];
+    
+    paged_memory FreshMemory;
+    InitPagedMemory(&FreshMemory, 20);
+    CopyToPagedMemory(&FreshMemory, 0, Program->Size, Program->Code);
+    
+    paged_memory CleanedMemory;
+    InitPagedMemory(&CleanedMemory, 20);
+    CopyToPagedMemory(&CleanedMemory, 0, Program->Size, Program->Code);
+    ClearDirtyPages(&CleanedMemory);
+    
+    paged_memory Replayed;
+    ClonePagedMemory(&CleanedMemory, &Replayed);
+    
+    paged_memory Loaded;
+    InitPagedMemory(&Loaded, 20);
+    
+    machine_state Fresh = {};
+    Fresh.ProgramSize = Program->Size;
+    Fresh.Memory = &FreshMemory;
+    
+    machine_state Cleaned = Fresh;
+    Cleaned.Memory = &CleanedMemory;
+    
+    u32 Difference;
+    b32 Result = ((RunMachine(Opcodes, &Fresh, 0) == MachineStop_EndOfProgram) &&
+                  (RunMachine(Opcodes, &Cleaned, 0) == MachineStop_EndOfProgram) &&
+                  WriteSparseDump(BENCH_DUMP_FILE, &FreshMemory, FreshMemory.DirtyPages) &&
+                  LoadSparseDump(BENCH_DUMP_FILE, &Loaded) &&
+                  !FindFirstDifference(&Loaded, &FreshMemory, &Difference));
+    
+    // NOTE: The program's code was never written, so it isn't in the second dump - on its own,
+    // that dump is not the whole image.
+    ReleasePagedMemory(&Loaded);
+    InitPagedMemory(&Loaded, 20);
+    Result = (Result &&
+              WriteSparseDump(BENCH_DUMP_FILE, &CleanedMemory, CleanedMemory.DirtyPages) &&
+              LoadSparseDump(BENCH_DUMP_FILE, &Replayed) &&
+              !FindFirstDifference(&Replayed, &CleanedMemory, &Difference) &&
+              LoadSparseDump(BENCH_DUMP_FILE, &Loaded) &&
+              FindFirstDifference(&Loaded, &CleanedMemory, &Difference) &&
+              (Difference < Program->Size));
+    
+    // NOTE: A dump that has been cut short, or isn't one, has to leave the memory alone.
+    u32 Size = 0;
+    u8 *Dump = Result ? ReadBenchFile(BENCH_DUMP_FILE, &Size) : 0;
+    Result = (Dump != 0);
+    if(Result)
+    {
+        ReleasePagedMemory(&Loaded);
+        InitPagedMemory(&Loaded, 20);
+        
+        Result = (WriteBenchFile(BENCH_DUMP_FILE, Dump, Size - MEMORY_PAGE_SIZE/2) &&
+                  !LoadSparseDump(BENCH_DUMP_FILE, &Loaded));
+        
+        Dump[0] ^= 0xff;
+        Result = (Result &&
+                  WriteBenchFile(BENCH_DUMP_FILE, Dump, Size) &&
+                  !LoadSparseDump(BENCH_DUMP_FILE, &Loaded) &&
+                  (GetResidentPages(&Loaded) == 0));
+        
+        free(Dump);
+    }
+    
+    if(!Result)
+    {
+        fprintf(stderr, "ERROR: Sparse dumps of the %s do not load back.\n", Program->Label);
+    }
+    
+    ReleasePagedMemory(&Loaded);
+    ReleasePagedMemory(&Replayed);
+    ReleasePagedMemory(&CleanedMemory);
+    ReleasePagedMemory(&FreshMemory);
+    remove(BENCH_DUMP_FILE);
+    
+    return Result;
+}
+
+#define BENCH_S86I_FILE "sim86_bench.s86i"
+
+static b32 S86iMatchesDecode(s86i_view *View, instruction *Decoded, decode_block_result Decode, u32 SourceSize)
+{
+    // NOTE: Every record has to unpack to what DecodeBlock gives, every address has to look up
+    // the record that starts there (or nothing), and the strings have to be the ones the
+    // disassembler prints.
+    b32 Result = ((View->InstructionCount == Decode.InstructionCount) &&
+                  (View->Header->StopReason == Decode.StopReason) &&
+                  (View->Header->SourceSize == SourceSize));
+    for(u32 Index = 0; Result && (Index < View->InstructionCount); ++Index)
+    {
+        instruction Unpacked = UnpackInstruction(View->Instructions[Index]);
+        Result = ((memcmp(&Unpacked, &Decoded[Index], sizeof(instruction)) == 0) &&
+                  (strcmp(GetS86iMnemonic(View, Unpacked.Op), GetMnemonic(Unpacked.Op)) == 0));
+    }
+    
+    u32 NextIndex = 0;
+    for(u32 Address = 0; Result && (Address < (SourceSize + S86I_INDEX_GRANULARITY)); ++Address)
+    {
+        u32 Expected = S86I_NOT_FOUND;
+        if((NextIndex < Decode.InstructionCount) && (Decoded[NextIndex].Address == Address))
+        {
+            Expected = NextIndex++;
+        }
+        Result = (FindS86iInstruction(View, Address) == Expected);
+    }
+    
+    for(u32 RegIndex = 0; Result && (RegIndex < (View->Header->RegisterNameCount / 3)); ++RegIndex)
+    {
+        for(u32 Form = 0; Result && (Form < 3); ++Form)
+        {
+            register_access Reg = {RegIndex, Form & 1, (Form == 2) ? 2u : 1u};
+            Result = (strcmp(GetS86iRegisterName(View, Reg), GetRegName(Reg)) == 0);
+        }
+    }
+    
+    return Result;
+}
+
+static b32 RoundTripsThroughS86i(bench_listing *Listing, instruction *Decoded)
+{
+    // NOTE: The listing is written out as a .s86i, mapped back in, and checked against
+    // DecodeBlock. Cut short anywhere, the same file has to be turned away when it is mapped.
+    decode_source Source = ListingSource(Listing);
+    decode_block_result Decode = DecodeBlock(Get8086OpcodeTable(), Source, 0, Source.Size, Decoded);
+    
+    b32 Result = false;
+    FILE *Dest = fopen(BENCH_S86I_FILE, "wb");
+    if(Dest)
+    {
+        u32 InstructionCount = 0;
+        Result = WriteS86iFile(Dest, Source, &InstructionCount);
+        Result = (fclose(Dest) == 0) && Result && (InstructionCount == Decode.InstructionCount);
+    }
+    
+    mapped_file File = {};
+    s86i_view View;
+    Result = (Result &&
+              MapFileReadOnly(BENCH_S86I_FILE, &File) &&
+              GetS86iView(File.Data, File.Size, &View) &&
+              S86iMatchesDecode(&View, Decoded, Decode, Source.Size));
+    
+    u32 Size = 0;
+    u8 *S86i = Result ? ReadBenchFile(BENCH_S86I_FILE, &Size) : 0;
+    Result = (S86i != 0);
+    if(Result)
+    {
+        // NOTE: Missing the last string's terminator, missing the whole last section, and
+        // missing the end of the header.
+        u32 ShortSizes[] = {Size - 1, (u32)View.Header->RegisterNames.Offset, (u32)sizeof(s86i_header) - 1};
+        UnmapFile(&File);
+        
+        for(u32 ShortIndex = 0; Result && (ShortIndex < ArrayCount(ShortSizes)); ++ShortIndex)
+        {
+            Result = (WriteBenchFile(BENCH_S86I_FILE, S86i, ShortSizes[ShortIndex]) &&
+                      MapFileReadOnly(BENCH_S86I_FILE, &File) &&
+                      !GetS86iView(File.Data, File.Size, &View));
+            UnmapFile(&File);
+        }
+        
+        free(S86i);
+    }
+    else
+    {
+        UnmapFile(&File);
+    }
+    
+    if(!Result)
+    {
+        fprintf(stderr, "ERROR: %s does not round-trip through .s86i.\n", Listing->FileName);
+    }
+    
+    remove(BENCH_S86I_FILE);
+    
+    return Result;
+}
+
+// NOTE: The listings are far too small to show what the boundary scan does on a whole image, so it
+// is also run over a megabyte of random (but valid) instructions, and checked against a full
+// decode of the same bytes - including where, and why, all three stop.
+#define BENCH_SCAN_SIZE (1024*1024)
+
+typedef decode_block_result bench_scan_func(length_table *Lengths, decode_source Source, u64 *Bitmap);
+
+static bench_scan_func *BenchScanFuncs[] = {ScanInstructionBoundaries, WalkInstructionBoundaries};
+static char const *BenchScanLabels[] = {"boundary scan", "boundary walk"};
+
+static u32 WriteRandomInstructions(length_table *Lengths, u8 *Dest, u32 Size)
+{
+    // NOTE: Random bytes are rerolled until they start a valid instruction, so prefixes and
+    // every irregular opcode row turn up as often as chance has them. Returns the offset of
+    // the last instruction start.
+    u32 State = 0x2545f491;
+    u32 Offset = 0;
+    u32 LastStart = 0;
+    while((Offset + Lengths->MaxInstructionByteCount) <= Size)
+    {
+        decode_source Source = {Dest + Offset, Lengths->MaxInstructionByteCount};
+        u32 Length;
+        do
+        {
+            for(u32 Index = 0; Index < Source.Size; ++Index)
+            {
+                Source.Bytes[Index] = (u8)(NextBenchRandom(&State) >> 24);
+            }
+            Length = GetInstructionLength(Lengths, Source, 0);
+        } while(Length > Source.Size);
+        
+        LastStart = Offset;
+        Offset += Length;
+    }
+    
+    // NOTE: What is left becomes zeros, which is add [bx + si], al.
+    memset(Dest + Offset, 0, Size - Offset);
+    
+    return LastStart;
+}
+
+static b32 ScansMatchDecode(char const *Label, decode_source Source, instruction *Decoded, u64 *Expected, u64 *Bitmap)
+{
+    u32 BitmapSize = ((Source.Size + 63) / 64)*sizeof(u64);
+    
+    decode_block_result Reference = DecodeBlock(Get8086OpcodeTable(), Source, 0, Source.Size, Decoded);
+    memset(Expected, 0, BitmapSize);
+    for(u32 Index = 0; Index < Reference.InstructionCount; ++Index)
+    {
+        u32 Offset = Decoded[Index].Address;
+        Expected[Offset / 64] |= (1ull << (Offset % 64));
+    }
+    
+    b32 Result = true;
+    for(u32 ScanIndex = 0; ScanIndex < ArrayCount(BenchScanFuncs); ++ScanIndex)
+    {
+        memset(Bitmap, 0, BitmapSize);
+        decode_block_result Scan = BenchScanFuncs[ScanIndex](Get8086LengthTable(), Source, Bitmap);
+        if((Scan.InstructionCount != Reference.InstructionCount) || (Scan.BytesDecoded != Reference.BytesDecoded) ||
+           (Scan.StopReason != Reference.StopReason) || (memcmp(Bitmap, Expected, BitmapSize) != 0))
+        {
+            fprintf(stderr, "ERROR: \"%s\" of %s does not match the reference decoder.\n", BenchScanLabels[ScanIndex], Label);
+            Result = false;
+        }
+    }
+    
+    return Result;
+}
+
+static b32 BenchBoundaryScan(void)
+{
+    length_table *Lengths = Get8086LengthTable();
+    
+    u8 *Bytes = (u8 *)malloc(BENCH_SCAN_SIZE);
+    instruction *Decoded = (instruction *)malloc(BENCH_SCAN_SIZE*sizeof(instruction));
+    u64 *Expected = (u64 *)malloc(BENCH_SCAN_SIZE / 8);
+    u64 *Bitmap = (u64 *)malloc(BENCH_SCAN_SIZE / 8);
+    
+    u32 LastStart = WriteRandomInstructions(Lengths, Bytes, BENCH_SCAN_SIZE);
+    decode_source Source = {Bytes, BENCH_SCAN_SIZE};
+    
+    // NOTE: As well as the whole image, the scans have to stop in the same place as the decoder
+    // when the source ends part way through an instruction, and when it hits an invalid one.
+    decode_source Truncated = {Bytes, LastStart + 1};
+    b32 Result = (ScansMatchDecode("random instructions", Source, Decoded, Expected, Bitmap) &&
+                  ScansMatchDecode("truncated random instructions", Truncated, Decoded, Expected, Bitmap));
+    
+    u32 InvalidByte = 0;
+    while(Lengths->FirstByte[InvalidByte] != Length_Invalid)
+    {
+        ++InvalidByte;
+    }
+    u32 InvalidAt = 3*BENCH_SCAN_SIZE / 4;
+    while(!(Expected[InvalidAt / 64] & (1ull << (InvalidAt % 64))))
+    {
+        ++InvalidAt;
+    }
+    u8 Replaced = Bytes[InvalidAt];
+    Bytes[InvalidAt] = (u8)InvalidByte;
+    Result = ScansMatchDecode("random instructions with an invalid one", Source, Decoded, Expected, Bitmap) && Result;
+    Bytes[InvalidAt] = Replaced;
+    
+    if(Result)
+    {
+        printf("Boundary scan (%u KB of random instructions%s):\n", BENCH_SCAN_SIZE / 1024,
+               Lengths->UseAVX2 ? ", AVX2" : "");
+        
+        bench_result Baseline = {};
+        u64 MinTicks = (u64)(MinSecondsPerTest * (f64)GetOSTimerFreq());
+        while(Baseline.Ticks < MinTicks)
+        {
+            u64 Start = ReadOSTimer();
+            decode_block_result Decode = DecodeCompactBlock(Get8086OpcodeTable(), Source, 0, BENCH_SCAN_SIZE, (compact_instruction *)Decoded);
+            Baseline.Ticks += ReadOSTimer() - Start;
+            
+            Baseline.ByteCount += Decode.BytesDecoded;
+            Baseline.InstructionCount += Decode.InstructionCount;
+        }
+        PrintResult("block, compact", Baseline, bench_result{});
+        
+        for(u32 ScanIndex = 0; ScanIndex < ArrayCount(BenchScanFuncs); ++ScanIndex)
+        {
+            bench_result Scan = {};
+            while(Scan.Ticks < MinTicks)
+            {
+                u64 Start = ReadOSTimer();
+                memset(Bitmap, 0, BENCH_SCAN_SIZE / 8);
+                decode_block_result Boundaries = BenchScanFuncs[ScanIndex](Lengths, Source, Bitmap);
+                Scan.Ticks += ReadOSTimer() - Start;
+                
+                Scan.ByteCount += Boundaries.BytesDecoded;
+                Scan.InstructionCount += Boundaries.InstructionCount;
+            }
+            PrintResult(BenchScanLabels[ScanIndex], Scan, Baseline);
+        }
+    }
+    
+    free(Bitmap);
+    free(Expected);
+    free(Decoded);
+    free(Bytes);
+    
+    return Result;
+}
+
+int main(int ArgCount, char **Args)
+{
+    if(ArgCount < 2)
+    {
+        fprintf(stderr, "USAGE: %s [8086 machine code file] ...\n", Args[0]);
+        return 1;
+    }
+
+    printf("Memory per decoded instruction: instruction %u bytes, compact_instruction %u bytes\n",
+           (u32)sizeof(instruction), (u32)sizeof(compact_instruction));
+
+    b32 AllMatched = BenchOperandStage();
+    AllMatched = BenchMemoryTraffic() && AllMatched;
+    AllMatched = BenchPagedMachines() && AllMatched;
+    AllMatched = BenchFanout() && AllMatched;
+    AllMatched = BenchExecution() && AllMatched;
+    AllMatched = BenchStepResults() && AllMatched;
+    AllMatched = BenchSnapshots() && AllMatched;
+    AllMatched = BenchSparseDumps() && AllMatched;
+    AllMatched = BenchBoundaryScan() && AllMatched;
+    bench_result Totals[ArrayCount(BenchPaths)] = {};
+
+    for(int ArgIndex = 1; ArgIndex < ArgCount; ++ArgIndex)
+    {
+        bench_listing Listing;
+        if(LoadListing(Args[ArgIndex], &Listing))
+        {
+            void *Scratch = calloc(Listing.ByteCount + 1, sizeof(instruction));
+
+            b32 Matched = (RoundTripsThroughCompact(&Listing) && RoundTripsThroughS86i(&Listing, (instruction *)Scratch));
+            for(u32 PathIndex = 0; Matched && (PathIndex < ArrayCount(BenchPaths)); ++PathIndex)
+            {
+                bench_path *Path = &BenchPaths[PathIndex];
+                if(Path->DestStride)
+                {
+                    u32 Count = Path->Decode(&Listing, Scratch);
+                    Matched = MatchesReference(&Listing, Path, Count, Scratch);
+                }
+                else
+                {
+                    Matched = MatchesBoundaries(&Listing, Path, (u64 *)Scratch);
+                }
+            }
+
+            if(Matched)
+            {
+                printf("%s: %u bytes, %u instructions (decoded: %u bytes wide, %u bytes compact)\n",
+                       Listing.FileName, Listing.ByteCount, Listing.InstructionCount,
+                       Listing.InstructionCount*(u32)sizeof(instruction), Listing.InstructionCount*(u32)sizeof(compact_instruction));
+
+                bench_result Baseline = {};
+                for(u32 PathIndex = 0; PathIndex < ArrayCount(BenchPaths); ++PathIndex)
+                {
+                    bench_path *Path = &BenchPaths[PathIndex];
+                    bench_result Result = TimeDecode(Path, &Listing, Scratch);
+                    PrintResult(Path->Label, Result, Baseline);
+                    Accumulate(&Totals[PathIndex], Result);
+
+                    if(PathIndex == 0)
+                    {
+                        Baseline = Result;
+                    }
+                }
+            }
+            else
+            {
+                AllMatched = false;
+            }
+
+            free(Scratch);
+            free(Listing.Reference);
+            free(Listing.Memory.Memory);
+            ReleasePagedMemory(&Listing.PagedMemory);
+        }
+    }
+
+    if(Totals[0].Ticks)
+    {
+        printf("All listings:\n");
+        for(u32 PathIndex = 0; PathIndex < ArrayCount(BenchPaths); ++PathIndex)
+        {
+            PrintResult(BenchPaths[PathIndex].Label, Totals[PathIndex], PathIndex ? Totals[0] : bench_result{});
+        }
+    }
+
+    return AllMatched ? 0 : 1;
+}
@@ -0,0 +1,377 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+/* NOTE: Recursive traversal. Instead of decoding every byte in order, decoding starts at the
+   entry points and follows the code: direct jump, call, and loop targets (the ones with a
+   Immediate_RelativeJumpDisplacement operand) are queued, and a run of instructions stops at
+   any unconditional transfer. Bytes that are never reached are never decoded, so data mixed
+   in with the code doesn't turn into garbage instructions.
+   
+   Every reachable instruction is decoded exactly once: the Starts bitmap says where decoding
+   has already been, and a run that reaches an instruction it has seen before just stops.
+   Basic blocks are only worked out at the end, once the instructions are sorted by address,
+   so a branch into the middle of an existing run costs nothing more than a leader bit.
+   
+   Memory is the four bitmaps (half a byte per source byte), plus one compact_instruction per
+   reachable instruction, plus the worklist, which only ever holds each leader once.
+*/
+
+static b32 IsBitSet(u64 *Bits, u32 Index)
+{
+    b32 Result = ((Bits[Index / 64] >> (Index % 64)) & 1);
+    return Result;
+}
+
+static void SetBit(u64 *Bits, u32 Index)
+{
+    Bits[Index / 64] |= (1ull << (Index % 64));
+}
+
+static b32 GetRelativeTarget(instruction Instruction, s64 *Target)
+{
+    b32 Result = false;
+    for(u32 OperandIndex = 0; OperandIndex < ArrayCount(Instruction.Operands); ++OperandIndex)
+    {
+        instruction_operand Operand = Instruction.Operands[OperandIndex];
+        if((Operand.Type == Operand_Immediate) && (Operand.Immediate.Flags & Immediate_RelativeJumpDisplacement))
+        {
+            *Target = (s64)Instruction.Address + Instruction.Size + Operand.Immediate.Value;
+            Result = true;
+        }
+    }
+    
+    return Result;
+}
+
+static b32 EndsBlock(instruction Instruction)
+{
+    // NOTE: Anything that can transfer control ends a block - conditional jumps and loops
+    // (which all have a relative displacement), plus calls, returns, interrupts, and hlt.
+    s64 Target = 0;
+    b32 Result = (GetRelativeTarget(Instruction, &Target) ||
+                  (Instruction.Op == Op_jmp) || (Instruction.Op == Op_call) ||
+                  (Instruction.Op == Op_ret) || (Instruction.Op == Op_retf) ||
+                  (Instruction.Op == Op_int) || (Instruction.Op == Op_int3) ||
+                  (Instruction.Op == Op_into) || (Instruction.Op == Op_iret) ||
+                  (Instruction.Op == Op_hlt));
+    return Result;
+}
+
+static b32 FallsThrough(instruction Instruction)
+{
+    b32 Result = ((Instruction.Op != Op_jmp) &&
+                  (Instruction.Op != Op_ret) && (Instruction.Op != Op_retf) &&
+                  (Instruction.Op != Op_iret) && (Instruction.Op != Op_hlt));
+    return Result;
+}
+
+struct cfg_worklist
+{
+    u32 Count;
+    u32 Capacity;
+    u32 *Offsets;
+};
+
+static b32 Reserve(void **Array, u32 *Capacity, u32 Needed, u32 ElementSize)
+{
+    b32 Result = true;
+    if(Needed > *Capacity)
+    {
+        u32 NewCapacity = *Capacity ? (*Capacity * 2) : 1024;
+        if(NewCapacity < Needed)
+        {
+            NewCapacity = Needed;
+        }
+        
+        void *NewArray = realloc(*Array, (size_t)NewCapacity*ElementSize);
+        if(NewArray)
+        {
+            *Array = NewArray;
+            *Capacity = NewCapacity;
+        }
+        else
+        {
+            Result = false;
+        }
+    }
+    
+    return Result;
+}
+
+static b32 QueueTarget(control_flow_graph *Graph, cfg_worklist *Worklist, s64 Target)
+{
+    b32 Result = true;
+    
+    if((Target < 0) || (Target >= Graph->Source.Size))
+    {
+        ++Graph->ExternalTargetCount;
+    }
+    else if(!IsBitSet(Graph->Leaders, (u32)Target))
+    {
+        SetBit(Graph->Leaders, (u32)Target);
+        Result = Reserve((void **)&Worklist->Offsets, &Worklist->Capacity, Worklist->Count + 1, sizeof(u32));
+        if(Result)
+        {
+            Worklist->Offsets[Worklist->Count++] = (u32)Target;
+        }
+    }
+    
+    return Result;
+}
+
+static b32 DecodeRun(control_flow_graph *Graph, opcode_table *Opcodes, cfg_worklist *Worklist, u32 Offset)
+{
+    b32 Result = true;
+    
+    decode_source Source = Graph->Source;
+    while(Result && (Offset < Source.Size) && !IsBitSet(Graph->Starts, Offset))
+    {
+        instruction Instruction;
+        decode_stop_reason StopReason;
+        if(IsBitSet(Graph->Covered, Offset))
+        {
+            ++Graph->ConflictCount;
+            break;
+        }
+        
+        if(!DecodeNext(Opcodes, Source, Offset, &Instruction, &StopReason))
+        {
+            SetBit(Graph->BadCode, Offset);
+            break;
+        }
+        
+        // NOTE: An instruction that would overlap one reached some other way isn't taken either -
+        // the output has to stay a single, reassemblable stream.
+        b32 Overlaps = false;
+        for(u32 ByteIndex = 1; ByteIndex < Instruction.Size; ++ByteIndex)
+        {
+            Overlaps = Overlaps || IsBitSet(Graph->Covered, Offset + ByteIndex);
+        }
+        
+        if(Overlaps)
+        {
+            ++Graph->ConflictCount;
+            break;
+        }
+        
+        Result = Reserve((void **)&Graph->Instructions, &Graph->InstructionCapacity,
+                         Graph->InstructionCount + 1, sizeof(compact_instruction));
+        if(Result)
+        {
+            SetBit(Graph->Starts, Offset);
+            for(u32 ByteIndex = 0; ByteIndex < Instruction.Size; ++ByteIndex)
+            {
+                SetBit(Graph->Covered, Offset + ByteIndex);
+            }
+            Graph->Instructions[Graph->InstructionCount++] = PackDecodedInstruction(Instruction);
+            
+            s64 Target = 0;
+            if(GetRelativeTarget(Instruction, &Target))
+            {
+                Result = QueueTarget(Graph, Worklist, Target);
+            }
+            
+            Offset += Instruction.Size;
+            if(EndsBlock(Instruction))
+            {
+                // NOTE: The fall-through of a call or conditional branch is queued like any other
+                // target, so it starts its own block.
+                if(Result && FallsThrough(Instruction))
+                {
+                    Result = QueueTarget(Graph, Worklist, Offset);
+                }
+                break;
+            }
+        }
+    }
+    
+    return Result;
+}
+
+static int CompareInstructionAddresses(void const *A, void const *B)
+{
+    u32 AddressA = ((compact_instruction const *)A)->Address;
+    u32 AddressB = ((compact_instruction const *)B)->Address;
+    int Result = (AddressA < AddressB) ? -1 : ((AddressA > AddressB) ? 1 : 0);
+    return Result;
+}
+
+static cfg_block *FindBlock(control_flow_graph *Graph, u32 Start)
+{
+    cfg_block *Result = 0;
+    
+    u32 Low = 0;
+    u32 High = Graph->BlockCount;
+    while(Low < High)
+    {
+        u32 Middle = (Low + High) / 2;
+        if(Graph->Blocks[Middle].Start < Start)
+        {
+            Low = Middle + 1;
+        }
+        else
+        {
+            High = Middle;
+        }
+    }
+    
+    if((Low < Graph->BlockCount) && (Graph->Blocks[Low].Start == Start))
+    {
+        Result = &Graph->Blocks[Low];
+    }
+    
+    return Result;
+}
+
+static void FinishBlock(control_flow_graph *Graph, opcode_table *Opcodes, cfg_block *Block)
+{
+    instruction Last = UnpackInstruction(Graph->Instructions[Block->FirstInstruction + Block->InstructionCount - 1]);
+    
+    s64 Target = 0;
+    if(GetRelativeTarget(Last, &Target) && (Target >= 0) && (Target < Graph->Source.Size))
+    {
+        Block->Successors[Block->SuccessorCount++] = (u32)Target;
+    }
+    
+    if(!EndsBlock(Last) || FallsThrough(Last))
+    {
+        if(Block->End < Graph->Source.Size)
+        {
+            if(IsBitSet(Graph->BadCode, Block->End))
+            {
+                // NOTE: Only the reason gets decoded again here - nothing decodes there.
+                instruction Unused;
+                DecodeNext(Opcodes, Graph->Source, Block->End, &Unused, &Block->StopReason);
+                Block->Flags |= Block_EndsOnBadCode;
+            }
+            else if(IsBitSet(Graph->Starts, Block->End))
+            {
+                Block->Successors[Block->SuccessorCount++] = Block->End;
+                Block->Flags |= Block_FallsThrough;
+            }
+        }
+    }
+}
+
+static control_flow_graph BuildControlFlowGraph(decode_source Source, u32 EntryPointCount, u32 *EntryPoints)
+{
+    control_flow_graph Result = {};
+    Result.Source = Source;
+    
+    opcode_table *Opcodes = Get8086OpcodeTable();
+    
+    size_t BitmapCount = (Source.Size + 63) / 64 + 1;
+    Result.Starts = (u64 *)calloc(BitmapCount, sizeof(u64));
+    Result.Covered = (u64 *)calloc(BitmapCount, sizeof(u64));
+    Result.Leaders = (u64 *)calloc(BitmapCount, sizeof(u64));
+    Result.BadCode = (u64 *)calloc(BitmapCount, sizeof(u64));
+    b32 Valid = (Result.Starts && Result.Covered && Result.Leaders && Result.BadCode);
+    
+    cfg_worklist Worklist = {};
+    for(u32 EntryIndex = 0; Valid && (EntryIndex < EntryPointCount); ++EntryIndex)
+    {
+        Valid = QueueTarget(&Result, &Worklist, EntryPoints[EntryIndex]);
+    }
+    
+    // NOTE: The worklist is a stack, so the most recently queued target - usually the fall-through
+    // of the branch just decoded - is decoded next, which keeps decoding roughly in address order.
+    while(Valid && Worklist.Count)
+    {
+        Valid = DecodeRun(&Result, Opcodes, &Worklist, Worklist.Offsets[--Worklist.Count]);
+    }
+    free(Worklist.Offsets);
+    
+    if(Valid && Result.InstructionCount)
+    {
+        qsort(Result.Instructions, Result.InstructionCount, sizeof(compact_instruction), CompareInstructionAddresses);
+        
+        Result.Blocks = (cfg_block *)calloc(Result.InstructionCount, sizeof(cfg_block));
+        Valid = (Result.Blocks != 0);
+    }
+    
+    if(Valid && Result.InstructionCount)
+    {
+        cfg_block *Block = 0;
+        for(u32 InstructionIndex = 0; InstructionIndex < Result.InstructionCount; ++InstructionIndex)
+        {
+            instruction Instruction = UnpackInstruction(Result.Instructions[InstructionIndex]);
+            
+            if(!Block || (Block->End != Instruction.Address) || IsBitSet(Result.Leaders, Instruction.Address) ||
+               EndsBlock(UnpackInstruction(Result.Instructions[InstructionIndex - 1])))
+            {
+                if(Block)
+                {
+                    FinishBlock(&Result, Opcodes, Block);
+                }
+                
+                Block = &Result.Blocks[Result.BlockCount++];
+                Block->Start = Instruction.Address;
+                Block->FirstInstruction = InstructionIndex;
+            }
+            
+            Block->End = Instruction.Address + Instruction.Size;
+            ++Block->InstructionCount;
+        }
+        FinishBlock(&Result, Opcodes, Block);
+        
+        for(u32 BlockIndex = 0; BlockIndex < Result.BlockCount; ++BlockIndex)
+        {
+            cfg_block *Block = &Result.Blocks[BlockIndex];
+            instruction Last = UnpackInstruction(Result.Instructions[Block->FirstInstruction + Block->InstructionCount - 1]);
+            
+            s64 Target = 0;
+            if(GetRelativeTarget(Last, &Target) && (Target >= 0) && (Target < Source.Size))
+            {
+                cfg_block *TargetBlock = FindBlock(&Result, (u32)Target);
+                if(TargetBlock)
+                {
+                    TargetBlock->Flags |= Block_BranchTarget;
+                }
+            }
+        }
+        
+        for(u32 EntryIndex = 0; EntryIndex < EntryPointCount; ++EntryIndex)
+        {
+            cfg_block *Entry = FindBlock(&Result, EntryPoints[EntryIndex]);
+            if(Entry)
+            {
+                Entry->Flags |= Block_EntryPoint;
+            }
+        }
+    }
+    
+    if(!Valid)
+    {
+        FreeControlFlowGraph(&Result);
+    }
+    
+    return Result;
+}
+
+static b32 IsValid(control_flow_graph *Graph)
+{
+    b32 Result = (Graph->Starts != 0);
+    return Result;
+}
+
+static void FreeControlFlowGraph(control_flow_graph *Graph)
+{
+    free(Graph->Starts);
+    free(Graph->Covered);
+    free(Graph->Leaders);
+    free(Graph->BadCode);
+    free(Graph->Instructions);
+    free(Graph->Blocks);
+    
+    *Graph = {};
+}
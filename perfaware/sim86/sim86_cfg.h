@@ -0,0 +1,65 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+#define CFG_MAX_ENTRY_POINTS 16
+
+enum cfg_block_flag : u32
+{
+    Block_EntryPoint = 0x1, // NOTE: One of the entry points passed to BuildControlFlowGraph starts here
+    Block_BranchTarget = 0x2, // NOTE: Some jump, call, or loop in the image targets this block
+    Block_FallsThrough = 0x4, // NOTE: Execution can continue straight into the next block
+    Block_EndsOnBadCode = 0x8, // NOTE: The bytes after the last instruction don't decode (see StopReason)
+};
+
+struct cfg_block
+{
+    u32 Start;
+    u32 End;
+    u32 Flags;
+    decode_stop_reason StopReason;
+    
+    u32 FirstInstruction;
+    u32 InstructionCount;
+    
+    // NOTE: The taken branch target first, if there is a known one, then the fall-through.
+    u32 SuccessorCount;
+    u32 Successors[2];
+};
+
+struct control_flow_graph
+{
+    decode_source Source;
+    
+    // NOTE: One bit per source byte each.
+    u64 *Starts; // NOTE: An instruction that was reached starts here
+    u64 *Covered; // NOTE: This byte is part of an instruction that was reached
+    u64 *Leaders; // NOTE: A block starts here (entry points and branch targets)
+    u64 *BadCode; // NOTE: Reached, but doesn't decode
+    
+    // NOTE: Every reachable instruction, decoded once, in address order.
+    u32 InstructionCount;
+    u32 InstructionCapacity;
+    compact_instruction *Instructions;
+    
+    u32 BlockCount;
+    cfg_block *Blocks;
+    
+    // NOTE: Targets that land inside an instruction reached some other way, and targets that
+    // point outside the source. Neither is followed.
+    u32 ConflictCount;
+    u32 ExternalTargetCount;
+};
+
+static control_flow_graph BuildControlFlowGraph(decode_source Source, u32 EntryPointCount, u32 *EntryPoints);
+static b32 IsValid(control_flow_graph *Graph);
+static void FreeControlFlowGraph(control_flow_graph *Graph);
@@ -0,0 +1,423 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+struct clock_table_entry
+{
+    operation_type Op;
+    clock_form Form;
+    u8 ByteClocks;
+    u8 WordClocks;
+    u8 Transfers;
+    u8 Extra;
+};
+
+// NOTE: Straight from the manual's instruction timings, leaving out effective address
+// calculation, which is added separately. The arithmetic and logic group, the shifts and
+// rotates, and the conditional jumps are only listed once each (as add, shl and jo), since
+// every operation in the group has the same timings.
+static clock_table_entry const ClockTableEntries[] =
+{
+    // NOTE: Op, form, byte clocks, word clocks, memory transfers, extra clocks
+    {Op_mov, ClockForm_RegReg, 2, 2, 0, 0},
+    {Op_mov, ClockForm_RegMem, 8, 8, 1, 0},
+    {Op_mov, ClockForm_MemReg, 9, 9, 1, 0},
+    {Op_mov, ClockForm_RegImm, 4, 4, 0, 0},
+    {Op_mov, ClockForm_MemImm, 10, 10, 1, 0},
+    {Op_mov, ClockForm_AccMem, 10, 10, 1, 0},
+    {Op_mov, ClockForm_MemAcc, 10, 10, 1, 0},
+    
+    {Op_push, ClockForm_Reg, 11, 11, 0, 0},
+    {Op_push, ClockForm_Seg, 10, 10, 0, 0},
+    {Op_push, ClockForm_Mem, 16, 16, 1, 0},
+    {Op_pop, ClockForm_Reg, 8, 8, 0, 0},
+    {Op_pop, ClockForm_Seg, 8, 8, 0, 0},
+    {Op_pop, ClockForm_Mem, 17, 17, 1, 0},
+    {Op_pushf, ClockForm_None, 10, 10, 0, 0},
+    {Op_popf, ClockForm_None, 8, 8, 0, 0},
+    
+    {Op_xchg, ClockForm_RegReg, 4, 4, 0, 0},
+    {Op_xchg, ClockForm_AccReg, 4, 3, 0, 0},
+    {Op_xchg, ClockForm_RegMem, 17, 17, 2, 0},
+    {Op_xchg, ClockForm_MemReg, 17, 17, 2, 0},
+    
+    {Op_in, ClockForm_AccImm, 10, 10, 0, 0},
+    {Op_in, ClockForm_AccReg, 8, 8, 0, 0},
+    {Op_out, ClockForm_ImmAcc, 10, 10, 0, 0},
+    {Op_out, ClockForm_RegAcc, 8, 8, 0, 0},
+    
+    {Op_xlat, ClockForm_None, 11, 11, 0, 0},
+    {Op_lea, ClockForm_RegMem, 2, 2, 0, 0},
+    {Op_lds, ClockForm_RegMem, 16, 16, 2, 0},
+    {Op_les, ClockForm_RegMem, 16, 16, 2, 0},
+    {Op_lahf, ClockForm_None, 4, 4, 0, 0},
+    {Op_sahf, ClockForm_None, 4, 4, 0, 0},
+    
+    {Op_add, ClockForm_RegReg, 3, 3, 0, 0},
+    {Op_add, ClockForm_RegMem, 9, 9, 1, 0},
+    {Op_add, ClockForm_MemReg, 16, 16, 2, 0},
+    {Op_add, ClockForm_RegImm, 4, 4, 0, 0},
+    {Op_add, ClockForm_MemImm, 17, 17, 2, 0},
+    {Op_add, ClockForm_AccImm, 4, 4, 0, 0},
+    
+    {Op_cmp, ClockForm_RegReg, 3, 3, 0, 0},
+    {Op_cmp, ClockForm_RegMem, 9, 9, 1, 0},
+    {Op_cmp, ClockForm_MemReg, 9, 9, 1, 0},
+    {Op_cmp, ClockForm_RegImm, 4, 4, 0, 0},
+    {Op_cmp, ClockForm_MemImm, 10, 10, 1, 0},
+    {Op_cmp, ClockForm_AccImm, 4, 4, 0, 0},
+    
+    {Op_test, ClockForm_RegReg, 3, 3, 0, 0},
+    {Op_test, ClockForm_RegMem, 9, 9, 1, 0},
+    {Op_test, ClockForm_MemReg, 9, 9, 1, 0},
+    {Op_test, ClockForm_RegImm, 5, 5, 0, 0},
+    {Op_test, ClockForm_MemImm, 11, 11, 1, 0},
+    {Op_test, ClockForm_AccImm, 4, 4, 0, 0},
+    
+    {Op_inc, ClockForm_Reg, 3, 2, 0, 0},
+    {Op_inc, ClockForm_Mem, 15, 15, 2, 0},
+    {Op_dec, ClockForm_Reg, 3, 2, 0, 0},
+    {Op_dec, ClockForm_Mem, 15, 15, 2, 0},
+    {Op_neg, ClockForm_Reg, 3, 3, 0, 0},
+    {Op_neg, ClockForm_Mem, 16, 16, 2, 0},
+    {Op_not, ClockForm_Reg, 3, 3, 0, 0},
+    {Op_not, ClockForm_Mem, 16, 16, 2, 0},
+    
+    {Op_aaa, ClockForm_None, 4, 4, 0, 0},
+    {Op_aas, ClockForm_None, 4, 4, 0, 0},
+    {Op_daa, ClockForm_None, 4, 4, 0, 0},
+    {Op_das, ClockForm_None, 4, 4, 0, 0},
+    {Op_aam, ClockForm_None, 83, 83, 0, 0},
+    {Op_aad, ClockForm_None, 60, 60, 0, 0},
+    {Op_cbw, ClockForm_None, 2, 2, 0, 0},
+    {Op_cwd, ClockForm_None, 5, 5, 0, 0},
+    
+    {Op_mul, ClockForm_Reg, 73, 125, 0, 0},
+    {Op_mul, ClockForm_Mem, 79, 131, 1, 0},
+    {Op_imul, ClockForm_Reg, 89, 141, 0, 0},
+    {Op_imul, ClockForm_Mem, 95, 147, 1, 0},
+    {Op_div, ClockForm_Reg, 85, 153, 0, 0},
+    {Op_div, ClockForm_Mem, 91, 159, 1, 0},
+    {Op_idiv, ClockForm_Reg, 106, 174, 0, 0},
+    {Op_idiv, ClockForm_Mem, 112, 180, 1, 0},
+    
+    // NOTE: By 1 is the immediate form, and by cl the register form.
+    {Op_shl, ClockForm_RegImm, 2, 2, 0, 0},
+    {Op_shl, ClockForm_RegReg, 8, 8, 0, 4},
+    {Op_shl, ClockForm_MemImm, 15, 15, 2, 0},
+    {Op_shl, ClockForm_MemReg, 20, 20, 2, 4},
+    
+    // NOTE: Memory transfers for these are worked out from si and di (see GetStringOddClocks).
+    {Op_movs, ClockForm_None, 18, 18, 0, 0},
+    {Op_movs, ClockForm_Repeat, 9, 9, 0, 17},
+    {Op_cmps, ClockForm_None, 22, 22, 0, 0},
+    {Op_cmps, ClockForm_Repeat, 9, 9, 0, 22},
+    {Op_scas, ClockForm_None, 15, 15, 0, 0},
+    {Op_scas, ClockForm_Repeat, 9, 9, 0, 15},
+    {Op_lods, ClockForm_None, 12, 12, 0, 0},
+    {Op_lods, ClockForm_Repeat, 9, 9, 0, 13},
+    {Op_stos, ClockForm_None, 11, 11, 0, 0},
+    {Op_stos, ClockForm_Repeat, 9, 9, 0, 10},
+    
+    {Op_call, ClockForm_Imm, 19, 19, 0, 0},
+    {Op_call, ClockForm_Reg, 16, 16, 0, 0},
+    {Op_call, ClockForm_Mem, 21, 21, 1, 0},
+    {Op_call, ClockForm_Far, 28, 28, 0, 0},
+    {Op_call, ClockForm_FarMem, 37, 37, 2, 0},
+    {Op_jmp, ClockForm_Imm, 15, 15, 0, 0},
+    {Op_jmp, ClockForm_Reg, 11, 11, 0, 0},
+    {Op_jmp, ClockForm_Mem, 18, 18, 1, 0},
+    {Op_jmp, ClockForm_Far, 15, 15, 0, 0},
+    {Op_jmp, ClockForm_FarMem, 24, 24, 2, 0},
+    {Op_ret, ClockForm_None, 8, 8, 0, 0},
+    {Op_ret, ClockForm_Imm, 12, 12, 0, 0},
+    {Op_retf, ClockForm_None, 18, 18, 0, 0},
+    {Op_retf, ClockForm_Imm, 17, 17, 0, 0},
+    
+    // NOTE: Not taken, then the extra when taken.
+    {Op_jo, ClockForm_Imm, 4, 4, 0, 12},
+    {Op_loop, ClockForm_Imm, 5, 5, 0, 12},
+    {Op_loopz, ClockForm_Imm, 6, 6, 0, 12},
+    {Op_loopnz, ClockForm_Imm, 5, 5, 0, 14},
+    {Op_jcxz, ClockForm_Imm, 6, 6, 0, 12},
+    {Op_into, ClockForm_None, 4, 4, 0, 49},
+    
+    {Op_int, ClockForm_Imm, 51, 51, 0, 0},
+    {Op_int3, ClockForm_None, 52, 52, 0, 0},
+    {Op_iret, ClockForm_None, 24, 24, 0, 0},
+    
+    {Op_clc, ClockForm_None, 2, 2, 0, 0},
+    {Op_cmc, ClockForm_None, 2, 2, 0, 0},
+    {Op_stc, ClockForm_None, 2, 2, 0, 0},
+    {Op_cld, ClockForm_None, 2, 2, 0, 0},
+    {Op_std, ClockForm_None, 2, 2, 0, 0},
+    {Op_cli, ClockForm_None, 2, 2, 0, 0},
+    {Op_sti, ClockForm_None, 2, 2, 0, 0},
+    {Op_hlt, ClockForm_None, 2, 2, 0, 0},
+    {Op_wait, ClockForm_None, 3, 3, 0, 0},
+    {Op_esc, ClockForm_RegImm, 2, 2, 0, 0},
+    {Op_esc, ClockForm_MemImm, 8, 8, 1, 0},
+    
+    // NOTE: Prefixes with nothing after them.
+    {Op_lock, ClockForm_None, 2, 2, 0, 0},
+    {Op_rep, ClockForm_None, 2, 2, 0, 0},
+    {Op_segment, ClockForm_None, 2, 2, 0, 0},
+};
+
+static void CopyClockTimings(clock_table *Table, operation_type From, u32 Count, operation_type const *To)
+{
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        memcpy(Table->Timings[To[Index]], Table->Timings[From], sizeof(Table->Timings[From]));
+    }
+}
+
+static b32 BuildClockTable(clock_table *Table)
+{
+    *Table = {};
+    for(u32 EntryIndex = 0; EntryIndex < ArrayCount(ClockTableEntries); ++EntryIndex)
+    {
+        clock_table_entry const *Entry = &ClockTableEntries[EntryIndex];
+        clock_timing *Timing = &Table->Timings[Entry->Op][Entry->Form];
+        Timing->Clocks[0] = Entry->ByteClocks;
+        Timing->Clocks[1] = Entry->WordClocks;
+        Timing->Transfers = Entry->Transfers;
+        Timing->Extra = Entry->Extra;
+    }
+    
+    static operation_type const Arithmetic[] = {Op_adc, Op_sub, Op_sbb, Op_and, Op_or, Op_xor};
+    static operation_type const Shifts[] = {Op_shr, Op_sar, Op_rol, Op_ror, Op_rcl, Op_rcr};
+    static operation_type const Jumps[] =
+    {
+        Op_jno, Op_jb, Op_jnb, Op_je, Op_jne, Op_jbe, Op_ja,
+        Op_js, Op_jns, Op_jp, Op_jnp, Op_jl, Op_jnl, Op_jle, Op_jg,
+    };
+    CopyClockTimings(Table, Op_add, ArrayCount(Arithmetic), Arithmetic);
+    CopyClockTimings(Table, Op_shl, ArrayCount(Shifts), Shifts);
+    CopyClockTimings(Table, Op_jo, ArrayCount(Jumps), Jumps);
+    
+    // NOTE: The accumulator forms of anything that has no short form cost the same as the
+    // register forms.
+    static u8 const ShortForms[][2] =
+    {
+        {ClockForm_AccReg, ClockForm_RegReg},
+        {ClockForm_RegAcc, ClockForm_RegReg},
+        {ClockForm_AccImm, ClockForm_RegImm},
+    };
+    for(u32 Op = 0; Op < Op_Count; ++Op)
+    {
+        for(u32 FormIndex = 0; FormIndex < ArrayCount(ShortForms); ++FormIndex)
+        {
+            clock_timing *Timing = &Table->Timings[Op][ShortForms[FormIndex][0]];
+            if(!Timing->Clocks[0])
+            {
+                *Timing = Table->Timings[Op][ShortForms[FormIndex][1]];
+            }
+        }
+    }
+    
+    return true;
+}
+
+static clock_table *Get8086ClockTable()
+{
+    // NOTE: Built once, the first time anyone asks for it, same as the opcode table.
+    static clock_table Table;
+    static b32 Built = BuildClockTable(&Table);
+    assert(Built);
+    
+    return &Table;
+}
+
+static b32 IsAccumulator(instruction_operand *Operand)
+{
+    b32 Result = ((Operand->Type == Operand_Register) && (Operand->Register.Index == Register_a) && (Operand->Register.Offset == 0));
+    return Result;
+}
+
+static clock_form GetClockForm(instruction *Instruction, u32 EncodingFlags, instruction_operand **Memory)
+{
+    instruction_operand *Dest = &Instruction->Operands[0];
+    instruction_operand *Source = &Instruction->Operands[1];
+    if(Dest->Type == Operand_None)
+    {
+        // NOTE: As in ExecuteInstruction, the short forms with the register in the opcode decode
+        // it into the second operand.
+        Dest = Source;
+        Source = &Instruction->Operands[0];
+    }
+    
+    *Memory = (Dest->Type == Operand_Memory) ? Dest : (Source->Type == Operand_Memory) ? Source : 0;
+    
+    // NOTE: The accumulator only gets the short form timings when the opcode implies it. With a
+    // mod reg r/m byte, it costs the same as any other register.
+    b32 Short = (EncodingFlags & Encoding_ShortForm);
+    
+    clock_form Result = ClockForm_None;
+    if(Dest->Type == Operand_None)
+    {
+        operation_type Op = Instruction->Op;
+        b32 String = ((Op == Op_movs) || (Op == Op_cmps) || (Op == Op_scas) || (Op == Op_lods) || (Op == Op_stos));
+        Result = (String && (Instruction->Flags & Inst_Rep)) ? ClockForm_Repeat : ClockForm_None;
+    }
+    else if(Source->Type == Operand_None)
+    {
+        switch(Dest->Type)
+        {
+            case Operand_Register:
+            {
+                u32 Index = Dest->Register.Index;
+                Result = ((Index >= Register_es) && (Index <= Register_ds)) ? ClockForm_Seg : ClockForm_Reg;
+            } break;
+            
+            case Operand_Memory:
+            {
+                Result = (Dest->Address.Flags & Address_ExplicitSegment) ? ClockForm_Far :
+                    (Instruction->Flags & Inst_Far) ? ClockForm_FarMem : ClockForm_Mem;
+            } break;
+            
+            case Operand_Immediate:
+            {
+                Result = ClockForm_Imm;
+            } break;
+            
+            default: {} break;
+        }
+    }
+    else if(Dest->Type == Operand_Register)
+    {
+        switch(Source->Type)
+        {
+            case Operand_Register:
+            {
+                Result = (Short && IsAccumulator(Dest)) ? ClockForm_AccReg :
+                    (Short && IsAccumulator(Source)) ? ClockForm_RegAcc : ClockForm_RegReg;
+            } break;
+            
+            case Operand_Memory:
+            {
+                Result = (Short && IsAccumulator(Dest)) ? ClockForm_AccMem : ClockForm_RegMem;
+            } break;
+            
+            case Operand_Immediate:
+            {
+                Result = (Short && IsAccumulator(Dest)) ? ClockForm_AccImm : ClockForm_RegImm;
+            } break;
+            
+            default: {} break;
+        }
+    }
+    else if(Dest->Type == Operand_Memory)
+    {
+        if(Source->Type == Operand_Register)
+        {
+            Result = (Short && IsAccumulator(Source)) ? ClockForm_MemAcc : ClockForm_MemReg;
+        }
+        else
+        {
+            Result = ClockForm_MemImm;
+        }
+    }
+    else
+    {
+        // NOTE: Only out has an immediate destination.
+        Result = ClockForm_ImmAcc;
+    }
+    
+    return Result;
+}
+
+static u32 GetEffectiveAddressClocks(effective_address_expression *Address, b32 HasDisplacement)
+{
+    // NOTE: HasDisplacement is whether the encoding has one, not whether it is zero - [bx+0]
+    // takes as long as [bx+2], and a lone bp always has one, since mod 00 with bp's r/m means a
+    // direct address instead.
+    u32 Base = Address->Terms[0].Register.Index;
+    u32 Index = Address->Terms[1].Register.Index;
+    if(!Base)
+    {
+        Base = Index;
+        Index = 0;
+    }
+    
+    u32 Result = 6;
+    if(Base && !Index)
+    {
+        Result = HasDisplacement ? 9 : 5;
+    }
+    else if(Base)
+    {
+        // NOTE: bp + di and bx + si take one clock less than bp + si and bx + di.
+        b32 Fast = (((Base == Register_bp) && (Index == Register_di)) || ((Base == Register_di) && (Index == Register_bp)) ||
+                    ((Base == Register_b) && (Index == Register_si)) || ((Base == Register_si) && (Index == Register_b)));
+        Result = (Fast ? 7 : 8) + (HasDisplacement ? 4 : 0);
+    }
+    
+    return Result;
+}
+
+static instruction_clocks GetInstructionClocks(clock_table *Table, instruction *Instruction, u32 EncodingFlags)
+{
+    assert(Instruction->Op < Op_Count);
+    
+    instruction_operand *Memory;
+    clock_form Form = GetClockForm(Instruction, EncodingFlags, &Memory);
+    clock_timing *Timing = &Table->Timings[Instruction->Op][Form];
+    
+    instruction_operand *Dest = Instruction->Operands[0].Type ? &Instruction->Operands[0] : &Instruction->Operands[1];
+    b32 Wide = IsWideOperand(Instruction, Dest);
+    
+    instruction_clocks Result = {};
+    Result.Clocks = Timing->Clocks[Wide ? 1 : 0];
+    Result.ExtraClocks = Timing->Extra;
+    if(Memory && (Form != ClockForm_Far))
+    {
+        if((Form != ClockForm_AccMem) && (Form != ClockForm_MemAcc))
+        {
+            Result.Clocks += GetEffectiveAddressClocks(&Memory->Address, (EncodingFlags & Encoding_Displacement));
+        }
+        
+        // NOTE: Far pointers are always a pair of words.
+        operation_type Op = Instruction->Op;
+        if(Wide || (Op == Op_lds) || (Op == Op_les) || (Form == ClockForm_FarMem))
+        {
+            Result.OddClocks = Timing->Transfers*CLOCKS_PER_ODD_TRANSFER;
+        }
+    }
+    
+    if(Instruction->Flags & Inst_Segment)
+    {
+        Result.Clocks += 2;
+    }
+    if(Instruction->Flags & Inst_Lock)
+    {
+        Result.Clocks += 2;
+    }
+    
+    return Result;
+}
+
+static u32 GetStringOddClocks(instruction *Instruction, u16 SI, u16 DI)
+{
+    // NOTE: For each repetition of a word string instruction. si and di only ever move by two,
+    // so whether they are odd stays the same for the whole repeat.
+    u32 Result = 0;
+    if(Instruction->Flags & Inst_Wide)
+    {
+        operation_type Op = Instruction->Op;
+        b32 ReadsSI = ((Op == Op_movs) || (Op == Op_cmps) || (Op == Op_lods));
+        b32 UsesDI = ((Op == Op_movs) || (Op == Op_cmps) || (Op == Op_scas) || (Op == Op_stos));
+        Result = CLOCKS_PER_ODD_TRANSFER*(((ReadsSI && (SI & 1)) ? 1 : 0) + ((UsesDI && (DI & 1)) ? 1 : 0));
+    }
+    
+    return Result;
+}
@@ -0,0 +1,95 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+/* NOTE: Clock counts for the 8086, from the instruction timings in the 8086 manual. Each
+   instruction costs:
+   
+   - its base clocks, which depend on the operation and the form of its operands (register,
+     memory, immediate, or one of the short forms the accumulator has), and for mul, imul, div
+     and idiv on whether it is byte or word (the manual gives a range for these, and the middle
+     of the range is used),
+   - the clocks to work out its effective address, if it has a memory operand, which depend on
+     which base and index registers it uses and whether it has a displacement,
+   - 2 for a segment override or lock prefix,
+   - 4 for every word it moves to or from memory at an odd address, since the 8086 does those as
+     two byte transfers,
+   - and, for jumps and loops, extra clocks when the jump is taken, for rep string instructions,
+     clocks for each repetition, and for shifts and rotates by cl, 4 for each bit.
+   
+   Stack accesses (push, pop, call, ret, int) are taken to be aligned. The prefetch queue, wait
+   states and the time interrupts take to be recognized are not modelled.
+   
+   The timings are looked up in a table built once from the manual's, so working out an
+   instruction's clocks is a few lookups. Even that is only done once per instruction with a
+   decode cache, which keeps them alongside the decoded instruction, and the threaded
+   interpreter and the JIT work out everything that doesn't depend on the machine state when an
+   instruction is lowered or compiled, and only add the odd-address and jump-taken clocks as
+   they run.
+*/
+
+// NOTE: The 8086 moves a word at an odd address as two bytes, which takes this much longer.
+static u32 const CLOCKS_PER_ODD_TRANSFER = 4;
+
+enum clock_form : u8
+{
+    ClockForm_None, // NOTE: No operands, or only implied ones
+    ClockForm_Reg,
+    ClockForm_Seg, // NOTE: A segment register on its own (push and pop)
+    ClockForm_Mem,
+    ClockForm_Imm, // NOTE: An immediate on its own, including relative jumps
+    ClockForm_Far, // NOTE: A jump or call straight to a segment:offset
+    ClockForm_FarMem, // NOTE: A jump or call through a far pointer in memory
+    ClockForm_RegReg,
+    ClockForm_RegMem,
+    ClockForm_MemReg,
+    ClockForm_RegImm,
+    ClockForm_MemImm,
+    
+    // NOTE: The short forms the accumulator has, for instructions the decoder marks with
+    // Encoding_ShortForm. Anything that has no short form of its own falls back to the register
+    // form. AccMem and MemAcc are only mov to and from a direct address, which takes no EA
+    // clocks - everything else pays for the address as usual.
+    ClockForm_AccReg,
+    ClockForm_RegAcc,
+    ClockForm_AccImm,
+    ClockForm_ImmAcc,
+    ClockForm_AccMem,
+    ClockForm_MemAcc,
+    
+    ClockForm_Repeat, // NOTE: A string instruction with a rep prefix
+    
+    ClockForm_Count,
+};
+
+struct clock_timing
+{
+    u8 Clocks[2]; // NOTE: Byte, then word
+    u8 Transfers; // NOTE: How many times the memory operand is read or written
+    u8 Extra; // NOTE: Per jump taken, per repetition, or per bit shifted
+};
+
+struct clock_table
+{
+    clock_timing Timings[Op_Count][ClockForm_Count];
+};
+
+struct instruction_clocks
+{
+    u32 Clocks; // NOTE: Everything that depends only on the instruction
+    u32 OddClocks; // NOTE: Added if its word memory operand is at an odd address
+    u32 ExtraClocks; // NOTE: Added per jump taken, per repetition, or per bit shifted by cl
+};
+
+static clock_table *Get8086ClockTable();
+static instruction_clocks GetInstructionClocks(clock_table *Table, instruction *Instruction, u32 EncodingFlags);
+static u32 GetStringOddClocks(instruction *Instruction, u16 SI, u16 DI);
@@ -36,6 +36,10 @@ struct decode_context
 {
     u32 DefaultSegment;
     u32 AdditionalFlags;
+    u32 EncodingFlags; // NOTE: For the last instruction decoded (see encoding_flag)
+    
+    // NOTE: If this is null, operands are built field by field (the reference path).
+    operand_templates *Templates;
 };
 
 static instruction_operand GetRegOperand(u32 IntelRegIndex, b32 Wide)
@@ -60,6 +64,54 @@ static instruction_operand GetRegOperand(u32 IntelRegIndex, b32 Wide)
     return Result;
 }
 
+static instruction_operand GetModOperand(u32 Mod, u32 RM, b32 Wide, s16 Displacement)
+{
+    instruction_operand Result = {};
+    
+    if(Mod == 0b11)
+    {
+        Result = GetRegOperand(RM, Wide);
+    }
+    else
+    {
+        register_mapping_8086 IntelTerm0[8] = { Register_b,  Register_b, Register_bp, Register_bp, Register_si, Register_di, Register_bp, Register_b};
+        register_mapping_8086 IntelTerm1[8] = {Register_si, Register_di, Register_si, Register_di};
+        
+        u32 I = RM&0x7;
+        register_mapping_8086 Term0 = IntelTerm0[I];
+        register_mapping_8086 Term1 = IntelTerm1[I];
+        if((Mod == 0b00) && (RM == 0b110))
+        {
+            Term0 = {};
+            Term1 = {};
+        }
+        
+        Result = EffectiveAddressOperand(RegisterAccess(Term0, 0, 2), RegisterAccess(Term1, 0, 2), Displacement);
+    }
+    
+    return Result;
+}
+
+static void BuildOperandTemplates(operand_templates *Dest)
+{
+    // NOTE: The REG operand only depends on REG and W, and the MOD/RM operand only depends on
+    // MOD, RM and W (the REG bits in the middle of a ModRM byte don't affect it), so these two
+    // small tables cover every (ModRM, W) combination. Memory operands are stored with a zero
+    // displacement, which the decoder patches in.
+    for(u32 Wide = 0; Wide < 2; ++Wide)
+    {
+        for(u32 Reg = 0; Reg < 8; ++Reg)
+        {
+            Dest->RegOperands[Wide][Reg] = GetRegOperand(Reg, Wide);
+        }
+        
+        for(u32 ModRM = 0; ModRM < 32; ++ModRM)
+        {
+            Dest->ModOperands[Wide][ModRM] = GetModOperand(ModRM >> 3, ModRM & 0x7, Wide, 0);
+        }
+    }
+}
+
 // NOTE(casey): ParseDataValue is not a real function, it's basically just a macro that is used in
 // TryParse. It should never be called otherwise, but that is not something you can do in C++.
 // In other languages it would be a "local function".
@@ -69,11 +121,17 @@ static u32 ParseDataValue(segmented_access *Access, b32 Exists, b32 Wide, b32 Si
     
     if(Exists)
     {
-        if(Wide)
+        if(Wide && (Access->SegmentOffset == 0xffff))
         {
-            u8 D0 = *AccessMemory(*Access, 0);
-            u8 D1 = *AccessMemory(*Access, 1);
-            Result = (D1 << 8) | D0;
+            // NOTE: The high byte comes from the start of the segment, not the next address.
+            Result = *AccessMemory(*Access);
+            Access->SegmentOffset += 1;
+            Result |= (*AccessMemory(*Access) << 8);
+            Access->SegmentOffset += 1;
+        }
+        else if(Wide)
+        {
+            Result = ReadMemoryU16(*Access);
             Access->SegmentOffset += 2;
         }
         else
@@ -90,7 +148,7 @@ static u32 ParseDataValue(segmented_access *Access, b32 Exists, b32 Wide, b32 Si
     return Result;
 }
 
-static instruction TryDecode(decode_context *Context, instruction_encoding *Inst, segmented_access At)
+static instruction TryDecode(decode_context *Context, instruction_encoding const *Inst, segmented_access At)
 {
     instruction Dest = {};
     b32 Has[Bits_Count] = {};
@@ -98,9 +156,11 @@ static instruction TryDecode(decode_context *Context, instruction_encoding *Inst
     b32 Valid = true;
     
     u64 StartingAddress = GetAbsoluteAddressOf(At);
+    u16 StartingOffset = At.SegmentOffset;
     
     u8 BitsPendingCount = 0;
     u8 BitsPending = 0;
+    b32 HasModRM = false;
     for(u32 BitsIndex = 0; Valid && (BitsIndex < ArrayCount(Inst->Bits)); ++BitsIndex)
     {
         instruction_bits TestBits = Inst->Bits[BitsIndex];
@@ -129,6 +189,8 @@ static instruction TryDecode(decode_context *Context, instruction_encoding *Inst
             ReadBits = BitsPending;
             ReadBits >>= BitsPendingCount;
             ReadBits &= ~(0xff << TestBits.BitCount);
+            
+            HasModRM = (HasModRM || (TestBits.Usage == Bits_MOD));
         }
         
         if(TestBits.Usage == Bits_Literal)
@@ -163,7 +225,9 @@ static instruction TryDecode(decode_context *Context, instruction_encoding *Inst
         Dest.Op = Inst->Op;
         Dest.Flags = Context->AdditionalFlags;
         Dest.Address = StartingAddress;
-        Dest.Size = GetAbsoluteAddressOf(At) - StartingAddress;
+        // NOTE: The offset wraps within the segment the way IP does on the 8086, so an
+        // instruction that runs off the end of its segment carries on from the start of it.
+        Dest.Size = (u16)(At.SegmentOffset - StartingOffset);
         Dest.SegmentOverride = Context->DefaultSegment;
         
         if(W)
@@ -176,6 +240,17 @@ static instruction TryDecode(decode_context *Context, instruction_encoding *Inst
             Dest.Flags |= Inst_Far;
         }
         
+        Context->EncodingFlags = 0;
+        if(!HasModRM)
+        {
+            Context->EncodingFlags |= Encoding_ShortForm;
+        }
+        
+        if((Mod == 0b01) || (Mod == 0b10))
+        {
+            Context->EncodingFlags |= Encoding_Displacement;
+        }
+        
         u32 Disp = Bits[Bits_Disp];
         s16 Displacement = (s16)Disp;
         
@@ -187,32 +262,33 @@ static instruction TryDecode(decode_context *Context, instruction_encoding *Inst
             *RegOperand = RegisterOperand(Register_es + (Bits[Bits_SR] & 0x3), 2);
         }
         
+        operand_templates *Templates = Context->Templates;
         if(Has[Bits_REG])
         {
-            *RegOperand = GetRegOperand(Bits[Bits_REG], W);
+            if(Templates)
+            {
+                *RegOperand = Templates->RegOperands[W != 0][Bits[Bits_REG] & 0x7];
+            }
+            else
+            {
+                *RegOperand = GetRegOperand(Bits[Bits_REG], W);
+            }
         }
         
         if(Has[Bits_MOD])
         {
-            if(Mod == 0b11)
+            b32 ModIsW = (W || (Bits[Bits_RMRegAlwaysW]));
+            if(Templates)
             {
-                *ModOperand = GetRegOperand(RM, W || (Bits[Bits_RMRegAlwaysW]));
+                *ModOperand = Templates->ModOperands[ModIsW][((Mod & 0x3) << 3) | (RM & 0x7)];
+                if(ModOperand->Type == Operand_Memory)
+                {
+                    ModOperand->Address.Displacement = Displacement;
+                }
             }
             else
             {
-                register_mapping_8086 IntelTerm0[8] = { Register_b,  Register_b, Register_bp, Register_bp, Register_si, Register_di, Register_bp, Register_b};
-                register_mapping_8086 IntelTerm1[8] = {Register_si, Register_di, Register_si, Register_di};
-                
-                u32 I = RM&0x7;
-                register_mapping_8086 Term0 = IntelTerm0[I];
-                register_mapping_8086 Term1 = IntelTerm1[I];
-                if((Mod == 0b00) && (RM == 0b110))
-                {
-                    Term0 = {};
-                    Term1 = {};
-                }
-                
-                *ModOperand = EffectiveAddressOperand(RegisterAccess(Term0, 0, 2), RegisterAccess(Term1, 0, 2), Displacement);
+                *ModOperand = GetModOperand(Mod, RM, ModIsW, Displacement);
             }
         }
         
@@ -259,33 +335,149 @@ static instruction TryDecode(decode_context *Context, instruction_encoding *Inst
     return Dest;
 }
 
-static instruction DecodeInstruction(instruction_table Table, segmented_access At)
+static b32 CouldMatch(instruction_encoding const *Inst, u8 FirstByte, u8 RegBits)
 {
-    /* TODO(casey): Hmm. It seems like this is a very inefficient way to parse
-       instructions, isn't it? For every instruction, we check every entry in the
-       table until we find a match. Is this bad design? Or did the person who wrote
-       it know what they were doing, and has a plan for how it can be optimized
-       later? Only time will tell... :) */
+    // NOTE: This walks the encoding the same way TryDecode does, but only checks
+    // the literal bits we actually know when building the opcode table: all of the first
+    // byte, and the REG field (bits 5-3) of the second byte. Anything else is left for
+    // TryDecode to reject at decode time, so the result is conservative - it may say
+    // an encoding could match when it can't, but never the other way around.
+    b32 Result = true;
     
-    decode_context Context = {};
+    u32 ByteIndex = 0;
+    u8 BitsPendingCount = 0;
+    for(u32 BitsIndex = 0; Result && (BitsIndex < ArrayCount(Inst->Bits)); ++BitsIndex)
+    {
+        instruction_bits TestBits = Inst->Bits[BitsIndex];
+        if(TestBits.Usage == Bits_End)
+        {
+            break;
+        }
+        
+        if(TestBits.BitCount != 0)
+        {
+            if(BitsPendingCount == 0)
+            {
+                BitsPendingCount = 8;
+                ++ByteIndex;
+            }
+            
+            BitsPendingCount -= TestBits.BitCount;
+            
+            if(TestBits.Usage == Bits_Literal)
+            {
+                u32 FieldMask = ~(0xff << TestBits.BitCount) << BitsPendingCount;
+                u32 Expected = TestBits.Value << BitsPendingCount;
+                if(ByteIndex == 1)
+                {
+                    Result = ((FirstByte & FieldMask) == Expected);
+                }
+                else if(ByteIndex == 2)
+                {
+                    u32 KnownMask = FieldMask & 0b00111000;
+                    Result = (((RegBits << 3) & KnownMask) == (Expected & KnownMask));
+                }
+            }
+        }
+    }
+    
+    return Result;
+}
+
+static b32 BuildOpcodeTable(instruction_table Table, opcode_table *Dest)
+{
+    *Dest = {};
+    Dest->Instructions = Table;
+    BuildOperandTemplates(&Dest->Templates);
+    
+    // NOTE: Encoding indices are stored as bytes, so the table can't grow past 256 entries.
+    assert(Table.EncodingCount <= 256);
+    
+    for(u32 FirstByte = 0; FirstByte < 256; ++FirstByte)
+    {
+        for(u32 RegBits = 0; RegBits < 8; ++RegBits)
+        {
+            opcode_candidates *Candidates = &Dest->Candidates[FirstByte][RegBits];
+            for(u32 Index = 0; Index < Table.EncodingCount; ++Index)
+            {
+                if(CouldMatch(&Table.Encodings[Index], (u8)FirstByte, (u8)RegBits))
+                {
+                    // NOTE: If this assert fires, the table has more overlapping encodings
+                    // for a single opcode than we have room for, and OPCODE_TABLE_MAX_CANDIDATES
+                    // needs to go up.
+                    assert(Candidates->Count < ArrayCount(Candidates->EncodingIndex));
+                    Candidates->EncodingIndex[Candidates->Count++] = (u8)Index;
+                }
+            }
+        }
+    }
+    
+    return true;
+}
+
+static opcode_table *Get8086OpcodeTable()
+{
+    // NOTE: The opcode table is built once, the first time anyone asks for it.
+    // Function-local statics are initialized thread-safely, so this can be called from
+    // any number of threads.
+    static opcode_table Table;
+    static b32 Built = BuildOpcodeTable(Get8086InstructionTable(), &Table);
+    assert(Built);
+    
+    return &Table;
+}
+
+static instruction TryDecodeAny(decode_context *Context, instruction_table Table, opcode_table *Opcodes, segmented_access At)
+{
     instruction Result = {};
     
-    u32 StartingAddress = GetAbsoluteAddressOf(At);
-    u32 TotalSize = 0;
-    while(TotalSize < Table.MaxInstructionByteCount)
+    if(Opcodes)
+    {
+        u8 FirstByte = *AccessMemory(At, 0);
+        u8 RegBits = (*AccessMemory(At, 1) >> 3) & 0x7;
+        
+        opcode_candidates *Candidates = &Opcodes->Candidates[FirstByte][RegBits];
+        for(u32 Index = 0; Index < Candidates->Count; ++Index)
+        {
+            Result = TryDecode(Context, &Table.Encodings[Candidates->EncodingIndex[Index]], At);
+            if(Result.Op)
+            {
+                break;
+            }
+        }
+    }
+    else
     {
-        Result = {};
         for(u32 Index = 0; Index < Table.EncodingCount; ++Index)
         {
-            instruction_encoding Inst = Table.Encodings[Index];
-            Result = TryDecode(&Context, &Inst, At);
+            Result = TryDecode(Context, &Table.Encodings[Index], At);
             if(Result.Op)
             {
-                At.SegmentOffset += Result.Size;
-                TotalSize += Result.Size;
                 break;
             }
         }
+    }
+    
+    return Result;
+}
+
+static instruction DecodePrefixedInstruction(instruction_table Table, opcode_table *Opcodes, segmented_access At,
+                                             u32 *EncodingFlags)
+{
+    decode_context Context = {};
+    Context.Templates = Opcodes ? &Opcodes->Templates : 0;
+    instruction Result = {};
+    
+    u32 StartingAddress = GetAbsoluteAddressOf(At);
+    u32 TotalSize = 0;
+    while(TotalSize < Table.MaxInstructionByteCount)
+    {
+        Result = TryDecodeAny(&Context, Table, Opcodes, At);
+        if(Result.Op)
+        {
+            At.SegmentOffset += Result.Size;
+            TotalSize += Result.Size;
+        }
         
         if(Result.Op == Op_lock)
         {
@@ -316,5 +508,150 @@ static instruction DecodeInstruction(instruction_table Table, segmented_access A
         Result = {};
     }
     
+    if(EncodingFlags)
+    {
+        *EncodingFlags = Context.EncodingFlags;
+    }
+    
+    return Result;
+}
+
+static instruction DecodeInstruction(instruction_table Table, segmented_access At)
+{
+    // NOTE: This is the reference decoder. For every instruction, it checks every
+    // entry in the table until it finds a match. It is kept around so the opcode table
+    // path below has something to be checked against.
+    instruction Result = DecodePrefixedInstruction(Table, 0, At, 0);
+    return Result;
+}
+
+static instruction DecodeInstruction(opcode_table *Opcodes, segmented_access At, u32 *EncodingFlags)
+{
+    // NOTE: This is the fast decoder. The first byte of the instruction (and the
+    // REG field of the second, for the group opcodes) selects the short list of encodings
+    // that could possibly match, so TryDecode only runs on those.
+    instruction Result = DecodePrefixedInstruction(Opcodes->Instructions, Opcodes, At, EncodingFlags);
+    return Result;
+}
+
+static decode_source DecodeSource(u32 Size, u8 *Bytes, b32 Padded)
+{
+    decode_source Result = {};
+    
+    Result.Bytes = Bytes;
+    Result.Size = Size;
+    Result.Padded = Padded;
+    
+    return Result;
+}
+
+// NOTE: DecodeNext is the body of the block decoders below. It decodes the instruction at Offset
+// into Dest and returns true, or returns false with the reason decoding has to stop there.
+static b32 DecodeNext(opcode_table *Opcodes, decode_source Source, u32 Offset, instruction *Dest, decode_stop_reason *StopReason)
+{
+    b32 Result = false;
+    
+    // NOTE: Each instruction is decoded through a 16-byte window starting at its first byte,
+    // exactly like a single-instruction decode. If the source is padded, every window can
+    // read the source in place. If not, only the last few instructions of the block, where
+    // the window would run off the end of the source, go through the zero-padded guard
+    // buffer. Everything before that still reads the source in place.
+    assert(Opcodes->Instructions.MaxInstructionByteCount < DECODE_SOURCE_PADDING);
+    
+    if(Offset >= Source.Size)
+    {
+        *StopReason = DecodeStop_EndOfSource;
+    }
+    else
+    {
+        u32 Remaining = Source.Size - Offset;
+        u8 *At = Source.Bytes + Offset;
+        
+        u8 GuardBuffer[DECODE_SOURCE_PADDING] = {};
+        if(!Source.Padded && (Remaining < sizeof(GuardBuffer)))
+        {
+            memcpy(GuardBuffer, At, Remaining);
+            At = GuardBuffer;
+        }
+        
+        *Dest = DecodeInstruction(Opcodes, FixedMemoryPow2(4, At));
+        if(!Dest->Op)
+        {
+            *StopReason = DecodeStop_Unrecognized;
+        }
+        else if(Dest->Size > Remaining)
+        {
+            *StopReason = DecodeStop_Truncated;
+        }
+        else
+        {
+            // NOTE: Addresses in a decoded block are byte offsets from the start of the source.
+            Dest->Address = Offset;
+            Result = true;
+        }
+    }
+    
+    return Result;
+}
+
+static decode_block_result DecodeBlock(opcode_table *Opcodes, decode_source Source, u32 Offset, u32 DestCount, instruction *Dest)
+{
+    decode_block_result Result = {};
+    
+    u32 StartOffset = Offset;
+    for(;;)
+    {
+        if(Result.InstructionCount >= DestCount)
+        {
+            Result.StopReason = (Offset < Source.Size) ? DecodeStop_DestFull : DecodeStop_EndOfSource;
+            break;
+        }
+        
+        instruction *Instruction = &Dest[Result.InstructionCount];
+        if(!DecodeNext(Opcodes, Source, Offset, Instruction, &Result.StopReason))
+        {
+            break;
+        }
+        
+        Offset += Instruction->Size;
+        ++Result.InstructionCount;
+    }
+    
+    Result.BytesDecoded = Offset - StartOffset;
+    
+    return Result;
+}
+
+static decode_block_result DecodeCompactBlock(opcode_table *Opcodes, decode_source Source, u32 Offset, u32 DestCount, compact_instruction *Dest)
+{
+    decode_block_result Result = {};
+    
+    // NOTE: The wide instruction only ever lives on the stack here. What gets written out
+    // is the 16-byte packed form.
+    u32 StartOffset = Offset;
+    for(;;)
+    {
+        if(Result.InstructionCount >= DestCount)
+        {
+            Result.StopReason = (Offset < Source.Size) ? DecodeStop_DestFull : DecodeStop_EndOfSource;
+            break;
+        }
+        
+        instruction Instruction;
+        if(!DecodeNext(Opcodes, Source, Offset, &Instruction, &Result.StopReason))
+        {
+            break;
+        }
+        
+        // NOTE: Everything the decoder produces fits the compact format, so this skips the
+        // round-trip check PackInstruction does. sim86_bench checks it on every listing instead.
+        Dest[Result.InstructionCount] = PackDecodedInstruction(Instruction);
+        
+        Offset += Instruction.Size;
+        ++Result.InstructionCount;
+    }
+    
+    Result.BytesDecoded = Offset - StartOffset;
+    
     return Result;
 }
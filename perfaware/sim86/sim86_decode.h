@@ -10,4 +10,56 @@
    
    ======================================================================== */
 
+// NOTE: Ready-made operands for every REG field, and every MOD/RM combination, at both widths.
+struct operand_templates
+{
+    instruction_operand RegOperands[2][8]; // NOTE: [W][REG]
+    instruction_operand ModOperands[2][32]; // NOTE: [W][(MOD << 3) | RM]
+};
+
+#define OPCODE_TABLE_MAX_CANDIDATES 4
+
+struct opcode_candidates
+{
+    u8 Count;
+    u8 EncodingIndex[OPCODE_TABLE_MAX_CANDIDATES];
+};
+
+struct opcode_table
+{
+    instruction_table Instructions;
+    
+    // NOTE: Indexed by the first instruction byte, then by the REG field of the second byte.
+    // Only the group opcodes (0x80, 0xd0, 0xf6, 0xff, etc.) actually differ across REG.
+    opcode_candidates Candidates[256][8];
+    
+    operand_templates Templates;
+};
+
+static opcode_table *Get8086OpcodeTable();
+
+// NOTE: What the decoder knows about how an instruction was encoded that the decoded instruction
+// doesn't say. Only the clock counts need it, so it stays out of instruction.Flags, which the
+// DLL hands out.
+enum encoding_flag : u32
+{
+    Encoding_ShortForm = 0x1, // NOTE: No mod reg r/m byte, so its registers are implied by the opcode
+    Encoding_Displacement = 0x2, // NOTE: Its memory operand has a displacement, even if that is zero
+};
+
 static instruction DecodeInstruction(instruction_table Table, segmented_access At);
+static instruction DecodeInstruction(opcode_table *Opcodes, segmented_access At, u32 *EncodingFlags = 0);
+
+// NOTE: A padded source has at least DECODE_SOURCE_PADDING readable bytes past Size, all of them
+// zero, so instructions near the end can be decoded in place without a guard buffer.
+#define DECODE_SOURCE_PADDING 16
+struct decode_source
+{
+    u8 *Bytes;
+    u32 Size;
+    b32 Padded;
+};
+
+static decode_source DecodeSource(u32 Size, u8 *Bytes, b32 Padded = false);
+static decode_block_result DecodeBlock(opcode_table *Opcodes, decode_source Source, u32 Offset, u32 DestCount, instruction *Dest);
+static decode_block_result DecodeCompactBlock(opcode_table *Opcodes, decode_source Source, u32 Offset, u32 DestCount, compact_instruction *Dest);
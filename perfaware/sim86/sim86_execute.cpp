@@ -0,0 +1,1161 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+// NOTE: The bits of FLAGS that mean something on the 8086. The rest read back as set when FLAGS
+// is pushed, as on the real thing, but are never stored.
+#define FLAGS_DEFINED_BITS 0x0fd5
+#define FLAGS_RESERVED_BITS 0xf002
+
+static u32 GetPhysicalAddress(paged_memory *Memory, u16 Segment, u16 Offset)
+{
+    u32 Result = (((u32)Segment << 4) + Offset) & Memory->Mask;
+    return Result;
+}
+
+static u32 ReadMachineMemory(paged_memory *Memory, u16 Segment, u16 Offset, b32 Wide)
+{
+    // NOTE: A word at offset 0xffff wraps around to the start of its segment, so only then is it
+    // not two bytes in a row.
+    u32 Result;
+    if(Wide && (Offset != 0xffff))
+    {
+        Result = ReadPagedU16(Memory, GetPhysicalAddress(Memory, Segment, Offset));
+    }
+    else
+    {
+        Result = *GetPagedByte(Memory, GetPhysicalAddress(Memory, Segment, Offset));
+        if(Wide)
+        {
+            Result |= *GetPagedByte(Memory, GetPhysicalAddress(Memory, Segment, 0)) << 8;
+        }
+    }
+    
+    return Result;
+}
+
+static void WriteMachineMemory(paged_memory *Memory, u16 Segment, u16 Offset, b32 Wide, u32 Value)
+{
+    if(Wide && (Offset != 0xffff))
+    {
+        WritePagedU16(Memory, GetPhysicalAddress(Memory, Segment, Offset), (u16)Value);
+    }
+    else
+    {
+        WritePagedByte(Memory, GetPhysicalAddress(Memory, Segment, Offset), (u8)Value);
+        if(Wide)
+        {
+            WritePagedByte(Memory, GetPhysicalAddress(Memory, Segment, 0), (u8)(Value >> 8));
+        }
+    }
+}
+
+static u32 ReadRegister(machine_state *State, register_access Reg)
+{
+    u32 Result = State->Registers[Reg.Index];
+    if(Reg.Count == 1)
+    {
+        Result = (Result >> (8*Reg.Offset)) & 0xff;
+    }
+    
+    return Result;
+}
+
+static void WriteRegister(machine_state *State, register_access Reg, u32 Value)
+{
+    u16 *Dest = &State->Registers[Reg.Index];
+    if(Reg.Count == 1)
+    {
+        u32 Shift = 8*Reg.Offset;
+        *Dest = (u16)((*Dest & ~(0xff << Shift)) | ((Value & 0xff) << Shift));
+    }
+    else
+    {
+        *Dest = (u16)Value;
+    }
+}
+
+static register_access Accumulator(b32 Wide)
+{
+    register_access Result = {Register_a, 0, Wide ? 2u : 1u};
+    return Result;
+}
+
+static u16 GetDataSegment(machine_state *State, instruction *Instruction, u32 DefaultSegment = Register_ds)
+{
+    u32 Segment = (Instruction->Flags & Inst_Segment) ? Instruction->SegmentOverride : DefaultSegment;
+    u16 Result = State->Registers[Segment];
+    return Result;
+}
+
+static u16 GetEffectiveSegment(machine_state *State, instruction *Instruction, effective_address_expression *Address)
+{
+    // NOTE: Addresses based on bp are in the stack segment, everything else is in the data
+    // segment, unless the instruction has a segment prefix.
+    b32 UsesBP = ((Address->Terms[0].Register.Index == Register_bp) || (Address->Terms[1].Register.Index == Register_bp));
+    u16 Result = GetDataSegment(State, Instruction, UsesBP ? Register_ss : Register_ds);
+    return Result;
+}
+
+static u16 GetEffectiveOffset(machine_state *State, effective_address_expression *Address)
+{
+    // NOTE: A term with no register has index zero, and Registers[0] is always zero.
+    u16 Result = (u16)(State->Registers[Address->Terms[0].Register.Index] +
+                       State->Registers[Address->Terms[1].Register.Index] +
+                       Address->Displacement);
+    return Result;
+}
+
+static b32 IsWideOperand(instruction *Instruction, instruction_operand *Operand)
+{
+    b32 Result = (Operand->Type == Operand_Register) ? (Operand->Register.Count == 2) : ((Instruction->Flags & Inst_Wide) != 0);
+    return Result;
+}
+
+static u32 ReadOperand(machine_state *State, instruction *Instruction, instruction_operand *Operand)
+{
+    u32 Result = 0;
+    
+    switch(Operand->Type)
+    {
+        case Operand_Register:
+        {
+            Result = ReadRegister(State, Operand->Register);
+        } break;
+        
+        case Operand_Memory:
+        {
+            effective_address_expression *Address = &Operand->Address;
+            Result = ReadMachineMemory(State->Memory, GetEffectiveSegment(State, Instruction, Address),
+                                       GetEffectiveOffset(State, Address), (Instruction->Flags & Inst_Wide));
+        } break;
+        
+        case Operand_Immediate:
+        {
+            Result = (u32)Operand->Immediate.Value & ((Instruction->Flags & Inst_Wide) ? 0xffff : 0xff);
+        } break;
+        
+        default: {} break;
+    }
+    
+    return Result;
+}
+
+static void WriteOperand(machine_state *State, instruction *Instruction, instruction_operand *Operand, u32 Value)
+{
+    switch(Operand->Type)
+    {
+        case Operand_Register:
+        {
+            WriteRegister(State, Operand->Register, Value);
+        } break;
+        
+        case Operand_Memory:
+        {
+            effective_address_expression *Address = &Operand->Address;
+            WriteMachineMemory(State->Memory, GetEffectiveSegment(State, Instruction, Address),
+                               GetEffectiveOffset(State, Address), (Instruction->Flags & Inst_Wide), Value);
+        } break;
+        
+        default: {} break;
+    }
+}
+
+static u32 ReadFarPointer(machine_state *State, instruction *Instruction, instruction_operand *Operand, u16 *Segment)
+{
+    // NOTE: A far pointer in memory is the offset followed by the segment.
+    effective_address_expression *Address = &Operand->Address;
+    u16 PointerSegment = GetEffectiveSegment(State, Instruction, Address);
+    u16 Offset = GetEffectiveOffset(State, Address);
+    
+    *Segment = (u16)ReadMachineMemory(State->Memory, PointerSegment, (u16)(Offset + 2), true);
+    u32 Result = ReadMachineMemory(State->Memory, PointerSegment, Offset, true);
+    return Result;
+}
+
+static b32 HasEvenParity(u32 Value)
+{
+    // NOTE: PF only ever looks at the low byte of the result.
+    Value = (Value ^ (Value >> 4)) & 0xf;
+    b32 Result = !((0x6996 >> Value) & 1);
+    return Result;
+}
+
+static void SetFlag(machine_state *State, u16 Bit, b32 Set)
+{
+    u16 *Flags = &State->Registers[Register_flags];
+    *Flags = Set ? (*Flags | Bit) : (*Flags & ~Bit);
+}
+
+static b32 GetFlag(machine_state *State, u16 Bit)
+{
+    b32 Result = ((State->Registers[Register_flags] & Bit) != 0);
+    return Result;
+}
+
+static u32 GetWidthMask(b32 Wide)
+{
+    u32 Result = Wide ? 0xffff : 0xff;
+    return Result;
+}
+
+static u32 GetSignBit(b32 Wide)
+{
+    u32 Result = Wide ? 0x8000 : 0x80;
+    return Result;
+}
+
+static void SetResultFlags(machine_state *State, u32 Result, b32 Wide)
+{
+    SetFlag(State, FlagBit_ZF, (Result & GetWidthMask(Wide)) == 0);
+    SetFlag(State, FlagBit_SF, Result & GetSignBit(Wide));
+    SetFlag(State, FlagBit_PF, HasEvenParity(Result));
+}
+
+static u32 Add(machine_state *State, u32 A, u32 B, u32 CarryIn, b32 Wide)
+{
+    u32 Result = A + B + CarryIn;
+    SetFlag(State, FlagBit_CF, Result > GetWidthMask(Wide));
+    SetFlag(State, FlagBit_AF, (A ^ B ^ Result) & 0x10);
+    SetFlag(State, FlagBit_OF, (A ^ Result) & (B ^ Result) & GetSignBit(Wide));
+    SetResultFlags(State, Result, Wide);
+    
+    Result &= GetWidthMask(Wide);
+    return Result;
+}
+
+static u32 Subtract(machine_state *State, u32 A, u32 B, u32 BorrowIn, b32 Wide)
+{
+    u32 Result = A - B - BorrowIn;
+    SetFlag(State, FlagBit_CF, A < (B + BorrowIn));
+    SetFlag(State, FlagBit_AF, (A ^ B ^ Result) & 0x10);
+    SetFlag(State, FlagBit_OF, (A ^ B) & (A ^ Result) & GetSignBit(Wide));
+    SetResultFlags(State, Result, Wide);
+    
+    Result &= GetWidthMask(Wide);
+    return Result;
+}
+
+static u32 Logic(machine_state *State, u32 Result, b32 Wide)
+{
+    // NOTE: AF is undefined after the logical operations. It is cleared, like CF and OF.
+    SetFlag(State, FlagBit_CF, false);
+    SetFlag(State, FlagBit_AF, false);
+    SetFlag(State, FlagBit_OF, false);
+    SetResultFlags(State, Result, Wide);
+    
+    Result &= GetWidthMask(Wide);
+    return Result;
+}
+
+static u32 ShiftOrRotate(machine_state *State, operation_type Op, u32 Value, u32 Count, b32 Wide)
+{
+    // NOTE: The 8086 uses the whole count in cl - it doesn't mask it to 5 bits the way later
+    // processors do. A count of zero changes nothing, flags included. OF is only defined for a
+    // count of one, but is set the same way for any count.
+    u32 Result = Value;
+    if(Count)
+    {
+        u32 Mask = GetWidthMask(Wide);
+        u32 SignBit = GetSignBit(Wide);
+        
+        b32 CF = GetFlag(State, FlagBit_CF);
+        for(u32 Index = 0; Index < Count; ++Index)
+        {
+            b32 Out = ((Op == Op_shl) || (Op == Op_rol) || (Op == Op_rcl)) ? ((Result & SignBit) != 0) : (Result & 1);
+            switch(Op)
+            {
+                case Op_shl: {Result = (Result << 1) & Mask;} break;
+                case Op_shr: {Result = Result >> 1;} break;
+                case Op_sar: {Result = (Result >> 1) | (Result & SignBit);} break;
+                case Op_rol: {Result = ((Result << 1) | Out) & Mask;} break;
+                case Op_ror: {Result = (Result >> 1) | (Out ? SignBit : 0);} break;
+                case Op_rcl: {Result = ((Result << 1) | CF) & Mask;} break;
+                case Op_rcr: {Result = (Result >> 1) | (CF ? SignBit : 0);} break;
+                default: {} break;
+            }
+            CF = Out;
+        }
+        
+        SetFlag(State, FlagBit_CF, CF);
+        switch(Op)
+        {
+            case Op_shl:
+            case Op_rol:
+            case Op_rcl:
+            {
+                SetFlag(State, FlagBit_OF, ((Result & SignBit) != 0) != CF);
+            } break;
+            
+            case Op_ror:
+            case Op_rcr:
+            {
+                SetFlag(State, FlagBit_OF, (Result ^ (Result << 1)) & SignBit);
+            } break;
+            
+            case Op_shr:
+            {
+                SetFlag(State, FlagBit_OF, Value & SignBit);
+            } break;
+            
+            default:
+            {
+                SetFlag(State, FlagBit_OF, false);
+            } break;
+        }
+        
+        if((Op == Op_shl) || (Op == Op_shr) || (Op == Op_sar))
+        {
+            SetResultFlags(State, Result, Wide);
+        }
+    }
+    
+    return Result;
+}
+
+static void Push(machine_state *State, u16 Value)
+{
+    u16 SP = (State->Registers[Register_sp] -= 2);
+    WriteMachineMemory(State->Memory, State->Registers[Register_ss], SP, true, Value);
+}
+
+static u16 Pop(machine_state *State)
+{
+    u16 SP = State->Registers[Register_sp];
+    u16 Result = (u16)ReadMachineMemory(State->Memory, State->Registers[Register_ss], SP, true);
+    State->Registers[Register_sp] = SP + 2;
+    return Result;
+}
+
+static void Interrupt(machine_state *State, u32 Type)
+{
+    // NOTE: The vector table is the first 1k of memory - an offset and a segment per type.
+    Push(State, State->Registers[Register_flags] | FLAGS_RESERVED_BITS);
+    SetFlag(State, FlagBit_IF, false);
+    SetFlag(State, FlagBit_TF, false);
+    Push(State, State->Registers[Register_cs]);
+    Push(State, State->Registers[Register_ip]);
+    
+    State->Registers[Register_ip] = (u16)ReadMachineMemory(State->Memory, 0, (u16)(4*Type), true);
+    State->Registers[Register_cs] = (u16)ReadMachineMemory(State->Memory, 0, (u16)(4*Type + 2), true);
+}
+
+static void Multiply(machine_state *State, operation_type Op, u32 Source, b32 Wide)
+{
+    // NOTE: CF and OF say whether the upper half of the result is needed. SF, ZF, AF and PF are
+    // undefined, and are left alone.
+    b32 Overflow;
+    if(Wide)
+    {
+        u32 Result = (Op == Op_imul) ? (u32)((s32)(s16)State->Registers[Register_a] * (s32)(s16)Source) : (State->Registers[Register_a] * Source);
+        State->Registers[Register_a] = (u16)Result;
+        State->Registers[Register_d] = (u16)(Result >> 16);
+        Overflow = (Op == Op_imul) ? ((s32)Result != (s16)Result) : ((Result >> 16) != 0);
+    }
+    else
+    {
+        u32 AL = State->Registers[Register_a] & 0xff;
+        u32 Result = (Op == Op_imul) ? (u32)((s32)(s8)AL * (s32)(s8)Source) : (AL * Source);
+        State->Registers[Register_a] = (u16)Result;
+        Overflow = (Op == Op_imul) ? ((s16)Result != (s8)Result) : (((Result >> 8) & 0xff) != 0);
+    }
+    
+    SetFlag(State, FlagBit_CF, Overflow);
+    SetFlag(State, FlagBit_OF, Overflow);
+}
+
+static b32 Divide(machine_state *State, operation_type Op, u32 Divisor, b32 Wide)
+{
+    // NOTE: Returns false, changing nothing, for a divide error (dividing by zero, or a quotient
+    // that doesn't fit). On the 8086, a signed quotient can't be the most negative value either.
+    b32 Result = (Divisor != 0);
+    if(Result)
+    {
+        if(Op == Op_idiv)
+        {
+            s64 Dividend = Wide ? (s32)(((u32)State->Registers[Register_d] << 16) | State->Registers[Register_a]) : (s16)State->Registers[Register_a];
+            s64 Signed = Wide ? (s16)Divisor : (s8)Divisor;
+            s64 Quotient = Dividend / Signed;
+            s64 Remainder = Dividend % Signed;
+            s64 Limit = Wide ? 0x7fff : 0x7f;
+            Result = ((Quotient <= Limit) && (Quotient >= -Limit));
+            if(Result && Wide)
+            {
+                State->Registers[Register_a] = (u16)Quotient;
+                State->Registers[Register_d] = (u16)Remainder;
+            }
+            else if(Result)
+            {
+                State->Registers[Register_a] = (u16)(((u8)Remainder << 8) | (u8)Quotient);
+            }
+        }
+        else
+        {
+            u32 Dividend = Wide ? (((u32)State->Registers[Register_d] << 16) | State->Registers[Register_a]) : State->Registers[Register_a];
+            u32 Quotient = Dividend / Divisor;
+            u32 Remainder = Dividend % Divisor;
+            Result = (Quotient <= GetWidthMask(Wide));
+            if(Result && Wide)
+            {
+                State->Registers[Register_a] = (u16)Quotient;
+                State->Registers[Register_d] = (u16)Remainder;
+            }
+            else if(Result)
+            {
+                State->Registers[Register_a] = (u16)((Remainder << 8) | Quotient);
+            }
+        }
+    }
+    
+    return Result;
+}
+
+static void AdjustForBCD(machine_state *State, operation_type Op)
+{
+    u32 AL = State->Registers[Register_a] & 0xff;
+    u32 AH = State->Registers[Register_a] >> 8;
+    b32 AF = GetFlag(State, FlagBit_AF);
+    b32 CF = GetFlag(State, FlagBit_CF);
+    
+    switch(Op)
+    {
+        case Op_aaa:
+        case Op_aas:
+        {
+            // NOTE: These only correct the low digit, and carry (or borrow) into AH.
+            b32 Adjust = (((AL & 0xf) > 9) || AF);
+            if(Adjust)
+            {
+                AL = (Op == Op_aaa) ? (AL + 6) : (AL - 6);
+                AH = (Op == Op_aaa) ? (AH + 1) : (AH - 1);
+            }
+            AL &= 0xf;
+            SetFlag(State, FlagBit_AF, Adjust);
+            SetFlag(State, FlagBit_CF, Adjust);
+        } break;
+        
+        case Op_daa:
+        case Op_das:
+        {
+            u32 Original = AL;
+            b32 AdjustLow = (((AL & 0xf) > 9) || AF);
+            b32 AdjustHigh = ((Original > 0x99) || CF);
+            if(AdjustLow)
+            {
+                AL = (Op == Op_daa) ? (AL + 6) : (AL - 6);
+            }
+            if(AdjustHigh)
+            {
+                AL = (Op == Op_daa) ? (AL + 0x60) : (AL - 0x60);
+            }
+            AL &= 0xff;
+            SetFlag(State, FlagBit_AF, AdjustLow);
+            
+            // NOTE: das also borrows when taking 6 off takes AL below zero. daa can't carry out
+            // of adding 6 without AdjustHigh being set already.
+            b32 Borrow = ((Op == Op_das) && AdjustLow && (Original < 6));
+            SetFlag(State, FlagBit_CF, AdjustHigh || Borrow);
+            SetResultFlags(State, AL, false);
+        } break;
+        
+        case Op_aam:
+        {
+            AH = AL / 10;
+            AL = AL % 10;
+            SetResultFlags(State, AL, false);
+        } break;
+        
+        case Op_aad:
+        {
+            AL = (AH*10 + AL) & 0xff;
+            AH = 0;
+            SetResultFlags(State, AL, false);
+        } break;
+        
+        default: {} break;
+    }
+    
+    State->Registers[Register_a] = (u16)(((AH & 0xff) << 8) | AL);
+}
+
+static b32 RepeatsWhileEqual(machine_state *State, instruction *Instruction)
+{
+    // NOTE: The decoder folds both rep/repe (f3) and repne (f2) into Inst_Rep, so which one it was
+    // is read back out of the prefix bytes. Every byte of a string instruction but the last is
+    // a prefix.
+    b32 Result = true;
+    paged_memory *Memory = State->Memory;
+    for(u32 Index = 0; (Index + 1) < Instruction->Size; ++Index)
+    {
+        u8 Prefix = *GetPagedByte(Memory, (Instruction->Address + Index) & Memory->Mask);
+        if(Prefix == 0xf2)
+        {
+            Result = false;
+        }
+        else if(Prefix == 0xf3)
+        {
+            Result = true;
+        }
+    }
+    
+    return Result;
+}
+
+static u32 ExecuteString(machine_state *State, instruction *Instruction)
+{
+    // NOTE: The source is DS:SI (or another segment, with a prefix) and the destination is always
+    // ES:DI. With a rep prefix, the whole repeat runs here, as one instruction. Returns how many
+    // times it ran.
+    paged_memory *Memory = State->Memory;
+    operation_type Op = Instruction->Op;
+    b32 Wide = ((Instruction->Flags & Inst_Wide) != 0);
+    u16 Step = (u16)(GetFlag(State, FlagBit_DF) ? -(Wide ? 2 : 1) : (Wide ? 2 : 1));
+    u16 SourceSegment = GetDataSegment(State, Instruction);
+    u16 DestSegment = State->Registers[Register_es];
+    
+    b32 Repeat = ((Instruction->Flags & Inst_Rep) != 0);
+    b32 WhileEqual = (Repeat && RepeatsWhileEqual(State, Instruction));
+    
+    u16 *SI = &State->Registers[Register_si];
+    u16 *DI = &State->Registers[Register_di];
+    u16 *CX = &State->Registers[Register_c];
+    u32 Result = 0;
+    while(!Repeat || *CX)
+    {
+        ++Result;
+        switch(Op)
+        {
+            case Op_movs:
+            {
+                WriteMachineMemory(Memory, DestSegment, *DI, Wide, ReadMachineMemory(Memory, SourceSegment, *SI, Wide));
+                *SI += Step;
+                *DI += Step;
+            } break;
+            
+            case Op_cmps:
+            {
+                Subtract(State, ReadMachineMemory(Memory, SourceSegment, *SI, Wide), ReadMachineMemory(Memory, DestSegment, *DI, Wide), 0, Wide);
+                *SI += Step;
+                *DI += Step;
+            } break;
+            
+            case Op_scas:
+            {
+                Subtract(State, ReadRegister(State, Accumulator(Wide)), ReadMachineMemory(Memory, DestSegment, *DI, Wide), 0, Wide);
+                *DI += Step;
+            } break;
+            
+            case Op_lods:
+            {
+                WriteRegister(State, Accumulator(Wide), ReadMachineMemory(Memory, SourceSegment, *SI, Wide));
+                *SI += Step;
+            } break;
+            
+            case Op_stos:
+            {
+                WriteMachineMemory(Memory, DestSegment, *DI, Wide, ReadRegister(State, Accumulator(Wide)));
+                *DI += Step;
+            } break;
+            
+            default: {} break;
+        }
+        
+        if(!Repeat)
+        {
+            break;
+        }
+        
+        --*CX;
+        if(((Op == Op_cmps) || (Op == Op_scas)) && (GetFlag(State, FlagBit_ZF) != WhileEqual))
+        {
+            break;
+        }
+    }
+    
+    return Result;
+}
+
+static b32 TestCondition(machine_state *State, operation_type Op)
+{
+    b32 CF = GetFlag(State, FlagBit_CF);
+    b32 ZF = GetFlag(State, FlagBit_ZF);
+    b32 SF = GetFlag(State, FlagBit_SF);
+    b32 OF = GetFlag(State, FlagBit_OF);
+    b32 PF = GetFlag(State, FlagBit_PF);
+    
+    b32 Result = false;
+    switch(Op)
+    {
+        case Op_jo: {Result = OF;} break;
+        case Op_jno: {Result = !OF;} break;
+        case Op_jb: {Result = CF;} break;
+        case Op_jnb: {Result = !CF;} break;
+        case Op_je: {Result = ZF;} break;
+        case Op_jne: {Result = !ZF;} break;
+        case Op_jbe: {Result = CF || ZF;} break;
+        case Op_ja: {Result = !CF && !ZF;} break;
+        case Op_js: {Result = SF;} break;
+        case Op_jns: {Result = !SF;} break;
+        case Op_jp: {Result = PF;} break;
+        case Op_jnp: {Result = !PF;} break;
+        case Op_jl: {Result = (SF != OF);} break;
+        case Op_jnl: {Result = (SF == OF);} break;
+        case Op_jle: {Result = ZF || (SF != OF);} break;
+        case Op_jg: {Result = !ZF && (SF == OF);} break;
+        default: {} break;
+    }
+    
+    return Result;
+}
+
+static void JumpRelative(machine_state *State, instruction_operand *Operand)
+{
+    State->Registers[Register_ip] += (u16)Operand->Immediate.Value;
+}
+
+static void JumpOrCall(machine_state *State, instruction *Instruction)
+{
+    // NOTE: Near (relative, or to an offset in a register or memory) and far (to an immediate
+    // segment:offset, or to a far pointer in memory). The target is worked out before anything
+    // is pushed, since it may be addressed through sp.
+    instruction_operand *Target = &Instruction->Operands[0];
+    
+    b32 Far = false;
+    u16 Segment = 0;
+    u16 Offset = 0;
+    if(Target->Type == Operand_Immediate)
+    {
+        Offset = (u16)(State->Registers[Register_ip] + Target->Immediate.Value);
+    }
+    else if((Target->Type == Operand_Memory) && (Target->Address.Flags & Address_ExplicitSegment))
+    {
+        Far = true;
+        Segment = (u16)Target->Address.ExplicitSegment;
+        Offset = (u16)Target->Address.Displacement;
+    }
+    else if(Instruction->Flags & Inst_Far)
+    {
+        Far = true;
+        Offset = (u16)ReadFarPointer(State, Instruction, Target, &Segment);
+    }
+    else
+    {
+        Offset = (u16)ReadOperand(State, Instruction, Target);
+    }
+    
+    if(Instruction->Op == Op_call)
+    {
+        if(Far)
+        {
+            Push(State, State->Registers[Register_cs]);
+        }
+        Push(State, State->Registers[Register_ip]);
+    }
+    
+    if(Far)
+    {
+        State->Registers[Register_cs] = Segment;
+    }
+    State->Registers[Register_ip] = Offset;
+}
+
+static machine_stop_reason ExecuteInstruction(machine_state *State, instruction *Instruction, instruction_clocks Clocks)
+{
+    // NOTE: IP has already been moved past the instruction, so relative jumps are relative to
+    // the next one, as on the 8086. Clocks is what GetInstructionClocks gives for it. An
+    // instruction that stops the machine changes nothing, and takes no clocks.
+    machine_stop_reason Result = MachineStop_None;
+    
+    operation_type Op = Instruction->Op;
+    instruction_operand *Dest = &Instruction->Operands[0];
+    instruction_operand *Source = &Instruction->Operands[1];
+    if(Dest->Type == Operand_None)
+    {
+        // NOTE: The short forms with the register in the opcode (push, pop, inc and dec) decode
+        // it into the second operand, since D is zero for them.
+        Dest = Source;
+    }
+    b32 Wide = IsWideOperand(Instruction, Dest);
+    u16 *Registers = State->Registers;
+    
+    // NOTE: Worked out before anything runs, since the instruction may change the registers its
+    // memory operand is addressed by.
+    u32 ClockCount = Clocks.Clocks;
+    if(Clocks.OddClocks)
+    {
+        instruction_operand *Memory = (Dest->Type == Operand_Memory) ? Dest : Source;
+        ClockCount += (GetEffectiveOffset(State, &Memory->Address) & 1) ? Clocks.OddClocks : 0;
+    }
+    
+    switch(Op)
+    {
+        case Op_mov:
+        {
+            WriteOperand(State, Instruction, Dest, ReadOperand(State, Instruction, Source));
+        } break;
+        
+        case Op_push:
+        {
+            // NOTE: push sp pushes sp as it is after the decrement, as on the 8086.
+            Registers[Register_sp] -= 2;
+            u16 Value = (u16)ReadOperand(State, Instruction, Dest);
+            WriteMachineMemory(State->Memory, Registers[Register_ss], Registers[Register_sp], true, Value);
+        } break;
+        
+        case Op_pop:
+        {
+            WriteOperand(State, Instruction, Dest, Pop(State));
+        } break;
+        
+        case Op_xchg:
+        {
+            u32 Temp = ReadOperand(State, Instruction, Dest);
+            WriteOperand(State, Instruction, Dest, ReadOperand(State, Instruction, Source));
+            WriteOperand(State, Instruction, Source, Temp);
+        } break;
+        
+        case Op_in:
+        {
+            // NOTE: Nothing is attached to any port, so reads float high.
+            WriteOperand(State, Instruction, Dest, GetWidthMask(Wide));
+        } break;
+        
+        case Op_out:
+        {
+        } break;
+        
+        case Op_xlat:
+        {
+            u16 Offset = (u16)(Registers[Register_b] + (Registers[Register_a] & 0xff));
+            WriteRegister(State, Accumulator(false), ReadMachineMemory(State->Memory, GetDataSegment(State, Instruction), Offset, false));
+        } break;
+        
+        case Op_lea:
+        {
+            WriteOperand(State, Instruction, Dest, GetEffectiveOffset(State, &Source->Address));
+        } break;
+        
+        case Op_lds:
+        case Op_les:
+        {
+            u16 Segment;
+            u32 Offset = ReadFarPointer(State, Instruction, Source, &Segment);
+            WriteOperand(State, Instruction, Dest, Offset);
+            Registers[(Op == Op_lds) ? Register_ds : Register_es] = Segment;
+        } break;
+        
+        case Op_lahf:
+        {
+            WriteRegister(State, {Register_a, 1, 1}, (Registers[Register_flags] | FLAGS_RESERVED_BITS) & 0xff);
+        } break;
+        
+        case Op_sahf:
+        {
+            Registers[Register_flags] = (u16)((Registers[Register_flags] & 0xff00) | (Registers[Register_a] >> 8)) & FLAGS_DEFINED_BITS;
+        } break;
+        
+        case Op_pushf:
+        {
+            Push(State, Registers[Register_flags] | FLAGS_RESERVED_BITS);
+        } break;
+        
+        case Op_popf:
+        {
+            Registers[Register_flags] = Pop(State) & FLAGS_DEFINED_BITS;
+        } break;
+        
+        case Op_add:
+        case Op_adc:
+        {
+            u32 CarryIn = (Op == Op_adc) ? GetFlag(State, FlagBit_CF) : 0;
+            WriteOperand(State, Instruction, Dest, Add(State, ReadOperand(State, Instruction, Dest), ReadOperand(State, Instruction, Source), CarryIn, Wide));
+        } break;
+        
+        case Op_sub:
+        case Op_sbb:
+        {
+            u32 BorrowIn = (Op == Op_sbb) ? GetFlag(State, FlagBit_CF) : 0;
+            WriteOperand(State, Instruction, Dest, Subtract(State, ReadOperand(State, Instruction, Dest), ReadOperand(State, Instruction, Source), BorrowIn, Wide));
+        } break;
+        
+        case Op_cmp:
+        {
+            Subtract(State, ReadOperand(State, Instruction, Dest), ReadOperand(State, Instruction, Source), 0, Wide);
+        } break;
+        
+        case Op_inc:
+        case Op_dec:
+        {
+            // NOTE: inc and dec leave CF alone.
+            b32 CF = GetFlag(State, FlagBit_CF);
+            u32 Value = ReadOperand(State, Instruction, Dest);
+            WriteOperand(State, Instruction, Dest, (Op == Op_inc) ? Add(State, Value, 1, 0, Wide) : Subtract(State, Value, 1, 0, Wide));
+            SetFlag(State, FlagBit_CF, CF);
+        } break;
+        
+        case Op_neg:
+        {
+            WriteOperand(State, Instruction, Dest, Subtract(State, 0, ReadOperand(State, Instruction, Dest), 0, Wide));
+        } break;
+        
+        case Op_aaa:
+        case Op_aas:
+        case Op_daa:
+        case Op_das:
+        case Op_aam:
+        case Op_aad:
+        {
+            AdjustForBCD(State, Op);
+        } break;
+        
+        case Op_mul:
+        case Op_imul:
+        {
+            Multiply(State, Op, ReadOperand(State, Instruction, Dest), Wide);
+        } break;
+        
+        case Op_div:
+        case Op_idiv:
+        {
+            if(!Divide(State, Op, ReadOperand(State, Instruction, Dest), Wide))
+            {
+                Interrupt(State, 0);
+            }
+        } break;
+        
+        case Op_cbw:
+        {
+            Registers[Register_a] = (u16)(s16)(s8)Registers[Register_a];
+        } break;
+        
+        case Op_cwd:
+        {
+            Registers[Register_d] = (Registers[Register_a] & 0x8000) ? 0xffff : 0;
+        } break;
+        
+        case Op_not:
+        {
+            WriteOperand(State, Instruction, Dest, ~ReadOperand(State, Instruction, Dest));
+        } break;
+        
+        case Op_shl:
+        case Op_shr:
+        case Op_sar:
+        case Op_rol:
+        case Op_ror:
+        case Op_rcl:
+        case Op_rcr:
+        {
+            u32 Count = ReadRegister(State, {Register_c, 0, 1});
+            if(Source->Type == Operand_Immediate)
+            {
+                Count = 1;
+            }
+            ClockCount += Count*Clocks.ExtraClocks;
+            WriteOperand(State, Instruction, Dest, ShiftOrRotate(State, Op, ReadOperand(State, Instruction, Dest), Count, Wide));
+        } break;
+        
+        case Op_and:
+        {
+            WriteOperand(State, Instruction, Dest, Logic(State, ReadOperand(State, Instruction, Dest) & ReadOperand(State, Instruction, Source), Wide));
+        } break;
+        
+        case Op_or:
+        {
+            WriteOperand(State, Instruction, Dest, Logic(State, ReadOperand(State, Instruction, Dest) | ReadOperand(State, Instruction, Source), Wide));
+        } break;
+        
+        case Op_xor:
+        {
+            WriteOperand(State, Instruction, Dest, Logic(State, ReadOperand(State, Instruction, Dest) ^ ReadOperand(State, Instruction, Source), Wide));
+        } break;
+        
+        case Op_test:
+        {
+            Logic(State, ReadOperand(State, Instruction, Dest) & ReadOperand(State, Instruction, Source), Wide);
+        } break;
+        
+        case Op_movs:
+        case Op_cmps:
+        case Op_scas:
+        case Op_lods:
+        case Op_stos:
+        {
+            u32 OddClocks = GetStringOddClocks(Instruction, Registers[Register_si], Registers[Register_di]);
+            ClockCount += ExecuteString(State, Instruction)*(Clocks.ExtraClocks + OddClocks);
+        } break;
+        
+        case Op_call:
+        case Op_jmp:
+        {
+            JumpOrCall(State, Instruction);
+        } break;
+        
+        case Op_ret:
+        case Op_retf:
+        {
+            Registers[Register_ip] = Pop(State);
+            if(Op == Op_retf)
+            {
+                Registers[Register_cs] = Pop(State);
+            }
+            if(Dest->Type == Operand_Immediate)
+            {
+                Registers[Register_sp] += (u16)Dest->Immediate.Value;
+            }
+        } break;
+        
+        case Op_jo: case Op_jno: case Op_jb: case Op_jnb: case Op_je: case Op_jne: case Op_jbe: case Op_ja:
+        case Op_js: case Op_jns: case Op_jp: case Op_jnp: case Op_jl: case Op_jnl: case Op_jle: case Op_jg:
+        {
+            if(TestCondition(State, Op))
+            {
+                JumpRelative(State, Dest);
+                ClockCount += Clocks.ExtraClocks;
+            }
+        } break;
+        
+        case Op_loop:
+        case Op_loopz:
+        case Op_loopnz:
+        {
+            u16 Count = --Registers[Register_c];
+            b32 ZF = GetFlag(State, FlagBit_ZF);
+            if(Count && ((Op == Op_loop) || ((Op == Op_loopz) == (ZF != 0))))
+            {
+                JumpRelative(State, Dest);
+                ClockCount += Clocks.ExtraClocks;
+            }
+        } break;
+        
+        case Op_jcxz:
+        {
+            if(Registers[Register_c] == 0)
+            {
+                JumpRelative(State, Dest);
+                ClockCount += Clocks.ExtraClocks;
+            }
+        } break;
+        
+        case Op_int:
+        {
+            Interrupt(State, Dest->Immediate.Value & 0xff);
+        } break;
+        
+        case Op_int3:
+        {
+            Interrupt(State, 3);
+        } break;
+        
+        case Op_into:
+        {
+            if(GetFlag(State, FlagBit_OF))
+            {
+                Interrupt(State, 4);
+                ClockCount += Clocks.ExtraClocks;
+            }
+        } break;
+        
+        case Op_iret:
+        {
+            Registers[Register_ip] = Pop(State);
+            Registers[Register_cs] = Pop(State);
+            Registers[Register_flags] = Pop(State) & FLAGS_DEFINED_BITS;
+        } break;
+        
+        case Op_clc: {SetFlag(State, FlagBit_CF, false);} break;
+        case Op_stc: {SetFlag(State, FlagBit_CF, true);} break;
+        case Op_cmc: {SetFlag(State, FlagBit_CF, !GetFlag(State, FlagBit_CF));} break;
+        case Op_cld: {SetFlag(State, FlagBit_DF, false);} break;
+        case Op_std: {SetFlag(State, FlagBit_DF, true);} break;
+        case Op_cli: {SetFlag(State, FlagBit_IF, false);} break;
+        case Op_sti: {SetFlag(State, FlagBit_IF, true);} break;
+        
+        case Op_hlt:
+        {
+            Result = MachineStop_Halt;
+        } break;
+        
+        case Op_wait:
+        case Op_esc:
+        case Op_lock:
+        case Op_rep:
+        case Op_segment:
+        {
+            // NOTE: There is no coprocessor, so wait never waits and esc does nothing. The
+            // prefixes only get here on their own if nothing followed them.
+        } break;
+        
+        default:
+        {
+            Result = MachineStop_Unimplemented;
+        } break;
+    }
+    
+    if(Result == MachineStop_None)
+    {
+        State->ClockCount += ClockCount;
+    }
+    
+    return Result;
+}
+
+static u32 CheckCodePage(decode_cache *Cache, paged_memory *Memory, u32 PageIndex)
+{
+    // NOTE: Returns the page's current generation, moving it on first if the page may have
+    // been written since the cache last looked at it.
+    if(!IsPageInSet(Memory->CodePages, PageIndex))
+    {
+        ++Cache->PageGenerations[PageIndex];
+        WatchCodePage(Memory, PageIndex);
+    }
+    
+    u32 Result = Cache->PageGenerations[PageIndex];
+    return Result;
+}
+
+static void SetCacheMemory(decode_cache *Cache, paged_memory *Memory)
+{
+    if(Cache->Memory != Memory)
+    {
+        Cache->Memory = Memory;
+        for(u32 PageIndex = 0; PageIndex < MAX_MEMORY_PAGE_COUNT; ++PageIndex)
+        {
+            ++Cache->PageGenerations[PageIndex];
+        }
+    }
+}
+
+static decode_cache_entry *FetchCacheEntry(opcode_table *Opcodes, decode_cache *Cache, paged_memory *Memory, u16 CS, u16 IP)
+{
+    SetCacheMemory(Cache, Memory);
+    
+    u32 Address = GetPhysicalAddress(Memory, CS, IP);
+    u32 PageIndex = Address >> MEMORY_PAGE_SIZE_POW2;
+    u32 NextPageIndex = (PageIndex + 1) & (Memory->PageCount - 1);
+    u32 Generation = CheckCodePage(Cache, Memory, PageIndex);
+    
+    decode_cache_entry *Result = &Cache->Entries[Address % DECODE_CACHE_ENTRY_COUNT];
+    instruction *Instruction = &Result->Instruction;
+    
+    b32 Hit = ((Instruction->Address == Address) && (Result->Generation == Generation) && Instruction->Op);
+    if(Hit && (((Address & MEMORY_PAGE_MASK) + Instruction->Size) > MEMORY_PAGE_SIZE))
+    {
+        Hit = (Result->NextGeneration == CheckCodePage(Cache, Memory, NextPageIndex));
+    }
+    
+    if(!Hit)
+    {
+        segmented_access At = PagedMemoryAccess(Memory);
+        At.SegmentBase = CS;
+        At.SegmentOffset = IP;
+        u32 EncodingFlags;
+        *Instruction = DecodeInstruction(Opcodes, At, &EncodingFlags);
+        Result->Lowered = {};
+        Result->Clocks = GetInstructionClocks(Get8086ClockTable(), Instruction, EncodingFlags);
+        
+        Result->Generation = Generation;
+        if(((u32)IP + Instruction->Size) > 0x10000)
+        {
+            // NOTE: This one wraps around to the start of its segment, which needn't be anywhere
+            // near the page it starts in, so it is decoded every time rather than kept.
+            Result->Generation = 0;
+        }
+        else if(((Address & MEMORY_PAGE_MASK) + Instruction->Size) > MEMORY_PAGE_SIZE)
+        {
+            Result->NextGeneration = CheckCodePage(Cache, Memory, NextPageIndex);
+        }
+    }
+    
+    return Result;
+}
+
+static machine_stop_reason StepMachine(opcode_table *Opcodes, machine_state *State)
+{
+    machine_stop_reason Result = MachineStop_None;
+    
+    u16 CS = State->Registers[Register_cs];
+    u16 IP = State->Registers[Register_ip];
+    if(State->ProgramSize && (GetPhysicalAddress(State->Memory, CS, IP) >= State->ProgramSize))
+    {
+        Result = MachineStop_EndOfProgram;
+    }
+    else
+    {
+        instruction Decoded;
+        instruction *Instruction = &Decoded;
+        instruction_clocks Clocks;
+        if(State->DecodeCache)
+        {
+            decode_cache_entry *Entry = FetchCacheEntry(Opcodes, State->DecodeCache, State->Memory, CS, IP);
+            Instruction = &Entry->Instruction;
+            Clocks = Entry->Clocks;
+        }
+        else
+        {
+            segmented_access At = PagedMemoryAccess(State->Memory);
+            At.SegmentBase = CS;
+            At.SegmentOffset = IP;
+            u32 EncodingFlags;
+            Decoded = DecodeInstruction(Opcodes, At, &EncodingFlags);
+            Clocks = GetInstructionClocks(Get8086ClockTable(), Instruction, EncodingFlags);
+        }
+        
+        if(Instruction->Op)
+        {
+            // NOTE: With TF set, the 8086 takes a type 1 interrupt after every instruction.
+            b32 Trap = GetFlag(State, FlagBit_TF);
+            
+            State->Registers[Register_ip] += (u16)Instruction->Size;
+            Result = ExecuteInstruction(State, Instruction, Clocks);
+            if(Result != MachineStop_None)
+            {
+                // NOTE: Anything that stops the machine leaves IP on the instruction that stopped
+                // it, so the state is exactly as it was before that instruction.
+                State->Registers[Register_ip] = IP;
+            }
+            else if(Trap)
+            {
+                Interrupt(State, 1);
+            }
+        }
+        else
+        {
+            Result = MachineStop_Unrecognized;
+        }
+    }
+    
+    return Result;
+}
+
+static machine_stop_reason RunMachine(opcode_table *Opcodes, machine_state *State, u64 MaxInstructions, u64 *InstructionCount)
+{
+    machine_stop_reason Result = MachineStop_None;
+    
+    u64 Count = 0;
+    while(!MaxInstructions || (Count < MaxInstructions))
+    {
+        Result = StepMachine(Opcodes, State);
+        if(Result != MachineStop_None)
+        {
+            break;
+        }
+        
+        ++Count;
+    }
+    
+    if(InstructionCount)
+    {
+        *InstructionCount = Count;
+    }
+    
+    return Result;
+}
@@ -0,0 +1,64 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+/* NOTE: The execution core. It runs a machine_state on its own paged memory, decoding each
+   instruction straight out of that memory at CS:IP, so a host only has to set up the state and
+   call RunMachine.
+   
+   Every instruction in the 8086 table is simulated, including interrupts (through the vector
+   table at address 0), divide errors and single-stepping with TF. There are no devices: in
+   reads all ones, out goes nowhere, and there is no coprocessor for esc or wait.
+   
+   Threading: nothing here is shared between machines except the opcode table, which is only
+   read. Any number of threads can run machines at once, as long as each machine (and its
+   paged memory) is only run by one of them at a time.
+*/
+
+/* NOTE: A decode cache keeps the decoded instruction for each physical address that has run,
+   so a loop is only decoded on its first time around. It is direct-mapped on the low bits of
+   the address, so any 4k of code fits without two instructions fighting over an entry.
+   
+   Entries aren't cleared when code changes. Instead, each page of memory has a generation,
+   and an entry is only used if it was decoded under the current generation of its page (and
+   of the next page too, for the few instructions that run over into it). Memory tells the
+   cache which pages may have changed through CodePages (see sim86_paged_memory.h), and the
+   cache moves those pages on to a new generation the next time it fetches from them.
+   
+   A decode cache can be used with any machine, but only by one at a time, and only on one
+   thread at a time. Switching it to different memory starts every page on a new generation.
+*/
+
+static u32 const DECODE_CACHE_ENTRY_COUNT = 4096;
+
+struct decode_cache_entry
+{
+    instruction Instruction;
+    lowered_instruction Lowered; // NOTE: For the threaded interpreter (see sim86_threaded.h)
+    instruction_clocks Clocks; // NOTE: Worked out when it is decoded (see sim86_clocks.h)
+    u32 Generation;
+    u32 NextGeneration;
+};
+
+struct decode_cache
+{
+    paged_memory *Memory;
+    u32 PageGenerations[MAX_MEMORY_PAGE_COUNT];
+    decode_cache_entry Entries[DECODE_CACHE_ENTRY_COUNT];
+};
+
+static machine_stop_reason ExecuteInstruction(machine_state *State, instruction *Instruction, instruction_clocks Clocks);
+static machine_stop_reason StepMachine(opcode_table *Opcodes, machine_state *State);
+
+// NOTE: Runs until the machine stops, or for MaxInstructions instructions if that comes first
+// (zero means no limit). InstructionCount, if given, is how many instructions were executed.
+static machine_stop_reason RunMachine(opcode_table *Opcodes, machine_state *State, u64 MaxInstructions, u64 *InstructionCount = 0);
@@ -0,0 +1,197 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+#define FANOUT_BATCH_SIZE 8
+
+struct fanout
+{
+    opcode_table *Opcodes;
+    machine_state *Start;
+    u32 InputCount;
+    machine_input *Inputs;
+    u32 VariantCount;
+    variant_result *Results;
+    u64 MaxInstructions;
+    
+    // NOTE: One clone of the starting memory per thread, handed out in the order threads start.
+    paged_memory *Clones;
+    u32 volatile NextClone;
+    u32 volatile NextBatch;
+};
+
+static u32 FindFirstInput(fanout *Fanout, u32 Variant)
+{
+    // NOTE: Inputs are sorted by Variant, so this is the first one for Variant or anything after.
+    u32 Low = 0;
+    u32 High = Fanout->InputCount;
+    while(Low < High)
+    {
+        u32 Middle = (Low + High) / 2;
+        if(Fanout->Inputs[Middle].Variant < Variant)
+        {
+            Low = Middle + 1;
+        }
+        else
+        {
+            High = Middle;
+        }
+    }
+    
+    return Low;
+}
+
+static void ApplyInput(machine_state *State, machine_input *Input)
+{
+    paged_memory *Memory = State->Memory;
+    u32 Address = Input->Address & Memory->Mask;
+    
+    switch(Input->Type)
+    {
+        case Input_Register:
+        {
+            State->Registers[Input->Register] = Input->Value;
+        } break;
+        
+        case Input_Byte:
+        {
+            WritePagedByte(Memory, Address, (u8)Input->Value);
+        } break;
+        
+        case Input_Word:
+        {
+            WritePagedU16(Memory, Address, Input->Value);
+        } break;
+    }
+}
+
+static u32 CountPages(u64 const *PageBits)
+{
+    u32 Result = 0;
+    for(u32 PageIndex = 0; PageIndex < MAX_MEMORY_PAGE_COUNT; ++PageIndex)
+    {
+        Result += IsPageInSet(PageBits, PageIndex);
+    }
+    
+    return Result;
+}
+
+static void FanoutWorker(void *Data)
+{
+    fanout *Fanout = (fanout *)Data;
+    paged_memory *Memory = &Fanout->Clones[AtomicIncrement(&Fanout->NextClone)];
+    
+    // NOTE: The clone is only reverted between variants, never replaced, so the code each
+    // variant decodes stays decoded for the next one unless a variant writes over it. Without
+    // a cache, variants still run, just decoding every instruction.
+    decode_cache *Cache = (decode_cache *)calloc(1, sizeof(decode_cache));
+    
+    for(;;)
+    {
+        u32 FirstVariant = AtomicIncrement(&Fanout->NextBatch)*FANOUT_BATCH_SIZE;
+        if(FirstVariant >= Fanout->VariantCount)
+        {
+            break;
+        }
+        
+        u32 EndVariant = Fanout->VariantCount - FirstVariant;
+        EndVariant = FirstVariant + ((EndVariant < FANOUT_BATCH_SIZE) ? EndVariant : FANOUT_BATCH_SIZE);
+        
+        u32 InputIndex = FindFirstInput(Fanout, FirstVariant);
+        for(u32 Variant = FirstVariant; Variant < EndVariant; ++Variant)
+        {
+            machine_state State = *Fanout->Start;
+            State.Memory = Memory;
+            State.DecodeCache = Cache;
+            
+            while((InputIndex < Fanout->InputCount) && (Fanout->Inputs[InputIndex].Variant == Variant))
+            {
+                ApplyInput(&State, &Fanout->Inputs[InputIndex++]);
+            }
+            
+            variant_result *Result = &Fanout->Results[Variant];
+            Result->StopReason = RunThreaded(Fanout->Opcodes, &State, Fanout->MaxInstructions, &Result->InstructionCount);
+            memcpy(Result->Registers, State.Registers, sizeof(Result->Registers));
+            Result->ClockCount = State.ClockCount;
+            Result->DirtyPageCount = CountPages(Memory->DirtyPages);
+            
+            RevertDirtyPages(Memory, Fanout->Start->Memory);
+        }
+    }
+    
+    free(Cache);
+}
+
+static b32 RunVariants(machine_state *Start, u32 InputCount, machine_input *Inputs,
+                       u32 VariantCount, variant_result *Results, u64 MaxInstructions, u32 ThreadCount)
+{
+    // NOTE: Returns false, without running anything, if an input is out of order or out of
+    // range, or if the clones can't be allocated.
+    b32 Result = true;
+    for(u32 InputIndex = 0; Result && (InputIndex < InputCount); ++InputIndex)
+    {
+        machine_input *Input = &Inputs[InputIndex];
+        Result = ((Input->Variant < VariantCount) &&
+                  ((InputIndex == 0) || (Inputs[InputIndex - 1].Variant <= Input->Variant)) &&
+                  ((Input->Type != Input_Register) || ((Input->Register > 0) && (Input->Register < MACHINE_REGISTER_COUNT))) &&
+                  (Input->Type <= Input_Word));
+    }
+    
+    u32 BatchCount = (VariantCount + FANOUT_BATCH_SIZE - 1) / FANOUT_BATCH_SIZE;
+    if(ThreadCount == 0)
+    {
+        ThreadCount = GetLogicalProcessorCount();
+    }
+    if(ThreadCount > BatchCount)
+    {
+        ThreadCount = BatchCount;
+    }
+    if(ThreadCount > SIM86_MAX_THREAD_COUNT)
+    {
+        ThreadCount = SIM86_MAX_THREAD_COUNT;
+    }
+    
+    fanout Fanout = {};
+    if(Result && ThreadCount)
+    {
+        Fanout.Clones = (paged_memory *)malloc(ThreadCount*sizeof(paged_memory));
+        Result = (Fanout.Clones != 0);
+    }
+    
+    if(Result && ThreadCount)
+    {
+        Fanout.Opcodes = Get8086OpcodeTable();
+        Fanout.Start = Start;
+        Fanout.InputCount = InputCount;
+        Fanout.Inputs = Inputs;
+        Fanout.VariantCount = VariantCount;
+        Fanout.Results = Results;
+        Fanout.MaxInstructions = MaxInstructions;
+        
+        // NOTE: Cloning writes to the source's page table, so the clones all have to be made
+        // here, before any of the threads start reading it.
+        for(u32 CloneIndex = 0; CloneIndex < ThreadCount; ++CloneIndex)
+        {
+            ClonePagedMemory(Start->Memory, &Fanout.Clones[CloneIndex]);
+        }
+        
+        RunOnThreads(ThreadCount, FanoutWorker, &Fanout);
+        
+        for(u32 CloneIndex = 0; CloneIndex < ThreadCount; ++CloneIndex)
+        {
+            ReleasePagedMemory(&Fanout.Clones[CloneIndex]);
+        }
+    }
+    
+    free(Fanout.Clones);
+    
+    return Result;
+}
@@ -0,0 +1,50 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+/* NOTE: Fan-out runs the same starting machine_state many times over, each time with a few of its
+   inputs changed - a variant. Every variant starts from a copy-on-write clone of the starting
+   memory, so it only pays for the pages it writes, never for a copy of the whole megabyte.
+   
+   Inputs are a flat list of machine_inputs, sorted by Variant, and any variant can have any
+   number of them (including none). Results has one variant_result per variant, in order.
+   Variants run on a pool of threads, each of which keeps one clone of the starting memory and
+   puts back only the pages a variant dirtied before running the next one.
+   
+   The starting machine_state and its memory must not be touched while variants are running.
+   Its memory loses write access to every page, as with any clone.
+*/
+
+enum machine_input_type : u8
+{
+    Input_Register, // NOTE: Registers[Register] = Value
+    Input_Byte, // NOTE: The byte at physical Address = Value
+    Input_Word, // NOTE: The word at physical Address = Value
+};
+
+struct machine_input
+{
+    u32 Variant;
+    u32 Address;
+    u16 Value;
+    u8 Type;
+    u8 Register;
+};
+
+struct variant_result
+{
+    u16 Registers[MACHINE_REGISTER_COUNT];
+    u64 ClockCount;
+    u64 InstructionCount;
+    u32 StopReason; // NOTE: machine_stop_reason
+    u32 DirtyPageCount; // NOTE: How many pages the variant wrote to
+};
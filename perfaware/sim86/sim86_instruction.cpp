@@ -69,3 +69,143 @@ static instruction_operand ImmediateOperand(u32 Value, u32 Flags = 0)
     
     return Result;
 }
+
+static_assert(sizeof(compact_instruction) == 16, "compact_instruction must stay 16 bytes");
+
+static instruction_operand UnpackOperand(u32 Form, compact_operand Source)
+{
+    instruction_operand Result = {};
+    
+    switch(Form)
+    {
+        case CompactOperand_Register:
+        {
+            Result.Type = Operand_Register;
+            Result.Register = RegisterAccess(Source.Info & 0xf, (Source.Info >> 4) & 0xf, Source.Info >> 8);
+        } break;
+        
+        case CompactOperand_Memory:
+        {
+            Result = EffectiveAddressOperand(RegisterAccess(Source.Info & 0xf, 0, 2), RegisterAccess((Source.Info >> 4) & 0xf, 0, 2),
+                                             (s16)Source.Value);
+        } break;
+        
+        case CompactOperand_MemoryExplicitSegment:
+        {
+            Result = IntersegmentAddressOperand(Source.Info, Source.Value);
+        } break;
+        
+        case CompactOperand_ImmediateUnsigned:
+        {
+            Result = ImmediateOperand(Source.Value);
+        } break;
+        
+        case CompactOperand_ImmediateSigned:
+        {
+            Result = ImmediateOperand((s16)Source.Value);
+        } break;
+        
+        case CompactOperand_RelativeJumpDisplacement:
+        {
+            Result = ImmediateOperand((s16)Source.Value, Immediate_RelativeJumpDisplacement);
+        } break;
+    }
+    
+    return Result;
+}
+
+static void PackOperand(instruction_operand Operand, u8 *Form, compact_operand *Dest)
+{
+    *Form = CompactOperand_None;
+    *Dest = {};
+    
+    switch(Operand.Type)
+    {
+        case Operand_None: {} break;
+        
+        case Operand_Register:
+        {
+            register_access Reg = Operand.Register;
+            *Form = CompactOperand_Register;
+            Dest->Info = (u16)(Reg.Index | (Reg.Offset << 4) | (Reg.Count << 8));
+        } break;
+        
+        case Operand_Memory:
+        {
+            effective_address_expression Address = Operand.Address;
+            Dest->Value = (u16)Address.Displacement;
+            if(Address.Flags & Address_ExplicitSegment)
+            {
+                *Form = CompactOperand_MemoryExplicitSegment;
+                Dest->Info = (u16)Address.ExplicitSegment;
+            }
+            else
+            {
+                *Form = CompactOperand_Memory;
+                Dest->Info = (u16)(Address.Terms[0].Register.Index | (Address.Terms[1].Register.Index << 4));
+            }
+        } break;
+        
+        case Operand_Immediate:
+        {
+            immediate Immediate = Operand.Immediate;
+            Dest->Value = (u16)Immediate.Value;
+            if(Immediate.Flags & Immediate_RelativeJumpDisplacement)
+            {
+                *Form = CompactOperand_RelativeJumpDisplacement;
+            }
+            else
+            {
+                *Form = (Immediate.Value < 0) ? CompactOperand_ImmediateSigned : CompactOperand_ImmediateUnsigned;
+            }
+        } break;
+    }
+}
+
+static instruction UnpackInstruction(compact_instruction Source)
+{
+    instruction Result = {};
+    
+    Result.Address = Source.Address;
+    Result.Size = Source.SizeAndSegmentOverride & 0xf;
+    Result.Op = (operation_type)Source.Op;
+    Result.Flags = Source.Flags;
+    Result.Operands[0] = UnpackOperand(Source.Forms & 0xf, Source.Operands[0]);
+    Result.Operands[1] = UnpackOperand(Source.Forms >> 4, Source.Operands[1]);
+    Result.SegmentOverride = Source.SizeAndSegmentOverride >> 4;
+    
+    return Result;
+}
+
+static compact_instruction PackDecodedInstruction(instruction Source)
+{
+    // NOTE: This does no checking at all, so it is only for instructions straight out of the
+    // decoder, which always fit. Anything else should go through PackInstruction.
+    compact_instruction Result = {};
+    
+    Result.Address = Source.Address;
+    Result.Op = (u8)Source.Op;
+    Result.Flags = (u8)Source.Flags;
+    Result.SizeAndSegmentOverride = (u8)(Source.Size | (Source.SegmentOverride << 4));
+    
+    u8 Form0, Form1;
+    PackOperand(Source.Operands[0], &Form0, &Result.Operands[0]);
+    PackOperand(Source.Operands[1], &Form1, &Result.Operands[1]);
+    Result.Forms = (u8)(Form0 | (Form1 << 4));
+    
+    return Result;
+}
+
+static b32 PackInstruction(instruction Source, compact_instruction *Dest)
+{
+    // NOTE: Returns false if the instruction can't be represented exactly. That never happens
+    // for instructions that came out of the decoder, but instructions built by hand can have
+    // field values the compact form has no room for. Rather than range-checking every field,
+    // this just checks that the packed instruction unpacks to exactly what we started with.
+    *Dest = PackDecodedInstruction(Source);
+    
+    instruction Unpacked = UnpackInstruction(*Dest);
+    b32 Result = (memcmp(&Unpacked, &Source, sizeof(Source)) == 0);
+    
+    return Result;
+}
@@ -95,3 +95,60 @@ struct instruction
     
     u32 SegmentOverride;
 };
+
+/* NOTE: compact_instruction is a 16-byte packed form of instruction, for holding large
+   numbers of decoded instructions in memory. PackInstruction/UnpackInstruction convert
+   between the two losslessly for anything the decoder produces.
+   
+   Each operand is a 4-bit compact_operand_form plus 4 bytes, whose meaning depends on the form:
+   
+   Register:                Info = Index | (Offset << 4) | (Count << 8)
+   Memory:                  Info = Term0 index | (Term1 index << 4), Value = displacement
+   Memory, explicit segment: Info = segment, Value = displacement
+   Immediate:               Value = value (zero-extended for _Unsigned, sign-extended for _Signed)
+*/
+enum compact_operand_form : u8
+{
+    CompactOperand_None,
+    CompactOperand_Register,
+    CompactOperand_Memory,
+    CompactOperand_MemoryExplicitSegment,
+    CompactOperand_ImmediateUnsigned,
+    CompactOperand_ImmediateSigned,
+    CompactOperand_RelativeJumpDisplacement,
+};
+struct compact_operand
+{
+    u16 Info;
+    u16 Value;
+};
+struct compact_instruction
+{
+    u32 Address;
+    
+    u8 Op;
+    u8 Flags;
+    u8 SizeAndSegmentOverride; // NOTE: Size in the low 4 bits, SegmentOverride in the high 4 bits
+    u8 Forms; // NOTE: compact_operand_form of operand 0 in the low 4 bits, operand 1 in the high 4 bits
+    
+    compact_operand Operands[2];
+};
+
+enum decode_stop_reason : u32
+{
+    DecodeStop_EndOfSource, // NOTE: Every byte of the source was decoded
+    DecodeStop_DestFull, // NOTE: The destination array filled up before the source ran out
+    DecodeStop_Unrecognized, // NOTE: The bytes at BytesDecoded are not a valid 8086 instruction
+    DecodeStop_Truncated, // NOTE: The instruction at BytesDecoded extends past the end of the source
+};
+struct decode_block_result
+{
+    u32 InstructionCount;
+    u32 BytesDecoded;
+    decode_stop_reason StopReason;
+};
+
+enum decoder_flag : u32
+{
+    Decoder_CopySource = 0x1, // NOTE: The decoder keeps its own padded copy of the source, instead of a view of the caller's memory
+};
@@ -0,0 +1,1385 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+// NOTE: Host registers, numbered the way x86-64 encodes them.
+enum jit_host_register : u8
+{
+    Host_rax,
+    Host_rcx,
+    Host_rdx,
+    Host_rbx,
+    Host_rsp,
+    Host_rbp,
+    Host_rsi,
+    Host_rdi,
+    Host_r8,
+    Host_r9,
+    Host_r10,
+    Host_r11,
+    Host_r12,
+    Host_r13,
+    Host_r14,
+    Host_r15,
+    
+    Host_None = 0xff,
+};
+
+/* NOTE: Register use in compiled code:
+
+   eax, ebx, ecx, edx, ebp, esi, edi   guest ax, bx, cx, dx, bp, si, di (zero-extended)
+   r8d                                 guest sp
+   r10                                 clocks not yet added to State->ClockCount
+   r12d                                the value of a memory operand, or ax during a budget check
+   r13d                                the offset of a memory operand
+   r14                                 the instruction budget that is left
+   r15                                 the machine_state
+   
+   [rsp + 32] holds the host flags across calls that have to keep them.
+*/
+
+static u8 const JITHostRegisters[MACHINE_REGISTER_COUNT] =
+{
+    Host_None,
+    Host_rax, // NOTE: ax
+    Host_rbx, // NOTE: bx
+    Host_rcx, // NOTE: cx
+    Host_rdx, // NOTE: dx
+    Host_r8, // NOTE: sp
+    Host_rbp, // NOTE: bp
+    Host_rsi, // NOTE: si
+    Host_rdi, // NOTE: di
+    Host_None, Host_None, Host_None, Host_None, Host_None, Host_None, Host_None,
+};
+
+static u8 const JITSavedHostRegisters[] = {Host_rbx, Host_rbp, Host_rsi, Host_rdi, Host_r12, Host_r13, Host_r14, Host_r15};
+
+#if _WIN32
+static u8 const JITArgumentRegisters[] = {Host_rcx, Host_rdx, Host_r8, Host_r9};
+static u32 const JIT_VOLATILE_HOST_REGISTERS = 0x0f07; // NOTE: rax, rcx, rdx, r8-r11
+#else
+static u8 const JITArgumentRegisters[] = {Host_rdi, Host_rsi, Host_rdx, Host_rcx};
+static u32 const JIT_VOLATILE_HOST_REGISTERS = 0x0fc7; // NOTE: rax, rcx, rdx, rsi, rdi, r8-r11
+#endif
+
+static u32 const JIT_FRAME_SIZE = 40;
+static s32 const JIT_FLAGS_SLOT = 32;
+static u16 const JIT_ARITHMETIC_FLAGS = (FlagBit_CF | FlagBit_PF | FlagBit_AF | FlagBit_ZF | FlagBit_SF | FlagBit_OF);
+
+enum jit_size : u8
+{
+    JITSize_8,
+    JITSize_16,
+    JITSize_32,
+    JITSize_64,
+};
+
+struct jit_emitter
+{
+    u8 *Base;
+    u32 Capacity;
+    u32 Used;
+    b32 Overflowed;
+};
+
+static void EmitByte(jit_emitter *Emitter, u32 Value)
+{
+    if(Emitter->Used < Emitter->Capacity)
+    {
+        Emitter->Base[Emitter->Used++] = (u8)Value;
+    }
+    else
+    {
+        Emitter->Overflowed = true;
+    }
+}
+
+static void EmitBytes(jit_emitter *Emitter, u32 Count, u64 Value)
+{
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        EmitByte(Emitter, (u32)(Value >> (8*Index)));
+    }
+}
+
+static void EmitImmediate(jit_emitter *Emitter, jit_size Size, u64 Value)
+{
+    u32 Count = (Size == JITSize_8) ? 1 : (Size == JITSize_16) ? 2 : (Size == JITSize_32) ? 4 : 8;
+    EmitBytes(Emitter, Count, Value);
+}
+
+static void EmitPrefixes(jit_emitter *Emitter, jit_size Size, u32 Reg, u32 Index, u32 Base)
+{
+    if(Size == JITSize_16)
+    {
+        EmitByte(Emitter, 0x66);
+    }
+    
+    u32 REX = ((Size == JITSize_64) ? 8 : 0) | ((Reg & 8) >> 1) | ((Index & 8) >> 2) | ((Base & 8) >> 3);
+    if(REX)
+    {
+        EmitByte(Emitter, 0x40 | REX);
+    }
+}
+
+static void EmitOpcode(jit_emitter *Emitter, u32 Opcode)
+{
+    // NOTE: Two-byte opcodes are written high byte first, as in 0x0fb7 for movzx.
+    if(Opcode > 0xff)
+    {
+        EmitByte(Emitter, Opcode >> 8);
+    }
+    EmitByte(Emitter, Opcode & 0xff);
+}
+
+static void EmitRegisterForm(jit_emitter *Emitter, jit_size Size, u32 Opcode, u32 Reg, u32 RM)
+{
+    // NOTE: Byte registers 4-7 are ah, ch, dh and bh only without a REX prefix, so they can't be
+    // mixed with r8-r15 (see CanCompile).
+    EmitPrefixes(Emitter, Size, Reg, 0, RM);
+    EmitOpcode(Emitter, Opcode);
+    EmitByte(Emitter, 0xc0 | ((Reg & 7) << 3) | (RM & 7));
+}
+
+static void EmitMemoryForm(jit_emitter *Emitter, jit_size Size, u32 Opcode, u32 Reg, u32 Base, u32 Index, s32 Displacement)
+{
+    // NOTE: [Base + Index + Displacement], always with a 32-bit displacement, so that rbp and r13
+    // need no special case. Index is Host_None for none.
+    b32 HasIndex = (Index != Host_None);
+    EmitPrefixes(Emitter, Size, Reg, HasIndex ? Index : 0, Base);
+    EmitOpcode(Emitter, Opcode);
+    if(HasIndex || ((Base & 7) == Host_rsp))
+    {
+        EmitByte(Emitter, 0x84 | ((Reg & 7) << 3));
+        EmitByte(Emitter, ((HasIndex ? (Index & 7) : 4) << 3) | (Base & 7));
+    }
+    else
+    {
+        EmitByte(Emitter, 0x80 | ((Reg & 7) << 3) | (Base & 7));
+    }
+    EmitBytes(Emitter, 4, (u32)Displacement);
+}
+
+static void EmitAluImmediate(jit_emitter *Emitter, jit_size Size, u32 Extension, u32 RM, u32 Immediate)
+{
+    EmitRegisterForm(Emitter, Size, (Size == JITSize_8) ? 0x80 : 0x81, Extension, RM);
+    EmitImmediate(Emitter, (Size == JITSize_64) ? JITSize_32 : Size, Immediate);
+}
+
+static void EmitMoveImmediate(jit_emitter *Emitter, jit_size Size, u32 Register, u64 Immediate)
+{
+    EmitPrefixes(Emitter, Size, 0, 0, Register);
+    EmitByte(Emitter, ((Size == JITSize_8) ? 0xb0 : 0xb8) | (Register & 7));
+    EmitImmediate(Emitter, Size, Immediate);
+}
+
+static void EmitPush(jit_emitter *Emitter, u32 Register)
+{
+    EmitPrefixes(Emitter, JITSize_32, 0, 0, Register);
+    EmitByte(Emitter, 0x50 | (Register & 7));
+}
+
+static void EmitPop(jit_emitter *Emitter, u32 Register)
+{
+    EmitPrefixes(Emitter, JITSize_32, 0, 0, Register);
+    EmitByte(Emitter, 0x58 | (Register & 7));
+}
+
+static s32 GetRegisterOffset(u32 Register)
+{
+    s32 Result = (s32)(offsetof(machine_state, Registers) + Register*sizeof(u16));
+    return Result;
+}
+
+static void EmitLoadGuestRegister(jit_emitter *Emitter, u32 Register)
+{
+    // NOTE: movzx r32, word [r15 + Registers[Register]]
+    EmitMemoryForm(Emitter, JITSize_32, 0x0fb7, JITHostRegisters[Register], Host_r15, Host_None, GetRegisterOffset(Register));
+}
+
+static void EmitStoreGuestRegister(jit_emitter *Emitter, u32 Register)
+{
+    EmitMemoryForm(Emitter, JITSize_16, 0x89, JITHostRegisters[Register], Host_r15, Host_None, GetRegisterOffset(Register));
+}
+
+static void EmitSaveFlags(jit_emitter *Emitter)
+{
+    // NOTE: pushfq, pop qword [rsp + JIT_FLAGS_SLOT]
+    EmitByte(Emitter, 0x9c);
+    EmitMemoryForm(Emitter, JITSize_32, 0x8f, 0, Host_rsp, Host_None, JIT_FLAGS_SLOT);
+}
+
+static void EmitRestoreFlags(jit_emitter *Emitter)
+{
+    // NOTE: push qword [rsp + JIT_FLAGS_SLOT], popfq
+    EmitMemoryForm(Emitter, JITSize_32, 0xff, 6, Host_rsp, Host_None, JIT_FLAGS_SLOT);
+    EmitByte(Emitter, 0x9d);
+}
+
+static void EmitRestoreGuardFlags(jit_emitter *Emitter)
+{
+    // NOTE: Undoes what EmitGuard saved: al + 0x7f overflows only if OF was set, then sahf puts
+    // back the rest, then ax comes back from r12d.
+    EmitByte(Emitter, 0x04);
+    EmitByte(Emitter, 0x7f);
+    EmitByte(Emitter, 0x9e);
+    EmitRegisterForm(Emitter, JITSize_32, 0x89, Host_r12, Host_rax);
+}
+
+static void EmitAdjustBudget(jit_emitter *Emitter, s32 Delta)
+{
+    // NOTE: lea leaves the flags alone, where add and sub would not.
+    EmitMemoryForm(Emitter, JITSize_64, 0x8d, Host_r14, Host_r14, Host_None, Delta);
+}
+
+static void EmitAddClocks(jit_emitter *Emitter, s32 Clocks)
+{
+    // NOTE: lea again, for the same reason.
+    EmitMemoryForm(Emitter, JITSize_64, 0x8d, Host_r10, Host_r10, Host_None, Clocks);
+}
+
+static void EmitFlushClocks(jit_emitter *Emitter)
+{
+    // NOTE: add [r15 + ClockCount], r10 - this one does change the flags.
+    EmitMemoryForm(Emitter, JITSize_64, 0x01, Host_r10, Host_r15, Host_None, (s32)offsetof(machine_state, ClockCount));
+}
+
+static u32 EmitJump(jit_emitter *Emitter, u32 Opcode)
+{
+    // NOTE: Returns where the 32-bit displacement is, to be filled in once the target is known.
+    EmitOpcode(Emitter, Opcode);
+    u32 Result = Emitter->Used;
+    EmitBytes(Emitter, 4, 0);
+    return Result;
+}
+
+static u32 JITReadMemory(machine_state *State, u32 SegmentAndOffset, u32 Wide)
+{
+    // NOTE: Called from compiled code. The segment register index is in the high 16 bits. Each
+    // call is one transfer, so this is where an odd word costs its extra clocks.
+    u16 Segment = State->Registers[SegmentAndOffset >> 16];
+    u32 Result = ReadMachineMemory(State->Memory, Segment, (u16)SegmentAndOffset, Wide);
+    State->ClockCount += (Wide && (SegmentAndOffset & 1)) ? CLOCKS_PER_ODD_TRANSFER : 0;
+    return Result;
+}
+
+static u32 JITWriteMemory(machine_state *State, u32 SegmentAndOffset, u32 Value, u32 Wide)
+{
+    // NOTE: Called from compiled code. Returns whether the write landed on a page some code was
+    // decoded from, in which case the compiled code stops right away.
+    paged_memory *Memory = State->Memory;
+    u16 Segment = State->Registers[SegmentAndOffset >> 16];
+    u16 Offset = (u16)SegmentAndOffset;
+    
+    u32 FirstPage = GetPhysicalAddress(Memory, Segment, Offset) >> MEMORY_PAGE_SIZE_POW2;
+    u32 LastPage = GetPhysicalAddress(Memory, Segment, (u16)(Offset + (Wide ? 1 : 0))) >> MEMORY_PAGE_SIZE_POW2;
+    u32 Result = (IsPageInSet(Memory->CodePages, FirstPage) || IsPageInSet(Memory->CodePages, LastPage));
+    
+    WriteMachineMemory(Memory, Segment, Offset, Wide, Value);
+    State->ClockCount += (Wide && (Offset & 1)) ? CLOCKS_PER_ODD_TRANSFER : 0;
+    return Result;
+}
+
+enum jit_stub_type : u8
+{
+    JITStub_Exit, // NOTE: Leave with IP set
+    JITStub_Guard, // NOTE: Not enough budget left - put back the flags saved by the check, then leave
+    JITStub_Write, // NOTE: Wrote to code - put back the saved flags and the unused budget, then leave
+};
+
+struct jit_stub
+{
+    u8 Type;
+    u16 IP;
+    u32 BudgetRefund;
+    u32 Offset;
+};
+
+struct jit_fixup
+{
+    u32 At;
+    s32 Instruction; // NOTE: The instruction jumped to, or -1 for a stub
+    u32 Stub;
+};
+
+struct jit_region_instruction
+{
+    instruction Instruction;
+    lowered_instruction Lowered;
+    
+    u16 IP;
+    u16 NextIP;
+    u16 TargetIP;
+    b32 FallsThrough;
+    b32 Jumps;
+    
+    // NOTE: Indices of the instructions falling through to and jumping to, -1 if they are
+    // outside the region.
+    s32 Next;
+    s32 Target;
+    
+    b32 Entry;
+    b32 Leader; // NOTE: Starts a basic block
+    b32 Header; // NOTE: Has its budget checked - the entry and anything a jump goes back to
+    u32 BlockLength;
+    u32 BlockRemaining; // NOTE: How many instructions after this one are in its block
+    u32 Longest; // NOTE: Most instructions that can run from here before the next check
+    
+    u16 FlagsUsed;
+    u16 FlagsSet;
+    u16 LiveIn;
+    u16 LiveOut;
+    
+    u32 Label;
+};
+
+struct jit_compiler
+{
+    jit_emitter Emitter;
+    
+    u32 InstructionCount;
+    jit_region_instruction Instructions[JIT_MAX_REGION_SIZE];
+    
+    u32 FixupCount;
+    jit_fixup Fixups[8*JIT_MAX_REGION_SIZE];
+    
+    u32 StubCount;
+    jit_stub Stubs[4*JIT_MAX_REGION_SIZE];
+};
+
+static void EmitJumpToStub(jit_compiler *Compiler, u32 Opcode, jit_stub_type Type, u16 IP, u32 BudgetRefund = 0)
+{
+    u32 StubIndex = 0;
+    while((StubIndex < Compiler->StubCount) &&
+          ((Compiler->Stubs[StubIndex].Type != Type) || (Compiler->Stubs[StubIndex].IP != IP) ||
+           (Compiler->Stubs[StubIndex].BudgetRefund != BudgetRefund)))
+    {
+        ++StubIndex;
+    }
+    
+    if(StubIndex == Compiler->StubCount)
+    {
+        assert(Compiler->StubCount < ArrayCount(Compiler->Stubs));
+        jit_stub *Stub = &Compiler->Stubs[Compiler->StubCount++];
+        *Stub = {};
+        Stub->Type = Type;
+        Stub->IP = IP;
+        Stub->BudgetRefund = BudgetRefund;
+    }
+    
+    assert(Compiler->FixupCount < ArrayCount(Compiler->Fixups));
+    jit_fixup *Fixup = &Compiler->Fixups[Compiler->FixupCount++];
+    Fixup->At = EmitJump(&Compiler->Emitter, Opcode);
+    Fixup->Instruction = -1;
+    Fixup->Stub = StubIndex;
+}
+
+static void EmitJumpTo(jit_compiler *Compiler, u32 Opcode, s32 Instruction, u16 IP)
+{
+    // NOTE: Jumps to the instruction's code if it is in the region, or leaves at IP if not.
+    if(Instruction >= 0)
+    {
+        assert(Compiler->FixupCount < ArrayCount(Compiler->Fixups));
+        jit_fixup *Fixup = &Compiler->Fixups[Compiler->FixupCount++];
+        Fixup->At = EmitJump(&Compiler->Emitter, Opcode);
+        Fixup->Instruction = Instruction;
+        Fixup->Stub = 0;
+    }
+    else
+    {
+        EmitJumpToStub(Compiler, Opcode, JITStub_Exit, IP);
+    }
+}
+
+static u32 GetHostRegister(u32 LoweredRegister, b32 Wide)
+{
+    // NOTE: Lowered word registers are register indices, and byte registers are byte offsets
+    // into Registers (see lowered_instruction). Byte registers come back as x86 encodes them:
+    // al, cl, dl, bl, then ah, ch, dh, bh.
+    u32 Result = Host_None;
+    if(Wide)
+    {
+        Result = (LoweredRegister < ArrayCount(JITHostRegisters)) ? JITHostRegisters[LoweredRegister] : Host_None;
+    }
+    else
+    {
+        u32 Index = LoweredRegister >> 1;
+        if((Index >= Register_a) && (Index <= Register_d))
+        {
+            Result = JITHostRegisters[Index] + 4*(LoweredRegister & 1);
+        }
+    }
+    
+    return Result;
+}
+
+static u32 GetHostAluExtension(operation_type Op)
+{
+    // NOTE: The /n of the x86 group 1 instructions (80, 81), which is also the high bits of the
+    // register-to-register opcodes.
+    u32 Result = 0;
+    switch(Op)
+    {
+        case Op_add: {Result = 0;} break;
+        case Op_or: {Result = 1;} break;
+        case Op_adc: {Result = 2;} break;
+        case Op_sbb: {Result = 3;} break;
+        case Op_and: case Op_test: {Result = 4;} break;
+        case Op_sub: {Result = 5;} break;
+        case Op_xor: {Result = 6;} break;
+        case Op_cmp: {Result = 7;} break;
+        default: {} break;
+    }
+    
+    return Result;
+}
+
+static u32 GetHostCondition(operation_type Op)
+{
+    // NOTE: The 8086 and x86-64 share condition codes, so this is the low nibble of jcc.
+    u32 Result = 0;
+    switch(Op)
+    {
+        case Op_jo: {Result = 0x0;} break;
+        case Op_jno: {Result = 0x1;} break;
+        case Op_jb: {Result = 0x2;} break;
+        case Op_jnb: {Result = 0x3;} break;
+        case Op_je: {Result = 0x4;} break;
+        case Op_jne: {Result = 0x5;} break;
+        case Op_jbe: {Result = 0x6;} break;
+        case Op_ja: {Result = 0x7;} break;
+        case Op_js: {Result = 0x8;} break;
+        case Op_jns: {Result = 0x9;} break;
+        case Op_jp: {Result = 0xa;} break;
+        case Op_jnp: {Result = 0xb;} break;
+        case Op_jl: {Result = 0xc;} break;
+        case Op_jnl: {Result = 0xd;} break;
+        case Op_jle: {Result = 0xe;} break;
+        case Op_jg: {Result = 0xf;} break;
+        default: {} break;
+    }
+    
+    return Result;
+}
+
+static b32 IsLoweredALU(lowered_instruction *Lowered)
+{
+    b32 Result = ((Lowered->Handler >= Lowered_mov_RR8) && (Lowered->Handler < Lowered_jo));
+    return Result;
+}
+
+static b32 IsLoweredJump(lowered_instruction *Lowered)
+{
+    b32 Result = ((Lowered->Handler >= Lowered_jo) && (Lowered->Handler <= Lowered_jmp));
+    return Result;
+}
+
+static u32 GetLoweredForm(lowered_instruction *Lowered)
+{
+    u32 FormIndex = (Lowered->Handler - Lowered_mov_RR8) % (2*LoweredForm_Count);
+    u32 Result = FormIndex / 2;
+    return Result;
+}
+
+static b32 IsLoweredWide(lowered_instruction *Lowered)
+{
+    b32 Result = ((Lowered->Handler - Lowered_mov_RR8) & 1);
+    return Result;
+}
+
+static b32 CanCompile(instruction *Instruction, lowered_instruction *Lowered)
+{
+    b32 Result = false;
+    if(IsLoweredALU(Lowered))
+    {
+        u32 Form = GetLoweredForm(Lowered);
+        b32 Wide = IsLoweredWide(Lowered);
+        b32 Test = (Instruction->Op == Op_test);
+        
+        u32 Dest = ((Form == LoweredForm_RR) || (Form == LoweredForm_RI) || (Form == LoweredForm_RM)) ? GetHostRegister(Lowered->Dest, Wide) : 0;
+        u32 Source = ((Form == LoweredForm_RR) || (Form == LoweredForm_MR)) ? GetHostRegister(Lowered->Source, Wide) : 0;
+        Result = ((Dest != Host_None) && (Source != Host_None));
+        
+        if(Result && !Wide)
+        {
+            // NOTE: ah, ch, dh and bh can't be used alongside r12, so byte forms that need it
+            // are only compiled for al, cl, dl and bl.
+            b32 DestWithScratch = (((Form == LoweredForm_RR) && Test) || ((Form == LoweredForm_RI) && Test) || (Form == LoweredForm_RM));
+            b32 SourceWithScratch = (((Form == LoweredForm_RR) && Test) || (Form == LoweredForm_MR));
+            Result = (!(DestWithScratch && (Dest & 4)) && !(SourceWithScratch && (Source & 4)));
+        }
+    }
+    else if((Lowered->Handler == Lowered_inc_R16) || (Lowered->Handler == Lowered_dec_R16))
+    {
+        Result = (GetHostRegister(Lowered->Dest, true) != Host_None);
+    }
+    else if(IsLoweredJump(Lowered))
+    {
+        Result = true;
+    }
+    
+    return Result;
+}
+
+static void EmitMemoryOffset(jit_emitter *Emitter, lowered_instruction *Lowered)
+{
+    // NOTE: r13d = (BaseA + BaseB + Displacement) & 0xffff
+    u32 Base = JITHostRegisters[Lowered->BaseA];
+    u32 Index = JITHostRegisters[Lowered->BaseB];
+    if(Base == Host_None)
+    {
+        Base = Index;
+        Index = Host_None;
+    }
+    
+    if(Base == Host_None)
+    {
+        EmitMoveImmediate(Emitter, JITSize_32, Host_r13, Lowered->Displacement);
+    }
+    else
+    {
+        EmitMemoryForm(Emitter, JITSize_32, 0x8d, Host_r13, Base, Index, Lowered->Displacement);
+        EmitRegisterForm(Emitter, JITSize_32, 0x0fb7, Host_r13, Host_r13);
+    }
+}
+
+static void EmitVolatileGuestRegisters(jit_emitter *Emitter, b32 Store)
+{
+    for(u32 Register = Register_a; Register <= Register_di; ++Register)
+    {
+        if(JIT_VOLATILE_HOST_REGISTERS & (1 << JITHostRegisters[Register]))
+        {
+            if(Store)
+            {
+                EmitStoreGuestRegister(Emitter, Register);
+            }
+            else
+            {
+                EmitLoadGuestRegister(Emitter, Register);
+            }
+        }
+    }
+}
+
+static void EmitMemoryCall(jit_emitter *Emitter, lowered_instruction *Lowered, b32 Wide, void *Function, b32 PassValue)
+{
+    // NOTE: Calls Function(State, Segment:Offset, [r12d,] Wide) with the offset in r13d, and
+    // leaves what it returns in r12d. The guest registers the call could change are stored
+    // before it and loaded again after it, and so are the clocks so far, since r10 doesn't
+    // survive it either.
+    EmitVolatileGuestRegisters(Emitter, true);
+    EmitFlushClocks(Emitter);
+    
+    u32 Argument = 0;
+    EmitRegisterForm(Emitter, JITSize_64, 0x89, Host_r15, JITArgumentRegisters[Argument++]);
+    EmitMemoryForm(Emitter, JITSize_32, 0x8d, JITArgumentRegisters[Argument++], Host_r13, Host_None, Lowered->Segment << 16);
+    if(PassValue)
+    {
+        EmitRegisterForm(Emitter, JITSize_32, 0x89, Host_r12, JITArgumentRegisters[Argument++]);
+    }
+    EmitMoveImmediate(Emitter, JITSize_32, JITArgumentRegisters[Argument++], Wide ? 1 : 0);
+    
+    EmitMoveImmediate(Emitter, JITSize_64, Host_rax, (u64)Function);
+    EmitRegisterForm(Emitter, JITSize_32, 0xff, 2, Host_rax);
+    EmitRegisterForm(Emitter, JITSize_32, 0x89, Host_rax, Host_r12);
+    
+    EmitRegisterForm(Emitter, JITSize_32, 0x31, Host_r10, Host_r10);
+    EmitVolatileGuestRegisters(Emitter, false);
+}
+
+static void EmitMemoryRead(jit_emitter *Emitter, lowered_instruction *Lowered, b32 Wide, b32 KeepFlags)
+{
+    if(KeepFlags)
+    {
+        EmitSaveFlags(Emitter);
+    }
+    
+    EmitMemoryCall(Emitter, Lowered, Wide, (void *)JITReadMemory, false);
+    
+    if(KeepFlags)
+    {
+        EmitRestoreFlags(Emitter);
+    }
+}
+
+static void EmitMemoryWrite(jit_compiler *Compiler, jit_region_instruction *Instruction, b32 Wide)
+{
+    // NOTE: Writes r12d. If that hit a page with code in it, this is as far as the region goes.
+    jit_emitter *Emitter = &Compiler->Emitter;
+    EmitSaveFlags(Emitter);
+    EmitMemoryCall(Emitter, &Instruction->Lowered, Wide, (void *)JITWriteMemory, true);
+    
+    EmitRegisterForm(Emitter, JITSize_32, 0x85, Host_r12, Host_r12);
+    EmitJumpToStub(Compiler, 0x0f85, JITStub_Write, Instruction->NextIP, Instruction->BlockRemaining);
+    
+    if(Instruction->LiveOut)
+    {
+        EmitRestoreFlags(Emitter);
+    }
+}
+
+static void EmitClearAF(jit_emitter *Emitter, jit_size Size, u32 Register)
+{
+    // NOTE: The 8086 leaves AF cleared after a logical operation (see Logic), but on x86-64 it is
+    // undefined. Adding zero to the result sets every flag just as the logical operation does
+    // (CF, OF and AF clear, ZF, SF and PF from the result), so this puts AF right.
+    EmitAluImmediate(Emitter, Size, 0, Register, 0);
+}
+
+static void EmitALU(jit_compiler *Compiler, jit_region_instruction *RegionInstruction)
+{
+    jit_emitter *Emitter = &Compiler->Emitter;
+    lowered_instruction *Lowered = &RegionInstruction->Lowered;
+    operation_type Op = RegionInstruction->Instruction.Op;
+    
+    u32 Form = GetLoweredForm(Lowered);
+    b32 Wide = IsLoweredWide(Lowered);
+    jit_size Size = Wide ? JITSize_16 : JITSize_8;
+    u32 Wbit = Wide ? 1 : 0;
+    
+    b32 Move = (Op == Op_mov);
+    b32 Test = (Op == Op_test);
+    b32 Logical = ((Op == Op_and) || (Op == Op_or) || (Op == Op_xor) || Test);
+    u32 Extension = GetHostAluExtension(Op);
+    u32 RegisterOpcode = Move ? (0x88 | Wbit) : Test ? (0x84 | Wbit) : ((Extension << 3) | Wbit);
+    
+    switch(Form)
+    {
+        case LoweredForm_RR:
+        case LoweredForm_RM:
+        {
+            u32 Dest = GetHostRegister(Lowered->Dest, Wide);
+            u32 Source = Host_r12;
+            if(Form == LoweredForm_RR)
+            {
+                Source = GetHostRegister(Lowered->Source, Wide);
+            }
+            else
+            {
+                EmitMemoryOffset(Emitter, Lowered);
+                EmitMemoryRead(Emitter, Lowered, Wide, RegionInstruction->LiveIn);
+            }
+            
+            if(Test)
+            {
+                // NOTE: test writes nothing, so it is done as an and on a copy.
+                if(Source != Host_r12)
+                {
+                    EmitRegisterForm(Emitter, JITSize_32, Wide ? 0x0fb7 : 0x0fb6, Host_r12, Source);
+                }
+                EmitRegisterForm(Emitter, Size, 0x20 | Wbit, Dest, Host_r12);
+                EmitClearAF(Emitter, Size, Host_r12);
+            }
+            else
+            {
+                EmitRegisterForm(Emitter, Size, RegisterOpcode, Source, Dest);
+                if(Logical)
+                {
+                    EmitClearAF(Emitter, Size, Dest);
+                }
+            }
+        } break;
+        
+        case LoweredForm_RI:
+        {
+            u32 Dest = GetHostRegister(Lowered->Dest, Wide);
+            if(Move)
+            {
+                EmitMoveImmediate(Emitter, Size, Dest, Lowered->Immediate);
+            }
+            else if(Test)
+            {
+                EmitRegisterForm(Emitter, JITSize_32, Wide ? 0x0fb7 : 0x0fb6, Host_r12, Dest);
+                EmitAluImmediate(Emitter, Size, Extension, Host_r12, Lowered->Immediate);
+                EmitClearAF(Emitter, Size, Host_r12);
+            }
+            else
+            {
+                EmitAluImmediate(Emitter, Size, Extension, Dest, Lowered->Immediate);
+                if(Logical)
+                {
+                    EmitClearAF(Emitter, Size, Dest);
+                }
+            }
+        } break;
+        
+        case LoweredForm_MR:
+        case LoweredForm_MI:
+        {
+            EmitMemoryOffset(Emitter, Lowered);
+            
+            u32 Source = (Form == LoweredForm_MR) ? GetHostRegister(Lowered->Source, Wide) : Host_None;
+            if(Move)
+            {
+                if(Source != Host_None)
+                {
+                    EmitRegisterForm(Emitter, JITSize_32, Wide ? 0x0fb7 : 0x0fb6, Host_r12, Source);
+                }
+                else
+                {
+                    EmitMoveImmediate(Emitter, JITSize_32, Host_r12, Lowered->Immediate);
+                }
+            }
+            else
+            {
+                EmitMemoryRead(Emitter, Lowered, Wide, RegionInstruction->LiveIn);
+                if(Source != Host_None)
+                {
+                    EmitRegisterForm(Emitter, Size, Test ? (0x20 | Wbit) : RegisterOpcode, Source, Host_r12);
+                }
+                else
+                {
+                    EmitAluImmediate(Emitter, Size, Extension, Host_r12, Lowered->Immediate);
+                }
+                
+                if(Logical)
+                {
+                    EmitClearAF(Emitter, Size, Host_r12);
+                }
+            }
+            
+            if(!Test && (Op != Op_cmp))
+            {
+                EmitMemoryWrite(Compiler, RegionInstruction, Wide);
+            }
+        } break;
+    }
+}
+
+static void EmitJumpInstruction(jit_compiler *Compiler, jit_region_instruction *RegionInstruction)
+{
+    jit_emitter *Emitter = &Compiler->Emitter;
+    operation_type Op = RegionInstruction->Instruction.Op;
+    s32 Target = RegionInstruction->Target;
+    u16 TargetIP = RegionInstruction->TargetIP;
+    
+    switch(Op)
+    {
+        case Op_jmp:
+        {
+            EmitJumpTo(Compiler, 0xe9, Target, TargetIP);
+        } break;
+        
+        case Op_loop:
+        case Op_loopz:
+        case Op_loopnz:
+        {
+            // NOTE: lea ecx, [rcx - 1], movzx ecx, cx, then jrcxz over the jump - none of which
+            // touch the flags.
+            EmitMemoryForm(Emitter, JITSize_32, 0x8d, Host_rcx, Host_rcx, Host_None, -1);
+            EmitRegisterForm(Emitter, JITSize_32, 0x0fb7, Host_rcx, Host_rcx);
+            EmitByte(Emitter, 0xe3);
+            EmitByte(Emitter, (Op == Op_loop) ? 5 : 6);
+            EmitJumpTo(Compiler, (Op == Op_loop) ? 0xe9 : (Op == Op_loopz) ? 0x0f84 : 0x0f85, Target, TargetIP);
+        } break;
+        
+        case Op_jcxz:
+        {
+            // NOTE: jrcxz to the jump, and a short jmp over it otherwise.
+            EmitByte(Emitter, 0xe3);
+            EmitByte(Emitter, 2);
+            EmitByte(Emitter, 0xeb);
+            EmitByte(Emitter, 5);
+            EmitJumpTo(Compiler, 0xe9, Target, TargetIP);
+        } break;
+        
+        default:
+        {
+            EmitJumpTo(Compiler, 0x0f80 | GetHostCondition(Op), Target, TargetIP);
+        } break;
+    }
+}
+
+static void EmitGuard(jit_compiler *Compiler, jit_region_instruction *RegionInstruction)
+{
+    // NOTE: Makes sure the budget covers everything that can run before the next check. The
+    // compare needs the flags, and pushfq and popfq are slow, so they are kept in ax instead
+    // (lahf for the low byte, seto for OF), with ax itself in r12d. They are put back even when
+    // nothing in the region reads them before setting them again, since any later exit needs
+    // them as they were.
+    jit_emitter *Emitter = &Compiler->Emitter;
+    EmitRegisterForm(Emitter, JITSize_32, 0x89, Host_rax, Host_r12);
+    EmitByte(Emitter, 0x9f);
+    EmitRegisterForm(Emitter, JITSize_8, 0x0f90, 0, Host_rax);
+    EmitAluImmediate(Emitter, JITSize_64, 7, Host_r14, RegionInstruction->Longest);
+    EmitJumpToStub(Compiler, 0x0f82, JITStub_Guard, RegionInstruction->IP);
+    EmitRestoreGuardFlags(Emitter);
+}
+
+static s32 FindRegionInstruction(jit_compiler *Compiler, u16 IP)
+{
+    s32 Result = -1;
+    for(u32 Index = 0; Index < Compiler->InstructionCount; ++Index)
+    {
+        if(Compiler->Instructions[Index].IP == IP)
+        {
+            Result = (s32)Index;
+            break;
+        }
+    }
+    
+    return Result;
+}
+
+static void GatherRegion(opcode_table *Opcodes, jit_compiler *Compiler, decode_cache *Cache, machine_state *State, u16 CS, u16 EntryIP)
+{
+    // NOTE: Everything reachable from EntryIP that can be compiled, in the same page, and inside
+    // the program, sorted by IP. It is searched breadth first, so if there is more than fits, what
+    // gets left out is what is furthest from the entry.
+    paged_memory *Memory = State->Memory;
+    u32 PageIndex = GetPhysicalAddress(Memory, CS, EntryIP) >> MEMORY_PAGE_SIZE_POW2;
+    
+    u32 PendingCount = 0;
+    u32 PendingIndex = 0;
+    u16 Pending[2*JIT_MAX_REGION_SIZE + 1];
+    Pending[PendingCount++] = EntryIP;
+    
+    Compiler->InstructionCount = 0;
+    while((PendingIndex < PendingCount) && (Compiler->InstructionCount < JIT_MAX_REGION_SIZE))
+    {
+        u16 IP = Pending[PendingIndex++];
+        if(FindRegionInstruction(Compiler, IP) >= 0)
+        {
+            continue;
+        }
+        
+        u32 Address = GetPhysicalAddress(Memory, CS, IP);
+        decode_cache_entry *Entry = FetchCacheEntry(Opcodes, Cache, Memory, CS, IP);
+        instruction Instruction = Entry->Instruction;
+        lowered_instruction Lowered;
+        LowerInstruction(&Instruction, Entry->Clocks, &Lowered);
+        
+        if(Instruction.Op &&
+           ((Address >> MEMORY_PAGE_SIZE_POW2) == PageIndex) &&
+           (((Address & MEMORY_PAGE_MASK) + Instruction.Size) <= MEMORY_PAGE_SIZE) &&
+           (((u32)IP + Instruction.Size) <= 0x10000) &&
+           (!State->ProgramSize || (Address < State->ProgramSize)) &&
+           CanCompile(&Instruction, &Lowered))
+        {
+            jit_region_instruction *Dest = &Compiler->Instructions[Compiler->InstructionCount++];
+            *Dest = {};
+            Dest->Instruction = Instruction;
+            Dest->Lowered = Lowered;
+            Dest->IP = IP;
+            Dest->NextIP = (u16)(IP + Instruction.Size);
+            Dest->Entry = (IP == EntryIP);
+            Dest->Jumps = IsLoweredJump(&Lowered);
+            Dest->FallsThrough = (Instruction.Op != Op_jmp);
+            if(Dest->FallsThrough)
+            {
+                Pending[PendingCount++] = Dest->NextIP;
+            }
+            if(Dest->Jumps)
+            {
+                Dest->TargetIP = (u16)(Dest->NextIP + Lowered.Displacement);
+                Pending[PendingCount++] = Dest->TargetIP;
+            }
+        }
+    }
+    
+    // NOTE: Insertion sort - there are only ever a few dozen.
+    for(u32 Index = 1; Index < Compiler->InstructionCount; ++Index)
+    {
+        jit_region_instruction Temp = Compiler->Instructions[Index];
+        u32 Dest = Index;
+        while(Dest && (Compiler->Instructions[Dest - 1].IP > Temp.IP))
+        {
+            Compiler->Instructions[Dest] = Compiler->Instructions[Dest - 1];
+            --Dest;
+        }
+        Compiler->Instructions[Dest] = Temp;
+    }
+}
+
+static void AnalyzeRegion(jit_compiler *Compiler)
+{
+    u32 Count = Compiler->InstructionCount;
+    jit_region_instruction *Instructions = Compiler->Instructions;
+    
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        jit_region_instruction *Instruction = &Instructions[Index];
+        Instruction->Next = Instruction->FallsThrough ? FindRegionInstruction(Compiler, Instruction->NextIP) : -1;
+        Instruction->Target = Instruction->Jumps ? FindRegionInstruction(Compiler, Instruction->TargetIP) : -1;
+        
+        operation_type Op = Instruction->Instruction.Op;
+        if(IsLoweredALU(&Instruction->Lowered))
+        {
+            Instruction->FlagsSet = (Op != Op_mov) ? JIT_ARITHMETIC_FLAGS : 0;
+            Instruction->FlagsUsed = ((Op == Op_adc) || (Op == Op_sbb)) ? FlagBit_CF : 0;
+        }
+        else if(!Instruction->Jumps)
+        {
+            Instruction->FlagsSet = JIT_ARITHMETIC_FLAGS & ~FlagBit_CF; // NOTE: inc and dec
+        }
+        else if((Op != Op_jmp) && (Op != Op_loop) && (Op != Op_jcxz))
+        {
+            Instruction->FlagsUsed = JIT_ARITHMETIC_FLAGS;
+        }
+    }
+    
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        jit_region_instruction *Instruction = &Instructions[Index];
+        jit_region_instruction *Previous = Index ? &Instructions[Index - 1] : 0;
+        
+        if(Instruction->Target >= 0)
+        {
+            jit_region_instruction *Target = &Instructions[Instruction->Target];
+            Target->Leader = true;
+            if(Target->IP <= Instruction->IP)
+            {
+                Target->Header = true;
+            }
+        }
+        
+        if(Instruction->Entry || !Previous || Previous->Jumps || (Previous->Next != (s32)Index))
+        {
+            Instruction->Leader = true;
+        }
+        if(Instruction->Entry)
+        {
+            Instruction->Header = true;
+        }
+    }
+    
+    // NOTE: Blocks run from each leader up to the next one.
+    for(u32 Index = 0; Index < Count;)
+    {
+        u32 End = Index + 1;
+        while((End < Count) && !Instructions[End].Leader)
+        {
+            ++End;
+        }
+        
+        Instructions[Index].BlockLength = End - Index;
+        for(u32 Within = Index; Within < End; ++Within)
+        {
+            Instructions[Within].BlockRemaining = End - Within - 1;
+        }
+        
+        Index = End;
+    }
+    
+    // NOTE: Anything but a header is only reached from instructions before it, so the longest
+    // run from each instruction to the next check can be worked out back to front.
+    for(u32 Index = Count; Index--;)
+    {
+        jit_region_instruction *Instruction = &Instructions[Index];
+        s32 Successors[2] = {Instruction->Next, Instruction->Target};
+        
+        u32 Longest = 0;
+        for(u32 SuccessorIndex = 0; SuccessorIndex < ArrayCount(Successors); ++SuccessorIndex)
+        {
+            s32 Successor = Successors[SuccessorIndex];
+            if((Successor >= 0) && !Instructions[Successor].Header && (Instructions[Successor].Longest > Longest))
+            {
+                Longest = Instructions[Successor].Longest;
+            }
+        }
+        
+        Instruction->Longest = 1 + Longest;
+    }
+    
+    // NOTE: Which flags are still to be read after each instruction. Leaving the region counts
+    // as reading all of them, and so does reaching a header, since its check can leave.
+    for(b32 Changed = true; Changed;)
+    {
+        Changed = false;
+        for(u32 Index = Count; Index--;)
+        {
+            jit_region_instruction *Instruction = &Instructions[Index];
+            
+            u16 LiveOut = 0;
+            if(Instruction->FallsThrough)
+            {
+                LiveOut |= (Instruction->Next >= 0) ? Instructions[Instruction->Next].LiveIn : JIT_ARITHMETIC_FLAGS;
+            }
+            if(Instruction->Jumps)
+            {
+                LiveOut |= (Instruction->Target >= 0) ? Instructions[Instruction->Target].LiveIn : JIT_ARITHMETIC_FLAGS;
+            }
+            
+            u16 LiveIn = Instruction->FlagsUsed | (LiveOut & ~Instruction->FlagsSet);
+            if(Instruction->Header)
+            {
+                LiveIn = JIT_ARITHMETIC_FLAGS;
+            }
+            if((LiveIn != Instruction->LiveIn) || (LiveOut != Instruction->LiveOut))
+            {
+                Instruction->LiveIn = LiveIn;
+                Instruction->LiveOut = LiveOut;
+                Changed = true;
+            }
+        }
+    }
+}
+
+static void EmitPrologue(jit_emitter *Emitter)
+{
+    for(u32 Index = 0; Index < ArrayCount(JITSavedHostRegisters); ++Index)
+    {
+        EmitPush(Emitter, JITSavedHostRegisters[Index]);
+    }
+    EmitAluImmediate(Emitter, JITSize_64, 5, Host_rsp, JIT_FRAME_SIZE);
+    
+    EmitRegisterForm(Emitter, JITSize_64, 0x89, JITArgumentRegisters[0], Host_r15);
+    EmitRegisterForm(Emitter, JITSize_64, 0x89, JITArgumentRegisters[1], Host_r14);
+    
+    for(u32 Register = Register_a; Register <= Register_di; ++Register)
+    {
+        EmitLoadGuestRegister(Emitter, Register);
+    }
+    
+    // NOTE: Only the arithmetic flags go into the host's flags. TF in particular must not.
+    EmitMemoryForm(Emitter, JITSize_32, 0x0fb7, Host_r12, Host_r15, Host_None, GetRegisterOffset(Register_flags));
+    EmitAluImmediate(Emitter, JITSize_32, 4, Host_r12, JIT_ARITHMETIC_FLAGS);
+    EmitRegisterForm(Emitter, JITSize_32, 0x31, Host_r10, Host_r10);
+    EmitPush(Emitter, Host_r12);
+    EmitByte(Emitter, 0x9d);
+}
+
+static void EmitEpilogue(jit_emitter *Emitter)
+{
+    for(u32 Register = Register_a; Register <= Register_di; ++Register)
+    {
+        EmitStoreGuestRegister(Emitter, Register);
+    }
+    
+    // NOTE: Flags = (Flags & ~JIT_ARITHMETIC_FLAGS) | (host flags & JIT_ARITHMETIC_FLAGS)
+    EmitByte(Emitter, 0x9c);
+    EmitPop(Emitter, Host_r12);
+    EmitAluImmediate(Emitter, JITSize_32, 4, Host_r12, JIT_ARITHMETIC_FLAGS);
+    EmitMemoryForm(Emitter, JITSize_32, 0x0fb7, Host_r13, Host_r15, Host_None, GetRegisterOffset(Register_flags));
+    EmitAluImmediate(Emitter, JITSize_32, 4, Host_r13, (u16)~JIT_ARITHMETIC_FLAGS);
+    EmitRegisterForm(Emitter, JITSize_32, 0x09, Host_r12, Host_r13);
+    EmitMemoryForm(Emitter, JITSize_16, 0x89, Host_r13, Host_r15, Host_None, GetRegisterOffset(Register_flags));
+    EmitFlushClocks(Emitter);
+    
+    EmitRegisterForm(Emitter, JITSize_64, 0x89, Host_r14, Host_rax);
+    EmitAluImmediate(Emitter, JITSize_64, 0, Host_rsp, JIT_FRAME_SIZE);
+    for(u32 Index = ArrayCount(JITSavedHostRegisters); Index--;)
+    {
+        EmitPop(Emitter, JITSavedHostRegisters[Index]);
+    }
+    EmitByte(Emitter, 0xc3);
+}
+
+static void PatchJump(jit_emitter *Emitter, u32 At, u32 Target)
+{
+    if((At + 4) <= Emitter->Capacity)
+    {
+        s32 Displacement = (s32)(Target - (At + 4));
+        memcpy(Emitter->Base + At, &Displacement, sizeof(Displacement));
+    }
+}
+
+static jit_code *EmitRegion(jit_compiler *Compiler, u8 *Base, u32 Capacity)
+{
+    // NOTE: Returns null if the region didn't fit in Capacity bytes.
+    jit_emitter *Emitter = &Compiler->Emitter;
+    *Emitter = {};
+    Emitter->Base = Base;
+    Emitter->Capacity = Capacity;
+    Compiler->FixupCount = 0;
+    Compiler->StubCount = 0;
+    
+    EmitPrologue(Emitter);
+    
+    u32 Count = Compiler->InstructionCount;
+    jit_region_instruction *Instructions = Compiler->Instructions;
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        if(Instructions[Index].Entry)
+        {
+            EmitJumpTo(Compiler, 0xe9, (s32)Index, Instructions[Index].IP);
+        }
+    }
+    
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        jit_region_instruction *Instruction = &Instructions[Index];
+        Instruction->Label = Emitter->Used;
+        
+        if(Instruction->Header)
+        {
+            EmitGuard(Compiler, Instruction);
+        }
+        if(Instruction->Leader)
+        {
+            EmitAdjustBudget(Emitter, -(s32)Instruction->BlockLength);
+        }
+        
+        // NOTE: A jump is charged as if it were taken, and gives back the difference if it
+        // falls through. Odd word transfers are charged by the memory calls.
+        lowered_instruction *Lowered = &Instruction->Lowered;
+        u32 Clocks = Lowered->Clocks + (Instruction->Jumps ? Lowered->ExtraClocks : 0);
+        EmitAddClocks(Emitter, (s32)Clocks);
+        
+        if(IsLoweredALU(Lowered))
+        {
+            EmitALU(Compiler, Instruction);
+        }
+        else if(Instruction->Jumps)
+        {
+            EmitJumpInstruction(Compiler, Instruction);
+            if(Instruction->FallsThrough && Lowered->ExtraClocks)
+            {
+                EmitAddClocks(Emitter, -(s32)Lowered->ExtraClocks);
+            }
+        }
+        else
+        {
+            u32 Extension = (Lowered->Handler == Lowered_inc_R16) ? 0 : 1;
+            EmitRegisterForm(Emitter, JITSize_16, 0xff, Extension, GetHostRegister(Lowered->Dest, true));
+        }
+        
+        if(Instruction->FallsThrough && (Instruction->Next != (s32)(Index + 1)))
+        {
+            EmitJumpTo(Compiler, 0xe9, Instruction->Next, Instruction->NextIP);
+        }
+    }
+    
+    u32 EpilogueOffset = Emitter->Used;
+    EmitEpilogue(Emitter);
+    
+    for(u32 StubIndex = 0; StubIndex < Compiler->StubCount; ++StubIndex)
+    {
+        jit_stub *Stub = &Compiler->Stubs[StubIndex];
+        Stub->Offset = Emitter->Used;
+        
+        if(Stub->Type == JITStub_Guard)
+        {
+            EmitRestoreGuardFlags(Emitter);
+        }
+        else if(Stub->Type == JITStub_Write)
+        {
+            EmitRestoreFlags(Emitter);
+            if(Stub->BudgetRefund)
+            {
+                EmitAdjustBudget(Emitter, (s32)Stub->BudgetRefund);
+            }
+        }
+        
+        // NOTE: mov word [r15 + IP], Stub->IP
+        EmitMemoryForm(Emitter, JITSize_16, 0xc7, 0, Host_r15, Host_None, GetRegisterOffset(Register_ip));
+        EmitImmediate(Emitter, JITSize_16, Stub->IP);
+        PatchJump(Emitter, EmitJump(Emitter, 0xe9), EpilogueOffset);
+    }
+    
+    for(u32 FixupIndex = 0; FixupIndex < Compiler->FixupCount; ++FixupIndex)
+    {
+        jit_fixup *Fixup = &Compiler->Fixups[FixupIndex];
+        u32 Target = (Fixup->Instruction >= 0) ? Instructions[Fixup->Instruction].Label : Compiler->Stubs[Fixup->Stub].Offset;
+        PatchJump(Emitter, Fixup->At, Target);
+    }
+    
+    jit_code *Result = Emitter->Overflowed ? 0 : (jit_code *)Base;
+    return Result;
+}
+
+static void FlushJIT(jit_cache *JIT)
+{
+    JIT->ArenaUsed = 0;
+    for(u32 BlockIndex = 0; BlockIndex < JIT_BLOCK_COUNT; ++BlockIndex)
+    {
+        JIT->Blocks[BlockIndex].Code = 0;
+    }
+}
+
+static jit_code *CompileRegion(opcode_table *Opcodes, jit_cache *JIT, decode_cache *Cache, machine_state *State, u16 CS, u16 IP)
+{
+    jit_code *Result = 0;
+    
+    jit_compiler *Compiler = (jit_compiler *)malloc(sizeof(jit_compiler));
+    if(Compiler)
+    {
+        GatherRegion(Opcodes, Compiler, Cache, State, CS, IP);
+        if(Compiler->InstructionCount)
+        {
+            AnalyzeRegion(Compiler);
+            
+            // NOTE: The arena is only ever writable while a region is being emitted into it. Every
+            // page from the one the region starts in to the end of the arena is opened up, since
+            // how much room the region takes isn't known until it has been emitted.
+            u32 PageMask = GetPageSize() - 1;
+            u32 WriteStart = JIT->ArenaUsed & ~PageMask;
+            if(ProtectExecutablePages(JIT->Arena + WriteStart, JIT->ArenaSize - WriteStart, false))
+            {
+                Result = EmitRegion(Compiler, JIT->Arena + JIT->ArenaUsed, JIT->ArenaSize - JIT->ArenaUsed);
+                if(!Result && ProtectExecutablePages(JIT->Arena, JIT->ArenaSize, false))
+                {
+                    FlushJIT(JIT);
+                    WriteStart = 0;
+                    Result = EmitRegion(Compiler, JIT->Arena, JIT->ArenaSize);
+                }
+                
+                if(!ProtectExecutablePages(JIT->Arena + WriteStart, JIT->ArenaSize - WriteStart, true))
+                {
+                    Result = 0;
+                }
+            }
+            
+            if(Result)
+            {
+                // NOTE: Keeps the next region on a 16-byte boundary.
+                JIT->ArenaUsed += (Compiler->Emitter.Used + 15) & ~15u;
+                if(JIT->ArenaUsed > JIT->ArenaSize)
+                {
+                    JIT->ArenaUsed = JIT->ArenaSize;
+                }
+            }
+        }
+        
+        free(Compiler);
+    }
+    
+    return Result;
+}
+
+static jit_cache *CreateJITCache(void)
+{
+    jit_cache *Result = 0;
+
+#if SIM86_JIT
+    u8 *Arena = AllocateExecutablePages(JIT_ARENA_SIZE);
+    if(Arena)
+    {
+        Result = (jit_cache *)calloc(1, sizeof(jit_cache));
+        if(Result)
+        {
+            Result->Arena = Arena;
+            Result->ArenaSize = JIT_ARENA_SIZE;
+        }
+        else
+        {
+            FreePages(Arena, JIT_ARENA_SIZE);
+        }
+    }
+#endif
+
+    return Result;
+}
+
+static void DestroyJITCache(jit_cache *JIT)
+{
+    if(JIT)
+    {
+        FreePages(JIT->Arena, JIT->ArenaSize);
+        free(JIT);
+    }
+}
+
+static jit_block *GetJITBlock(opcode_table *Opcodes, jit_cache *JIT, decode_cache *Cache, machine_state *State, u16 CS, u16 IP)
+{
+    paged_memory *Memory = State->Memory;
+    u32 Address = GetPhysicalAddress(Memory, CS, IP);
+    u32 Generation = CheckCodePage(Cache, Memory, Address >> MEMORY_PAGE_SIZE_POW2);
+    
+    jit_block *Block = &JIT->Blocks[Address % JIT_BLOCK_COUNT];
+    if((Block->CS != CS) || (Block->IP != IP) || (Block->ProgramSize != State->ProgramSize) || !Block->Generation)
+    {
+        *Block = {};
+        Block->CS = CS;
+        Block->IP = IP;
+        Block->ProgramSize = State->ProgramSize;
+        Block->Generation = Generation;
+    }
+    else if(Block->Generation != Generation)
+    {
+        // NOTE: The page has been written since this was compiled.
+        if(Block->Code && (Block->Invalidations < JIT_MAX_INVALIDATIONS))
+        {
+            ++Block->Invalidations;
+        }
+        Block->Code = 0;
+        Block->Hits = 0;
+        Block->Failed = false;
+        Block->Generation = Generation;
+    }
+    
+    if(!Block->Code && !Block->Failed && (Block->Invalidations < JIT_MAX_INVALIDATIONS) && (++Block->Hits >= JIT_HOT_COUNT))
+    {
+        Block->Code = CompileRegion(Opcodes, JIT, Cache, State, CS, IP);
+        Block->Failed = !Block->Code;
+    }
+    
+    return Block;
+}
+
+static machine_stop_reason RunJIT(opcode_table *Opcodes, machine_state *State, u64 MaxInstructions, u64 *InstructionCount)
+{
+    jit_cache *JIT = State->JIT;
+    decode_cache *Cache = State->DecodeCache;
+    if(!JIT || !Cache)
+    {
+        machine_stop_reason Result = RunThreaded(Opcodes, State, MaxInstructions, InstructionCount);
+        return Result;
+    }
+    
+    machine_stop_reason Result = MachineStop_None;
+    
+    paged_memory *Memory = State->Memory;
+    u16 *Registers = State->Registers;
+    SetCacheMemory(Cache, Memory);
+    if(JIT->Memory != Memory)
+    {
+        FlushJIT(JIT);
+        memset(JIT->Blocks, 0, sizeof(JIT->Blocks));
+        JIT->Memory = Memory;
+    }
+    
+    u64 Limit = MaxInstructions ? MaxInstructions : ~0ull;
+    u64 Count = 0;
+    while(Count < Limit)
+    {
+        u16 CS = Registers[Register_cs];
+        u16 IP = Registers[Register_ip];
+        if(State->ProgramSize && (GetPhysicalAddress(Memory, CS, IP) >= State->ProgramSize))
+        {
+            Result = MachineStop_EndOfProgram;
+            break;
+        }
+        
+        // NOTE: Compiled code never single-steps, so with TF set everything is interpreted.
+        if(!(Registers[Register_flags] & FlagBit_TF))
+        {
+            jit_block *Block = GetJITBlock(Opcodes, JIT, Cache, State, CS, IP);
+            if(Block->Code)
+            {
+                u64 Budget = Limit - Count;
+                u64 Left = Block->Code(State, Budget);
+                Count += Budget - Left;
+                if(Left != Budget)
+                {
+                    continue;
+                }
+            }
+        }
+        
+        // NOTE: Otherwise the interpreter runs up to the next jump, and the address it lands on
+        // is the next one to be counted.
+        u64 Ran = 0;
+        Result = RunThreaded(Opcodes, State, Limit - Count, &Ran, true);
+        Count += Ran;
+        if(Result != MachineStop_None)
+        {
+            break;
+        }
+    }
+    
+    if(InstructionCount)
+    {
+        *InstructionCount = Count;
+    }
+    
+    return Result;
+}
@@ -0,0 +1,95 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+/* NOTE: The JIT compiles code that runs often into x86-64 host code, for machines that run for
+   a long time. It sits on top of the threaded interpreter: the interpreter runs until the next
+   jump or loop, and every address it lands on is counted. Once an address has been landed on
+   JIT_HOT_COUNT times, the code around it is compiled and run from then on.
+   
+   What gets compiled is a region: every instruction reachable from that address by falling
+   through, jumping or looping, up to JIT_MAX_REGION_SIZE of them, and as long as they are all
+   in the same 4k page. Only mov, the two-operand arithmetic and logic instructions, inc and dec
+   of word registers, and the relative jumps and loops are compiled - anything else is where the
+   region stops, and where the compiled code hands back to the interpreter. Jumps inside the
+   region are host jumps, so a loop runs entirely in host code until it ends.
+   
+   While compiled code runs, the guest's general registers live in host registers (ax in eax,
+   cx in ecx, and so on, since the 8086 numbers them the same way x86-64 does), and the guest's
+   arithmetic flags are the host's flags: the host instructions set CF, PF, AF, ZF, SF and OF
+   exactly as the 8086 does, and jumps test them directly. Memory goes through the same
+   ReadMachineMemory and WriteMachineMemory as the interpreter, called from the compiled code.
+   
+   Compiled code always stops on an instruction boundary with the state exactly as the
+   interpreter would have left it, including stopping after exactly MaxInstructions. It is
+   dropped when its page of memory is written, through the same code page tracking the decode
+   cache uses (see sim86_paged_memory.h). If a region writes to any page with code in it, it
+   stops right after that instruction, so code that writes over itself still runs correctly;
+   code that keeps doing that stops being compiled after JIT_MAX_INVALIDATIONS tries.
+   
+   Compiled code can only run on an x86-64 host. Elsewhere, or if the OS won't give out memory
+   that can be executed, Sim86_CreateJIT returns null and machines run on the interpreter.
+   
+   A JIT can be used with any machine, but only by one at a time, and only on one thread at a
+   time. Switching it to different memory drops everything it has compiled.
+*/
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIM86_JIT 1
+#else
+#define SIM86_JIT 0
+#endif
+
+static u32 const JIT_BLOCK_COUNT = 1024;
+static u32 const JIT_ARENA_SIZE = 1024*1024;
+static u32 const JIT_HOT_COUNT = 16;
+static u32 const JIT_MAX_REGION_SIZE = 64;
+static u32 const JIT_MAX_INVALIDATIONS = 8;
+
+// NOTE: Runs the region with at most Budget instructions, and returns how much of the budget is
+// left. Returning Budget means it stopped before running anything.
+typedef u64 jit_code(machine_state *State, u64 Budget);
+
+struct jit_block
+{
+    jit_code *Code; // NOTE: Null until the region starting here is compiled
+    
+    // NOTE: Code is only used for the CS:IP and ProgramSize it was compiled for, and only while
+    // its page is still on the same generation in the decode cache.
+    u32 Generation;
+    u32 ProgramSize;
+    u16 CS;
+    u16 IP;
+    
+    u16 Hits;
+    u8 Invalidations;
+    u8 Failed; // NOTE: Nothing could be compiled here
+};
+
+struct jit_cache
+{
+    paged_memory *Memory;
+    
+    // NOTE: Compiled code is packed into the arena one region after another. Once it is full,
+    // everything is dropped and it starts over.
+    u8 *Arena;
+    u32 ArenaSize;
+    u32 ArenaUsed;
+    
+    // NOTE: Direct-mapped on the physical address of the region's first instruction.
+    jit_block Blocks[JIT_BLOCK_COUNT];
+};
+
+static jit_cache *CreateJITCache(void);
+static void DestroyJITCache(jit_cache *JIT);
+
+// NOTE: Runs like RunThreaded, compiling as it goes if the machine has a JIT and a decode cache.
+static machine_stop_reason RunJIT(opcode_table *Opcodes, machine_state *State, u64 MaxInstructions, u64 *InstructionCount = 0);
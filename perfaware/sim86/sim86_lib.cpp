@@ -12,21 +12,43 @@
 
 #include <assert.h>
 #include <memory.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "sim86.h"
 
+#include "sim86_platform.h"
 #include "sim86_instruction.h"
 #include "sim86_instruction_table.h"
+#include "sim86_paged_memory.h"
+#include "sim86_machine.h"
+#include "sim86_fanout.h"
 #include "sim86_memory.h"
 #include "sim86_decode.h"
+#include "sim86_clocks.h"
+#include "sim86_threaded.h"
+#include "sim86_execute.h"
+#include "sim86_jit.h"
+#include "sim86_scan.h"
 #include "sim86_text.h"
+#include "sim86_s86i.h"
 
+#include "sim86_platform.cpp"
 #include "sim86_instruction.cpp"
 #include "sim86_instruction_table.cpp"
+#include "sim86_paged_memory.cpp"
+#include "sim86_machine.cpp"
 #include "sim86_memory.cpp"
 #include "sim86_decode.cpp"
+#include "sim86_execute.cpp"
+#include "sim86_clocks.cpp"
+#include "sim86_threaded.cpp"
+#include "sim86_jit.cpp"
+#include "sim86_fanout.cpp"
+#include "sim86_scan.cpp"
 #include "sim86_text.cpp"
+#include "sim86_s86i.cpp"
 
 extern "C" u32 Sim86_GetVersion(void)
 {
@@ -36,7 +58,8 @@ extern "C" u32 Sim86_GetVersion(void)
 
 extern "C" void Sim86_Decode8086Instruction(u32 SourceSize, u8 *Source, instruction *Dest)
 {
-    instruction_table Table = Get8086InstructionTable();
+    opcode_table *Opcodes = Get8086OpcodeTable();
+    instruction_table Table = Opcodes->Instructions;
     
     // NOTE(casey): The 8086 decoder requires the ability to read up to 15 bytes (the maximum
     // allowable instruction size)
@@ -49,7 +72,366 @@ extern "C" void Sim86_Decode8086Instruction(u32 SourceSize, u8 *Source, instruct
     }
     
     segmented_access At = FixedMemoryPow2(4, Source);
-    *Dest = DecodeInstruction(Table, At);
+    *Dest = DecodeInstruction(Opcodes, At);
+}
+
+extern "C" void Sim86_DecodeBlock(u32 SourceSize, u8 *Source, u32 DestCount, instruction *Dest, decode_block_result *Result)
+{
+    // NOTE: This decodes as many instructions as fit in Dest with a single call, so callers
+    // coming through an FFI only pay for the crossing once per block instead of once per
+    // instruction. Decoding stops at the end of the source, when Dest is full, or at the
+    // first byte sequence that doesn't decode, and Result says which one happened.
+    // BytesDecoded is always the offset of the first byte that was not decoded, so a caller
+    // can resume by calling again at Source + BytesDecoded.
+    *Result = DecodeBlock(Get8086OpcodeTable(), DecodeSource(SourceSize, Source), 0, DestCount, Dest);
+}
+
+/* NOTE: A decoder is a reusable context for decoding one source buffer many times. It holds
+   the opcode table and either a view of the caller's memory or, with Decoder_CopySource, its
+   own zero-padded copy of it (which never needs a guard buffer, and lets the caller free or
+   reuse their buffer right away).
+   
+   Threading: decoders are never shared internally, and the opcode table they point at is
+   built once and only read after that. So any number of threads can decode at the same time
+   as long as each one uses its own decoder. A single decoder must not be used from two
+   threads at once. Sim86_CreateDecoder and Sim86_DestroyDecoder may be called from any
+   thread.
+*/
+struct sim86_decoder
+{
+    opcode_table *Opcodes;
+    decode_source Source;
+    u8 *OwnedCopy;
+};
+
+extern "C" sim86_decoder *Sim86_CreateDecoder(u32 SourceSize, u8 *Source, u32 Flags)
+{
+    sim86_decoder *Result = (sim86_decoder *)calloc(1, sizeof(sim86_decoder));
+    if(Result)
+    {
+        Result->Opcodes = Get8086OpcodeTable();
+        
+        if(Flags & Decoder_CopySource)
+        {
+            Result->OwnedCopy = (u8 *)calloc(SourceSize + DECODE_SOURCE_PADDING, 1);
+            if(Result->OwnedCopy)
+            {
+                memcpy(Result->OwnedCopy, Source, SourceSize);
+                Result->Source = DecodeSource(SourceSize, Result->OwnedCopy, true);
+            }
+            else
+            {
+                free(Result);
+                Result = 0;
+            }
+        }
+        else
+        {
+            Result->Source = DecodeSource(SourceSize, Source);
+        }
+    }
+    
+    return Result;
+}
+
+extern "C" void Sim86_DestroyDecoder(sim86_decoder *Decoder)
+{
+    if(Decoder)
+    {
+        free(Decoder->OwnedCopy);
+        free(Decoder);
+    }
+}
+
+extern "C" void Sim86_DecoderDecodeInstruction(sim86_decoder *Decoder, u32 Offset, instruction *Dest)
+{
+    // NOTE: Unlike Sim86_Decode8086Instruction, the address of the decoded instruction is its
+    // offset in the decoder's source. Dest->Op is zero if nothing could be decoded at Offset.
+    decode_block_result Result = DecodeBlock(Decoder->Opcodes, Decoder->Source, Offset, 1, Dest);
+    if(Result.InstructionCount == 0)
+    {
+        *Dest = {};
+    }
+}
+
+extern "C" void Sim86_DecoderDecodeBlock(sim86_decoder *Decoder, u32 Offset, u32 DestCount, instruction *Dest, decode_block_result *Result)
+{
+    // NOTE: Same as Sim86_DecodeBlock, starting at Offset in the decoder's source. Addresses are
+    // offsets from the start of the source (not from Offset), and BytesDecoded counts the
+    // bytes decoded by this call.
+    *Result = DecodeBlock(Decoder->Opcodes, Decoder->Source, Offset, DestCount, Dest);
+}
+
+extern "C" void Sim86_DecoderDecodeCompactBlock(sim86_decoder *Decoder, u32 Offset, u32 DestCount, compact_instruction *Dest, decode_block_result *Result)
+{
+    // NOTE: Same as Sim86_DecoderDecodeBlock, but writes 16-byte compact_instructions instead of
+    // full instructions. Use Sim86_UnpackInstruction to get the full form back when needed.
+    *Result = DecodeCompactBlock(Decoder->Opcodes, Decoder->Source, Offset, DestCount, Dest);
+}
+
+extern "C" b32 Sim86_PackInstruction(instruction *Source, compact_instruction *Dest)
+{
+    b32 Result = PackInstruction(*Source, Dest);
+    return Result;
+}
+
+extern "C" void Sim86_UnpackInstruction(compact_instruction *Source, instruction *Dest)
+{
+    *Dest = UnpackInstruction(*Source);
+}
+
+extern "C" void Sim86_ScanInstructionBoundaries(u32 SourceSize, u8 *Source, u64 *Bitmap, decode_block_result *Result)
+{
+    // NOTE: Finds instruction start offsets without decoding operands. Bit N of Bitmap is set if
+    // an instruction starts at byte N of the source, for exactly the instructions Sim86_DecodeBlock
+    // would return. Bitmap needs (SourceSize + 63) / 64 entries, and must be cleared by the caller.
+    *Result = ScanInstructionBoundaries(Get8086LengthTable(), DecodeSource(SourceSize, Source), Bitmap);
+}
+
+struct sim86_mapped_file
+{
+    mapped_file Map;
+};
+
+extern "C" sim86_mapped_file *Sim86_MapS86iFile(char const *FileName, s86i_view *View)
+{
+    // NOTE: Maps a .s86i file written by "sim86 -s86i", and fills View with pointers straight
+    // into the mapping. Nothing is copied or parsed, so this costs the same for a file of a
+    // million instructions as for ten. View stays valid until Sim86_UnmapS86iFile. Returns
+    // null if the file can't be mapped, or isn't a .s86i file this version understands.
+    sim86_mapped_file *Result = (sim86_mapped_file *)calloc(1, sizeof(sim86_mapped_file));
+    if(Result)
+    {
+        if(!MapFileReadOnly(FileName, &Result->Map) ||
+           !GetS86iView(Result->Map.Data, Result->Map.Size, View))
+        {
+            UnmapFile(&Result->Map);
+            free(Result);
+            Result = 0;
+        }
+    }
+    
+    return Result;
+}
+
+extern "C" void Sim86_UnmapS86iFile(sim86_mapped_file *File)
+{
+    if(File)
+    {
+        UnmapFile(&File->Map);
+        free(File);
+    }
+}
+
+extern "C" u32 Sim86_FindS86iInstruction(s86i_view *View, u32 Address)
+{
+    // NOTE: Index of the record for the instruction starting at Address, or S86I_NOT_FOUND.
+    u32 Result = FindS86iInstruction(View, Address);
+    return Result;
+}
+
+extern "C" char const *Sim86_S86iMnemonic(s86i_view *View, u32 Op)
+{
+    char const *Result = GetS86iMnemonic(View, Op);
+    return Result;
+}
+
+extern "C" char const *Sim86_S86iRegisterName(s86i_view *View, register_access *RegAccess)
+{
+    char const *Result = GetS86iRegisterName(View, *RegAccess);
+    return Result;
+}
+
+extern "C" u8 *Sim86_AllocateMachineMemory(u32 Size)
+{
+    // NOTE: Zeroed, page-aligned memory for a simulated machine, which Sim86_LoadMachineMemory
+    // can map program files into. Returns null if the OS won't provide it.
+    u8 *Result = AllocatePages(Size);
+    return Result;
+}
+
+extern "C" void Sim86_FreeMachineMemory(u8 *Memory, u32 Size)
+{
+    FreePages(Memory, Size);
+}
+
+extern "C" b32 Sim86_LoadMachineMemory(char const *FileName, u32 MemorySize, u8 *Memory, u32 *BytesLoaded)
+{
+    // NOTE: Makes Memory (from Sim86_AllocateMachineMemory) hold the start of the file, followed by
+    // zeroes. Where the OS allows it, the file is mapped copy-on-write rather than copied, so a
+    // program loads in the same time whatever its size, and writes to Memory never reach the
+    // file. Returns false, with Memory zeroed, if the file can't be opened.
+    u64 BytesMapped = 0;
+    b32 Result = MapFileIntoPages(FileName, Memory, MemorySize, &BytesMapped);
+    *BytesLoaded = (u32)BytesMapped;
+    return Result;
+}
+
+extern "C" paged_memory *Sim86_CreatePagedMemory(paged_memory *CloneFrom)
+{
+    // NOTE: A megabyte of paged memory (see sim86_paged_memory.h). With no CloneFrom, it reads as
+    // all zeroes and owns no pages yet. Otherwise it shares every page of CloneFrom, copy-on-write,
+    // so it costs the same however much of CloneFrom is in use. Returns null if out of memory.
+    paged_memory *Result = (paged_memory *)malloc(sizeof(paged_memory));
+    if(Result)
+    {
+        if(CloneFrom)
+        {
+            ClonePagedMemory(CloneFrom, Result);
+        }
+        else
+        {
+            InitPagedMemory(Result, 20);
+        }
+    }
+    
+    return Result;
+}
+
+extern "C" void Sim86_DestroyPagedMemory(paged_memory *Memory)
+{
+    if(Memory)
+    {
+        ReleasePagedMemory(Memory);
+        free(Memory);
+    }
+}
+
+extern "C" u8 *Sim86_GetWritablePage(paged_memory *Memory, u32 PageIndex)
+{
+    // NOTE: Call this when Memory->WritePages[PageIndex] is null. Afterwards it isn't, and writes
+    // to that page can go straight through it until Memory is next cloned.
+    u8 *Result = GetWritablePage(Memory, PageIndex);
+    return Result;
+}
+
+extern "C" b32 Sim86_LoadPagedMemory(char const *FileName, paged_memory *Memory, u32 *BytesLoaded)
+{
+    // NOTE: Writes the start of the file into Memory at address 0. Pages the file would leave all
+    // zero aren't allocated. Returns false if the file can't be opened.
+    b32 Result = LoadPagedMemoryFromFile(FileName, Memory, BytesLoaded);
+    return Result;
+}
+
+extern "C" void Sim86_ReadPagedMemory(paged_memory *Memory, u32 Address, u32 Size, u8 *Dest)
+{
+    CopyFromPagedMemory(Memory, Address, Size, Dest);
+}
+
+extern "C" void Sim86_WritePagedMemory(paged_memory *Memory, u32 Address, u32 Size, u8 *Source)
+{
+    CopyToPagedMemory(Memory, Address, Size, Source);
+}
+
+extern "C" void Sim86_ClearDirtyPages(paged_memory *Memory)
+{
+    // NOTE: Starts tracking writes over again: afterwards, Memory->DirtyPages only shows the pages
+    // written from here on. Write access to the dirty pages is taken away to do that, so reload
+    // any WritePages entries you were holding on to.
+    ClearDirtyPages(Memory);
+}
+
+extern "C" b32 Sim86_FindFirstDifference(paged_memory *A, paged_memory *B, u32 *Address)
+{
+    // NOTE: Returns false if A and B hold the same bytes. Otherwise returns true, with the lowest
+    // address where they differ in Address. Pages A and B still share aren't compared at all.
+    b32 Result = FindFirstDifference(A, B, Address);
+    return Result;
+}
+
+extern "C" b32 Sim86_WriteSparseDump(char const *FileName, paged_memory *Memory)
+{
+    // NOTE: Writes just the dirty pages of Memory to a .s86d file (see sim86_paged_memory.h).
+    b32 Result = WriteSparseDump(FileName, Memory, Memory->DirtyPages);
+    return Result;
+}
+
+extern "C" b32 Sim86_LoadSparseDump(char const *FileName, paged_memory *Memory)
+{
+    b32 Result = LoadSparseDump(FileName, Memory);
+    return Result;
+}
+
+extern "C" b32 Sim86_SaveSnapshot(char const *FileName, machine_state *State)
+{
+    // NOTE: Writes State, and every page of State->Memory that isn't all zero, to a .s86s file
+    // (see sim86_machine.h).
+    b32 Result = SaveSnapshot(FileName, State);
+    return Result;
+}
+
+extern "C" b32 Sim86_RestoreSnapshot(char const *FileName, machine_state *State)
+{
+    // NOTE: Sets State to the state saved in a .s86s file. State->Memory is reset to the saved
+    // memory, or, if it is null, created with Sim86_CreatePagedMemory. Either way it belongs to
+    // the caller, to destroy with Sim86_DestroyPagedMemory. The file is mapped, not read, so
+    // restoring costs almost nothing up front, and each page is only read from the file when
+    // the machine first touches it. Returns false, with State unchanged, if the file can't be
+    // restored.
+    paged_memory *Memory = State->Memory ? State->Memory : Sim86_CreatePagedMemory(0);
+    b32 Result = (Memory && RestoreSnapshot(FileName, State, Memory));
+    if(!Result && (Memory != State->Memory))
+    {
+        Sim86_DestroyPagedMemory(Memory);
+    }
+    
+    return Result;
+}
+
+extern "C" decode_cache *Sim86_CreateDecodeCache(void)
+{
+    // NOTE: Set a machine_state's DecodeCache to this to only decode each instruction once
+    // (see sim86_execute.h). Returns null if out of memory.
+    decode_cache *Result = (decode_cache *)calloc(1, sizeof(decode_cache));
+    return Result;
+}
+
+extern "C" void Sim86_DestroyDecodeCache(decode_cache *Cache)
+{
+    free(Cache);
+}
+
+extern "C" jit_cache *Sim86_CreateJIT(void)
+{
+    // NOTE: Set a machine_state's JIT to this, along with a decode cache, to compile code that
+    // runs often (see sim86_jit.h). Returns null if out of memory, or if the host isn't x86-64.
+    jit_cache *Result = CreateJITCache();
+    return Result;
+}
+
+extern "C" void Sim86_DestroyJIT(jit_cache *JIT)
+{
+    DestroyJITCache(JIT);
+}
+
+extern "C" machine_stop_reason Sim86_Step(machine_state *State)
+{
+    // NOTE: Runs the one instruction at CS:IP. If the machine stops instead, the reason is
+    // returned and State is left exactly as it was.
+    machine_stop_reason Result = StepMachine(Get8086OpcodeTable(), State);
+    return Result;
+}
+
+extern "C" machine_stop_reason Sim86_Run(machine_state *State, u64 MaxInstructions, u64 *InstructionCount)
+{
+    // NOTE: Runs until the machine stops, or until MaxInstructions instructions have run if that
+    // is not zero (in which case MachineStop_None is returned). InstructionCount, if not null,
+    // gets how many instructions ran. With a decode cache, this runs on the threaded interpreter,
+    // and with a JIT as well, code that runs often is compiled.
+    machine_stop_reason Result = RunJIT(Get8086OpcodeTable(), State, MaxInstructions, InstructionCount);
+    return Result;
+}
+
+extern "C" b32 Sim86_RunVariants(machine_state *Start, u32 InputCount, machine_input *Inputs,
+                                 u32 VariantCount, variant_result *Results, u64 MaxInstructions, u32 ThreadCount)
+{
+    // NOTE: Runs VariantCount copies of Start, each with its own inputs, on ThreadCount threads
+    // (or one per logical processor, if ThreadCount is zero), and fills in one result per variant
+    // (see sim86_fanout.h). Each variant stops on its own, or after MaxInstructions instructions
+    // if that is not zero. Start and its memory are left as they were, except that the memory
+    // loses write access to its pages, as with any clone.
+    b32 Result = RunVariants(Start, InputCount, Inputs, VariantCount, Results, MaxInstructions, ThreadCount);
+    return Result;
 }
 
 extern "C" char const *Sim86_RegisterNameFromOperand(register_access *RegAccess)
@@ -64,6 +446,24 @@ extern "C" char const *Sim86_MnemonicFromOperationType(operation_type Type)
     return Result;
 }
 
+extern "C" u32 Sim86_FormatInstruction(instruction *Instruction, u32 DestSize, char *Dest)
+{
+    // NOTE: Writes the instruction as sim86 disassembles it, without a newline, and null
+    // terminated. Returns the length, or 0 if DestSize is too small - more than
+    // MAX_INSTRUCTION_TEXT_LENGTH is always enough.
+    u32 Result = 0;
+    
+    text_buffer Buffer = TextBuffer(DestSize, Dest);
+    AppendInstruction(&Buffer, *Instruction);
+    if(!Buffer.Overflowed)
+    {
+        Dest[Buffer.Used] = 0;
+        Result = Buffer.Used;
+    }
+    
+    return Result;
+}
+
 extern "C" void Sim86_Get8086InstructionTable(instruction_table *Dest)
 {
     *Dest = Get8086InstructionTable();
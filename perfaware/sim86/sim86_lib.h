@@ -13,9 +13,53 @@
 #include "sim86.h"
 #include "sim86_instruction.h"
 #include "sim86_instruction_table.h"
+#include "sim86_paged_memory.h"
+#include "sim86_machine.h"
+#include "sim86_fanout.h"
+#include "sim86_s86i.h"
+
+struct sim86_decoder;
+struct sim86_mapped_file;
 
 extern "C" u32 Sim86_GetVersion(void);
 extern "C" void Sim86_Decode8086Instruction(u32 SourceSize, u8 *Source, instruction *Dest);
 extern "C" char const *Sim86_RegisterNameFromOperand(register_access *RegAccess);
 extern "C" char const *Sim86_MnemonicFromOperationType(operation_type Type);
-extern "C" void Sim86_Get8086InstructionTable(instruction_table *Dest);
\ No newline at end of file
+extern "C" u32 Sim86_FormatInstruction(instruction *Instruction, u32 DestSize, char *Dest);
+extern "C" void Sim86_Get8086InstructionTable(instruction_table *Dest);
+extern "C" void Sim86_DecodeBlock(u32 SourceSize, u8 *Source, u32 DestCount, instruction *Dest, decode_block_result *Result);
+extern "C" sim86_decoder *Sim86_CreateDecoder(u32 SourceSize, u8 *Source, u32 Flags);
+extern "C" void Sim86_DestroyDecoder(sim86_decoder *Decoder);
+extern "C" void Sim86_DecoderDecodeInstruction(sim86_decoder *Decoder, u32 Offset, instruction *Dest);
+extern "C" void Sim86_DecoderDecodeBlock(sim86_decoder *Decoder, u32 Offset, u32 DestCount, instruction *Dest, decode_block_result *Result);
+extern "C" void Sim86_DecoderDecodeCompactBlock(sim86_decoder *Decoder, u32 Offset, u32 DestCount, compact_instruction *Dest, decode_block_result *Result);
+extern "C" b32 Sim86_PackInstruction(instruction *Source, compact_instruction *Dest);
+extern "C" void Sim86_UnpackInstruction(compact_instruction *Source, instruction *Dest);
+extern "C" void Sim86_ScanInstructionBoundaries(u32 SourceSize, u8 *Source, u64 *Bitmap, decode_block_result *Result);
+extern "C" sim86_mapped_file *Sim86_MapS86iFile(char const *FileName, s86i_view *View);
+extern "C" void Sim86_UnmapS86iFile(sim86_mapped_file *File);
+extern "C" u32 Sim86_FindS86iInstruction(s86i_view *View, u32 Address);
+extern "C" char const *Sim86_S86iMnemonic(s86i_view *View, u32 Op);
+extern "C" char const *Sim86_S86iRegisterName(s86i_view *View, register_access *RegAccess);
+extern "C" u8 *Sim86_AllocateMachineMemory(u32 Size);
+extern "C" void Sim86_FreeMachineMemory(u8 *Memory, u32 Size);
+extern "C" b32 Sim86_LoadMachineMemory(char const *FileName, u32 MemorySize, u8 *Memory, u32 *BytesLoaded);
+extern "C" paged_memory *Sim86_CreatePagedMemory(paged_memory *CloneFrom);
+extern "C" void Sim86_DestroyPagedMemory(paged_memory *Memory);
+extern "C" u8 *Sim86_GetWritablePage(paged_memory *Memory, u32 PageIndex);
+extern "C" b32 Sim86_LoadPagedMemory(char const *FileName, paged_memory *Memory, u32 *BytesLoaded);
+extern "C" void Sim86_ReadPagedMemory(paged_memory *Memory, u32 Address, u32 Size, u8 *Dest);
+extern "C" void Sim86_WritePagedMemory(paged_memory *Memory, u32 Address, u32 Size, u8 *Source);
+extern "C" void Sim86_ClearDirtyPages(paged_memory *Memory);
+extern "C" b32 Sim86_FindFirstDifference(paged_memory *A, paged_memory *B, u32 *Address);
+extern "C" b32 Sim86_WriteSparseDump(char const *FileName, paged_memory *Memory);
+extern "C" b32 Sim86_LoadSparseDump(char const *FileName, paged_memory *Memory);
+extern "C" b32 Sim86_SaveSnapshot(char const *FileName, machine_state *State);
+extern "C" b32 Sim86_RestoreSnapshot(char const *FileName, machine_state *State);
+extern "C" decode_cache *Sim86_CreateDecodeCache(void);
+extern "C" void Sim86_DestroyDecodeCache(decode_cache *Cache);
+extern "C" jit_cache *Sim86_CreateJIT(void);
+extern "C" void Sim86_DestroyJIT(jit_cache *JIT);
+extern "C" machine_stop_reason Sim86_Step(machine_state *State);
+extern "C" machine_stop_reason Sim86_Run(machine_state *State, u64 MaxInstructions, u64 *InstructionCount);
+extern "C" b32 Sim86_RunVariants(machine_state *Start, u32 InputCount, machine_input *Inputs, u32 VariantCount, variant_result *Results, u64 MaxInstructions, u32 ThreadCount);
\ No newline at end of file
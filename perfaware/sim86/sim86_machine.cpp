@@ -0,0 +1,98 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+static b32 SaveSnapshot(char const *FileName, machine_state *State)
+{
+    // NOTE: Every page that isn't the zero page goes in, shared or not, so the snapshot doesn't
+    // depend on anything else still being around when it is restored.
+    b32 Result = false;
+    
+    FILE *File = fopen(FileName, "wb");
+    if(File)
+    {
+        paged_memory *Memory = State->Memory;
+        
+        snapshot_header Header = {};
+        Header.Magic = SNAPSHOT_MAGIC;
+        Header.Version = SNAPSHOT_VERSION;
+        Header.HeaderSize = sizeof(Header);
+        Header.PageSize = MEMORY_PAGE_SIZE;
+        Header.MemorySize = Memory->Mask + 1;
+        Header.PageCount = GetResidentPages(Memory, Header.PageBits);
+        Header.PagesOffset = MEMORY_PAGE_SIZE;
+        Header.ClockCount = State->ClockCount;
+        Header.ProgramSize = State->ProgramSize;
+        memcpy(Header.Registers, State->Registers, sizeof(Header.Registers));
+        
+        static u8 const Padding[MEMORY_PAGE_SIZE] = {};
+        Result = ((fwrite(&Header, sizeof(Header), 1, File) == 1) &&
+                  (fwrite(Padding, Header.PagesOffset - sizeof(Header), 1, File) == 1) &&
+                  WritePages(File, Memory, Header.PageBits));
+        Result = (fclose(File) == 0) && Result;
+    }
+    
+    return Result;
+}
+
+static b32 RestoreSnapshot(char const *FileName, machine_state *State, paged_memory *Memory)
+{
+    // NOTE: Memory gets reset to the snapshot's memory, with its pages read in place from the
+    // mapped file. Returns false, with State and Memory untouched, if the file isn't a snapshot
+    // this version can restore.
+    mapped_file File;
+    b32 Result = MapFileReadOnly(FileName, &File);
+    if(Result)
+    {
+        snapshot_header Header = {};
+        if(File.Size >= sizeof(Header))
+        {
+            memcpy(&Header, File.Data, sizeof(Header));
+        }
+        
+        u32 PageBitCount = 0;
+        for(u32 PageIndex = 0; PageIndex < MAX_MEMORY_PAGE_COUNT; ++PageIndex)
+        {
+            PageBitCount += IsPageInSet(Header.PageBits, PageIndex);
+        }
+        
+        Result = ((Header.Magic == SNAPSHOT_MAGIC) &&
+                  (Header.Version == SNAPSHOT_VERSION) &&
+                  (Header.HeaderSize >= sizeof(Header)) &&
+                  (Header.PageSize == MEMORY_PAGE_SIZE) &&
+                  (Header.MemorySize == (1u << 20)) &&
+                  (Header.PageCount == PageBitCount) &&
+                  (Header.PagesOffset >= Header.HeaderSize) &&
+                  ((Header.PagesOffset % MEMORY_PAGE_SIZE) == 0) &&
+                  (File.Size == (Header.PagesOffset + (u64)Header.PageCount*MEMORY_PAGE_SIZE)));
+        if(Result)
+        {
+            paged_memory Restored;
+            InitPagedMemory(&Restored, 20);
+            Result = AttachBacking(&Restored, &File, Header.PagesOffset, Header.PageBits);
+            if(Result)
+            {
+                ReleasePagedMemory(Memory);
+                *Memory = Restored;
+                
+                memcpy(State->Registers, Header.Registers, sizeof(State->Registers));
+                State->ClockCount = Header.ClockCount;
+                State->ProgramSize = Header.ProgramSize;
+                State->Memory = Memory;
+            }
+        }
+        
+        UnmapFile(&File);
+    }
+    
+    return Result;
+}
@@ -0,0 +1,99 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+/* NOTE: Everything about a simulated 8086 that a snapshot has to capture.
+
+   Registers is indexed the same way as register_access.Index: 1-4 are ax, bx, cx and dx, 5-8 are
+   sp, bp, si and di, 9-12 are es, cs, ss and ds, 13 is ip, and 14 is the FLAGS word, laid out
+   as on the real 8086 (see flags_bit). Entry 0 is unused.
+*/
+
+enum flags_bit : u16
+{
+    FlagBit_CF = 0x0001,
+    FlagBit_PF = 0x0004,
+    FlagBit_AF = 0x0010,
+    FlagBit_ZF = 0x0040,
+    FlagBit_SF = 0x0080,
+    FlagBit_TF = 0x0100,
+    FlagBit_IF = 0x0200,
+    FlagBit_DF = 0x0400,
+    FlagBit_OF = 0x0800,
+};
+
+static u32 const MACHINE_REGISTER_COUNT = 16;
+
+struct decode_cache;
+struct jit_cache;
+
+struct machine_state
+{
+    u16 Registers[MACHINE_REGISTER_COUNT];
+    u64 ClockCount;
+    
+    // NOTE: How many bytes of program were loaded at address 0. The part1 listings have no hlt -
+    // they end by running off the end of their code, so this is where execution stops.
+    u32 ProgramSize;
+    
+    paged_memory *Memory;
+    
+    // NOTE: Optional. With a decode cache (from Sim86_CreateDecodeCache), each instruction is
+    // only decoded the first time it runs, rather than every time. It isn't part of a snapshot.
+    decode_cache *DecodeCache;
+    
+    // NOTE: Optional, and only used along with a decode cache. With a JIT (from Sim86_CreateJIT),
+    // code that runs often is compiled to host code (see sim86_jit.h). It isn't part of a
+    // snapshot either.
+    jit_cache *JIT;
+};
+
+enum machine_stop_reason : u32
+{
+    MachineStop_None, // NOTE: Nothing stopped it - it ran as many instructions as it was allowed
+    MachineStop_EndOfProgram, // NOTE: CS:IP went past the end of the program (see ProgramSize)
+    MachineStop_Halt, // NOTE: It executed a hlt
+    MachineStop_Unrecognized, // NOTE: The bytes at CS:IP are not a valid 8086 instruction
+    MachineStop_Unimplemented, // NOTE: The instruction at CS:IP decoded, but can't be simulated
+};
+
+/* NOTE: A snapshot (.s86s) is a machine_state and all of its memory that isn't zero:
+
+   snapshot_header
+   (zero padding up to PagesOffset)
+   Pages   PageCount pages of PageSize bytes, for the bits set in PageBits, in page order
+   
+   PagesOffset is a multiple of PageSize, so once the file is mapped, every page in it is
+   page-aligned and can be read right where it is. Restoring maps the file and points the
+   page table at it; pages are only read from disk when the restored machine touches them,
+   and only copied when it writes them.
+*/
+
+static u32 const SNAPSHOT_MAGIC = 0x53363853; // NOTE: "S86S"
+static u32 const SNAPSHOT_VERSION = 1;
+
+struct snapshot_header
+{
+    u32 Magic;
+    u32 Version;
+    u32 HeaderSize;
+    u32 PageSize;
+    
+    u32 MemorySize;
+    u32 PageCount;
+    u64 PageBits[MEMORY_PAGE_BITMAP_COUNT];
+    u64 PagesOffset;
+    
+    u64 ClockCount;
+    u32 ProgramSize;
+    u16 Registers[MACHINE_REGISTER_COUNT];
+};
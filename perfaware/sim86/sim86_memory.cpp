@@ -36,19 +36,130 @@ static segmented_access MoveBaseBy(segmented_access Access, s32 Offset)
     
     Result.SegmentBase += (Result.SegmentOffset >> 4);
     Result.SegmentOffset &= 0xf;
-
+    
     assert(GetAbsoluteAddressOf(Result, 0) == GetAbsoluteAddressOf(Access, 0));
     
     return Result;
 }
 
+static u8 *GetPagedByte(paged_memory *Memory, u32 AbsAddr)
+{
+    u8 *Result = Memory->ReadPages[AbsAddr >> MEMORY_PAGE_SIZE_POW2] + (AbsAddr & MEMORY_PAGE_MASK);
+    return Result;
+}
+
 static u8 *AccessMemory(segmented_access SegMem, u16 Offset)
 {
     u32 AbsAddr = GetAbsoluteAddressOf(SegMem, Offset);
-    u8 *Result = SegMem.Memory + AbsAddr;
+    u8 *Result = SegMem.Paged ? GetPagedByte(SegMem.Paged, AbsAddr) : (SegMem.Memory + AbsAddr);
+    return Result;
+}
+
+static u8 ReadMemoryU8(segmented_access SegMem, u16 Offset)
+{
+    u8 Result = *AccessMemory(SegMem, Offset);
+    return Result;
+}
+
+static void WritePagedByte(paged_memory *Memory, u32 AbsAddr, u8 Value)
+{
+    u8 *Page = Memory->WritePages[AbsAddr >> MEMORY_PAGE_SIZE_POW2];
+    if(!Page)
+    {
+        Page = GetWritablePage(Memory, AbsAddr >> MEMORY_PAGE_SIZE_POW2);
+    }
+    Page[AbsAddr & MEMORY_PAGE_MASK] = Value;
+}
+
+static void WriteMemoryU8(segmented_access SegMem, u16 Offset, u8 Value)
+{
+    u32 AbsAddr = GetAbsoluteAddressOf(SegMem, Offset);
+    if(SegMem.Paged)
+    {
+        WritePagedByte(SegMem.Paged, AbsAddr, Value);
+    }
+    else
+    {
+        SegMem.Memory[AbsAddr] = Value;
+    }
+}
+
+static u16 ReadPagedU16(paged_memory *Memory, u32 AbsAddr)
+{
+    // NOTE: Same as below, with the page boundary in place of the top of memory.
+    u16 Result;
+    if((AbsAddr & MEMORY_PAGE_MASK) != MEMORY_PAGE_MASK)
+    {
+        memcpy(&Result, GetPagedByte(Memory, AbsAddr), sizeof(Result));
+    }
+    else
+    {
+        Result = (u16)((*GetPagedByte(Memory, (AbsAddr + 1) & Memory->Mask) << 8) | *GetPagedByte(Memory, AbsAddr));
+    }
+    
+    return Result;
+}
+
+static void WritePagedU16(paged_memory *Memory, u32 AbsAddr, u16 Value)
+{
+    u8 *Page = Memory->WritePages[AbsAddr >> MEMORY_PAGE_SIZE_POW2];
+    if(Page && ((AbsAddr & MEMORY_PAGE_MASK) != MEMORY_PAGE_MASK))
+    {
+        memcpy(Page + (AbsAddr & MEMORY_PAGE_MASK), &Value, sizeof(Value));
+    }
+    else
+    {
+        WritePagedByte(Memory, AbsAddr, (u8)Value);
+        WritePagedByte(Memory, (AbsAddr + 1) & Memory->Mask, (u8)(Value >> 8));
+    }
+}
+
+static u16 ReadMemoryU16(segmented_access SegMem, u16 Offset)
+{
+    // NOTE: One address calculation and one load for both bytes (little-endian, like the 8086).
+    // Only a word that straddles the top of memory (or a page, for paged memory) has to be put
+    // together by hand.
+    u32 AbsAddr = GetAbsoluteAddressOf(SegMem, Offset);
+    u32 SplitMask = SegMem.Paged ? MEMORY_PAGE_MASK : SegMem.Mask;
+    
+    u16 Result;
+    if((AbsAddr & SplitMask) != SplitMask)
+    {
+        u8 *At = SegMem.Paged ? GetPagedByte(SegMem.Paged, AbsAddr) : (SegMem.Memory + AbsAddr);
+        memcpy(&Result, At, sizeof(Result));
+    }
+    else if(SegMem.Paged)
+    {
+        Result = ReadPagedU16(SegMem.Paged, AbsAddr);
+    }
+    else
+    {
+        Result = (u16)((SegMem.Memory[0] << 8) | SegMem.Memory[AbsAddr]);
+    }
+    
     return Result;
 }
 
+static void WriteMemoryU16(segmented_access SegMem, u16 Offset, u16 Value)
+{
+    u32 AbsAddr = GetAbsoluteAddressOf(SegMem, Offset);
+    u8 *At = SegMem.Memory + AbsAddr;
+    
+    if(SegMem.Paged)
+    {
+        WritePagedU16(SegMem.Paged, AbsAddr, Value);
+    }
+    else if(AbsAddr < SegMem.Mask)
+    {
+        memcpy(At, &Value, sizeof(Value));
+    }
+    else
+    {
+        At[0] = (u8)Value;
+        SegMem.Memory[0] = (u8)(Value >> 8);
+    }
+}
+
 static b32 IsValid(segmented_access SegMem)
 {
     b32 Result = (SegMem.Mask != 0);
@@ -64,3 +175,13 @@ static segmented_access FixedMemoryPow2(u32 SizePow2, u8 *Memory)
     
     return Result;
 }
+
+static segmented_access PagedMemoryAccess(paged_memory *Memory)
+{
+    segmented_access Result = {};
+    
+    Result.Paged = Memory;
+    Result.Mask = Memory->Mask;
+    
+    return Result;
+}
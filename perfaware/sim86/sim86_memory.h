@@ -16,6 +16,11 @@ struct segmented_access
     u32 Mask;
     u16 SegmentBase;
     u16 SegmentOffset;
+    
+    // NOTE: Set instead of Memory for paged memory. AccessMemory then gives a pointer that is
+    // only good for reading - writes have to go through WriteMemoryU8/WriteMemoryU16, which
+    // take care of copy-on-write.
+    paged_memory *Paged;
 };
 
 static u32 GetHighestAddress(segmented_access SegMem);
@@ -23,6 +28,11 @@ static u32 GetAbsoluteAddressOf(segmented_access SegMem, u16 Offset = 0);
 static segmented_access MoveBaseBy(segmented_access Access, s32 Offset);
 
 static u8 *AccessMemory(segmented_access SegMem, u16 Offset = 0);
+static u8 ReadMemoryU8(segmented_access SegMem, u16 Offset = 0);
+static void WriteMemoryU8(segmented_access SegMem, u16 Offset, u8 Value);
+static u16 ReadMemoryU16(segmented_access SegMem, u16 Offset = 0);
+static void WriteMemoryU16(segmented_access SegMem, u16 Offset, u16 Value);
 
 static b32 IsValid(segmented_access SegMem);
 static segmented_access FixedMemoryPow2(u32 SizePow2, u8 *Memory);
+static segmented_access PagedMemoryAccess(paged_memory *Memory);
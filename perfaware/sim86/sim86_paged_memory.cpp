@@ -0,0 +1,479 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+struct memory_page
+{
+    // NOTE: Data comes first, so the data pointers in a page table are also pointers to the
+    // memory_page they belong to.
+    u8 Data[MEMORY_PAGE_SIZE];
+    
+    // NOTE: How many paged_memorys have this page in their page table.
+    u32 volatile RefCount;
+};
+
+// NOTE: A read-only file mapping (a snapshot) whose pages paged_memorys read straight out of the
+// mapping. Those pages aren't memory_pages and have no RefCount of their own - the whole
+// mapping is shared instead, and stays mapped until the last paged_memory using it lets go.
+struct page_backing
+{
+    mapped_file File;
+    u32 volatile RefCount;
+};
+
+// NOTE: Every page that was never written reads from here. It is never written or freed.
+static memory_page GlobalZeroPage;
+
+// NOTE: Where writes go when a page couldn't be allocated, so a write never has to check.
+static memory_page GlobalDiscardPage;
+
+// NOTE: Pages allocated and not yet freed, across all paged_memorys - for statistics only.
+static u32 volatile GlobalAllocatedPageCount;
+
+static memory_page *GetMemoryPage(u8 *Data)
+{
+    memory_page *Result = (memory_page *)Data;
+    return Result;
+}
+
+static b32 IsOwnedPage(paged_memory *Memory, u8 *Data)
+{
+    // NOTE: Whether Data is a memory_page, rather than the zero page or a page of the backing.
+    page_backing *Backing = Memory->Backing;
+    b32 Result = ((Data != GlobalZeroPage.Data) &&
+                  (!Backing || (Data < Backing->File.Data) || (Data >= (Backing->File.Data + Backing->File.Size))));
+    return Result;
+}
+
+static void AddPageReference(paged_memory *Memory, u8 *Data)
+{
+    if(IsOwnedPage(Memory, Data))
+    {
+        AtomicIncrement(&GetMemoryPage(Data)->RefCount);
+    }
+}
+
+static void ReleasePage(paged_memory *Memory, u8 *Data)
+{
+    if(IsOwnedPage(Memory, Data))
+    {
+        if(AtomicDecrement(&GetMemoryPage(Data)->RefCount) == 1)
+        {
+            AtomicDecrement(&GlobalAllocatedPageCount);
+            free(GetMemoryPage(Data));
+        }
+    }
+}
+
+static void MarkPageDirty(paged_memory *Memory, u32 PageIndex)
+{
+    Memory->DirtyPages[PageIndex / 64] |= (1ull << (PageIndex % 64));
+}
+
+static b32 IsPageInSet(u64 const *PageBits, u32 PageIndex)
+{
+    b32 Result = ((PageBits[PageIndex / 64] >> (PageIndex % 64)) & 1);
+    return Result;
+}
+
+static void WatchCodePage(paged_memory *Memory, u32 PageIndex)
+{
+    // NOTE: Until the page is next written, which clears the bit again in GetWritablePage.
+    Memory->CodePages[PageIndex / 64] |= (1ull << (PageIndex % 64));
+    Memory->WritePages[PageIndex] = 0;
+}
+
+static void InitPagedMemory(paged_memory *Memory, u32 SizePow2)
+{
+    assert((SizePow2 >= MEMORY_PAGE_SIZE_POW2) && ((1u << (SizePow2 - MEMORY_PAGE_SIZE_POW2)) <= MAX_MEMORY_PAGE_COUNT));
+    
+    *Memory = {};
+    Memory->Mask = (1 << SizePow2) - 1;
+    Memory->PageCount = 1 << (SizePow2 - MEMORY_PAGE_SIZE_POW2);
+    for(u32 PageIndex = 0; PageIndex < Memory->PageCount; ++PageIndex)
+    {
+        Memory->ReadPages[PageIndex] = GlobalZeroPage.Data;
+    }
+}
+
+static void ReleasePagedMemory(paged_memory *Memory)
+{
+    for(u32 PageIndex = 0; PageIndex < Memory->PageCount; ++PageIndex)
+    {
+        ReleasePage(Memory, Memory->ReadPages[PageIndex]);
+    }
+    
+    page_backing *Backing = Memory->Backing;
+    if(Backing && (AtomicDecrement(&Backing->RefCount) == 1))
+    {
+        UnmapFile(&Backing->File);
+        free(Backing);
+    }
+    
+    *Memory = {};
+}
+
+static void ClonePagedMemory(paged_memory *Source, paged_memory *Dest)
+{
+    // NOTE: Nothing is copied here. Both sides share every page, so both lose write access to
+    // all of them, and the first write to each page on either side goes through GetWritablePage.
+    // The clone starts with no dirty pages; the source keeps its own.
+    *Dest = *Source;
+    Dest->OutOfMemory = false;
+    memset(Dest->DirtyPages, 0, sizeof(Dest->DirtyPages));
+    memset(Dest->CodePages, 0, sizeof(Dest->CodePages));
+    if(Source->Backing)
+    {
+        AtomicIncrement(&Source->Backing->RefCount);
+    }
+    for(u32 PageIndex = 0; PageIndex < Source->PageCount; ++PageIndex)
+    {
+        AddPageReference(Source, Source->ReadPages[PageIndex]);
+        Source->WritePages[PageIndex] = 0;
+        Dest->WritePages[PageIndex] = 0;
+    }
+}
+
+static u8 *GetWritablePage(paged_memory *Memory, u32 PageIndex)
+{
+    assert(PageIndex < Memory->PageCount);
+    
+    u8 *Result = Memory->WritePages[PageIndex];
+    if(!Result)
+    {
+        Memory->CodePages[PageIndex / 64] &= ~(1ull << (PageIndex % 64));
+        
+        u8 *Shared = Memory->ReadPages[PageIndex];
+        if(IsOwnedPage(Memory, Shared) && (AtomicLoad(&GetMemoryPage(Shared)->RefCount) == 1))
+        {
+            // NOTE: Everyone this page was shared with has since copied it or gone away, so it
+            // can be written in place. Nobody can start sharing it again without going through
+            // this paged_memory, which is ours.
+            Result = Shared;
+            Memory->WritePages[PageIndex] = Result;
+            MarkPageDirty(Memory, PageIndex);
+        }
+        else
+        {
+            memory_page *Page = (memory_page *)malloc(sizeof(memory_page));
+            if(Page)
+            {
+                AtomicIncrement(&GlobalAllocatedPageCount);
+                memcpy(Page->Data, Shared, MEMORY_PAGE_SIZE);
+                Page->RefCount = 1;
+                
+                Result = Page->Data;
+                Memory->ReadPages[PageIndex] = Result;
+                Memory->WritePages[PageIndex] = Result;
+                MarkPageDirty(Memory, PageIndex);
+                ReleasePage(Memory, Shared);
+            }
+            else
+            {
+                Memory->OutOfMemory = true;
+                Result = GlobalDiscardPage.Data;
+            }
+        }
+    }
+    
+    return Result;
+}
+
+static void ClearDirtyPages(paged_memory *Memory)
+{
+    // NOTE: The pages stay where they are - only write access goes, so that the next write to
+    // each of them comes back through GetWritablePage, which marks it dirty again (and, since
+    // the page is still ours alone, doesn't copy it).
+    for(u32 PageIndex = 0; PageIndex < Memory->PageCount; ++PageIndex)
+    {
+        if(IsPageInSet(Memory->DirtyPages, PageIndex))
+        {
+            Memory->WritePages[PageIndex] = 0;
+        }
+    }
+    
+    memset(Memory->DirtyPages, 0, sizeof(Memory->DirtyPages));
+}
+
+static void RevertDirtyPages(paged_memory *Memory, paged_memory *Source)
+{
+    // NOTE: Memory has to be a clone of Source, and Source must not have been written since.
+    // Only the dirty pages can differ, so putting those back makes Memory the same as a fresh
+    // clone. A page Memory has to itself is copied over in place, so running clone after clone
+    // this way allocates nothing once each page it writes has been allocated once.
+    for(u32 PageIndex = 0; PageIndex < Memory->PageCount; ++PageIndex)
+    {
+        if(IsPageInSet(Memory->DirtyPages, PageIndex))
+        {
+            u8 *Page = Memory->ReadPages[PageIndex];
+            u8 *Original = Source->ReadPages[PageIndex];
+            if(IsOwnedPage(Memory, Page) && (AtomicLoad(&GetMemoryPage(Page)->RefCount) == 1))
+            {
+                memcpy(Page, Original, MEMORY_PAGE_SIZE);
+            }
+            else
+            {
+                AddPageReference(Source, Original);
+                ReleasePage(Memory, Page);
+                Memory->ReadPages[PageIndex] = Original;
+            }
+            
+            Memory->WritePages[PageIndex] = 0;
+            Memory->CodePages[PageIndex / 64] &= ~(1ull << (PageIndex % 64));
+        }
+    }
+    
+    memset(Memory->DirtyPages, 0, sizeof(Memory->DirtyPages));
+    Memory->OutOfMemory = false;
+}
+
+static void CopyToPagedMemory(paged_memory *Memory, u32 Address, u32 Size, u8 const *Source)
+{
+    // NOTE: Pages that would only be given zeroes and still read as zero are left alone, so
+    // loading a mostly empty image only allocates the pages that have something in them.
+    while(Size)
+    {
+        Address &= Memory->Mask;
+        u32 PageIndex = Address >> MEMORY_PAGE_SIZE_POW2;
+        u32 PageOffset = Address & MEMORY_PAGE_MASK;
+        u32 ChunkSize = MEMORY_PAGE_SIZE - PageOffset;
+        if(ChunkSize > Size)
+        {
+            ChunkSize = Size;
+        }
+        
+        b32 Skip = (Memory->ReadPages[PageIndex] == GlobalZeroPage.Data);
+        for(u32 Index = 0; Skip && (Index < ChunkSize); ++Index)
+        {
+            Skip = (Source[Index] == 0);
+        }
+        
+        if(!Skip)
+        {
+            memcpy(GetWritablePage(Memory, PageIndex) + PageOffset, Source, ChunkSize);
+        }
+        
+        Address += ChunkSize;
+        Source += ChunkSize;
+        Size -= ChunkSize;
+    }
+}
+
+static void CopyFromPagedMemory(paged_memory *Memory, u32 Address, u32 Size, u8 *Dest)
+{
+    while(Size)
+    {
+        Address &= Memory->Mask;
+        u32 PageIndex = Address >> MEMORY_PAGE_SIZE_POW2;
+        u32 PageOffset = Address & MEMORY_PAGE_MASK;
+        u32 ChunkSize = MEMORY_PAGE_SIZE - PageOffset;
+        if(ChunkSize > Size)
+        {
+            ChunkSize = Size;
+        }
+        
+        memcpy(Dest, Memory->ReadPages[PageIndex] + PageOffset, ChunkSize);
+        
+        Address += ChunkSize;
+        Dest += ChunkSize;
+        Size -= ChunkSize;
+    }
+}
+
+static b32 LoadPagedMemoryFromFile(char const *FileName, paged_memory *Memory, u32 *BytesLoaded)
+{
+    // NOTE: Copies the start of the file into Memory at address 0. As with the flat memory,
+    // anything past the end of the simulated memory is discarded.
+    *BytesLoaded = 0;
+    
+    mapped_file File;
+    b32 Result = MapFileReadOnly(FileName, &File);
+    if(Result)
+    {
+        u32 Size = (File.Size > ((u64)Memory->Mask + 1)) ? (Memory->Mask + 1) : (u32)File.Size;
+        CopyToPagedMemory(Memory, 0, Size, File.Data);
+        UnmapFile(&File);
+        
+        *BytesLoaded = Size;
+    }
+    
+    return Result;
+}
+
+static u32 GetResidentPages(paged_memory *Memory, u64 *PageBits = 0)
+{
+    // NOTE: Pages that hold anything other than the zero page, whether or not they are shared.
+    // Returns how many there are, and sets their bits in PageBits if given.
+    u32 Result = 0;
+    for(u32 PageIndex = 0; PageIndex < Memory->PageCount; ++PageIndex)
+    {
+        if(Memory->ReadPages[PageIndex] != GlobalZeroPage.Data)
+        {
+            if(PageBits)
+            {
+                PageBits[PageIndex / 64] |= (1ull << (PageIndex % 64));
+            }
+            ++Result;
+        }
+    }
+    
+    return Result;
+}
+
+static b32 AttachBacking(paged_memory *Memory, mapped_file *File, u64 PagesOffset, u64 const *PageBits)
+{
+    // NOTE: Memory (fresh from InitPagedMemory) reads the pages in PageBits straight out of File,
+    // which are stored one after another from PagesOffset, and takes ownership of the mapping.
+    // Nothing is read or copied here, so this costs the same however big the pages are.
+    b32 Result = false;
+    
+    assert(!Memory->Backing);
+    page_backing *Backing = (page_backing *)malloc(sizeof(page_backing));
+    if(Backing)
+    {
+        Backing->File = *File;
+        Backing->RefCount = 1;
+        Memory->Backing = Backing;
+        *File = {};
+        
+        u8 *Page = Backing->File.Data + PagesOffset;
+        for(u32 PageIndex = 0; PageIndex < Memory->PageCount; ++PageIndex)
+        {
+            if(IsPageInSet(PageBits, PageIndex))
+            {
+                Memory->ReadPages[PageIndex] = Page;
+                Page += MEMORY_PAGE_SIZE;
+            }
+        }
+        
+        Result = true;
+    }
+    
+    return Result;
+}
+
+static b32 FindFirstDifference(paged_memory *A, paged_memory *B, u32 *Address)
+{
+    // NOTE: Pages that are still shared between A and B are the same page, so they are skipped
+    // without looking at them. For memories cloned from each other, only pages that one of them
+    // wrote ever get compared.
+    assert(A->PageCount == B->PageCount);
+    
+    b32 Result = false;
+    for(u32 PageIndex = 0; !Result && (PageIndex < A->PageCount); ++PageIndex)
+    {
+        u8 *PageA = A->ReadPages[PageIndex];
+        u8 *PageB = B->ReadPages[PageIndex];
+        if((PageA != PageB) && (memcmp(PageA, PageB, MEMORY_PAGE_SIZE) != 0))
+        {
+            u32 Offset = 0;
+            while(PageA[Offset] == PageB[Offset])
+            {
+                ++Offset;
+            }
+            
+            *Address = (PageIndex << MEMORY_PAGE_SIZE_POW2) | Offset;
+            Result = true;
+        }
+    }
+    
+    return Result;
+}
+
+static b32 WritePages(FILE *File, paged_memory *Memory, u64 const *PageBits)
+{
+    b32 Result = true;
+    for(u32 PageIndex = 0; Result && (PageIndex < Memory->PageCount); ++PageIndex)
+    {
+        if(IsPageInSet(PageBits, PageIndex))
+        {
+            Result = (fwrite(Memory->ReadPages[PageIndex], MEMORY_PAGE_SIZE, 1, File) == 1);
+        }
+    }
+    
+    return Result;
+}
+
+static b32 WriteSparseDump(char const *FileName, paged_memory *Memory, u64 const *PageBits)
+{
+    // NOTE: One fwrite per page, straight out of the page, and nothing at all for pages that
+    // aren't in PageBits.
+    b32 Result = false;
+    
+    FILE *File = fopen(FileName, "wb");
+    if(File)
+    {
+        sparse_dump_header Header = {};
+        Header.Magic = SPARSE_DUMP_MAGIC;
+        Header.Version = SPARSE_DUMP_VERSION;
+        Header.HeaderSize = sizeof(Header);
+        Header.PageSize = MEMORY_PAGE_SIZE;
+        Header.MemorySize = Memory->Mask + 1;
+        for(u32 PageIndex = 0; PageIndex < Memory->PageCount; ++PageIndex)
+        {
+            if(IsPageInSet(PageBits, PageIndex))
+            {
+                Header.PageBits[PageIndex / 64] |= (1ull << (PageIndex % 64));
+                ++Header.PageCount;
+            }
+        }
+        
+        Result = ((fwrite(&Header, sizeof(Header), 1, File) == 1) &&
+                  WritePages(File, Memory, Header.PageBits));
+        Result = (fclose(File) == 0) && Result;
+    }
+    
+    return Result;
+}
+
+static b32 LoadSparseDump(char const *FileName, paged_memory *Memory)
+{
+    // NOTE: Writes every page in the dump into Memory. Returns false, with Memory untouched, if
+    // the file isn't a sparse dump of a memory this size.
+    mapped_file File;
+    b32 Result = MapFileReadOnly(FileName, &File);
+    if(Result)
+    {
+        sparse_dump_header Header = {};
+        if(File.Size >= sizeof(Header))
+        {
+            memcpy(&Header, File.Data, sizeof(Header));
+        }
+        
+        Result = ((Header.Magic == SPARSE_DUMP_MAGIC) &&
+                  (Header.Version == SPARSE_DUMP_VERSION) &&
+                  (Header.HeaderSize >= sizeof(Header)) &&
+                  (Header.PageSize == MEMORY_PAGE_SIZE) &&
+                  (Header.MemorySize == (Memory->Mask + 1)) &&
+                  (File.Size == (Header.HeaderSize + (u64)Header.PageCount*MEMORY_PAGE_SIZE)));
+        
+        u32 PageBitCount = 0;
+        for(u32 PageIndex = 0; PageIndex < Memory->PageCount; ++PageIndex)
+        {
+            PageBitCount += IsPageInSet(Header.PageBits, PageIndex);
+        }
+        Result = Result && (PageBitCount == Header.PageCount);
+        
+        u8 *Page = File.Data + Header.HeaderSize;
+        for(u32 PageIndex = 0; Result && (PageIndex < Memory->PageCount); ++PageIndex)
+        {
+            if(IsPageInSet(Header.PageBits, PageIndex))
+            {
+                CopyToPagedMemory(Memory, PageIndex << MEMORY_PAGE_SIZE_POW2, MEMORY_PAGE_SIZE, Page);
+                Page += MEMORY_PAGE_SIZE;
+            }
+        }
+        
+        UnmapFile(&File);
+    }
+    
+    return Result;
+}
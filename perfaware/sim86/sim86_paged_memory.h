@@ -0,0 +1,98 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+/* NOTE: Paged memory is simulated memory split into 4k pages, where only the pages that have
+   been written to take up any real memory. A page nobody has written reads as zero (every one
+   of them is the same shared page of zeroes), and a page is only allocated the first time
+   something writes to it.
+   
+   Pages can also be shared between paged_memorys. Cloning one gives the clone every page of
+   the original without copying any of them, and whichever side writes to a shared page first
+   gets its own copy of it right then (copy-on-write). So a program image can be loaded once
+   and cloned into thousands of simulated machines, each of which only costs the page table
+   plus the pages it actually wrote.
+   
+   Reading is one extra lookup: ReadPages[Address >> MEMORY_PAGE_SIZE_POW2] is always valid
+   to read. Writing goes through WritePages, which is only set for pages this memory owns
+   outright - if it is null, Sim86_GetWritablePage (GetWritablePage inside the library) makes
+   the page private and returns it.
+   
+   Every page that is made writable is also marked in DirtyPages, so the pages written since the
+   memory was created (or since ClearDirtyPages) are known without any cost per write. Clearing
+   them takes write access away again, so the next write to each page marks it dirty again.
+   
+   A decode cache (see sim86_execute.h) uses the same trick to notice code being written: every
+   page it has decoded instructions from is marked in CodePages and has its write access taken
+   away, and GetWritablePage clears the mark when the page is next written. A page whose mark
+   is gone may have changed, so the cache drops what it decoded from it before using it again.
+   
+   Threading: different paged_memorys can be used from different threads at once, even when
+   they share pages. A single paged_memory must only be used by one thread at a time, and that
+   includes cloning it.
+*/
+
+static u32 const MEMORY_PAGE_SIZE_POW2 = 12;
+static u32 const MEMORY_PAGE_SIZE = 4096;
+static u32 const MEMORY_PAGE_MASK = 4095;
+static u32 const MAX_MEMORY_PAGE_COUNT = 256;
+static u32 const MEMORY_PAGE_BITMAP_COUNT = 4;
+
+struct page_backing;
+
+struct paged_memory
+{
+    u8 *ReadPages[MAX_MEMORY_PAGE_COUNT];
+    u8 *WritePages[MAX_MEMORY_PAGE_COUNT];
+    
+    // NOTE: Bit (PageIndex % 64) of DirtyPages[PageIndex / 64] is set for every page written to
+    // since the memory was created or last had ClearDirtyPages.
+    u64 DirtyPages[MEMORY_PAGE_BITMAP_COUNT];
+    
+    // NOTE: Bit set for every page a decode cache has checked and not seen written since. Write
+    // access to these pages is always taken away, so that clearing the bit can't be missed.
+    u64 CodePages[MEMORY_PAGE_BITMAP_COUNT];
+    
+    u32 Mask;
+    u32 PageCount;
+    
+    // NOTE: Set if a page couldn't be allocated. Writes to that page went nowhere.
+    b32 OutOfMemory;
+    
+    // NOTE: Set for memory restored from a snapshot, whose pages are read straight out of the
+    // mapped snapshot file until they are written.
+    page_backing *Backing;
+};
+
+/* NOTE: A sparse dump (.s86d) is a set of pages from a paged memory - usually its dirty pages:
+
+   sparse_dump_header
+   Pages   PageCount pages of PageSize bytes, for the bits set in PageBits, in page order
+   
+   Loading one into fresh memory gives back an exact image, since every page not in the dump
+   reads as zero. Loading one on top of the memory it was cleaned from replays the writes since.
+   As with .s86i, a reader should refuse any Magic, Version or PageSize it doesn't recognize.
+*/
+
+static u32 const SPARSE_DUMP_MAGIC = 0x44363853; // NOTE: "S86D"
+static u32 const SPARSE_DUMP_VERSION = 1;
+
+struct sparse_dump_header
+{
+    u32 Magic;
+    u32 Version;
+    u32 HeaderSize;
+    u32 PageSize;
+    
+    u32 MemorySize;
+    u32 PageCount;
+    u64 PageBits[MEMORY_PAGE_BITMAP_COUNT];
+};
@@ -0,0 +1,214 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+/* NOTE: Disassembly split into three stages, each on its own thread(s):
+   
+   - one decode thread fills batches of PIPELINE_BATCH_SIZE instructions, in order,
+   - a pool of formatter threads turns whole batches into text, in any order,
+   - the calling thread writes the text out, in batch order, one fwrite per batch.
+   
+   Batches move through a fixed ring of PIPELINE_SLOT_COUNT slots, so at most that many are in
+   flight, and the decoder simply waits if the writer falls behind. The writer also formats
+   the batch it is waiting on if no formatter has picked it up yet, so the pipeline still
+   finishes even if none of the formatter threads could be started.
+*/
+
+static u32 GetTicket(u32 BatchIndex, pipeline_stage Stage)
+{
+    u32 Result = BatchIndex*Stage_Count + Stage;
+    return Result;
+}
+
+static pipeline_slot *GetSlot(disasm_pipeline *Pipeline, u32 BatchIndex)
+{
+    pipeline_slot *Result = &Pipeline->Slots[BatchIndex % PIPELINE_SLOT_COUNT];
+    return Result;
+}
+
+static void WaitForOtherStages(u32 *SpinCount)
+{
+    // NOTE: Spin briefly, since the wait is usually short, then start giving the core away, in
+    // case the stage being waited on needs it.
+    if(++*SpinCount > 64)
+    {
+        YieldThread();
+    }
+}
+
+static b32 IsPastLastBatch(disasm_pipeline *Pipeline, u32 BatchIndex)
+{
+    b32 Result = (AtomicLoad(&Pipeline->DecodeDone) && (BatchIndex >= Pipeline->BatchCount));
+    return Result;
+}
+
+static void DecodeStage(void *Data)
+{
+    disasm_pipeline *Pipeline = (disasm_pipeline *)Data;
+    
+    u32 Offset = 0;
+    u32 BatchIndex = 0;
+    decode_stop_reason StopReason = DecodeStop_EndOfSource;
+    for(b32 Decoding = true; Decoding; ++BatchIndex)
+    {
+        pipeline_slot *Slot = GetSlot(Pipeline, BatchIndex);
+        u32 SpinCount = 0;
+        while(AtomicLoad(&Slot->Ticket) != GetTicket(BatchIndex, Stage_Free))
+        {
+            WaitForOtherStages(&SpinCount);
+        }
+        
+        decode_block_result Result = DecodeBlock(Pipeline->Opcodes, Pipeline->Source, Offset,
+                                                 PIPELINE_BATCH_SIZE, Slot->Instructions);
+        Offset += Result.BytesDecoded;
+        Slot->InstructionCount = Result.InstructionCount;
+        
+        Decoding = (Result.StopReason == DecodeStop_DestFull);
+        if(!Decoding)
+        {
+            StopReason = Result.StopReason;
+            if(!Result.InstructionCount)
+            {
+                break;
+            }
+        }
+        
+        AtomicStore(&Slot->Ticket, GetTicket(BatchIndex, Stage_Decoded));
+    }
+    
+    Pipeline->BatchCount = BatchIndex;
+    Pipeline->StopReason = StopReason;
+    AtomicStore(&Pipeline->DecodeDone, true);
+}
+
+static b32 TryFormatBatch(disasm_pipeline *Pipeline, u32 BatchIndex)
+{
+    // NOTE: Whoever moves NextFormatBatch past a decoded batch owns formatting it.
+    pipeline_slot *Slot = GetSlot(Pipeline, BatchIndex);
+    b32 Result = ((AtomicLoad(&Slot->Ticket) == GetTicket(BatchIndex, Stage_Decoded)) &&
+                  AtomicCompareExchange(&Pipeline->NextFormatBatch, BatchIndex, BatchIndex + 1));
+    if(Result)
+    {
+        Slot->Text.Used = 0;
+        for(u32 InstructionIndex = 0; InstructionIndex < Slot->InstructionCount; ++InstructionIndex)
+        {
+            AppendInstructionRecord(&Slot->Text, Pipeline->Format, Slot->Instructions[InstructionIndex]);
+        }
+        
+        AtomicStore(&Slot->Ticket, GetTicket(BatchIndex, Stage_Formatted));
+    }
+    
+    return Result;
+}
+
+static void FormatStage(void *Data)
+{
+    disasm_pipeline *Pipeline = (disasm_pipeline *)Data;
+    
+    u32 SpinCount = 0;
+    for(;;)
+    {
+        u32 BatchIndex = AtomicLoad(&Pipeline->NextFormatBatch);
+        if(TryFormatBatch(Pipeline, BatchIndex))
+        {
+            SpinCount = 0;
+        }
+        else if(IsPastLastBatch(Pipeline, BatchIndex))
+        {
+            break;
+        }
+        else
+        {
+            WaitForOtherStages(&SpinCount);
+        }
+    }
+}
+
+static void WriteStage(disasm_pipeline *Pipeline)
+{
+    for(u32 BatchIndex = 0; ; ++BatchIndex)
+    {
+        pipeline_slot *Slot = GetSlot(Pipeline, BatchIndex);
+        
+        u32 SpinCount = 0;
+        b32 Done = false;
+        while(!Done && (AtomicLoad(&Slot->Ticket) != GetTicket(BatchIndex, Stage_Formatted)))
+        {
+            if(!TryFormatBatch(Pipeline, BatchIndex))
+            {
+                Done = IsPastLastBatch(Pipeline, BatchIndex);
+                WaitForOtherStages(&SpinCount);
+            }
+        }
+        
+        if(Done)
+        {
+            break;
+        }
+        
+        FlushTextBuffer(&Slot->Text, Pipeline->Dest);
+        AtomicStore(&Slot->Ticket, GetTicket(BatchIndex + PIPELINE_SLOT_COUNT, Stage_Free));
+    }
+}
+
+static b32 DisAsm8086Pipelined(decode_source Source, u32 FormatterCount, output_format Format, FILE *Dest,
+                               decode_stop_reason *StopReason)
+{
+    // NOTE: Returns false, having written nothing, if the pipeline couldn't be set up. The
+    // caller should fall back to a serial disassembly then.
+    b32 Result = false;
+    
+    disasm_pipeline *Pipeline = (disasm_pipeline *)calloc(1, sizeof(disasm_pipeline));
+    if(Pipeline)
+    {
+        Pipeline->Opcodes = Get8086OpcodeTable();
+        Pipeline->Source = Source;
+        Pipeline->Format = Format;
+        Pipeline->Dest = Dest;
+        
+        u32 MaxLength = (Format == Output_Text) ? MAX_INSTRUCTION_TEXT_LENGTH : MAX_INSTRUCTION_RECORD_LENGTH;
+        u32 TextSize = PIPELINE_BATCH_SIZE*(MaxLength + 1);
+        b32 Allocated = true;
+        for(u32 SlotIndex = 0; SlotIndex < PIPELINE_SLOT_COUNT; ++SlotIndex)
+        {
+            pipeline_slot *Slot = &Pipeline->Slots[SlotIndex];
+            Slot->Ticket = GetTicket(SlotIndex, Stage_Free);
+            Slot->Instructions = (instruction *)malloc(PIPELINE_BATCH_SIZE*sizeof(instruction));
+            Slot->Text = TextBuffer(TextSize, (char *)malloc(TextSize));
+            Allocated = Allocated && Slot->Instructions && Slot->Text.Data;
+        }
+        
+        thread_group Decoder;
+        if(Allocated && StartThreads(&Decoder, 1, DecodeStage, Pipeline))
+        {
+            thread_group Formatters;
+            StartThreads(&Formatters, FormatterCount, FormatStage, Pipeline);
+            
+            WriteStage(Pipeline);
+            
+            JoinThreads(&Formatters);
+            JoinThreads(&Decoder);
+            
+            *StopReason = Pipeline->StopReason;
+            Result = true;
+        }
+        
+        for(u32 SlotIndex = 0; SlotIndex < PIPELINE_SLOT_COUNT; ++SlotIndex)
+        {
+            free(Pipeline->Slots[SlotIndex].Instructions);
+            free(Pipeline->Slots[SlotIndex].Text.Data);
+        }
+        free(Pipeline);
+    }
+    
+    return Result;
+}
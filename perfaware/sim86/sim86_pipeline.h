@@ -0,0 +1,57 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+#define PIPELINE_BATCH_SIZE 4096
+#define PIPELINE_SLOT_COUNT 16
+
+enum pipeline_stage : u32
+{
+    Stage_Free,
+    Stage_Decoded,
+    Stage_Formatted,
+    
+    Stage_Count = 4,
+};
+
+struct pipeline_slot
+{
+    // NOTE: The slot holds batch N, at stage S, when Ticket is (N*Stage_Count + S). Each stage
+    // waits for the exact ticket it needs, so the slots form a bounded ring, and nothing ever
+    // has to take a lock.
+    u32 volatile Ticket;
+    
+    u32 InstructionCount;
+    instruction *Instructions;
+    text_buffer Text;
+};
+
+struct disasm_pipeline
+{
+    opcode_table *Opcodes;
+    decode_source Source;
+    output_format Format;
+    FILE *Dest;
+    
+    pipeline_slot Slots[PIPELINE_SLOT_COUNT];
+    
+    u32 volatile NextFormatBatch;
+    
+    // NOTE: Written by the decode thread. BatchCount and StopReason are only valid once
+    // DecodeDone is set.
+    u32 volatile DecodeDone;
+    u32 BatchCount;
+    decode_stop_reason StopReason;
+};
+
+static b32 DisAsm8086Pipelined(decode_source Source, u32 FormatterCount, output_format Format, FILE *Dest,
+                               decode_stop_reason *StopReason);
@@ -0,0 +1,502 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+#if _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+static DWORD WINAPI Win32ThreadProc(LPVOID Param)
+{
+    thread_group *Group = (thread_group *)Param;
+    Group->Work(Group->Data);
+    return 0;
+}
+
+static u32 GetLogicalProcessorCount()
+{
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+    u32 Result = Info.dwNumberOfProcessors;
+    return Result;
+}
+
+static b32 MapFileReadOnly(char const *FileName, mapped_file *Result)
+{
+    *Result = {};
+    
+    b32 Opened = false;
+    HANDLE File = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if(File != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER Size;
+        if(GetFileSizeEx(File, &Size))
+        {
+            Opened = true;
+            if(Size.QuadPart)
+            {
+                HANDLE Mapping = CreateFileMappingA(File, 0, PAGE_READONLY, 0, 0, 0);
+                void *Data = Mapping ? MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+                if(Data)
+                {
+                    Result->Data = (u8 *)Data;
+                    Result->Size = (u64)Size.QuadPart;
+                }
+                else
+                {
+                    Opened = false;
+                }
+                
+                // NOTE: The view keeps the mapping, and the file, alive on its own.
+                if(Mapping)
+                {
+                    CloseHandle(Mapping);
+                }
+            }
+        }
+        
+        CloseHandle(File);
+    }
+    
+    return Opened;
+}
+
+static void UnmapFile(mapped_file *File)
+{
+    if(File->Data)
+    {
+        UnmapViewOfFile(File->Data);
+    }
+    
+    *File = {};
+}
+
+static b32 GetFileByteCount(char const *FileName, u64 *ByteCount)
+{
+    WIN32_FILE_ATTRIBUTE_DATA Data;
+    b32 Result = GetFileAttributesExA(FileName, GetFileExInfoStandard, &Data);
+    *ByteCount = Result ? (((u64)Data.nFileSizeHigh << 32) | Data.nFileSizeLow) : 0;
+    return Result;
+}
+
+static u32 GetPageSize()
+{
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+    u32 Result = Info.dwPageSize;
+    return Result;
+}
+
+static u8 *AllocatePages(u64 Size)
+{
+    u8 *Result = (u8 *)VirtualAlloc(0, (SIZE_T)Size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    return Result;
+}
+
+static u8 *AllocateExecutablePages(u64 Size)
+{
+    u8 *Result = (u8 *)VirtualAlloc(0, (SIZE_T)Size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    return Result;
+}
+
+static b32 ProtectExecutablePages(u8 *Memory, u64 Size, b32 Executable)
+{
+    DWORD OldProtect;
+    b32 Result = VirtualProtect(Memory, (SIZE_T)Size, Executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &OldProtect);
+    if(Result && Executable)
+    {
+        FlushInstructionCache(GetCurrentProcess(), Memory, (SIZE_T)Size);
+    }
+    
+    return Result;
+}
+
+static void FreePages(u8 *Memory, u64 Size)
+{
+    if(Memory)
+    {
+        VirtualFree(Memory, 0, MEM_RELEASE);
+    }
+}
+
+static b32 MapFileIntoPages(char const *FileName, u8 *Memory, u64 MemorySize, u64 *BytesMapped)
+{
+    // NOTE: Windows can't map a file view over part of an existing allocation, so this reads
+    // the file in instead. It's still one ReadFile per megabyte or so, not one call per byte.
+    *BytesMapped = 0;
+    
+    b32 Opened = false;
+    HANDLE File = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if(File != INVALID_HANDLE_VALUE)
+    {
+        Opened = true;
+        while(*BytesMapped < MemorySize)
+        {
+            u64 Remaining = MemorySize - *BytesMapped;
+            DWORD ReadSize = (Remaining > 0x40000000) ? 0x40000000 : (DWORD)Remaining;
+            DWORD BytesRead = 0;
+            if(!ReadFile(File, Memory + *BytesMapped, ReadSize, &BytesRead, 0) || !BytesRead)
+            {
+                break;
+            }
+            
+            *BytesMapped += BytesRead;
+        }
+        
+        CloseHandle(File);
+    }
+    
+    ZeroMemory(Memory + *BytesMapped, (SIZE_T)(MemorySize - *BytesMapped));
+    
+    return Opened;
+}
+
+static u32 StartThreads(thread_group *Group, u32 ThreadCount, thread_work *Work, void *Data)
+{
+    Group->Count = 0;
+    Group->Work = Work;
+    Group->Data = Data;
+    
+    while((Group->Count < ThreadCount) && (Group->Count < SIM86_MAX_THREAD_COUNT))
+    {
+        HANDLE Thread = CreateThread(0, 0, Win32ThreadProc, Group, 0, 0);
+        if(!Thread)
+        {
+            break;
+        }
+        
+        Group->Handles[Group->Count++] = Thread;
+    }
+    
+    return Group->Count;
+}
+
+static void JoinThreads(thread_group *Group)
+{
+    for(u32 ThreadIndex = 0; ThreadIndex < Group->Count; ++ThreadIndex)
+    {
+        WaitForSingleObject(Group->Handles[ThreadIndex], INFINITE);
+        CloseHandle(Group->Handles[ThreadIndex]);
+    }
+    
+    Group->Count = 0;
+}
+
+static void YieldThread()
+{
+    SwitchToThread();
+}
+
+static u32 AtomicIncrement(u32 volatile *Value)
+{
+    u32 Result = (u32)InterlockedIncrement((LONG volatile *)Value) - 1;
+    return Result;
+}
+
+static u32 AtomicDecrement(u32 volatile *Value)
+{
+    u32 Result = (u32)InterlockedDecrement((LONG volatile *)Value) + 1;
+    return Result;
+}
+
+static u32 AtomicLoad(u32 volatile *Value)
+{
+    u32 Result = (u32)InterlockedOr((LONG volatile *)Value, 0);
+    return Result;
+}
+
+static void AtomicStore(u32 volatile *Value, u32 New)
+{
+    InterlockedExchange((LONG volatile *)Value, (LONG)New);
+}
+
+static b32 AtomicCompareExchange(u32 volatile *Value, u32 Expected, u32 New)
+{
+    b32 Result = ((u32)InterlockedCompareExchange((LONG volatile *)Value, (LONG)New, (LONG)Expected) == Expected);
+    return Result;
+}
+
+#else
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void *PosixThreadProc(void *Param)
+{
+    thread_group *Group = (thread_group *)Param;
+    Group->Work(Group->Data);
+    return 0;
+}
+
+static u32 GetLogicalProcessorCount()
+{
+    long Count = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 Result = (Count > 0) ? (u32)Count : 1;
+    return Result;
+}
+
+static b32 MapFileReadOnly(char const *FileName, mapped_file *Result)
+{
+    *Result = {};
+    
+    b32 Opened = false;
+    int File = open(FileName, O_RDONLY);
+    if(File >= 0)
+    {
+        struct stat Stat;
+        if(fstat(File, &Stat) == 0)
+        {
+            Opened = true;
+            if(Stat.st_size)
+            {
+                void *Data = mmap(0, (size_t)Stat.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+                if(Data != MAP_FAILED)
+                {
+                    Result->Data = (u8 *)Data;
+                    Result->Size = (u64)Stat.st_size;
+                }
+                else
+                {
+                    Opened = false;
+                }
+            }
+        }
+        
+        // NOTE: The mapping keeps the file alive on its own.
+        close(File);
+    }
+    
+    return Opened;
+}
+
+static void UnmapFile(mapped_file *File)
+{
+    if(File->Data)
+    {
+        munmap(File->Data, (size_t)File->Size);
+    }
+    
+    *File = {};
+}
+
+static b32 GetFileByteCount(char const *FileName, u64 *ByteCount)
+{
+    struct stat Stat;
+    b32 Result = (stat(FileName, &Stat) == 0);
+    *ByteCount = Result ? (u64)Stat.st_size : 0;
+    return Result;
+}
+
+static u32 GetPageSize()
+{
+    long Size = sysconf(_SC_PAGESIZE);
+    u32 Result = (Size > 0) ? (u32)Size : 4096;
+    return Result;
+}
+
+static u8 *AllocatePages(u64 Size)
+{
+    void *Memory = mmap(0, (size_t)Size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    u8 *Result = (Memory != MAP_FAILED) ? (u8 *)Memory : 0;
+    return Result;
+}
+
+static u8 *AllocateExecutablePages(u64 Size)
+{
+    void *Memory = mmap(0, (size_t)Size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    u8 *Result = (Memory != MAP_FAILED) ? (u8 *)Memory : 0;
+    return Result;
+}
+
+static b32 ProtectExecutablePages(u8 *Memory, u64 Size, b32 Executable)
+{
+    b32 Result = (mprotect(Memory, (size_t)Size, Executable ? (PROT_READ|PROT_EXEC) : (PROT_READ|PROT_WRITE)) == 0);
+    return Result;
+}
+
+static void FreePages(u8 *Memory, u64 Size)
+{
+    if(Memory)
+    {
+        munmap(Memory, (size_t)Size);
+    }
+}
+
+static b32 ZeroPages(u8 *Memory, u64 Size)
+{
+    // NOTE: Swapping in fresh anonymous pages is cheaper than clearing the old ones, and drops
+    // whatever file mapping was there before.
+    b32 Result = (mmap(Memory, (size_t)Size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) != MAP_FAILED);
+    return Result;
+}
+
+// NOTE: Below this size, reading a file in costs less than setting up a mapping of it and
+// faulting that in (roughly break-even at 512k on Linux, with the file in the page cache).
+#define SIM86_MIN_MAPPED_FILE_SIZE (512*1024)
+
+static b32 MapFileIntoPages(char const *FileName, u8 *Memory, u64 MemorySize, u64 *BytesMapped)
+{
+    *BytesMapped = 0;
+    
+    b32 Opened = false;
+    int File = open(FileName, O_RDONLY);
+    if(File >= 0)
+    {
+        struct stat Stat;
+        if(fstat(File, &Stat) == 0)
+        {
+            u64 FileSize = (u64)Stat.st_size;
+            u64 LoadSize = (FileSize < MemorySize) ? FileSize : MemorySize;
+            u64 PageMask = GetPageSize() - 1;
+            u64 LoadedEnd = (LoadSize + PageMask) & ~PageMask;
+            if(LoadedEnd > MemorySize)
+            {
+                LoadedEnd = MemorySize;
+            }
+            
+            if(LoadSize >= SIM86_MIN_MAPPED_FILE_SIZE)
+            {
+                // NOTE: MAP_PRIVATE makes the pages copy-on-write, so they are shared with the
+                // page cache (and with every other process that has the same file loaded) until
+                // written. The bytes after the end of the file, in its last page, read as zero.
+                Opened = (mmap(Memory, (size_t)LoadedEnd, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, File, 0) != MAP_FAILED);
+                if(Opened)
+                {
+                    *BytesMapped = LoadSize;
+                    
+                    // NOTE: MAP_POPULATE would fault a writable private mapping in for writing,
+                    // which copies every page up front. Faulting in for reading keeps them shared.
+                    // Kernels older than 5.14 don't have that, so they get a read-ahead hint.
+#ifdef MADV_POPULATE_READ
+                    if(madvise(Memory, (size_t)LoadedEnd, MADV_POPULATE_READ) != 0)
+#endif
+                    {
+                        madvise(Memory, (size_t)LoadedEnd, MADV_WILLNEED);
+                    }
+                }
+            }
+            else
+            {
+                Opened = true;
+                while(*BytesMapped < LoadSize)
+                {
+                    ssize_t BytesRead = read(File, Memory + *BytesMapped, (size_t)(LoadSize - *BytesMapped));
+                    if(BytesRead <= 0)
+                    {
+                        break;
+                    }
+                    
+                    *BytesMapped += (u64)BytesRead;
+                }
+                
+                memset(Memory + *BytesMapped, 0, (size_t)(LoadedEnd - *BytesMapped));
+            }
+            
+            if(Opened && (LoadedEnd < MemorySize))
+            {
+                ZeroPages(Memory + LoadedEnd, MemorySize - LoadedEnd);
+            }
+        }
+        
+        // NOTE: The mapping keeps the file alive on its own.
+        close(File);
+    }
+    
+    if(!Opened)
+    {
+        // NOTE: A failed MAP_FIXED can leave the range unmapped, so this has to remap it either way.
+        ZeroPages(Memory, MemorySize);
+    }
+    
+    return Opened;
+}
+
+static u32 StartThreads(thread_group *Group, u32 ThreadCount, thread_work *Work, void *Data)
+{
+    Group->Count = 0;
+    Group->Work = Work;
+    Group->Data = Data;
+    
+    while((Group->Count < ThreadCount) && (Group->Count < SIM86_MAX_THREAD_COUNT))
+    {
+        pthread_t Thread;
+        if(pthread_create(&Thread, 0, PosixThreadProc, Group) != 0)
+        {
+            break;
+        }
+        
+        Group->Handles[Group->Count++] = (void *)Thread;
+    }
+    
+    return Group->Count;
+}
+
+static void JoinThreads(thread_group *Group)
+{
+    for(u32 ThreadIndex = 0; ThreadIndex < Group->Count; ++ThreadIndex)
+    {
+        pthread_join((pthread_t)Group->Handles[ThreadIndex], 0);
+    }
+    
+    Group->Count = 0;
+}
+
+static void YieldThread()
+{
+    sched_yield();
+}
+
+static u32 AtomicIncrement(u32 volatile *Value)
+{
+    u32 Result = __atomic_fetch_add(Value, 1, __ATOMIC_SEQ_CST);
+    return Result;
+}
+
+static u32 AtomicDecrement(u32 volatile *Value)
+{
+    u32 Result = __atomic_fetch_sub(Value, 1, __ATOMIC_SEQ_CST);
+    return Result;
+}
+
+static u32 AtomicLoad(u32 volatile *Value)
+{
+    u32 Result = __atomic_load_n(Value, __ATOMIC_ACQUIRE);
+    return Result;
+}
+
+static void AtomicStore(u32 volatile *Value, u32 New)
+{
+    __atomic_store_n(Value, New, __ATOMIC_RELEASE);
+}
+
+static b32 AtomicCompareExchange(u32 volatile *Value, u32 Expected, u32 New)
+{
+    b32 Result = __atomic_compare_exchange_n(Value, &Expected, New, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return Result;
+}
+
+#endif
+
+static void RunOnThreads(u32 ThreadCount, thread_work *Work, void *Data)
+{
+    thread_group Group;
+    StartThreads(&Group, ThreadCount ? (ThreadCount - 1) : 0, Work, Data);
+    
+    Work(Data);
+    
+    JoinThreads(&Group);
+}
@@ -0,0 +1,79 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+// NOTE: The only OS services sim86 needs beyond the C runtime. Everything else stays portable C.
+
+#define SIM86_MAX_THREAD_COUNT 256
+
+typedef void thread_work(void *Data);
+
+struct thread_group
+{
+    u32 Count;
+    void *Handles[SIM86_MAX_THREAD_COUNT];
+    
+    thread_work *Work;
+    void *Data;
+};
+
+struct mapped_file
+{
+    u8 *Data;
+    u64 Size;
+};
+
+static u32 GetLogicalProcessorCount();
+
+// NOTE: Maps a whole file read-only. Returns false, with Result cleared, if it can't. An empty
+// file maps successfully, with no Data.
+static b32 MapFileReadOnly(char const *FileName, mapped_file *Result);
+static void UnmapFile(mapped_file *File);
+static b32 GetFileByteCount(char const *FileName, u64 *ByteCount);
+
+// NOTE: Page-aligned, zeroed memory straight from the OS, for memory that files get mapped into.
+static u32 GetPageSize();
+static u8 *AllocatePages(u64 Size);
+static void FreePages(u8 *Memory, u64 Size);
+
+// NOTE: Like AllocatePages, but for generated code. The memory starts out read-write, and
+// ProtectExecutablePages switches pages of it to read-execute (and back) so it is never writable
+// and executable at once. Freed with FreePages.
+static u8 *AllocateExecutablePages(u64 Size);
+static b32 ProtectExecutablePages(u8 *Memory, u64 Size, b32 Executable);
+
+// NOTE: Makes the MemorySize bytes at Memory (page aligned, from AllocatePages) read as the
+// start of the file, followed by zeroes. Writes to Memory are private - they never reach the
+// file. Returns false, with the memory zeroed, if the file can't be opened.
+static b32 MapFileIntoPages(char const *FileName, u8 *Memory, u64 MemorySize, u64 *BytesMapped);
+
+// NOTE: Starts up to ThreadCount new threads running Work(Data), and returns how many actually
+// started. Group has to stay put until JoinThreads returns.
+static u32 StartThreads(thread_group *Group, u32 ThreadCount, thread_work *Work, void *Data);
+static void JoinThreads(thread_group *Group);
+
+// NOTE: Runs Work(Data) on ThreadCount threads at once - the calling thread is one of them - and
+// returns once every one of them has returned. Work is expected to pull its jobs off a shared
+// counter with AtomicIncrement, so it doesn't matter how many threads actually got started.
+static void RunOnThreads(u32 ThreadCount, thread_work *Work, void *Data);
+
+// NOTE: For spin-waits that might go on for a while - gives the core to someone else.
+static void YieldThread();
+
+// NOTE: AtomicIncrement and AtomicDecrement return the value from before they changed it.
+// AtomicLoad and AtomicStore are acquire and release, so whatever was written before a store is
+// visible after the matching load, on any thread.
+static u32 AtomicIncrement(u32 volatile *Value);
+static u32 AtomicDecrement(u32 volatile *Value);
+static u32 AtomicLoad(u32 volatile *Value);
+static void AtomicStore(u32 volatile *Value, u32 New);
+static b32 AtomicCompareExchange(u32 volatile *Value, u32 Expected, u32 New);
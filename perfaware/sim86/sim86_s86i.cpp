@@ -0,0 +1,245 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+static u64 AlignUp(u64 Value, u64 Alignment)
+{
+    u64 Result = (Value + Alignment - 1) & ~(Alignment - 1);
+    return Result;
+}
+
+static u8 *BuildStringTable(u32 Count, text_string const *Strings, u64 *Size)
+{
+    u64 TotalSize = Count*sizeof(u32);
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        TotalSize += Strings[Index].Length + 1;
+    }
+    
+    u8 *Result = (u8 *)calloc(TotalSize, 1);
+    if(Result)
+    {
+        u32 *Offsets = (u32 *)Result;
+        u32 At = Count*sizeof(u32);
+        for(u32 Index = 0; Index < Count; ++Index)
+        {
+            Offsets[Index] = At;
+            memcpy(Result + At, Strings[Index].Data, Strings[Index].Length);
+            At += Strings[Index].Length + 1;
+        }
+    }
+    
+    *Size = TotalSize;
+    return Result;
+}
+
+static void WriteSection(FILE *Dest, u64 *At, s86i_section Section, void const *Data)
+{
+    // NOTE: Sections are written in order, so all that's ever needed is padding up to the next one.
+    static u8 const Zeroes[64] = {};
+    while(*At < Section.Offset)
+    {
+        u64 PadSize = Section.Offset - *At;
+        if(PadSize > sizeof(Zeroes))
+        {
+            PadSize = sizeof(Zeroes);
+        }
+        
+        fwrite(Zeroes, 1, (size_t)PadSize, Dest);
+        *At += PadSize;
+    }
+    
+    fwrite(Data, 1, (size_t)Section.Size, Dest);
+    *At += Section.Size;
+}
+
+static b32 WriteS86iFile(FILE *Dest, decode_source Source, u32 *InstructionCount)
+{
+    b32 Result = false;
+    
+    s86i_header Header = {};
+    Header.Magic = S86I_MAGIC;
+    Header.Version = S86I_VERSION;
+    Header.HeaderSize = sizeof(Header);
+    Header.RecordSize = sizeof(compact_instruction);
+    Header.SourceSize = Source.Size;
+    Header.IndexGranularity = S86I_INDEX_GRANULARITY;
+    Header.IndexCount = (Source.Size + S86I_INDEX_GRANULARITY - 1) / S86I_INDEX_GRANULARITY;
+    Header.MnemonicCount = Op_Count;
+    Header.RegisterNameCount = sizeof(RegisterNameText) / sizeof(text_string);
+    
+    // NOTE: There can't be more instructions than bytes.
+    compact_instruction *Records = (compact_instruction *)malloc(((size_t)Source.Size + 1)*sizeof(compact_instruction));
+    u32 *AddressIndex = (u32 *)malloc(((size_t)Header.IndexCount + 1)*sizeof(u32));
+    u8 *Mnemonics = BuildStringTable(Header.MnemonicCount, OpcodeMnemonicText, &Header.Mnemonics.Size);
+    u8 *RegisterNames = BuildStringTable(Header.RegisterNameCount, &RegisterNameText[0][0], &Header.RegisterNames.Size);
+    
+    if(Records && AddressIndex && Mnemonics && RegisterNames)
+    {
+        decode_block_result Decoded = DecodeCompactBlock(Get8086OpcodeTable(), Source, 0, Source.Size, Records);
+        Header.InstructionCount = Decoded.InstructionCount;
+        Header.StopReason = Decoded.StopReason;
+        
+        u32 RecordIndex = 0;
+        for(u32 Granule = 0; Granule < Header.IndexCount; ++Granule)
+        {
+            while((RecordIndex < Header.InstructionCount) &&
+                  (Records[RecordIndex].Address < (Granule*S86I_INDEX_GRANULARITY)))
+            {
+                ++RecordIndex;
+            }
+            AddressIndex[Granule] = RecordIndex;
+        }
+        AddressIndex[Header.IndexCount] = Header.InstructionCount;
+        
+        Header.Records.Offset = AlignUp(sizeof(Header), 64);
+        Header.Records.Size = (u64)Header.InstructionCount*sizeof(compact_instruction);
+        Header.AddressIndex.Offset = AlignUp(Header.Records.Offset + Header.Records.Size, 64);
+        Header.AddressIndex.Size = ((u64)Header.IndexCount + 1)*sizeof(u32);
+        Header.Mnemonics.Offset = AlignUp(Header.AddressIndex.Offset + Header.AddressIndex.Size, 64);
+        Header.RegisterNames.Offset = AlignUp(Header.Mnemonics.Offset + Header.Mnemonics.Size, 64);
+        
+        u64 At = 0;
+        s86i_section HeaderSection = {0, sizeof(Header)};
+        WriteSection(Dest, &At, HeaderSection, &Header);
+        WriteSection(Dest, &At, Header.Records, Records);
+        WriteSection(Dest, &At, Header.AddressIndex, AddressIndex);
+        WriteSection(Dest, &At, Header.Mnemonics, Mnemonics);
+        WriteSection(Dest, &At, Header.RegisterNames, RegisterNames);
+        
+        *InstructionCount = Header.InstructionCount;
+        Result = !ferror(Dest);
+    }
+    
+    free(Records);
+    free(AddressIndex);
+    free(Mnemonics);
+    free(RegisterNames);
+    
+    return Result;
+}
+
+static b32 SectionFits(u64 FileSize, s86i_section Section, u64 Size, u64 Alignment)
+{
+    b32 Result = ((Section.Offset <= FileSize) &&
+                  (Section.Size <= (FileSize - Section.Offset)) &&
+                  (Section.Size >= Size) &&
+                  ((Section.Offset % Alignment) == 0));
+    return Result;
+}
+
+static b32 StringTableIsValid(s86i_section Section, u8 const *File, u32 Count)
+{
+    // NOTE: Every offset has to land inside the strings, and the last string has to be
+    // terminated, so nothing can read off the end of the section.
+    u8 const *Base = File + Section.Offset;
+    u32 const *Offsets = (u32 const *)Base;
+    
+    b32 Result = ((Section.Size > Count*sizeof(u32)) && (Base[Section.Size - 1] == 0));
+    for(u32 Index = 0; Result && (Index < Count); ++Index)
+    {
+        Result = ((Offsets[Index] >= Count*sizeof(u32)) && (Offsets[Index] < Section.Size));
+    }
+    
+    return Result;
+}
+
+static b32 GetS86iView(u8 const *File, u64 FileSize, s86i_view *View)
+{
+    *View = {};
+    
+    s86i_header const *Header = (s86i_header const *)File;
+    b32 Result = ((FileSize >= sizeof(s86i_header)) &&
+                  (Header->Magic == S86I_MAGIC) &&
+                  (Header->Version == S86I_VERSION) &&
+                  (Header->HeaderSize >= sizeof(s86i_header)) &&
+                  (Header->RecordSize == sizeof(compact_instruction)) &&
+                  (Header->IndexGranularity != 0) &&
+                  (Header->RegisterNameCount >= 3) &&
+                  SectionFits(FileSize, Header->Records, (u64)Header->InstructionCount*sizeof(compact_instruction), 4) &&
+                  SectionFits(FileSize, Header->AddressIndex, ((u64)Header->IndexCount + 1)*sizeof(u32), 4) &&
+                  SectionFits(FileSize, Header->Mnemonics, 0, 4) &&
+                  SectionFits(FileSize, Header->RegisterNames, 0, 4) &&
+                  StringTableIsValid(Header->Mnemonics, File, Header->MnemonicCount) &&
+                  StringTableIsValid(Header->RegisterNames, File, Header->RegisterNameCount));
+    
+    if(Result)
+    {
+        View->Header = Header;
+        View->InstructionCount = Header->InstructionCount;
+        View->Instructions = (compact_instruction const *)(File + Header->Records.Offset);
+        View->AddressIndex = (u32 const *)(File + Header->AddressIndex.Offset);
+        View->MnemonicOffsets = (u32 const *)(File + Header->Mnemonics.Offset);
+        View->RegisterNameOffsets = (u32 const *)(File + Header->RegisterNames.Offset);
+        View->Mnemonics = (char const *)(File + Header->Mnemonics.Offset);
+        View->RegisterNames = (char const *)(File + Header->RegisterNames.Offset);
+    }
+    
+    return Result;
+}
+
+static u32 FindS86iInstruction(s86i_view *View, u32 Address)
+{
+    // NOTE: The address index narrows the search down to one granule's worth of records.
+    u32 Result = S86I_NOT_FOUND;
+    
+    u32 Granule = Address / View->Header->IndexGranularity;
+    if(Granule < View->Header->IndexCount)
+    {
+        u32 Low = View->AddressIndex[Granule];
+        u32 High = View->AddressIndex[Granule + 1];
+        if(High > View->InstructionCount)
+        {
+            High = View->InstructionCount;
+        }
+        
+        while(Low < High)
+        {
+            u32 Middle = (Low + High) / 2;
+            if(View->Instructions[Middle].Address < Address)
+            {
+                Low = Middle + 1;
+            }
+            else
+            {
+                High = Middle;
+            }
+        }
+        
+        if((Low < View->InstructionCount) && (View->Instructions[Low].Address == Address))
+        {
+            Result = Low;
+        }
+    }
+    
+    return Result;
+}
+
+static char const *GetS86iMnemonic(s86i_view *View, u32 Op)
+{
+    char const *Result = "";
+    if(Op < View->Header->MnemonicCount)
+    {
+        Result = View->Mnemonics + View->MnemonicOffsets[Op];
+    }
+    
+    return Result;
+}
+
+static char const *GetS86iRegisterName(s86i_view *View, register_access Reg)
+{
+    // NOTE: Same selection as GetRegName.
+    u32 RegisterCount = View->Header->RegisterNameCount / 3;
+    u32 Index = (Reg.Index % RegisterCount)*3 + ((Reg.Count == 2) ? 2 : (Reg.Offset & 1));
+    char const *Result = View->RegisterNames + View->RegisterNameOffsets[Index];
+    return Result;
+}
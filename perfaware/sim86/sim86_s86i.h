@@ -0,0 +1,77 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+/* NOTE: .s86i is a file of already-decoded instructions, laid out so it can be mapped into
+   memory and used in place, with no parsing:
+   
+   s86i_header
+   Records        InstructionCount compact_instructions, in address order (64-byte aligned)
+   AddressIndex   IndexCount + 1 u32s: entry N is the first record whose Address is at least
+                  N*IndexGranularity, and the last entry is InstructionCount
+   Mnemonics      MnemonicCount u32 offsets, then the zero-terminated strings they point to,
+                  indexed by operation_type
+   RegisterNames  RegisterNameCount u32 offsets, then the strings, indexed by
+                  (register index * 3) + (0 low byte, 1 high byte, 2 whole register)
+   
+   Section offsets are from the start of the file, string offsets are from the start of their
+   section, and everything is little-endian. A reader
+   should refuse any file whose Magic, Version, or RecordSize it doesn't recognize.
+*/
+
+static u32 const S86I_MAGIC = 0x49363853; // NOTE: "S86I"
+static u32 const S86I_VERSION = 1;
+static u32 const S86I_INDEX_GRANULARITY = 256;
+static u32 const S86I_NOT_FOUND = 0xffffffff;
+
+struct s86i_section
+{
+    u64 Offset;
+    u64 Size;
+};
+
+struct s86i_header
+{
+    u32 Magic;
+    u32 Version;
+    u32 HeaderSize;
+    u32 RecordSize;
+    
+    u64 SourceSize;
+    u32 InstructionCount;
+    decode_stop_reason StopReason;
+    
+    u32 IndexGranularity;
+    u32 IndexCount;
+    u32 MnemonicCount;
+    u32 RegisterNameCount;
+    
+    s86i_section Records;
+    s86i_section AddressIndex;
+    s86i_section Mnemonics;
+    s86i_section RegisterNames;
+};
+
+// NOTE: Pointers straight into a mapped .s86i file - nothing is copied.
+struct s86i_view
+{
+    s86i_header const *Header;
+    
+    u32 InstructionCount;
+    compact_instruction const *Instructions;
+    u32 const *AddressIndex;
+    
+    u32 const *MnemonicOffsets;
+    u32 const *RegisterNameOffsets;
+    char const *Mnemonics;
+    char const *RegisterNames;
+};
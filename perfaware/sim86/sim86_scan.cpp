@@ -0,0 +1,426 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+#if SIM86_SCAN_AVX2
+#include <immintrin.h>
+#if _MSC_VER
+#include <intrin.h>
+#define SIM86_TARGET_AVX2
+#else
+#define SIM86_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static b32 HostHasAVX2()
+{
+    b32 Result = false;
+
+#if SIM86_SCAN_AVX2 && _MSC_VER
+    // NOTE: The OS has to save the upper halves of the ymm registers too, not just the CPU have them.
+    int Info[4];
+    __cpuid(Info, 0);
+    if(Info[0] >= 7)
+    {
+        __cpuid(Info, 1);
+        b32 OSSavesAVX = ((Info[2] & (1 << 27)) && (Info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6));
+        __cpuidex(Info, 7, 0);
+        Result = (OSSavesAVX && (Info[1] & (1 << 5)));
+    }
+#elif SIM86_SCAN_AVX2
+    __builtin_cpu_init();
+    Result = __builtin_cpu_supports("avx2");
+#endif
+
+    return Result;
+}
+
+static u8 GetSingleLength(opcode_table *Opcodes, u8 FirstByte, u8 SecondByte)
+{
+    // NOTE: Every 8086 instruction's length is determined by its first two bytes: the opcode,
+    // and the ModRM byte (or the second opcode byte, for aam/aad). So rather than working the
+    // lengths out separately, the table is filled in by asking the real decoder about every
+    // byte pair, one encoding at a time (no prefix handling), with zeroes after it.
+    u8 Bytes[16] = {FirstByte, SecondByte};
+    
+    decode_context Context = {};
+    Context.Templates = &Opcodes->Templates;
+    instruction Instruction = TryDecodeAny(&Context, Opcodes->Instructions, Opcodes, FixedMemoryPow2(4, Bytes));
+    
+    u8 Result = Length_Invalid;
+    if((Instruction.Op == Op_lock) || (Instruction.Op == Op_rep) || (Instruction.Op == Op_segment))
+    {
+        Result = Length_Prefix;
+    }
+    else if(Instruction.Op)
+    {
+        Result = (u8)Instruction.Size;
+    }
+    
+    return Result;
+}
+
+static u8 GetDisplacementByteCount(u8 ModRM)
+{
+    // NOTE: mod 00 with r/m 110 is a direct address, which is a 16-bit displacement on its own.
+    u32 Mod = ModRM >> 6;
+    u8 Result = (Mod == 0b01) ? 1 : (Mod == 0b10) ? 2 : ((ModRM & 0xc7) == 0x06) ? 2 : 0;
+    return Result;
+}
+
+static b32 BuildLengthTable(opcode_table *Opcodes, length_table *Dest)
+{
+    *Dest = {};
+    Dest->MaxInstructionByteCount = Opcodes->Instructions.MaxInstructionByteCount;
+    
+    for(u32 FirstByte = 0; FirstByte < 256; ++FirstByte)
+    {
+        u8 Row[256];
+        b32 AllSame = true;
+        for(u32 SecondByte = 0; SecondByte < 256; ++SecondByte)
+        {
+            Row[SecondByte] = GetSingleLength(Opcodes, (u8)FirstByte, (u8)SecondByte);
+            AllSame = AllSame && (Row[SecondByte] == Row[0]);
+        }
+        
+        if(AllSame)
+        {
+            Dest->FirstByte[FirstByte] = Row[0];
+        }
+        else
+        {
+            // NOTE: A prefix never depends on what comes after it, so this would be a bug in the table.
+            assert(Row[0] != Length_Prefix);
+            
+            u32 RowIndex = 0;
+            while((RowIndex < Dest->RowCount) && (memcmp(Dest->SecondByte[RowIndex], Row, sizeof(Row)) != 0))
+            {
+                ++RowIndex;
+            }
+            
+            if(RowIndex == Dest->RowCount)
+            {
+                // NOTE: If this assert fires, LENGTH_TABLE_MAX_ROWS needs to go up.
+                assert(Dest->RowCount < LENGTH_TABLE_MAX_ROWS);
+                memcpy(Dest->SecondByte[Dest->RowCount++], Row, sizeof(Row));
+            }
+            
+            Dest->FirstByte[FirstByte] = (u8)(Length_SecondByte | RowIndex);
+        }
+    }
+    
+    b32 RowsFit = ((Dest->RowCount*8) <= ArrayCount(Dest->RegLengths));
+    for(u32 RowIndex = 0; RowsFit && (RowIndex < Dest->RowCount); ++RowIndex)
+    {
+        u8 *Row = Dest->SecondByte[RowIndex];
+        u8 *RegLengths = &Dest->RegLengths[RowIndex*8];
+        
+        // NOTE: Zero stays invalid, so a REG value that is invalid has to be invalid for every
+        // mod and r/m to fit.
+        b32 Regular = true;
+        for(u32 SecondByte = 0; SecondByte < 256; ++SecondByte)
+        {
+            u32 Reg = (SecondByte >> 3) & 0x7;
+            u8 Length = Row[SecondByte] ? (u8)(Row[SecondByte] - GetDisplacementByteCount((u8)SecondByte)) : 0;
+            if((SecondByte & 0xc7) == 0)
+            {
+                RegLengths[Reg] = Length;
+            }
+            Regular = Regular && (RegLengths[Reg] == Length);
+        }
+        
+        if(!Regular)
+        {
+            memset(RegLengths, Length_Irregular, 8);
+        }
+    }
+    
+    Dest->UseAVX2 = (RowsFit && HostHasAVX2());
+    
+    return true;
+}
+
+static length_table *Get8086LengthTable()
+{
+    // NOTE: Built once, the first time anyone asks for it, same as the opcode table.
+    static length_table Table;
+    static b32 Built = BuildLengthTable(Get8086OpcodeTable(), &Table);
+    assert(Built);
+    
+    return &Table;
+}
+
+static u8 GetLengthEntry(length_table *Lengths, u8 FirstByte, u8 SecondByte)
+{
+    // NOTE: A length, Length_Prefix or Length_Invalid, for an instruction (not counting any
+    // prefixes) that starts with these two bytes.
+    u8 Result = Lengths->FirstByte[FirstByte];
+    if(Result & Length_SecondByte)
+    {
+        Result = Lengths->SecondByte[Result & ~Length_SecondByte][SecondByte];
+    }
+    
+    return Result;
+}
+
+static u8 GetLengthEntryAt(length_table *Lengths, decode_source Source, u32 Offset)
+{
+    u8 FirstByte = (Offset < Source.Size) ? Source.Bytes[Offset] : 0;
+    u8 SecondByte = ((Offset + 1) < Source.Size) ? Source.Bytes[Offset + 1] : 0;
+    u8 Result = GetLengthEntry(Lengths, FirstByte, SecondByte);
+    return Result;
+}
+
+static u32 GetInstructionLength(length_table *Lengths, decode_source Source, u32 Offset)
+{
+    // NOTE: Returns the total size of the instruction at Offset, prefixes included, or something
+    // larger than MaxInstructionByteCount if there is no valid instruction there. It does not
+    // check the result against the end of the source - like the decoder, bytes past the end
+    // just read as zero.
+    u32 MaxInstructionByteCount = Lengths->MaxInstructionByteCount;
+    
+    u32 Result = 0;
+    u32 At = Offset;
+    while(Result < MaxInstructionByteCount)
+    {
+        u8 Entry = GetLengthEntryAt(Lengths, Source, At);
+        if(Entry == Length_Prefix)
+        {
+            Result += 1;
+            At += 1;
+        }
+        else
+        {
+            Result = (Entry == Length_Invalid) ? (MaxInstructionByteCount + 1) : (Result + Entry);
+            break;
+        }
+    }
+    
+    return Result;
+}
+
+static b32 MarkInstructionStart(length_table *Lengths, decode_source Source, u32 Offset, u32 TotalSize,
+                                u64 *Bitmap, decode_block_result *Result)
+{
+    // NOTE: Returns false, with Result's StopReason set, if the scan has to stop at Offset.
+    b32 Continue = false;
+    if(TotalSize > Lengths->MaxInstructionByteCount)
+    {
+        Result->StopReason = DecodeStop_Unrecognized;
+    }
+    else if(TotalSize > (Source.Size - Offset))
+    {
+        Result->StopReason = DecodeStop_Truncated;
+    }
+    else
+    {
+        Bitmap[Offset / 64] |= (1ull << (Offset % 64));
+        ++Result->InstructionCount;
+        Continue = true;
+    }
+    
+    return Continue;
+}
+
+static decode_block_result WalkInstructionBoundaries(length_table *Lengths, decode_source Source, u64 *Bitmap)
+{
+    // NOTE: The plain path: one table walk per instruction, straight through the source.
+    decode_block_result Result = {};
+    Result.StopReason = DecodeStop_EndOfSource;
+    
+    u32 Offset = 0;
+    while(Offset < Source.Size)
+    {
+        u32 TotalSize = GetInstructionLength(Lengths, Source, Offset);
+        if(!MarkInstructionStart(Lengths, Source, Offset, TotalSize, Bitmap, &Result))
+        {
+            break;
+        }
+        Offset += TotalSize;
+    }
+    
+    Result.BytesDecoded = Offset;
+    
+    return Result;
+}
+
+#if SIM86_SCAN_AVX2
+
+static SIM86_TARGET_AVX2 __m256i Lookup256(__m256i const *Table, u32 SliceCount, __m256i Index)
+{
+    // NOTE: vpshufb only looks up 16 entries, so each 16-entry slice of the table is looked up
+    // with the low nibble, and kept in the lanes whose high nibble picks that slice. Indices
+    // past the last slice look up zero.
+    __m256i LowNibble = _mm256_and_si256(Index, _mm256_set1_epi8(0x0f));
+    __m256i HighNibble = _mm256_and_si256(_mm256_srli_epi16(Index, 4), _mm256_set1_epi8(0x0f));
+    
+    __m256i Result = _mm256_setzero_si256();
+    for(u32 Slice = 0; Slice < SliceCount; ++Slice)
+    {
+        __m256i InSlice = _mm256_cmpeq_epi8(HighNibble, _mm256_set1_epi8((char)Slice));
+        Result = _mm256_or_si256(Result, _mm256_and_si256(InSlice, _mm256_shuffle_epi8(Table[Slice], LowNibble)));
+    }
+    
+    return Result;
+}
+
+static SIM86_TARGET_AVX2 void GetLengthEntriesAVX2(length_table *Lengths, decode_source Source, u32 Start, u32 Count, u8 *Dest)
+{
+    // NOTE: Dest[N] gets the length entry for an instruction starting at Start + N, for every
+    // byte, whether or not an instruction actually starts there. That is what makes it possible
+    // to do 32 at a time - which of them are real starts is left to the walk.
+    // NOTE: Only the slices of RegLengths that have rows in them need looking at.
+    u32 RegSliceCount = (Lengths->RowCount*8 + 15) / 16;
+    __m256i FirstByte[16];
+    __m256i RegLengths[16];
+    for(u32 Slice = 0; Slice < 16; ++Slice)
+    {
+        FirstByte[Slice] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)&Lengths->FirstByte[16*Slice]));
+        RegLengths[Slice] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)&Lengths->RegLengths[16*Slice]));
+    }
+    
+    // NOTE: Indexed by mod, plus 4 for a direct address.
+    __m256i DisplacementBytes = _mm256_setr_epi8(0, 1, 2, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                 0, 1, 2, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m256i Zero = _mm256_setzero_si256();
+    __m256i Irregular = _mm256_set1_epi8(Length_Irregular);
+    
+    // NOTE: Each lane needs the byte after it as well, so the vectors stop a byte short of the
+    // end of the source and the rest is done one byte at a time.
+    u32 Index = 0;
+    while(((Index + 32) <= Count) && ((Start + Index + 33) <= Source.Size))
+    {
+        u8 *At = Source.Bytes + Start + Index;
+        __m256i First = _mm256_loadu_si256((__m256i *)At);
+        __m256i Second = _mm256_loadu_si256((__m256i *)(At + 1));
+        
+        __m256i Entry = Lookup256(FirstByte, 16, First);
+        
+        __m256i Row = _mm256_and_si256(_mm256_slli_epi16(Entry, 3), _mm256_set1_epi8((char)0xf8));
+        __m256i Reg = _mm256_and_si256(_mm256_srli_epi16(Second, 3), _mm256_set1_epi8(0x07));
+        __m256i RegLength = Lookup256(RegLengths, RegSliceCount, _mm256_or_si256(Row, Reg));
+        
+        __m256i Mod = _mm256_and_si256(_mm256_srli_epi16(Second, 6), _mm256_set1_epi8(0x03));
+        __m256i DirectAddress = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(Second, _mm256_set1_epi8((char)0xc7)), _mm256_set1_epi8(0x06)),
+                                                 _mm256_set1_epi8(4));
+        __m256i Displacement = _mm256_shuffle_epi8(DisplacementBytes, _mm256_or_si256(Mod, DirectAddress));
+        
+        // NOTE: Only real lengths get the displacement added - invalid and irregular stay as they are.
+        __m256i IsLength = _mm256_and_si256(_mm256_cmpgt_epi8(RegLength, Zero), _mm256_cmpgt_epi8(_mm256_set1_epi8(16), RegLength));
+        __m256i SecondByteLength = _mm256_add_epi8(RegLength, _mm256_and_si256(Displacement, IsLength));
+        
+        // NOTE: Length_SecondByte is the sign bit.
+        __m256i Result = _mm256_blendv_epi8(Entry, SecondByteLength, Entry);
+        _mm256_storeu_si256((__m256i *)(Dest + Index), Result);
+        
+        u32 IrregularMask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(Result, Irregular));
+        for(u32 Lane = 0; IrregularMask; ++Lane, IrregularMask >>= 1)
+        {
+            if(IrregularMask & 1)
+            {
+                Dest[Index + Lane] = GetLengthEntry(Lengths, At[Lane], At[Lane + 1]);
+            }
+        }
+        
+        Index += 32;
+    }
+    
+    for(; Index < Count; ++Index)
+    {
+        Dest[Index] = GetLengthEntryAt(Lengths, Source, Start + Index);
+    }
+}
+
+#define SCAN_BLOCK_SIZE 4096
+
+static decode_block_result ScanInstructionBoundariesAVX2(length_table *Lengths, decode_source Source, u64 *Bitmap)
+{
+    // NOTE: A block at a time, the length of an instruction starting at every byte is worked out
+    // 32 bytes at a time, then the walk only has to hop from one start to the next through that.
+    // Prefixes and invalid bytes (rare in real code) go through the plain table walk instead.
+    decode_block_result Result = {};
+    Result.StopReason = DecodeStop_EndOfSource;
+    
+    // NOTE: Blocks start small and double, so a source that isn't code (and stops the scan
+    // after a few bytes) doesn't pay for the lengths of a whole block.
+    u8 Entries[SCAN_BLOCK_SIZE];
+    u32 BlockSize = 256;
+    u32 Offset = 0;
+    b32 Continue = true;
+    for(u32 BlockStart = 0; Continue && (BlockStart < Source.Size); BlockStart += BlockSize)
+    {
+        if((BlockStart != 0) && (BlockSize < SCAN_BLOCK_SIZE))
+        {
+            BlockSize *= 2;
+        }
+        
+        u32 BlockCount = Source.Size - BlockStart;
+        if(BlockCount > BlockSize)
+        {
+            BlockCount = BlockSize;
+        }
+        GetLengthEntriesAVX2(Lengths, Source, BlockStart, BlockCount, Entries);
+        
+        // NOTE: An instruction can run past the end of the block, so Offset carries over into
+        // the next one.
+        u32 BlockEnd = BlockStart + BlockCount;
+        while(Continue && (Offset < BlockEnd))
+        {
+            // NOTE: Anything that isn't a plain length (Length_Invalid wraps around here) takes the
+            // slow path.
+            u32 TotalSize = Entries[Offset - BlockStart];
+            if((TotalSize - 1) >= Lengths->MaxInstructionByteCount)
+            {
+                TotalSize = GetInstructionLength(Lengths, Source, Offset);
+            }
+            
+            Continue = MarkInstructionStart(Lengths, Source, Offset, TotalSize, Bitmap, &Result);
+            if(Continue)
+            {
+                Offset += TotalSize;
+            }
+        }
+    }
+    
+    Result.BytesDecoded = Offset;
+    
+    return Result;
+}
+
+#endif
+
+static decode_block_result ScanInstructionBoundaries(length_table *Lengths, decode_source Source, u64 *Bitmap)
+{
+    /* NOTE: This finds where every instruction starts without decoding any operands. It follows
+       exactly the same rules as a linear decode (prefixes included), so it sets a bit in Bitmap
+       at every address DecodeBlock would return, and stops at the same place for the same reason.
+       
+       Bitmap must have room for one bit per source byte, rounded up to a whole u64. Bits are
+       only ever set, so clear it first.
+       
+       Where an instruction starts depends on the length of the one before it, so finding the
+       starts is a serial walk either way. With AVX2, though, the lengths are looked up for every
+       byte 32 at a time first, which leaves the walk itself with a single load per instruction.
+    */
+    decode_block_result Result;
+#if SIM86_SCAN_AVX2
+    if(Lengths->UseAVX2)
+    {
+        Result = ScanInstructionBoundariesAVX2(Lengths, Source, Bitmap);
+    }
+    else
+#endif
+    {
+        Result = WalkInstructionBoundaries(Lengths, Source, Bitmap);
+    }
+    
+    return Result;
+}
@@ -0,0 +1,54 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+enum length_entry : u8
+{
+    Length_Invalid = 0x00, // NOTE: No 8086 instruction starts with this byte (or byte pair)
+    Length_Irregular = 0x20, // NOTE: Only in RegLengths - the REG field isn't enough, so the whole row has to be looked at
+    Length_Prefix = 0x40, // NOTE: A one-byte prefix (lock, rep, segment)
+    Length_SecondByte = 0x80, // NOTE: The length depends on the second byte - the low bits are the row index
+    
+    // NOTE: Anything else (1 through 15) is the length of the instruction, from its first byte alone.
+};
+
+#define LENGTH_TABLE_MAX_ROWS 64
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIM86_SCAN_AVX2 1
+#else
+#define SIM86_SCAN_AVX2 0
+#endif
+
+struct length_table
+{
+    u32 MaxInstructionByteCount;
+    
+    u8 FirstByte[256];
+    
+    // NOTE: Rows are deduplicated, so every opcode whose length depends on the ModRM byte in the
+    // same way (say, "ModRM plus an 8-bit immediate") shares a single row.
+    u32 RowCount;
+    u8 SecondByte[LENGTH_TABLE_MAX_ROWS][256];
+    
+    // NOTE: Nearly every row is a length for each REG field value, plus however many displacement
+    // bytes the mod and r/m fields ask for. RegLengths holds those, indexed by row*8 + REG, so the
+    // vector path only needs 256-entry lookups. Rows that don't work that way (aam and aad, which
+    // need one exact second byte) are Length_Irregular throughout.
+    u8 RegLengths[256];
+    b32 UseAVX2; // NOTE: This host has AVX2, and every row fits in RegLengths
+};
+
+static length_table *Get8086LengthTable();
+static u8 GetLengthEntry(length_table *Lengths, u8 FirstByte, u8 SecondByte);
+static u32 GetInstructionLength(length_table *Lengths, decode_source Source, u32 Offset);
+static decode_block_result ScanInstructionBoundaries(length_table *Lengths, decode_source Source, u64 *Bitmap);
+static decode_block_result WalkInstructionBoundaries(length_table *Lengths, decode_source Source, u64 *Bitmap);
@@ -0,0 +1,290 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+/* NOTE: A parallel linear sweep produces exactly the instructions a serial decode from offset
+   zero would, but decodes most of them on worker threads.
+   
+   The source is cut into fixed-size chunks. A worker decodes each chunk from its first byte,
+   without knowing whether an instruction really starts there (the "main stream"). It also
+   walks every other offset the true stream could enter the chunk at, using only the length
+   table, until that walk lands on an instruction of the main stream. 8086 code resynchronizes
+   quickly, so this almost always happens within a few instructions.
+   
+   Stitching then runs in order on the calling thread. The true stream's entry into each chunk
+   is known from where the previous chunk left off. If that entry resynchronized, only the few
+   instructions before the sync point get decoded again, and the main stream's instructions
+   from there on are kept. If it never did, the chunk falls back to a plain serial decode.
+   
+   Chunks are processed in batches of a few per thread, so memory use stays bounded no matter
+   how large the source is.
+*/
+
+static b32 IsChunkStart(sweep_chunk *Chunk, u32 Offset)
+{
+    u32 Bit = Offset - Chunk->Start;
+    b32 Result = ((Chunk->MainStarts[Bit / 64] >> (Bit % 64)) & 1);
+    return Result;
+}
+
+static void SpeculateChunk(linear_sweep *Sweep, sweep_chunk *Chunk)
+{
+    u32 ChunkByteCount = Chunk->End - Chunk->Start;
+    memset(Chunk->MainStarts, 0, ((ChunkByteCount + 63) / 64)*sizeof(u64));
+    
+    Chunk->MainInstructionCount = 0;
+    Chunk->MainStopped = false;
+    Chunk->MainStopReason = DecodeStop_EndOfSource;
+    
+    u32 Offset = Chunk->Start;
+    while(Offset < Chunk->End)
+    {
+        instruction Instruction;
+        if(!DecodeNext(Sweep->Opcodes, Sweep->Source, Offset, &Instruction, &Chunk->MainStopReason))
+        {
+            Chunk->MainStopped = true;
+            break;
+        }
+        
+        u32 Bit = Offset - Chunk->Start;
+        Chunk->MainStarts[Bit / 64] |= (1ull << (Bit % 64));
+        Chunk->Instructions[Chunk->MainInstructionCount++] = PackDecodedInstruction(Instruction);
+        Offset += Instruction.Size;
+    }
+    Chunk->MainExit = Offset;
+    
+    // NOTE: A candidate that reaches MainExit has synced too, even when that is past the end
+    // of the chunk, or is where the main stream stopped on bad code - either way, from there
+    // on it would do exactly what the main stream did.
+    u32 MaxInstructionByteCount = Sweep->Lengths->MaxInstructionByteCount;
+    for(u32 Candidate = 0; Candidate < SWEEP_MAX_CANDIDATES; ++Candidate)
+    {
+        Chunk->SyncOffset[Candidate] = SWEEP_NO_SYNC;
+    }
+    Chunk->SyncOffset[0] = Chunk->Start;
+    
+    for(u32 Candidate = 1; Candidate < MaxInstructionByteCount; ++Candidate)
+    {
+        Offset = Chunk->Start + Candidate;
+        while(Offset < Chunk->End)
+        {
+            if(IsChunkStart(Chunk, Offset) || (Offset == Chunk->MainExit))
+            {
+                Chunk->SyncOffset[Candidate] = Offset;
+                break;
+            }
+            
+            // NOTE: A candidate that hits bad code before syncing is left for the fallback,
+            // which will report the error exactly where a serial decode would.
+            u32 Length = GetInstructionLength(Sweep->Lengths, Sweep->Source, Offset);
+            if((Length > MaxInstructionByteCount) || (Length > (Sweep->Source.Size - Offset)))
+            {
+                break;
+            }
+            
+            Offset += Length;
+            if(Offset == Chunk->MainExit)
+            {
+                Chunk->SyncOffset[Candidate] = Offset;
+                break;
+            }
+        }
+    }
+}
+
+static void SweepWorker(void *Data)
+{
+    linear_sweep *Sweep = (linear_sweep *)Data;
+    for(;;)
+    {
+        u32 ChunkIndex = AtomicIncrement(&Sweep->NextChunkIndex);
+        if(ChunkIndex >= Sweep->ChunkCount)
+        {
+            break;
+        }
+        
+        SpeculateChunk(Sweep, &Sweep->Chunks[ChunkIndex]);
+    }
+}
+
+static u32 DecodeChunkRange(linear_sweep *Sweep, u32 *Offset, u32 End, compact_instruction *Dest)
+{
+    // NOTE: Plain serial decode of every instruction starting before End. On bad code, this
+    // marks the whole sweep as stopped.
+    u32 Result = 0;
+    while(*Offset < End)
+    {
+        instruction Instruction;
+        if(!DecodeNext(Sweep->Opcodes, Sweep->Source, *Offset, &Instruction, &Sweep->StopReason))
+        {
+            Sweep->Stopped = true;
+            break;
+        }
+        
+        Dest[Result++] = PackDecodedInstruction(Instruction);
+        *Offset += Instruction.Size;
+    }
+    
+    return Result;
+}
+
+static void StitchChunk(linear_sweep *Sweep, sweep_chunk *Chunk)
+{
+    u32 Entry = Sweep->NextOffset;
+    u32 Lead = Entry - Chunk->Start;
+    assert(Entry >= Chunk->Start);
+    
+    u32 Sync = (Lead < SWEEP_MAX_CANDIDATES) ? Chunk->SyncOffset[Lead] : SWEEP_NO_SYNC;
+    if(Sync != SWEEP_NO_SYNC)
+    {
+        // NOTE: Re-decode the lead-in up to the sync point...
+        u32 Offset = Entry;
+        u32 LeadCount = DecodeChunkRange(Sweep, &Offset, Sync, Sweep->LeadScratch);
+        if(Sweep->Stopped || (Offset != Sync))
+        {
+            // NOTE: The length table and the decoder never disagree (sim86_bench checks this),
+            // but if they ever did, the fallback below is always correct.
+            Sweep->Stopped = false;
+            Sync = SWEEP_NO_SYNC;
+        }
+        else
+        {
+            // NOTE: ...then splice it in front of the main stream's instructions from there on.
+            u32 FirstKept = 0;
+            u32 High = Chunk->MainInstructionCount;
+            while(FirstKept < High)
+            {
+                u32 Middle = (FirstKept + High) / 2;
+                if(Chunk->Instructions[Middle].Address < Sync)
+                {
+                    FirstKept = Middle + 1;
+                }
+                else
+                {
+                    High = Middle;
+                }
+            }
+            
+            u32 KeptCount = Chunk->MainInstructionCount - FirstKept;
+            memmove(Chunk->Instructions + LeadCount, Chunk->Instructions + FirstKept, KeptCount*sizeof(compact_instruction));
+            memcpy(Chunk->Instructions, Sweep->LeadScratch, LeadCount*sizeof(compact_instruction));
+            
+            Chunk->InstructionCount = LeadCount + KeptCount;
+            Sweep->NextOffset = Chunk->MainExit;
+            if(Chunk->MainStopped)
+            {
+                Sweep->Stopped = true;
+                Sweep->StopReason = Chunk->MainStopReason;
+            }
+        }
+    }
+    
+    if(Sync == SWEEP_NO_SYNC)
+    {
+        u32 Offset = Entry;
+        Chunk->InstructionCount = DecodeChunkRange(Sweep, &Offset, Chunk->End, Chunk->Instructions);
+        Sweep->NextOffset = Offset;
+        ++Sweep->FallbackChunkCount;
+    }
+    
+    ++Sweep->StitchedChunkCount;
+}
+
+static linear_sweep BeginLinearSweep(decode_source Source, u32 ThreadCount, u32 ChunkSize)
+{
+    linear_sweep Result = {};
+    
+    Result.Opcodes = Get8086OpcodeTable();
+    Result.Lengths = Get8086LengthTable();
+    Result.Source = Source;
+    Result.ThreadCount = ThreadCount ? ThreadCount : 1;
+    
+    // NOTE: Chunks have to be longer than any instruction, so the true stream can't skip one.
+    Result.ChunkSize = (ChunkSize < 64) ? 64 : ChunkSize;
+    
+    Result.ChunkCapacity = Result.ThreadCount*SWEEP_CHUNKS_PER_THREAD;
+    Result.Chunks = (sweep_chunk *)calloc(Result.ChunkCapacity, sizeof(sweep_chunk));
+    Result.LeadScratch = (compact_instruction *)malloc(Result.ChunkSize*sizeof(compact_instruction));
+    
+    b32 Allocated = (Result.Chunks && Result.LeadScratch);
+    for(u32 ChunkIndex = 0; Allocated && (ChunkIndex < Result.ChunkCapacity); ++ChunkIndex)
+    {
+        sweep_chunk *Chunk = &Result.Chunks[ChunkIndex];
+        Chunk->MainStarts = (u64 *)malloc(((Result.ChunkSize + 63) / 64)*sizeof(u64));
+        Chunk->Instructions = (compact_instruction *)malloc(Result.ChunkSize*sizeof(compact_instruction));
+        Allocated = (Chunk->MainStarts && Chunk->Instructions);
+    }
+    
+    if(!Allocated)
+    {
+        EndLinearSweep(&Result);
+    }
+    
+    return Result;
+}
+
+static b32 IsValid(linear_sweep *Sweep)
+{
+    b32 Result = (Sweep->Chunks != 0);
+    return Result;
+}
+
+static u32 SweepNextBatch(linear_sweep *Sweep)
+{
+    // NOTE: Returns how many of Sweep->Chunks now hold final instructions, in source order, or
+    // zero once the sweep is done. Check Sweep->Stopped afterwards to see whether it ended on bad
+    // code rather than the end of the source.
+    u32 Result = 0;
+    
+    if(!Sweep->Stopped && (Sweep->NextOffset < Sweep->Source.Size))
+    {
+        // NOTE: The batch starts at whichever chunk the true stream is in right now.
+        u32 ChunkStart = (Sweep->NextOffset / Sweep->ChunkSize)*Sweep->ChunkSize;
+        
+        Sweep->ChunkCount = 0;
+        while((Sweep->ChunkCount < Sweep->ChunkCapacity) && (ChunkStart < Sweep->Source.Size))
+        {
+            sweep_chunk *Chunk = &Sweep->Chunks[Sweep->ChunkCount++];
+            Chunk->Start = ChunkStart;
+            Chunk->End = ((Sweep->Source.Size - ChunkStart) > Sweep->ChunkSize) ? (ChunkStart + Sweep->ChunkSize) : Sweep->Source.Size;
+            ChunkStart = Chunk->End;
+        }
+        
+        Sweep->NextChunkIndex = 0;
+        u32 ThreadCount = (Sweep->ThreadCount < Sweep->ChunkCount) ? Sweep->ThreadCount : Sweep->ChunkCount;
+        RunOnThreads(ThreadCount, SweepWorker, Sweep);
+        
+        while(!Sweep->Stopped && (Result < Sweep->ChunkCount))
+        {
+            StitchChunk(Sweep, &Sweep->Chunks[Result++]);
+        }
+    }
+    
+    return Result;
+}
+
+static void EndLinearSweep(linear_sweep *Sweep)
+{
+    if(Sweep->Chunks)
+    {
+        for(u32 ChunkIndex = 0; ChunkIndex < Sweep->ChunkCapacity; ++ChunkIndex)
+        {
+            free(Sweep->Chunks[ChunkIndex].MainStarts);
+            free(Sweep->Chunks[ChunkIndex].Instructions);
+        }
+    }
+    
+    free(Sweep->Chunks);
+    free(Sweep->LeadScratch);
+    
+    *Sweep = {};
+}
@@ -0,0 +1,71 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+
+#define SWEEP_DEFAULT_CHUNK_SIZE (64*1024)
+#define SWEEP_CHUNKS_PER_THREAD 4
+#define SWEEP_NO_SYNC 0xffffffff
+
+// NOTE: The true instruction stream enters a chunk somewhere in its first MaxInstructionByteCount
+// bytes, so that is how many candidate entry points each chunk has to consider.
+#define SWEEP_MAX_CANDIDATES DECODE_SOURCE_PADDING
+
+struct sweep_chunk
+{
+    // NOTE: A chunk owns every instruction that *starts* in [Start, End), even if it runs past End.
+    u32 Start;
+    u32 End;
+    
+    // NOTE: Filled in speculatively, on whichever thread picks the chunk up. The main stream is
+    // a full decode from Start. Every other candidate entry point (Start + 1, Start + 2, ...) is
+    // only walked with the length table until it lands on an instruction of the main stream,
+    // and SyncOffset records where, or SWEEP_NO_SYNC if it never does inside the chunk.
+    u32 MainInstructionCount;
+    u32 MainExit;
+    b32 MainStopped;
+    decode_stop_reason MainStopReason;
+    u64 *MainStarts;
+    u32 SyncOffset[SWEEP_MAX_CANDIDATES];
+    
+    // NOTE: Filled in when the chunk is stitched onto the one before it. By then, Instructions
+    // holds exactly what a serial decode would have produced for this chunk.
+    u32 InstructionCount;
+    compact_instruction *Instructions;
+};
+
+struct linear_sweep
+{
+    opcode_table *Opcodes;
+    length_table *Lengths;
+    decode_source Source;
+    u32 ThreadCount;
+    u32 ChunkSize;
+    
+    u32 ChunkCapacity;
+    u32 ChunkCount;
+    sweep_chunk *Chunks;
+    compact_instruction *LeadScratch;
+    u32 volatile NextChunkIndex;
+    
+    // NOTE: Where the true instruction stream continues from, once every chunk so far is stitched.
+    u32 NextOffset;
+    b32 Stopped;
+    decode_stop_reason StopReason;
+    
+    u32 StitchedChunkCount;
+    u32 FallbackChunkCount;
+};
+
+static linear_sweep BeginLinearSweep(decode_source Source, u32 ThreadCount, u32 ChunkSize = SWEEP_DEFAULT_CHUNK_SIZE);
+static b32 IsValid(linear_sweep *Sweep);
+static u32 SweepNextBatch(linear_sweep *Sweep);
+static void EndLinearSweep(linear_sweep *Sweep);
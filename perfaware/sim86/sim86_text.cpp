@@ -19,45 +19,136 @@ char const *OpcodeMnemonics[] =
 #include "sim86_instruction_table.inl"
 };
 
-static char const *GetMnemonic(operation_type Op)
+// NOTE: The same strings, with their lengths worked out at compile time, for the text emitter.
+struct text_string
+{
+    char const *Data;
+    u32 Length;
+};
+
+#define TEXT_STRING(String) text_string{String, sizeof(String) - 1}
+
+static text_string const OpcodeMnemonicText[] =
+{
+    TEXT_STRING(""),
+
+#define INST(Mnemonic, ...) TEXT_STRING(#Mnemonic),
+#define INSTALT(...)
+#include "sim86_instruction_table.inl"
+};
+
+static text_string const RegisterNameText[][3] =
+{
+    {TEXT_STRING(""), TEXT_STRING(""), TEXT_STRING("")},
+    {TEXT_STRING("al"), TEXT_STRING("ah"), TEXT_STRING("ax")},
+    {TEXT_STRING("bl"), TEXT_STRING("bh"), TEXT_STRING("bx")},
+    {TEXT_STRING("cl"), TEXT_STRING("ch"), TEXT_STRING("cx")},
+    {TEXT_STRING("dl"), TEXT_STRING("dh"), TEXT_STRING("dx")},
+    {TEXT_STRING("sp"), TEXT_STRING("sp"), TEXT_STRING("sp")},
+    {TEXT_STRING("bp"), TEXT_STRING("bp"), TEXT_STRING("bp")},
+    {TEXT_STRING("si"), TEXT_STRING("si"), TEXT_STRING("si")},
+    {TEXT_STRING("di"), TEXT_STRING("di"), TEXT_STRING("di")},
+    {TEXT_STRING("es"), TEXT_STRING("es"), TEXT_STRING("es")},
+    {TEXT_STRING("cs"), TEXT_STRING("cs"), TEXT_STRING("cs")},
+    {TEXT_STRING("ss"), TEXT_STRING("ss"), TEXT_STRING("ss")},
+    {TEXT_STRING("ds"), TEXT_STRING("ds"), TEXT_STRING("ds")},
+    {TEXT_STRING("ip"), TEXT_STRING("ip"), TEXT_STRING("ip")},
+    {TEXT_STRING("flags"), TEXT_STRING("flags"), TEXT_STRING("flags")}
+};
+
+static text_string GetMnemonicText(operation_type Op)
 {
-    char const *Result = "";
+    text_string Result = OpcodeMnemonicText[0];
     if(Op < Op_Count)
     {
-        Result = OpcodeMnemonics[Op];
+        Result = OpcodeMnemonicText[Op];
     }
     
     return Result;
 }
 
+static text_string GetRegNameText(register_access Reg)
+{
+    text_string Result = RegisterNameText[Reg.Index % ArrayCount(RegisterNameText)][(Reg.Count == 2) ? 2 : Reg.Offset&1];
+    return Result;
+}
+
+static char const *GetMnemonic(operation_type Op)
+{
+    char const *Result = GetMnemonicText(Op).Data;
+    return Result;
+}
+
 static char const *GetRegName(register_access Reg)
 {
-    char const *Names[][3] =
-    {
-        {"", "", ""},
-        {"al", "ah", "ax"},
-        {"bl", "bh", "bx"},
-        {"cl", "ch", "cx"},
-        {"dl", "dh", "dx"},
-        {"sp", "sp", "sp"},
-        {"bp", "bp", "bp"},
-        {"si", "si", "si"},
-        {"di", "di", "di"},
-        {"es", "es", "es"},
-        {"cs", "cs", "cs"},
-        {"ss", "ss", "ss"},
-        {"ds", "ds", "ds"},
-        {"ip", "ip", "ip"},
-        {"flags", "flags", "flags"}
-    };
-    
-    char const *Result = Names[Reg.Index % ArrayCount(Names)][(Reg.Count == 2) ? 2 : Reg.Offset&1];
+    char const *Result = GetRegNameText(Reg).Data;
     return Result;
 }
 
-static void PrintEffectiveAddressExpression(effective_address_expression Address, FILE *Dest)
+static text_buffer TextBuffer(u32 Size, char *Data)
+{
+    text_buffer Result = {};
+    Result.Size = Size;
+    Result.Data = Data;
+    
+    return Result;
+}
+
+static b32 HasRoomForInstruction(text_buffer *Buffer)
+{
+    // NOTE: One instruction plus its newline.
+    b32 Result = ((Buffer->Size - Buffer->Used) > MAX_INSTRUCTION_TEXT_LENGTH);
+    return Result;
+}
+
+static void Append(text_buffer *Dest, text_string String)
+{
+    memcpy(Dest->Data + Dest->Used, String.Data, String.Length);
+    Dest->Used += String.Length;
+}
+
+static void Append(text_buffer *Dest, char Char)
+{
+    Dest->Data[Dest->Used++] = Char;
+}
+
+static void AppendU32(text_buffer *Dest, u32 Value)
+{
+    // NOTE: Digits come out backwards, so they go into a scratch buffer first.
+    char Digits[10];
+    u32 DigitCount = 0;
+    do
+    {
+        Digits[DigitCount++] = (char)('0' + (Value % 10));
+        Value /= 10;
+    } while(Value);
+    
+    while(DigitCount)
+    {
+        Dest->Data[Dest->Used++] = Digits[--DigitCount];
+    }
+}
+
+static void AppendS32(text_buffer *Dest, s32 Value, b32 AlwaysSign = false)
+{
+    // NOTE: Matches printf's "%d", or "%+d" with AlwaysSign.
+    u32 Magnitude = (u32)Value;
+    if(Value < 0)
+    {
+        Append(Dest, '-');
+        Magnitude = 0u - Magnitude;
+    }
+    else if(AlwaysSign)
+    {
+        Append(Dest, '+');
+    }
+    
+    AppendU32(Dest, Magnitude);
+}
+
+static void AppendEffectiveAddressExpression(text_buffer *Dest, effective_address_expression Address)
 {
-    char const *Separator = "";
+    b32 NeedsSeparator = false;
     for(u32 Index = 0; Index < ArrayCount(Address.Terms); ++Index)
     {
         effective_address_term Term = Address.Terms[Index];
@@ -65,24 +156,35 @@ static void PrintEffectiveAddressExpression(effective_address_expression Address
         
         if(Reg.Index)
         {
-            fprintf(Dest, "%s", Separator);
+            if(NeedsSeparator)
+            {
+                Append(Dest, '+');
+            }
+            
             if(Term.Scale != 1)
             {
-                fprintf(Dest, "%d*", Term.Scale);
+                AppendS32(Dest, Term.Scale);
+                Append(Dest, '*');
             }
-            fprintf(Dest, "%s", GetRegName(Reg));
-            Separator = "+";
+            Append(Dest, GetRegNameText(Reg));
+            NeedsSeparator = true;
         }
     }
     
     if(Address.Displacement != 0)
     {
-        fprintf(Dest, "%+d", Address.Displacement);
+        AppendS32(Dest, Address.Displacement, true);
     }
 }
 
-static void PrintInstruction(instruction Instruction, FILE *Dest)
+static void AppendInstruction(text_buffer *Dest, instruction Instruction)
 {
+    if(!HasRoomForInstruction(Dest))
+    {
+        Dest->Overflowed = true;
+        return;
+    }
+    
     u32 Flags = Instruction.Flags;
     u32 W = Flags & Inst_Wide;
     
@@ -95,26 +197,31 @@ static void PrintInstruction(instruction Instruction, FILE *Dest)
             Instruction.Operands[0] = Instruction.Operands[1];
             Instruction.Operands[1] = Temp;
         }
-        fprintf(Dest, "lock ");
+        Append(Dest, TEXT_STRING("lock "));
     }
     
-    char const *MnemonicSuffix = "";
+    text_string MnemonicSuffix = TEXT_STRING("");
     if(Flags & Inst_Rep)
     {
-        fprintf(Dest, "rep ");
-        MnemonicSuffix = W ? "w" : "b";
+        Append(Dest, TEXT_STRING("rep "));
+        MnemonicSuffix = W ? TEXT_STRING("w") : TEXT_STRING("b");
     }
     
-    fprintf(Dest, "%s%s ", GetMnemonic(Instruction.Op), MnemonicSuffix);
+    Append(Dest, GetMnemonicText(Instruction.Op));
+    Append(Dest, MnemonicSuffix);
+    Append(Dest, ' ');
     
-    char const *Separator = "";
+    b32 NeedsSeparator = false;
     for(u32 OperandIndex = 0; OperandIndex < ArrayCount(Instruction.Operands); ++OperandIndex)
     {
         instruction_operand Operand = Instruction.Operands[OperandIndex];
         if(Operand.Type != Operand_None)
         {
-            fprintf(Dest, "%s", Separator);
-            Separator = ", ";
+            if(NeedsSeparator)
+            {
+                Append(Dest, TEXT_STRING(", "));
+            }
+            NeedsSeparator = true;
             
             switch(Operand.Type)
             {
@@ -122,7 +229,7 @@ static void PrintInstruction(instruction Instruction, FILE *Dest)
                 
                 case Operand_Register:
                 {
-                    fprintf(Dest, "%s", GetRegName(Operand.Register));
+                    Append(Dest, GetRegNameText(Operand.Register));
                 } break;
                 
                 case Operand_Memory:
@@ -131,28 +238,31 @@ static void PrintInstruction(instruction Instruction, FILE *Dest)
 
                     if(Flags & Inst_Far)
                     {
-                        fprintf(Dest, "far ");
+                        Append(Dest, TEXT_STRING("far "));
                     }
                     
                     if(Address.Flags & Address_ExplicitSegment)
                     {
-                        fprintf(Dest, "%u:%u", Address.ExplicitSegment, Address.Displacement);
+                        AppendU32(Dest, Address.ExplicitSegment);
+                        Append(Dest, ':');
+                        AppendU32(Dest, (u32)Address.Displacement);
                     }
                     else
                     {
                         if(Instruction.Operands[0].Type != Operand_Register)
                         {
-                            fprintf(Dest, "%s ", W ? "word" : "byte");
+                            Append(Dest, W ? TEXT_STRING("word ") : TEXT_STRING("byte "));
                         }
                         
                         if(Flags & Inst_Segment)
                         {
-                            fprintf(Dest, "%s:", GetRegName({Instruction.SegmentOverride, 0, 2}));
+                            Append(Dest, GetRegNameText({Instruction.SegmentOverride, 0, 2}));
+                            Append(Dest, ':');
                         }
                         
-                        fprintf(Dest, "[");
-                        PrintEffectiveAddressExpression(Address, Dest);
-                        fprintf(Dest, "]");
+                        Append(Dest, '[');
+                        AppendEffectiveAddressExpression(Dest, Address);
+                        Append(Dest, ']');
                     }
                 } break;
                 
@@ -161,14 +271,325 @@ static void PrintInstruction(instruction Instruction, FILE *Dest)
                     immediate Immediate = Operand.Immediate;
                     if(Immediate.Flags & Immediate_RelativeJumpDisplacement)
                     {
-                        fprintf(Dest, "$%+d", Immediate.Value + Instruction.Size);
+                        Append(Dest, '$');
+                        AppendS32(Dest, Immediate.Value + Instruction.Size, true);
                     }
                     else
                     {
-                        fprintf(Dest, "%d", Immediate.Value);
+                        AppendS32(Dest, Immediate.Value);
                     }
                 } break;
             }
         }
     }
 }
+
+static void AppendNewline(text_buffer *Dest)
+{
+    // NOTE: HasRoomForInstruction leaves room for this after every instruction.
+    Append(Dest, '\n');
+}
+
+/* NOTE: Structured output, for tools that want the fields rather than assembly text. Both
+   formats carry the same information per instruction:
+   
+   address, size, op       where the instruction is, and its mnemonic
+   lock, rep, wide, far    its flags
+   segment                 the segment override register, if it has one
+   operands                each one of:
+                             reg  register name
+                             mem  base/index register names (either may be missing), displacement
+                             ptr  an explicit segment:offset (far jmp/call), as segment and offset
+                             imm  value
+                             rel  absolute target address of a relative jump, call, or loop
+*/
+
+static b32 HasRoomForRecord(text_buffer *Buffer)
+{
+    b32 Result = ((Buffer->Size - Buffer->Used) > MAX_INSTRUCTION_RECORD_LENGTH);
+    return Result;
+}
+
+static void AppendU64(text_buffer *Dest, u64 Value)
+{
+    char Digits[20];
+    u32 DigitCount = 0;
+    do
+    {
+        Digits[DigitCount++] = (char)('0' + (Value % 10));
+        Value /= 10;
+    } while(Value);
+    
+    while(DigitCount)
+    {
+        Dest->Data[Dest->Used++] = Digits[--DigitCount];
+    }
+}
+
+static void AppendS64(text_buffer *Dest, s64 Value)
+{
+    u64 Magnitude = (u64)Value;
+    if(Value < 0)
+    {
+        Append(Dest, '-');
+        Magnitude = 0ull - Magnitude;
+    }
+    
+    AppendU64(Dest, Magnitude);
+}
+
+static s64 GetRelativeJumpTarget(u64 Address, instruction Instruction, immediate Immediate)
+{
+    s64 Result = (s64)Address + Instruction.Size + Immediate.Value;
+    return Result;
+}
+
+static void AppendJSONOperand(text_buffer *Dest, u64 Address, instruction Instruction, instruction_operand Operand)
+{
+    switch(Operand.Type)
+    {
+        case Operand_None: {} break;
+        
+        case Operand_Register:
+        {
+            Append(Dest, TEXT_STRING("{\"type\":\"reg\",\"reg\":\""));
+            Append(Dest, GetRegNameText(Operand.Register));
+            Append(Dest, TEXT_STRING("\"}"));
+        } break;
+        
+        case Operand_Memory:
+        {
+            effective_address_expression Address = Operand.Address;
+            if(Address.Flags & Address_ExplicitSegment)
+            {
+                Append(Dest, TEXT_STRING("{\"type\":\"ptr\",\"segment\":"));
+                AppendU32(Dest, Address.ExplicitSegment);
+                Append(Dest, TEXT_STRING(",\"offset\":"));
+                AppendU32(Dest, (u32)Address.Displacement);
+            }
+            else
+            {
+                Append(Dest, TEXT_STRING("{\"type\":\"mem\""));
+                if(Address.Terms[0].Register.Index)
+                {
+                    Append(Dest, TEXT_STRING(",\"base\":\""));
+                    Append(Dest, GetRegNameText(Address.Terms[0].Register));
+                    Append(Dest, '"');
+                }
+                if(Address.Terms[1].Register.Index)
+                {
+                    Append(Dest, TEXT_STRING(",\"index\":\""));
+                    Append(Dest, GetRegNameText(Address.Terms[1].Register));
+                    Append(Dest, '"');
+                }
+                Append(Dest, TEXT_STRING(",\"disp\":"));
+                AppendS32(Dest, Address.Displacement);
+            }
+            Append(Dest, '}');
+        } break;
+        
+        case Operand_Immediate:
+        {
+            immediate Immediate = Operand.Immediate;
+            if(Immediate.Flags & Immediate_RelativeJumpDisplacement)
+            {
+                Append(Dest, TEXT_STRING("{\"type\":\"rel\",\"target\":"));
+                AppendS64(Dest, GetRelativeJumpTarget(Address, Instruction, Immediate));
+            }
+            else
+            {
+                Append(Dest, TEXT_STRING("{\"type\":\"imm\",\"value\":"));
+                AppendS32(Dest, Immediate.Value);
+            }
+            Append(Dest, '}');
+        } break;
+    }
+}
+
+static void AppendJSONFlag(text_buffer *Dest, b32 IsSet, text_string Name, b32 *NeedsSeparator)
+{
+    if(IsSet)
+    {
+        if(*NeedsSeparator)
+        {
+            Append(Dest, ',');
+        }
+        Append(Dest, '"');
+        Append(Dest, Name);
+        Append(Dest, '"');
+        *NeedsSeparator = true;
+    }
+}
+
+static void AppendInstructionJSON(text_buffer *Dest, u64 Address, instruction Instruction)
+{
+    u32 Flags = Instruction.Flags;
+    
+    Append(Dest, TEXT_STRING("{\"address\":"));
+    AppendU64(Dest, Address);
+    Append(Dest, TEXT_STRING(",\"size\":"));
+    AppendU32(Dest, Instruction.Size);
+    Append(Dest, TEXT_STRING(",\"op\":\""));
+    Append(Dest, GetMnemonicText(Instruction.Op));
+    
+    Append(Dest, TEXT_STRING("\",\"flags\":["));
+    b32 NeedsSeparator = false;
+    AppendJSONFlag(Dest, Flags & Inst_Lock, TEXT_STRING("lock"), &NeedsSeparator);
+    AppendJSONFlag(Dest, Flags & Inst_Rep, TEXT_STRING("rep"), &NeedsSeparator);
+    AppendJSONFlag(Dest, Flags & Inst_Wide, TEXT_STRING("wide"), &NeedsSeparator);
+    AppendJSONFlag(Dest, Flags & Inst_Far, TEXT_STRING("far"), &NeedsSeparator);
+    Append(Dest, ']');
+    
+    if(Flags & Inst_Segment)
+    {
+        Append(Dest, TEXT_STRING(",\"segment\":\""));
+        Append(Dest, GetRegNameText({Instruction.SegmentOverride, 0, 2}));
+        Append(Dest, '"');
+    }
+    
+    Append(Dest, TEXT_STRING(",\"operands\":["));
+    NeedsSeparator = false;
+    for(u32 OperandIndex = 0; OperandIndex < ArrayCount(Instruction.Operands); ++OperandIndex)
+    {
+        instruction_operand Operand = Instruction.Operands[OperandIndex];
+        if(Operand.Type != Operand_None)
+        {
+            if(NeedsSeparator)
+            {
+                Append(Dest, ',');
+            }
+            AppendJSONOperand(Dest, Address, Instruction, Operand);
+            NeedsSeparator = true;
+        }
+    }
+    Append(Dest, TEXT_STRING("]}"));
+}
+
+static void AppendCSVHeader(text_buffer *Dest)
+{
+    Append(Dest, TEXT_STRING("address,size,op,lock,rep,wide,far,segment,"
+                             "op0_type,op0_reg,op0_base,op0_index,op0_disp,op0_imm,"
+                             "op1_type,op1_reg,op1_base,op1_index,op1_disp,op1_imm\n"));
+}
+
+static void AppendCSVOperand(text_buffer *Dest, u64 Address, instruction Instruction, instruction_operand Operand)
+{
+    // NOTE: Always exactly six columns: type, reg, base, index, disp, imm. A ptr operand puts
+    // its segment in imm and its offset in disp.
+    switch(Operand.Type)
+    {
+        case Operand_None:
+        {
+            Append(Dest, TEXT_STRING(",,,,,"));
+        } break;
+        
+        case Operand_Register:
+        {
+            Append(Dest, TEXT_STRING("reg,"));
+            Append(Dest, GetRegNameText(Operand.Register));
+            Append(Dest, TEXT_STRING(",,,,"));
+        } break;
+        
+        case Operand_Memory:
+        {
+            effective_address_expression Address = Operand.Address;
+            if(Address.Flags & Address_ExplicitSegment)
+            {
+                Append(Dest, TEXT_STRING("ptr,,,,"));
+                AppendU32(Dest, (u32)Address.Displacement);
+                Append(Dest, ',');
+                AppendU32(Dest, Address.ExplicitSegment);
+            }
+            else
+            {
+                Append(Dest, TEXT_STRING("mem,,"));
+                Append(Dest, GetRegNameText(Address.Terms[0].Register));
+                Append(Dest, ',');
+                Append(Dest, GetRegNameText(Address.Terms[1].Register));
+                Append(Dest, ',');
+                AppendS32(Dest, Address.Displacement);
+                Append(Dest, ',');
+            }
+        } break;
+        
+        case Operand_Immediate:
+        {
+            immediate Immediate = Operand.Immediate;
+            if(Immediate.Flags & Immediate_RelativeJumpDisplacement)
+            {
+                Append(Dest, TEXT_STRING("rel,,,,,"));
+                AppendS64(Dest, GetRelativeJumpTarget(Address, Instruction, Immediate));
+            }
+            else
+            {
+                Append(Dest, TEXT_STRING("imm,,,,,"));
+                AppendS32(Dest, Immediate.Value);
+            }
+        } break;
+    }
+}
+
+static void AppendInstructionCSV(text_buffer *Dest, u64 Address, instruction Instruction)
+{
+    u32 Flags = Instruction.Flags;
+    
+    AppendU64(Dest, Address);
+    Append(Dest, ',');
+    AppendU32(Dest, Instruction.Size);
+    Append(Dest, ',');
+    Append(Dest, GetMnemonicText(Instruction.Op));
+    Append(Dest, (Flags & Inst_Lock) ? TEXT_STRING(",1") : TEXT_STRING(",0"));
+    Append(Dest, (Flags & Inst_Rep) ? TEXT_STRING(",1") : TEXT_STRING(",0"));
+    Append(Dest, (Flags & Inst_Wide) ? TEXT_STRING(",1") : TEXT_STRING(",0"));
+    Append(Dest, (Flags & Inst_Far) ? TEXT_STRING(",1,") : TEXT_STRING(",0,"));
+    if(Flags & Inst_Segment)
+    {
+        Append(Dest, GetRegNameText({Instruction.SegmentOverride, 0, 2}));
+    }
+    
+    for(u32 OperandIndex = 0; OperandIndex < ArrayCount(Instruction.Operands); ++OperandIndex)
+    {
+        Append(Dest, ',');
+        AppendCSVOperand(Dest, Address, Instruction, Instruction.Operands[OperandIndex]);
+    }
+}
+
+static void AppendInstructionRecord(text_buffer *Dest, output_format Format, instruction Instruction, u64 AddressBase)
+{
+    // NOTE: Appends the instruction, and its newline, in whichever format was asked for. Records
+    // give addresses as AddressBase + Instruction.Address, so they can be file offsets past 4GB.
+    b32 HasRoom = (Format == Output_Text) ? HasRoomForInstruction(Dest) : HasRoomForRecord(Dest);
+    if(!HasRoom)
+    {
+        Dest->Overflowed = true;
+        return;
+    }
+    
+    switch(Format)
+    {
+        case Output_Text: {AppendInstruction(Dest, Instruction);} break;
+        case Output_NDJSON: {AppendInstructionJSON(Dest, AddressBase + Instruction.Address, Instruction);} break;
+        case Output_CSV: {AppendInstructionCSV(Dest, AddressBase + Instruction.Address, Instruction);} break;
+    }
+    
+    AppendNewline(Dest);
+}
+
+static void FlushTextBuffer(text_buffer *Buffer, FILE *Dest)
+{
+    // NOTE: One write for the whole buffer. stdio passes writes this size straight through.
+    if(Buffer->Used)
+    {
+        fwrite(Buffer->Data, 1, Buffer->Used, Dest);
+    }
+    
+    Buffer->Used = 0;
+}
+
+static void PrintInstruction(instruction Instruction, FILE *Dest)
+{
+    char Text[MAX_INSTRUCTION_TEXT_LENGTH + 1];
+    text_buffer Buffer = TextBuffer(sizeof(Text), Text);
+    AppendInstruction(&Buffer, Instruction);
+    FlushTextBuffer(&Buffer, Dest);
+}
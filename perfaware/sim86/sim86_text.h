@@ -10,4 +10,37 @@
    
    ======================================================================== */
 
+
+// NOTE: Enough room for the text of any one instruction. The Append functions below never check
+// for room themselves - AppendInstruction checks once, up front, against this.
+#define MAX_INSTRUCTION_TEXT_LENGTH 128
+
+// NOTE: The same, for one NDJSON or CSV record (see AppendInstructionRecord).
+#define MAX_INSTRUCTION_RECORD_LENGTH 512
+
+enum output_format : u32
+{
+    Output_Text, // NOTE: NASM syntax, one instruction per line
+    Output_NDJSON, // NOTE: One JSON object per instruction, per line
+    Output_CSV, // NOTE: One row per instruction, with the columns given by AppendCSVHeader
+};
+
+struct text_buffer
+{
+    u32 Size;
+    u32 Used;
+    char *Data;
+    
+    b32 Overflowed;
+};
+
+static text_buffer TextBuffer(u32 Size, char *Data);
+static b32 HasRoomForInstruction(text_buffer *Buffer);
+static void AppendInstruction(text_buffer *Dest, instruction Instruction);
+static void AppendNewline(text_buffer *Dest);
+static b32 HasRoomForRecord(text_buffer *Buffer);
+static void AppendInstructionRecord(text_buffer *Dest, output_format Format, instruction Instruction, u64 AddressBase = 0);
+static void AppendCSVHeader(text_buffer *Dest);
+static void FlushTextBuffer(text_buffer *Buffer, FILE *Dest);
+
 static void PrintInstruction(instruction Instruction, FILE *Dest);
@@ -0,0 +1,529 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+static u16 const LAZY_ARITHMETIC_FLAGS = (FlagBit_CF | FlagBit_PF | FlagBit_AF | FlagBit_ZF | FlagBit_SF | FlagBit_OF);
+
+static u16 MaterializeFlags(u16 *Registers, lazy_flags *Lazy)
+{
+    // NOTE: Works the recorded operation's flags into Registers[Register_flags], if there is one
+    // (see Add, Subtract and Logic for what each sets), and returns the flags word.
+    if(Lazy->Op != LazyFlags_None)
+    {
+        u32 A = Lazy->A;
+        u32 B = Lazy->B;
+        u32 Value = Lazy->Result;
+        u32 SignBit = GetSignBit(Lazy->Wide);
+        
+        u32 Flags = 0;
+        Flags |= (Value & GetWidthMask(Lazy->Wide)) ? 0 : FlagBit_ZF;
+        Flags |= (Value & SignBit) ? FlagBit_SF : 0;
+        Flags |= HasEvenParity(Value) ? FlagBit_PF : 0;
+        if(Lazy->Op != LazyFlags_Logic)
+        {
+            // NOTE: A carry out of an add, or a borrow out of a subtract, shows up in the bit just
+            // above the sign bit.
+            u32 Overflow = (Lazy->Op == LazyFlags_Add) ? ((A ^ Value) & (B ^ Value)) : ((A ^ B) & (A ^ Value));
+            Flags |= (Value & (SignBit << 1)) ? FlagBit_CF : 0;
+            Flags |= ((A ^ B ^ Value) & 0x10) ? FlagBit_AF : 0;
+            Flags |= (Overflow & SignBit) ? FlagBit_OF : 0;
+        }
+        
+        Registers[Register_flags] = (u16)((Registers[Register_flags] & ~Lazy->Set) | (Flags & Lazy->Set));
+        Lazy->Op = LazyFlags_None;
+    }
+    
+    return Registers[Register_flags];
+}
+
+static u32 GetLazyCarry(u16 *Registers, lazy_flags *Lazy)
+{
+    // NOTE: Just CF, without working out the rest.
+    u32 Result = ((Registers[Register_flags] & FlagBit_CF) != 0);
+    if((Lazy->Op != LazyFlags_None) && (Lazy->Set & FlagBit_CF))
+    {
+        Result = ((Lazy->Op != LazyFlags_Logic) && (Lazy->Result & (GetSignBit(Lazy->Wide) << 1)));
+    }
+    
+    return Result;
+}
+
+static u32 RecordFlags(lazy_flags *Lazy, lazy_flags_op Op, u16 Set, u32 A, u32 B, u32 Result, b32 Wide)
+{
+    // NOTE: Whatever was recorded before is dropped, so anything it set that this doesn't has to
+    // be in the flags word already.
+    Lazy->Op = (u16)Op;
+    Lazy->Set = Set;
+    Lazy->Wide = Wide;
+    Lazy->A = A;
+    Lazy->B = B;
+    Lazy->Result = Result;
+    
+    Result &= GetWidthMask(Wide);
+    return Result;
+}
+
+static u32 Alu_mov(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    return B;
+}
+
+static u32 Alu_add(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Add, LAZY_ARITHMETIC_FLAGS, A, B, A + B, Wide);
+    return Result;
+}
+
+static u32 Alu_adc(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Add, LAZY_ARITHMETIC_FLAGS, A, B, A + B + GetLazyCarry(Registers, Lazy), Wide);
+    return Result;
+}
+
+static u32 Alu_sub(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Subtract, LAZY_ARITHMETIC_FLAGS, A, B, A - B, Wide);
+    return Result;
+}
+
+static u32 Alu_sbb(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Subtract, LAZY_ARITHMETIC_FLAGS, A, B, A - B - GetLazyCarry(Registers, Lazy), Wide);
+    return Result;
+}
+
+static u32 Alu_cmp(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Subtract, LAZY_ARITHMETIC_FLAGS, A, B, A - B, Wide);
+    return Result;
+}
+
+static u32 Alu_and(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Logic, LAZY_ARITHMETIC_FLAGS, A, B, A & B, Wide);
+    return Result;
+}
+
+static u32 Alu_or(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Logic, LAZY_ARITHMETIC_FLAGS, A, B, A | B, Wide);
+    return Result;
+}
+
+static u32 Alu_xor(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Logic, LAZY_ARITHMETIC_FLAGS, A, B, A ^ B, Wide);
+    return Result;
+}
+
+static u32 Alu_test(u16 *Registers, lazy_flags *Lazy, u32 A, u32 B, b32 Wide)
+{
+    u32 Result = RecordFlags(Lazy, LazyFlags_Logic, LAZY_ARITHMETIC_FLAGS, A, B, A & B, Wide);
+    return Result;
+}
+
+static u8 LowerRegister(register_access Register)
+{
+    u8 Result = (u8)((Register.Count == 2) ? Register.Index : (2*Register.Index + Register.Offset));
+    return Result;
+}
+
+static void LowerMemory(instruction *Instruction, instruction_operand *Operand, lowered_instruction *Dest)
+{
+    effective_address_expression *Address = &Operand->Address;
+    Dest->BaseA = (u8)Address->Terms[0].Register.Index;
+    Dest->BaseB = (u8)Address->Terms[1].Register.Index;
+    Dest->Displacement = (u16)Address->Displacement;
+    
+    b32 UsesBP = ((Dest->BaseA == Register_bp) || (Dest->BaseB == Register_bp));
+    Dest->Segment = (u8)((Instruction->Flags & Inst_Segment) ? Instruction->SegmentOverride : (UsesBP ? Register_ss : Register_ds));
+}
+
+static void LowerInstruction(instruction *Instruction, instruction_clocks Clocks, lowered_instruction *Dest)
+{
+    *Dest = {};
+    Dest->Handler = Lowered_Generic;
+    
+    instruction_operand *First = &Instruction->Operands[0];
+    instruction_operand *Second = &Instruction->Operands[1];
+    b32 Wide = ((Instruction->Flags & Inst_Wide) != 0);
+    
+    u32 ALUBase = 0;
+    u32 JumpHandler = 0;
+    switch(Instruction->Op)
+    {
+#define LOWER_ALU_CASE(Op, Writes, ReadsDest) case Op_##Op: {ALUBase = Lowered_##Op##_RR8;} break;
+#define LOWER_JUMP_CASE(Op, Condition) case Op_##Op: {JumpHandler = Lowered_##Op;} break;
+        THREADED_ALU_OPS(LOWER_ALU_CASE)
+        THREADED_JUMP_OPS(LOWER_JUMP_CASE)
+#undef LOWER_ALU_CASE
+#undef LOWER_JUMP_CASE
+
+        case Op_inc:
+        case Op_dec:
+        {
+            // NOTE: The short forms decode their register into the second operand.
+            instruction_operand *Operand = First->Type ? First : Second;
+            if((Operand->Type == Operand_Register) && (Operand->Register.Count == 2))
+            {
+                Dest->Handler = (Instruction->Op == Op_inc) ? Lowered_inc_R16 : Lowered_dec_R16;
+                Dest->Dest = (u8)Operand->Register.Index;
+            }
+        } break;
+        
+        default: {} break;
+    }
+    
+    if(ALUBase)
+    {
+        // NOTE: Each form has a byte then a word handler (see THREADED_ALU_FORMS). Memory operands
+        // that name their segment outright (only far jumps and calls do) and anything else
+        // unusual stay generic.
+        u32 Form = LoweredForm_Count;
+        if(First->Type == Operand_Register)
+        {
+            Wide = (First->Register.Count == 2);
+            Dest->Dest = LowerRegister(First->Register);
+            if(Second->Type == Operand_Register)
+            {
+                Form = (Second->Register.Count == First->Register.Count) ? LoweredForm_RR : LoweredForm_Count;
+                Dest->Source = LowerRegister(Second->Register);
+            }
+            else if(Second->Type == Operand_Immediate)
+            {
+                Form = LoweredForm_RI;
+            }
+            else if((Second->Type == Operand_Memory) && !(Second->Address.Flags & Address_ExplicitSegment))
+            {
+                Form = LoweredForm_RM;
+                LowerMemory(Instruction, Second, Dest);
+            }
+        }
+        else if((First->Type == Operand_Memory) && !(First->Address.Flags & Address_ExplicitSegment))
+        {
+            LowerMemory(Instruction, First, Dest);
+            if(Second->Type == Operand_Register)
+            {
+                Form = LoweredForm_MR;
+                Wide = (Second->Register.Count == 2);
+                Dest->Source = LowerRegister(Second->Register);
+            }
+            else if(Second->Type == Operand_Immediate)
+            {
+                Form = LoweredForm_MI;
+            }
+        }
+        
+        if(Second->Type == Operand_Immediate)
+        {
+            Dest->Immediate = (u16)(Second->Immediate.Value & GetWidthMask(Wide));
+        }
+        
+        if(Form < LoweredForm_Count)
+        {
+            Dest->Handler = (u8)(ALUBase + 2*Form + (Wide ? 1 : 0));
+        }
+        else
+        {
+            *Dest = {};
+            Dest->Handler = Lowered_Generic;
+        }
+    }
+    else if(JumpHandler && (First->Type == Operand_Immediate))
+    {
+        Dest->Handler = (u8)JumpHandler;
+        Dest->Displacement = (u16)First->Immediate.Value;
+    }
+    
+    if(Dest->Handler != Lowered_Generic)
+    {
+        // NOTE: None of these has both a memory operand and a jump, so one field covers both.
+        Dest->Clocks = (u8)Clocks.Clocks;
+        Dest->ExtraClocks = (u8)(Clocks.OddClocks + Clocks.ExtraClocks);
+    }
+}
+
+static u16 GetLoweredOffset(u16 *Registers, lowered_instruction *Lowered)
+{
+    u16 Result = (u16)(Registers[Lowered->BaseA] + Registers[Lowered->BaseB] + Lowered->Displacement);
+    return Result;
+}
+
+/* NOTE: The handlers are written once, as macros, and come out either as labels chained
+   through computed goto or as the cases of a switch. Each handler has already had IP moved past
+   its instruction, and Entry and Lowered are its cache entry and lowered form.
+*/
+
+#if SIM86_COMPUTED_GOTO
+#define THREADED_HANDLER(Name) Handler_##Name:
+#define THREADED_JUMP_TO_HANDLER goto *HandlerLabels[Lowered->Handler]
+#define THREADED_NEXT ++Count; THREADED_FETCH; THREADED_JUMP_TO_HANDLER
+#else
+#define THREADED_HANDLER(Name) case Lowered_##Name:
+#define THREADED_JUMP_TO_HANDLER goto Dispatch
+#define THREADED_NEXT ++Count; goto Fetch
+#endif
+
+// NOTE: Everything StepMachine checks before an instruction. Single-stepping with TF set is
+// left to StepMachine itself.
+#define THREADED_FETCH \
+    if(Count == Limit) \
+    { \
+        goto Done; \
+    } \
+    IP = Registers[Register_ip]; \
+    if(State->ProgramSize && (GetPhysicalAddress(Memory, Registers[Register_cs], IP) >= State->ProgramSize)) \
+    { \
+        Result = MachineStop_EndOfProgram; \
+        goto Done; \
+    } \
+    if(Registers[Register_flags] & FlagBit_TF) \
+    { \
+        goto SingleStep; \
+    } \
+    Entry = FetchCacheEntry(Opcodes, Cache, Memory, Registers[Register_cs], IP); \
+    if(!Entry->Instruction.Op) \
+    { \
+        Result = MachineStop_Unrecognized; \
+        goto Done; \
+    } \
+    Lowered = &Entry->Lowered; \
+    Registers[Register_ip] = (u16)(IP + Entry->Instruction.Size)
+
+#define THREADED_ALU_FORM_HANDLERS(Op, Writes, ReadsDest) \
+    THREADED_HANDLER(Op##_RR8) \
+    { \
+        u8 *Dest = &RegisterBytes[Lowered->Dest]; \
+        u32 Value = Alu_##Op(Registers, &Lazy, ReadsDest ? *Dest : 0, RegisterBytes[Lowered->Source], false); \
+        if(Writes) *Dest = (u8)Value; \
+        Clocks += Lowered->Clocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_RR16) \
+    { \
+        u16 *Dest = &Registers[Lowered->Dest]; \
+        u32 Value = Alu_##Op(Registers, &Lazy, ReadsDest ? *Dest : 0, Registers[Lowered->Source], true); \
+        if(Writes) *Dest = (u16)Value; \
+        Clocks += Lowered->Clocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_RI8) \
+    { \
+        u8 *Dest = &RegisterBytes[Lowered->Dest]; \
+        u32 Value = Alu_##Op(Registers, &Lazy, ReadsDest ? *Dest : 0, Lowered->Immediate, false); \
+        if(Writes) *Dest = (u8)Value; \
+        Clocks += Lowered->Clocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_RI16) \
+    { \
+        u16 *Dest = &Registers[Lowered->Dest]; \
+        u32 Value = Alu_##Op(Registers, &Lazy, ReadsDest ? *Dest : 0, Lowered->Immediate, true); \
+        if(Writes) *Dest = (u16)Value; \
+        Clocks += Lowered->Clocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_RM8) \
+    { \
+        u8 *Dest = &RegisterBytes[Lowered->Dest]; \
+        u32 Source = ReadMachineMemory(Memory, Registers[Lowered->Segment], GetLoweredOffset(Registers, Lowered), false); \
+        u32 Value = Alu_##Op(Registers, &Lazy, ReadsDest ? *Dest : 0, Source, false); \
+        if(Writes) *Dest = (u8)Value; \
+        Clocks += Lowered->Clocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_RM16) \
+    { \
+        u16 *Dest = &Registers[Lowered->Dest]; \
+        u16 Offset = GetLoweredOffset(Registers, Lowered); \
+        u32 Source = ReadMachineMemory(Memory, Registers[Lowered->Segment], Offset, true); \
+        u32 Value = Alu_##Op(Registers, &Lazy, ReadsDest ? *Dest : 0, Source, true); \
+        if(Writes) *Dest = (u16)Value; \
+        Clocks += Lowered->Clocks + (Offset & 1)*Lowered->ExtraClocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_MR8) \
+    { \
+        u16 Segment = Registers[Lowered->Segment]; \
+        u16 Offset = GetLoweredOffset(Registers, Lowered); \
+        u32 Dest = ReadsDest ? ReadMachineMemory(Memory, Segment, Offset, false) : 0; \
+        u32 Value = Alu_##Op(Registers, &Lazy, Dest, RegisterBytes[Lowered->Source], false); \
+        if(Writes) WriteMachineMemory(Memory, Segment, Offset, false, Value); \
+        Clocks += Lowered->Clocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_MR16) \
+    { \
+        u16 Segment = Registers[Lowered->Segment]; \
+        u16 Offset = GetLoweredOffset(Registers, Lowered); \
+        u32 Dest = ReadsDest ? ReadMachineMemory(Memory, Segment, Offset, true) : 0; \
+        u32 Value = Alu_##Op(Registers, &Lazy, Dest, Registers[Lowered->Source], true); \
+        if(Writes) WriteMachineMemory(Memory, Segment, Offset, true, Value); \
+        Clocks += Lowered->Clocks + (Offset & 1)*Lowered->ExtraClocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_MI8) \
+    { \
+        u16 Segment = Registers[Lowered->Segment]; \
+        u16 Offset = GetLoweredOffset(Registers, Lowered); \
+        u32 Dest = ReadsDest ? ReadMachineMemory(Memory, Segment, Offset, false) : 0; \
+        u32 Value = Alu_##Op(Registers, &Lazy, Dest, Lowered->Immediate, false); \
+        if(Writes) WriteMachineMemory(Memory, Segment, Offset, false, Value); \
+        Clocks += Lowered->Clocks; \
+    } \
+    THREADED_NEXT; \
+    THREADED_HANDLER(Op##_MI16) \
+    { \
+        u16 Segment = Registers[Lowered->Segment]; \
+        u16 Offset = GetLoweredOffset(Registers, Lowered); \
+        u32 Dest = ReadsDest ? ReadMachineMemory(Memory, Segment, Offset, true) : 0; \
+        u32 Value = Alu_##Op(Registers, &Lazy, Dest, Lowered->Immediate, true); \
+        if(Writes) WriteMachineMemory(Memory, Segment, Offset, true, Value); \
+        Clocks += Lowered->Clocks + (Offset & 1)*Lowered->ExtraClocks; \
+    } \
+    THREADED_NEXT;
+
+#define THREADED_JUMP_HANDLER(Op, Condition) \
+    THREADED_HANDLER(Op) \
+    { \
+        Clocks += Lowered->Clocks; \
+        if(Condition) \
+        { \
+            Registers[Register_ip] += Lowered->Displacement; \
+            Clocks += Lowered->ExtraClocks; \
+        } \
+        if(StopAtJump) \
+        { \
+            ++Count; \
+            goto Done; \
+        } \
+    } \
+    THREADED_NEXT;
+
+static machine_stop_reason RunThreaded(opcode_table *Opcodes, machine_state *State, u64 MaxInstructions, u64 *InstructionCount,
+                                       b32 StopAtJump)
+{
+    decode_cache *Cache = State->DecodeCache;
+    if(!Cache)
+    {
+        machine_stop_reason Result = RunMachine(Opcodes, State, MaxInstructions, InstructionCount);
+        return Result;
+    }
+    
+    machine_stop_reason Result = MachineStop_None;
+    
+    paged_memory *Memory = State->Memory;
+    u16 *Registers = State->Registers;
+    u8 *RegisterBytes = (u8 *)State->Registers;
+    u64 Limit = MaxInstructions ? MaxInstructions : ~0ull;
+    u64 Count = 0;
+    u64 Clocks = 0;
+    lazy_flags Lazy = {};
+    
+    u16 IP;
+    decode_cache_entry *Entry;
+    lowered_instruction *Lowered;
+
+#if SIM86_COMPUTED_GOTO
+#define THREADED_ALU_FORM_LABEL(Op, Form) &&Handler_##Op##_##Form,
+#define THREADED_ALU_LABELS(Op, Writes, ReadsDest) THREADED_ALU_FORMS(THREADED_ALU_FORM_LABEL, Op)
+#define THREADED_JUMP_LABEL(Op, Condition) &&Handler_##Op,
+    static void *HandlerLabels[Lowered_Count] =
+    {
+        &&Handler_None,
+        &&Handler_Generic,
+        THREADED_ALU_OPS(THREADED_ALU_LABELS)
+        THREADED_JUMP_OPS(THREADED_JUMP_LABEL)
+        &&Handler_inc_R16,
+        &&Handler_dec_R16,
+    };
+#undef THREADED_ALU_FORM_LABEL
+#undef THREADED_ALU_LABELS
+#undef THREADED_JUMP_LABEL
+
+#endif
+
+  Fetch:
+    THREADED_FETCH;
+#if SIM86_COMPUTED_GOTO
+    THREADED_JUMP_TO_HANDLER;
+#else
+  Dispatch:
+    switch(Lowered->Handler)
+    {
+#endif
+
+        THREADED_HANDLER(None)
+        {
+            LowerInstruction(&Entry->Instruction, Entry->Clocks, Lowered);
+        }
+        THREADED_JUMP_TO_HANDLER;
+        
+        THREADED_HANDLER(Generic)
+        {
+            MaterializeFlags(Registers, &Lazy);
+            Result = ExecuteInstruction(State, &Entry->Instruction, Entry->Clocks);
+            if(Result != MachineStop_None)
+            {
+                Registers[Register_ip] = IP;
+                goto Done;
+            }
+        }
+        THREADED_NEXT;
+        
+        THREADED_ALU_OPS(THREADED_ALU_FORM_HANDLERS)
+        THREADED_JUMP_OPS(THREADED_JUMP_HANDLER)
+        
+        THREADED_HANDLER(inc_R16)
+        {
+            // NOTE: inc and dec leave CF alone, so it goes into the flags word before they
+            // replace whatever set it.
+            u32 Value = Registers[Lowered->Dest];
+            SetFlag(State, FlagBit_CF, GetLazyCarry(Registers, &Lazy));
+            Registers[Lowered->Dest] = (u16)RecordFlags(&Lazy, LazyFlags_Add, LAZY_ARITHMETIC_FLAGS & ~FlagBit_CF, Value, 1, Value + 1, true);
+            Clocks += Lowered->Clocks;
+        }
+        THREADED_NEXT;
+        
+        THREADED_HANDLER(dec_R16)
+        {
+            u32 Value = Registers[Lowered->Dest];
+            SetFlag(State, FlagBit_CF, GetLazyCarry(Registers, &Lazy));
+            Registers[Lowered->Dest] = (u16)RecordFlags(&Lazy, LazyFlags_Subtract, LAZY_ARITHMETIC_FLAGS & ~FlagBit_CF, Value, 1, Value - 1, true);
+            Clocks += Lowered->Clocks;
+        }
+        THREADED_NEXT;
+
+#if !SIM86_COMPUTED_GOTO
+        default: {} break;
+    }
+    goto Fetch;
+#endif
+
+  SingleStep:
+    MaterializeFlags(Registers, &Lazy);
+    Result = StepMachine(Opcodes, State);
+    if(Result == MachineStop_None)
+    {
+        ++Count;
+        goto Fetch;
+    }
+  
+  Done:
+    MaterializeFlags(Registers, &Lazy);
+    State->ClockCount += Clocks;
+    if(InstructionCount)
+    {
+        *InstructionCount = Count;
+    }
+    
+    return Result;
+}
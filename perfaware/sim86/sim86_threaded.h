@@ -0,0 +1,181 @@
+/* ========================================================================
+
+   (C) Copyright 2023 by Molly Rocket, Inc., All Rights Reserved.
+   
+   This software is provided 'as-is', without any express or implied
+   warranty. In no event will the authors be held liable for any damages
+   arising from the use of this software.
+   
+   Please see https://computerenhance.com for more information
+   
+   ======================================================================== */
+
+/* NOTE: The threaded interpreter. Instead of working out what to do from an instruction's
+   operands every time it runs, each instruction in the decode cache is lowered once into a
+   lowered_instruction: a handler chosen for its exact form (operation, which operands are
+   registers, memory or immediates, and byte or word), plus the operands already reduced to
+   register indices, a segment and a displacement. Running it is then a jump straight to its
+   handler, and each handler ends by fetching the next instruction and jumping straight to
+   that one's handler (with computed goto, where the compiler has it), rather than returning
+   to a central switch.
+   
+   Only the forms loops spend their time in get handlers of their own: mov and the two-operand
+   arithmetic and logic instructions on registers, memory and immediates, inc and dec of word
+   registers, and the jumps and loops. Everything else goes to a generic handler that runs it
+   through ExecuteInstruction, so the results are always exactly the same as StepMachine's.
+   
+   The threaded interpreter needs a decode cache to keep the lowered instructions in. Without
+   one, RunThreaded is the same as RunMachine.
+   
+   Flags are lazy. Most flags an instruction sets are set again by the next one before anything
+   looks at them, so rather than working out all six arithmetic flags every time, the handlers
+   only record the last operation that set them, its operands and its result, in a lazy_flags.
+   They are worked out into Registers[Register_flags] only when something reads them: a jump
+   or loop that tests them, the carry into adc and sbb, anything that goes to the generic
+   handler (pushf, lahf and the rest), single-stepping, and returning. Outside RunThreaded the
+   flags word is always up to date.
+   
+   Clocks are added up in a local as the handlers run, and go into State->ClockCount on the way
+   out.
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIM86_COMPUTED_GOTO 1
+#else
+// NOTE: MSVC has no computed goto, so there the handlers are the cases of a switch instead.
+#define SIM86_COMPUTED_GOTO 0
+#endif
+
+// NOTE: Op, whether the result is written back, and whether the destination is read first.
+#define THREADED_ALU_OPS(X) \
+    X(mov, 1, 0) \
+    X(add, 1, 1) \
+    X(adc, 1, 1) \
+    X(sub, 1, 1) \
+    X(sbb, 1, 1) \
+    X(cmp, 0, 1) \
+    X(and, 1, 1) \
+    X(or, 1, 1) \
+    X(xor, 1, 1) \
+    X(test, 0, 1)
+
+// NOTE: The operand forms of each of those, in the order LowerInstruction relies on: register
+// or memory destination, register, immediate or memory source, byte then word.
+#define THREADED_ALU_FORMS(X, Op) \
+    X(Op, RR8) X(Op, RR16) \
+    X(Op, RI8) X(Op, RI16) \
+    X(Op, RM8) X(Op, RM16) \
+    X(Op, MR8) X(Op, MR16) \
+    X(Op, MI8) X(Op, MI16)
+
+enum lowered_alu_form
+{
+    LoweredForm_RR,
+    LoweredForm_RI,
+    LoweredForm_RM,
+    LoweredForm_MR,
+    LoweredForm_MI,
+    
+    LoweredForm_Count,
+};
+
+// NOTE: The flags in a jump condition, worked out from the lazy flags first if need be.
+#define THREADED_FLAGS MaterializeFlags(Registers, &Lazy)
+
+// NOTE: Op, and when it jumps. loop, loopz and loopnz decrement cx before anything else is
+// tested.
+#define THREADED_JUMP_OPS(X) \
+    X(jo, (THREADED_FLAGS & FlagBit_OF)) \
+    X(jno, !(THREADED_FLAGS & FlagBit_OF)) \
+    X(jb, (THREADED_FLAGS & FlagBit_CF)) \
+    X(jnb, !(THREADED_FLAGS & FlagBit_CF)) \
+    X(je, (THREADED_FLAGS & FlagBit_ZF)) \
+    X(jne, !(THREADED_FLAGS & FlagBit_ZF)) \
+    X(jbe, (THREADED_FLAGS & (FlagBit_CF | FlagBit_ZF))) \
+    X(ja, !(THREADED_FLAGS & (FlagBit_CF | FlagBit_ZF))) \
+    X(js, (THREADED_FLAGS & FlagBit_SF)) \
+    X(jns, !(THREADED_FLAGS & FlagBit_SF)) \
+    X(jp, (THREADED_FLAGS & FlagBit_PF)) \
+    X(jnp, !(THREADED_FLAGS & FlagBit_PF)) \
+    X(jl, (!(THREADED_FLAGS & FlagBit_SF) != !(THREADED_FLAGS & FlagBit_OF))) \
+    X(jnl, (!(THREADED_FLAGS & FlagBit_SF) == !(THREADED_FLAGS & FlagBit_OF))) \
+    X(jle, ((THREADED_FLAGS & FlagBit_ZF) || (!(THREADED_FLAGS & FlagBit_SF) != !(THREADED_FLAGS & FlagBit_OF)))) \
+    X(jg, (!(THREADED_FLAGS & FlagBit_ZF) && (!(THREADED_FLAGS & FlagBit_SF) == !(THREADED_FLAGS & FlagBit_OF)))) \
+    X(loop, (--Registers[Register_c] != 0)) \
+    X(loopz, ((--Registers[Register_c] != 0) && (THREADED_FLAGS & FlagBit_ZF))) \
+    X(loopnz, ((--Registers[Register_c] != 0) && !(THREADED_FLAGS & FlagBit_ZF))) \
+    X(jcxz, (Registers[Register_c] == 0)) \
+    X(jmp, true)
+
+#define LOWERED_ALU_FORM_ENUM(Op, Form) Lowered_##Op##_##Form,
+#define LOWERED_ALU_ENUM(Op, Writes, ReadsDest) THREADED_ALU_FORMS(LOWERED_ALU_FORM_ENUM, Op)
+#define LOWERED_JUMP_ENUM(Op, Condition) Lowered_##Op,
+
+enum lowered_handler : u8
+{
+    Lowered_None, // NOTE: Not lowered yet - the handler for this lowers it, then runs it
+    Lowered_Generic,
+    THREADED_ALU_OPS(LOWERED_ALU_ENUM)
+    THREADED_JUMP_OPS(LOWERED_JUMP_ENUM)
+    Lowered_inc_R16,
+    Lowered_dec_R16,
+    
+    Lowered_Count,
+};
+
+#undef LOWERED_ALU_FORM_ENUM
+#undef LOWERED_ALU_ENUM
+#undef LOWERED_JUMP_ENUM
+
+enum lazy_flags_op : u16
+{
+    LazyFlags_None, // NOTE: Registers[Register_flags] is up to date
+    LazyFlags_Add,
+    LazyFlags_Subtract,
+    LazyFlags_Logic,
+};
+
+struct lazy_flags
+{
+    u16 Op; // NOTE: lazy_flags_op
+    u16 Set; // NOTE: Which flags it sets - inc and dec leave CF alone
+    b32 Wide;
+    
+    // NOTE: The operands, not counting any carry or borrow in, and the result, counting it and
+    // before it is cut down to the operand size, so the carry out is still there above it.
+    u32 A;
+    u32 B;
+    u32 Result;
+};
+
+struct lowered_instruction
+{
+    u8 Handler; // NOTE: lowered_handler
+    
+    // NOTE: Register operands. A word register is its index in Registers, and a byte register
+    // is its byte offset into Registers, so ah is 2*Register_a + 1.
+    u8 Dest;
+    u8 Source;
+    
+    // NOTE: The memory operand, if there is one: Registers[Segment]:(Registers[BaseA] +
+    // Registers[BaseB] + Displacement). A missing base is register 0, which is always zero.
+    u8 Segment;
+    u8 BaseA;
+    u8 BaseB;
+    
+    // NOTE: The clocks it takes (see sim86_clocks.h), and the clocks added when its word memory
+    // operand is at an odd address, or when it jumps. Generic instructions count their own.
+    u8 Clocks;
+    u8 ExtraClocks;
+    
+    // NOTE: Also the displacement of a relative jump.
+    u16 Displacement;
+    u16 Immediate;
+};
+
+static void LowerInstruction(instruction *Instruction, instruction_clocks Clocks, lowered_instruction *Dest);
+
+// NOTE: Runs like RunMachine. With StopAtJump, it also returns after the first jump or loop
+// instruction that has a handler of its own, taken or not.
+static machine_stop_reason RunThreaded(opcode_table *Opcodes, machine_state *State, u64 MaxInstructions, u64 *InstructionCount = 0,
+                                       b32 StopAtJump = false);